@@ -28,6 +28,7 @@ int SDL_main(int argc, const char **argv)
     int override_fs = -1;
     int force_swdec = 0;
     long autoconnect = -1;
+    const char *metrics_address = NULL;
 
 	for (int i = 1, consumed; i < argc; i += consumed) {
 		consumed = -1;
@@ -54,6 +55,14 @@ int SDL_main(int argc, const char **argv)
                 return 1;
             }
 
+            consumed = 2;
+        } else if (!strcmp(argv[i], "-m") || !strcmp(argv[i], "--metrics")) {
+            if (i + 1 >= argc) {
+                vpilog("%s requires an argument\n", argv[i]);
+                return 1;
+            }
+
+            metrics_address = argv[i+1];
             consumed = 2;
 		} else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
 			display_cli_help(argv);
@@ -68,6 +77,11 @@ int SDL_main(int argc, const char **argv)
 
     vanilla_install_logger(vpilog_va);
 
+    if (metrics_address && vanilla_metrics_serve(metrics_address) != VANILLA_SUCCESS) {
+        vpilog("Failed to serve metrics on %s\n", metrics_address);
+        return 1;
+    }
+
     // Load config
     vpi_config_init();
     if (autoconnect >= vpi_config.connected_console_count) {
@@ -115,6 +129,10 @@ exit:
 exit_config:
     vpi_config_free();
 
+    if (metrics_address) {
+        vanilla_metrics_stop();
+    }
+
     return ret;
 }
 
@@ -129,5 +147,9 @@ void display_cli_help(const char **argv) {
     vpilog("                        (<id> is the index of the console in the\n");
     vpilog("                        menu, e.g. 0 is the first console, 1 is\n");
     vpilog("                        the second, etc.)\n");
+	vpilog("    -m <address>,\n");
+    vpilog("    --metrics <address> Serve Prometheus metrics over HTTP on\n");
+    vpilog("                        <address>, either a port on localhost,\n");
+    vpilog("                        host:port or unix:/path/to/socket\n");
 	vpilog("    -h, --help          Show this help message\n");
 }
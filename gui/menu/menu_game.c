@@ -53,6 +53,20 @@ static const int AUDIO_STREAM_INDEX = 1;
 
 static pthread_t vpi_event_thread;
 
+static int metric_frames_decoded = -1;
+static int metric_frames_dropped = -1;
+static int metric_decode_latency = -1;
+
+// Polled from the pipe every VPI_PIPE_STATS_INTERVAL_S while in game
+static const int VPI_PIPE_STATS_INTERVAL_S = 5;
+static int metric_pipe_datagrams[2][VANILLA_RELAY_PORT_COUNT];
+static int metric_pipe_send_errors[2][VANILLA_RELAY_PORT_COUNT];
+static int metric_pipe_recv_timeouts[2][VANILLA_RELAY_PORT_COUNT];
+static pthread_t vpi_pipe_stats_thread;
+static pthread_mutex_t vpi_pipe_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vpi_pipe_stats_cond = PTHREAD_COND_INITIALIZER;
+static int vpi_pipe_stats_running = 0;
+
 int vpi_egl_available = 0;
 
 static int status_lbl;
@@ -248,15 +262,6 @@ typedef struct {
     enum AVPixelFormat (*get_format)(struct AVCodecContext *s, const enum AVPixelFormat * fmt);
 } hwdec_t;
 
-enum HwDecoderType {
-    HWDEC_TYPE_NVDEC,
-    HWDEC_TYPE_VAAPI,
-    HWDEC_TYPE_V4L2REQUEST,
-    HWDEC_TYPE_DRM,
-    HWDEC_TYPE_SOFTWARE,
-    HWDEC_TYPE_COUNT
-};
-
 #ifdef VANILLA_V4L2REQUEST_AVAILABLE
 static int is_v4l2request_available(void)
 {
@@ -374,6 +379,11 @@ int open_decoder(vpi_decode_state_t *s, hwdec_t *dec)
         );
     }
 
+#ifdef AV_CODEC_FLAG_COPY_OPAQUE
+    // Carry each packet's frame ID through to its decoded frame for tracing
+    s->codec_ctx->flags |= AV_CODEC_FLAG_COPY_OPAQUE;
+#endif
+
 	ffmpeg_err = avcodec_open2(s->codec_ctx, dec->codec, NULL);
     if (ffmpeg_err < 0) {
 		vpilog("Failed to open decoder: %i\n", ffmpeg_err);
@@ -385,15 +395,8 @@ int open_decoder(vpi_decode_state_t *s, hwdec_t *dec)
     return VANILLA_SUCCESS;
 }
 
-int vpi_decode_init(vpi_decode_state_t *s)
+static void get_decoders(hwdec_t *decoders)
 {
-    int ffmpeg_err;
-
-    // av_log_set_level(AV_LOG_VERBOSE);
-
-    // Initialize decoding context, preferring hardware decoding when available
-    hwdec_t decoders[HWDEC_TYPE_COUNT];
-
     decoders[HWDEC_TYPE_NVDEC].name = "NVDEC";
     decoders[HWDEC_TYPE_NVDEC].codec = avcodec_find_decoder_by_name("h264_cuvid");
     decoders[HWDEC_TYPE_NVDEC].get_format = nvdec_get_format;
@@ -413,52 +416,103 @@ int vpi_decode_init(vpi_decode_state_t *s)
     decoders[HWDEC_TYPE_SOFTWARE].name = "Software";
     decoders[HWDEC_TYPE_SOFTWARE].codec = avcodec_find_decoder(AV_CODEC_ID_H264);
     decoders[HWDEC_TYPE_SOFTWARE].get_format = 0;
+}
+
+const char *vpi_decode_backend_name(int type)
+{
+    static const char *names[HWDEC_TYPE_COUNT] = {"nvdec", "vaapi", "v4l2request", "v4l2m2m", "software"};
+    if (type < 0 || type >= HWDEC_TYPE_COUNT) {
+        return "auto";
+    }
+    return names[type];
+}
+
+static int try_decoder(vpi_decode_state_t *s, hwdec_t *decoders, int type)
+{
+    // Clear out anything left from a previous attempt
+    vpi_decode_exit(s);
+
+    switch (type) {
+#ifdef VANILLA_CUDA_AVAILABLE
+    case HWDEC_TYPE_NVDEC:
+        // See if we can create an NVDEC context (most NVIDIA GPUs)
+        if (av_hwdevice_ctx_create(&s->hw_device_ctx, AV_HWDEVICE_TYPE_CUDA, 0, 0, 0) < 0) {
+            return VANILLA_ERR_GENERIC;
+        }
+        break;
+#endif // VANILLA_CUDA_AVAILABLE
+    case HWDEC_TYPE_VAAPI:
+        // See if we can create a VAAPI context (most Linux systems)
+        if (av_hwdevice_ctx_create(&s->hw_device_ctx, AV_HWDEVICE_TYPE_VAAPI, 0, 0, 0) < 0) {
+            return VANILLA_ERR_GENERIC;
+        }
+        break;
+#ifdef VANILLA_V4L2REQUEST_AVAILABLE
+    case HWDEC_TYPE_V4L2REQUEST:
+        if (!is_v4l2request_available()
+            || av_hwdevice_ctx_create(&s->hw_device_ctx, AV_HWDEVICE_TYPE_V4L2REQUEST, NULL, NULL, 0) < 0) {
+            return VANILLA_ERR_GENERIC;
+        }
+        break;
+#endif // VANILLA_V4L2REQUEST_AVAILABLE
+    case HWDEC_TYPE_DRM:
+        // See if we can create a DRM context (Raspberry Pi, et al.)
+        if (av_hwdevice_ctx_create(&s->hw_device_ctx, AV_HWDEVICE_TYPE_DRM, "/dev/dri/card0", 0, 0) < 0) {
+            return VANILLA_ERR_GENERIC;
+        }
+        break;
+    case HWDEC_TYPE_SOFTWARE:
+        break;
+    default:
+        // Not compiled in
+        return VANILLA_ERR_GENERIC;
+    }
+
+    return open_decoder(s, &decoders[type]);
+}
+
+static int finish_decode_init(vpi_decode_state_t *s);
+
+int vpi_decode_init(vpi_decode_state_t *s)
+{
+    // av_log_set_level(AV_LOG_VERBOSE);
+
+    static const double decode_latency_bounds[] = {1, 2, 4, 8, 12, 16, 25, 33, 50, 100};
+    metric_frames_decoded = vanilla_metrics_counter("vanilla_gui_frames_total{state=\"decoded\"}", "Video frames by what happened to them after decoding");
+    metric_frames_dropped = vanilla_metrics_counter("vanilla_gui_frames_total{state=\"dropped\"}", "Video frames by what happened to them after decoding");
+    metric_decode_latency = vanilla_metrics_histogram("vanilla_gui_decode_latency_ms", "Time from handing a frame to the decoder until it comes out", decode_latency_bounds, sizeof(decode_latency_bounds) / sizeof(double));
+
+    // Initialize decoding context, preferring hardware decoding when available
+    hwdec_t decoders[HWDEC_TYPE_COUNT];
+    get_decoders(decoders);
 
     // Discover the most ideal hardware decoder
     int r = VANILLA_ERR_GENERIC;
 
     if (!vpi_config.force_software_decode) {
 #ifdef VANILLA_CUDA_AVAILABLE
-        // See if we can create an NVDEC context (most NVIDIA GPUs)
-        if (r != VANILLA_SUCCESS) {
-            vpi_decode_exit(s);
-            if (((ffmpeg_err = av_hwdevice_ctx_create(&s->hw_device_ctx, AV_HWDEVICE_TYPE_CUDA, 0, 0, 0)) >= 0)) {
-                r = open_decoder(s, &decoders[HWDEC_TYPE_NVDEC]);
-            }
-        }
+        r = try_decoder(s, decoders, HWDEC_TYPE_NVDEC);
 #endif // VANILLA_CUDA_AVAILABLE
 
-        // See if we can create a VAAPI context (most Linux systems)
-        if (r != VANILLA_SUCCESS) {
-            vpi_decode_exit(s);
-            if (vpi_egl_available
-                && ((ffmpeg_err = av_hwdevice_ctx_create(&s->hw_device_ctx, AV_HWDEVICE_TYPE_VAAPI, 0, 0, 0)) >= 0)) {
-                r = open_decoder(s, &decoders[HWDEC_TYPE_VAAPI]);
-            }
+        // VAAPI frames can only be displayed through EGL
+        if (r != VANILLA_SUCCESS && vpi_egl_available) {
+            r = try_decoder(s, decoders, HWDEC_TYPE_VAAPI);
         }
 
 #ifdef VANILLA_V4L2REQUEST_AVAILABLE
-        if (r != VANILLA_SUCCESS && is_v4l2request_available()) {
-            vpi_decode_exit(s);
-            if ((ffmpeg_err = av_hwdevice_ctx_create(&s->hw_device_ctx, AV_HWDEVICE_TYPE_V4L2REQUEST, NULL, NULL, 0)) >= 0) {
-                r = open_decoder(s, &decoders[HWDEC_TYPE_V4L2REQUEST]);
-            }
+        if (r != VANILLA_SUCCESS) {
+            r = try_decoder(s, decoders, HWDEC_TYPE_V4L2REQUEST);
         }
 #endif // VANILLA_V4L2REQUEST_AVAILABLE
 
-        // See if we can create a DRM context (Raspberry Pi, et al.)
         if (r != VANILLA_SUCCESS) {
-            vpi_decode_exit(s);
-            if ((ffmpeg_err = av_hwdevice_ctx_create(&s->hw_device_ctx, AV_HWDEVICE_TYPE_DRM, "/dev/dri/card0", 0, 0)) >= 0) {
-                r = open_decoder(s, &decoders[HWDEC_TYPE_DRM]);
-            }
+            r = try_decoder(s, decoders, HWDEC_TYPE_DRM);
         }
     }
 
     // Finally, fallback to a software decoder.
     if (r != VANILLA_SUCCESS) {
-        vpi_decode_exit(s);
-        r = open_decoder(s, &decoders[HWDEC_TYPE_SOFTWARE]);
+        r = try_decoder(s, decoders, HWDEC_TYPE_SOFTWARE);
     }
 
     // We don't expect the software decoder to fail, but just in case.
@@ -467,6 +521,29 @@ int vpi_decode_init(vpi_decode_state_t *s)
         return r;
     }
 
+    return finish_decode_init(s);
+}
+
+int vpi_decode_init_backend(vpi_decode_state_t *s, int type)
+{
+    if (type < 0) {
+        return vpi_decode_init(s);
+    }
+
+    hwdec_t decoders[HWDEC_TYPE_COUNT];
+    get_decoders(decoders);
+
+    int r = try_decoder(s, decoders, type);
+    if (r != VANILLA_SUCCESS) {
+        vpi_decode_exit(s);
+        return r;
+    }
+
+    return finish_decode_init(s);
+}
+
+static int finish_decode_init(vpi_decode_state_t *s)
+{
     pthread_mutex_lock(&vpi_present_frame_mutex);
 	vpi_present_frame = av_frame_alloc();
     pthread_mutex_unlock(&vpi_present_frame_mutex);
@@ -709,10 +786,16 @@ void vpi_game_shutdown()
 static void vpi_publish_decoded_frame(vpi_decode_state_t *s)
 {
     vui_context_t *vui = s->vui;
+    uint32_t frame_id = (uint32_t) (uintptr_t) s->frame->opaque;
+
+    vanilla_trace_begin("publish", frame_id);
 
     pthread_mutex_lock(&vpi_present_frame_mutex);
 
-    // Send frame out to display
+    // Send frame out to display, replacing any frame the display didn't get to
+    if (vpi_present_frame->format != -1) {
+        vanilla_metrics_add(metric_frames_dropped, 1);
+    }
     av_frame_unref(vpi_present_frame);
     av_frame_move_ref(vpi_present_frame, s->frame);
     vpi_present_frame_sequence++;
@@ -727,6 +810,8 @@ static void vpi_publish_decoded_frame(vpi_decode_state_t *s)
     pthread_cond_broadcast(&vpi_present_frame_cond);
     pthread_mutex_unlock(&vpi_present_frame_mutex);
 
+    vanilla_trace_end("publish", frame_id);
+
     // Now that we have our first frame, switch UI to game mode if not already
     // FIXME: Not thread safe? Not a huge deal but might want to fix some day
     if (!vui_game_mode_get(vui)) {
@@ -741,6 +826,7 @@ static int vpi_receive_decoded_frames(vpi_decode_state_t *s)
 
     while (s->thread_running) {
         // Attempt to receive frames from decoder
+        uint64_t trace_start = vanilla_trace_now();
         int err = avcodec_receive_frame(s->codec_ctx, s->frame);
         if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) {
             break;
@@ -751,6 +837,14 @@ static int vpi_receive_decoded_frames(vpi_decode_state_t *s)
             return err;
         }
 
+        vanilla_trace_complete("avcodec_receive_frame", (uint32_t) (uintptr_t) s->frame->opaque, trace_start);
+
+        // Packets are stamped with av_gettime_relative() when enqueued
+        vanilla_metrics_add(metric_frames_decoded, 1);
+        if (s->frame->pts != AV_NOPTS_VALUE) {
+            vanilla_metrics_observe(metric_decode_latency, (av_gettime_relative() - s->frame->pts) / 1000.0);
+        }
+
         // Received a frame, send it out for publishing
         vpi_publish_decoded_frame(s);
         received++;
@@ -834,6 +928,13 @@ static int vpi_decode_submit_packet(vpi_decode_state_t *s, AVPacket *pkt,
                                     size_t *outstanding_packets)
 {
     int err = AVERROR_EXIT;
+#ifdef AV_CODEC_FLAG_COPY_OPAQUE
+    uint32_t frame_id = (uint32_t) (uintptr_t) pkt->opaque;
+#else
+    uint32_t frame_id = 0;
+#endif
+
+    vanilla_trace_begin("avcodec_send_packet", frame_id);
 
     for (int poll = 0; s->thread_running; poll++) {
         err = avcodec_send_packet(s->codec_ctx, pkt);
@@ -850,6 +951,8 @@ static int vpi_decode_submit_packet(vpi_decode_state_t *s, AVPacket *pkt,
         }
     }
 
+    vanilla_trace_end("avcodec_send_packet", frame_id);
+
     if (!s->thread_running) {
         return AVERROR_EXIT;
     }
@@ -908,7 +1011,8 @@ void *vpi_decode_loop(void *arg)
 }
 
 static int vpi_decode_enqueue(vpi_decode_state_t *s,
-                              const uint8_t *data, size_t size)
+                              const uint8_t *data, size_t size,
+                              uint32_t frame_id)
 {
     // Allocate new packet
     AVPacket *pkt = av_packet_alloc();
@@ -927,6 +1031,9 @@ static int vpi_decode_enqueue(vpi_decode_state_t *s,
     memcpy(pkt->data, data, size);
     pkt->pts = av_gettime_relative();
     pkt->dts = pkt->pts;
+#ifdef AV_CODEC_FLAG_COPY_OPAQUE
+    pkt->opaque = (void *) (uintptr_t) frame_id;
+#endif
 
     // Acquire lock
     pthread_mutex_lock(&s->mutex);
@@ -953,6 +1060,71 @@ static int vpi_decode_enqueue(vpi_decode_state_t *s,
     return 0;
 }
 
+static void register_pipe_stats_metrics()
+{
+    static const char *directions[2] = {"to_frontend", "to_console"};
+    static const char *ports[VANILLA_RELAY_PORT_COUNT] = {"vid", "aud", "msg", "cmd", "hid"};
+
+    char name[128];
+    for (int d = 0; d < 2; d++) {
+        for (int p = 0; p < VANILLA_RELAY_PORT_COUNT; p++) {
+            snprintf(name, sizeof(name), "vanilla_gui_pipe_datagrams{direction=\"%s\",port=\"%s\"}", directions[d], ports[p]);
+            metric_pipe_datagrams[d][p] = vanilla_metrics_gauge(name, "Datagrams the pipe relayed since it connected to the console");
+            snprintf(name, sizeof(name), "vanilla_gui_pipe_send_errors{direction=\"%s\",port=\"%s\"}", directions[d], ports[p]);
+            metric_pipe_send_errors[d][p] = vanilla_metrics_gauge(name, "Datagrams the pipe failed to relay since it connected to the console");
+            snprintf(name, sizeof(name), "vanilla_gui_pipe_recv_timeouts{direction=\"%s\",port=\"%s\"}", directions[d], ports[p]);
+            metric_pipe_recv_timeouts[d][p] = vanilla_metrics_gauge(name, "250ms periods the pipe received nothing on a port");
+        }
+    }
+}
+
+// vanilla_get_pipe_stats() can block for a while if the pipe doesn't answer,
+// so it's polled on its own thread rather than from the display update
+static void *vpi_pipe_stats_loop(void *arg)
+{
+    uint64_t last_send_errors = 0;
+
+    pthread_mutex_lock(&vpi_pipe_stats_mutex);
+    while (vpi_pipe_stats_running) {
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec += VPI_PIPE_STATS_INTERVAL_S;
+        pthread_cond_timedwait(&vpi_pipe_stats_cond, &vpi_pipe_stats_mutex, &wake);
+        if (!vpi_pipe_stats_running) {
+            break;
+        }
+        pthread_mutex_unlock(&vpi_pipe_stats_mutex);
+
+        vanilla_pipe_stats_t stats;
+        if (vanilla_get_pipe_stats(vpi_config.server_address, &stats) == VANILLA_SUCCESS) {
+            uint64_t send_errors = 0;
+            for (int p = 0; p < VANILLA_RELAY_PORT_COUNT; p++) {
+                const vanilla_relay_stats_t *dirs[2] = {&stats.to_frontend[p], &stats.to_console[p]};
+                for (int d = 0; d < 2; d++) {
+                    vanilla_metrics_set(metric_pipe_datagrams[d][p], dirs[d]->datagrams);
+                    vanilla_metrics_set(metric_pipe_send_errors[d][p], dirs[d]->send_errors);
+                    vanilla_metrics_set(metric_pipe_recv_timeouts[d][p], dirs[d]->recv_timeouts);
+                    send_errors += dirs[d]->send_errors;
+                }
+            }
+
+            // Statistics reset when the pipe reconnects, so only log growth
+            if (send_errors > last_send_errors) {
+                const vanilla_relay_stats_t *vid = &stats.to_frontend[VANILLA_RELAY_PORT_VID];
+                vpilog("Pipe failed to relay %llu datagrams (video: %llu relayed, %llu failed, max burst %llu)\n",
+                    (unsigned long long) (send_errors - last_send_errors), (unsigned long long) vid->datagrams,
+                    (unsigned long long) vid->send_errors, (unsigned long long) vid->max_burst);
+            }
+            last_send_errors = send_errors;
+        }
+
+        pthread_mutex_lock(&vpi_pipe_stats_mutex);
+    }
+    pthread_mutex_unlock(&vpi_pipe_stats_mutex);
+
+    return NULL;
+}
+
 void *vpi_event_loop(void *arg)
 {
     vui_context_t *vui = (vui_context_t *) arg;
@@ -963,6 +1135,13 @@ void *vpi_event_loop(void *arg)
 
     memset(&s, 0, sizeof(s));
 
+    register_pipe_stats_metrics();
+    vpi_pipe_stats_running = 1;
+    int pipe_stats_alloc = (pthread_create(&vpi_pipe_stats_thread, 0, vpi_pipe_stats_loop, 0) == 0);
+    if (!pipe_stats_alloc) {
+        vpilog("Failed to create pipe stats thread\n");
+    }
+
     while (vpi_game_queued_error != VANILLA_ERR_SHUTDOWN && vanilla_wait_event(&event)) {
         int stop = 0;
 
@@ -1005,7 +1184,9 @@ void *vpi_event_loop(void *arg)
                 }
 
                 // Send data to decoder thread
-                int err = vpi_decode_enqueue(&s, event.data, event.size);
+                vanilla_trace_begin("decode_enqueue", event.frame_id);
+                int err = vpi_decode_enqueue(&s, event.data, event.size, event.frame_id);
+                vanilla_trace_end("decode_enqueue", event.frame_id);
                 if (err < 0) {
                     vpilog("Failed to queue packet for decoder: %s (%i)\n",
                            av_err2str(err), err);
@@ -1053,6 +1234,14 @@ void *vpi_event_loop(void *arg)
         vpi_decode_alloc = 0;
     }
 
+    if (pipe_stats_alloc) {
+        pthread_mutex_lock(&vpi_pipe_stats_mutex);
+        vpi_pipe_stats_running = 0;
+        pthread_cond_signal(&vpi_pipe_stats_cond);
+        pthread_mutex_unlock(&vpi_pipe_stats_mutex);
+        pthread_join(vpi_pipe_stats_thread, 0);
+    }
+
     return NULL;
 }
 
@@ -13,6 +13,15 @@
 #define VPI_TOAST_MAX_LEN 1024
 #define VPI_DECODE_QUEUE_CAPACITY 8
 
+enum HwDecoderType {
+    HWDEC_TYPE_NVDEC,
+    HWDEC_TYPE_VAAPI,
+    HWDEC_TYPE_V4L2REQUEST,
+    HWDEC_TYPE_DRM,
+    HWDEC_TYPE_SOFTWARE,
+    HWDEC_TYPE_COUNT
+};
+
 typedef struct {
     vui_context_t *vui;
     AVCodecContext *codec_ctx;
@@ -49,6 +58,8 @@ void vpi_decode_record_stop();
 void vpi_decode_send_audio(const void *data, size_t size);
 
 int vpi_decode_init(vpi_decode_state_t *s);
+int vpi_decode_init_backend(vpi_decode_state_t *s, int type);
+const char *vpi_decode_backend_name(int type);
 void vpi_decode_exit(vpi_decode_state_t *s);
 
 #endif // VANILLA_PI_MENU_GAME_H
@@ -168,12 +168,17 @@ static void publish(const float a[3], const float g[3])
     float gy = g[2];
     float gz = g[1];
 
-    vanilla_set_button(VANILLA_SENSOR_ACCEL_X, pack_float(ax));
-    vanilla_set_button(VANILLA_SENSOR_ACCEL_Y, pack_float(ay));
-    vanilla_set_button(VANILLA_SENSOR_ACCEL_Z, pack_float(az));
-    vanilla_set_button(VANILLA_SENSOR_GYRO_PITCH, pack_float(gx));
-    vanilla_set_button(VANILLA_SENSOR_GYRO_YAW,   pack_float(gy));
-    vanilla_set_button(VANILLA_SENSOR_GYRO_ROLL,  pack_float(gz));
+    // Publish all six values together so no packet mixes two samples
+    vanilla_input_state_t state;
+    state.buttons[VANILLA_SENSOR_ACCEL_X] = pack_float(ax);
+    state.buttons[VANILLA_SENSOR_ACCEL_Y] = pack_float(ay);
+    state.buttons[VANILLA_SENSOR_ACCEL_Z] = pack_float(az);
+    state.buttons[VANILLA_SENSOR_GYRO_PITCH] = pack_float(gx);
+    state.buttons[VANILLA_SENSOR_GYRO_YAW]   = pack_float(gy);
+    state.buttons[VANILLA_SENSOR_GYRO_ROLL]  = pack_float(gz);
+    vanilla_set_input_state_masked(&state,
+        VANILLA_INPUT_MASK(VANILLA_SENSOR_ACCEL_X) | VANILLA_INPUT_MASK(VANILLA_SENSOR_ACCEL_Y) | VANILLA_INPUT_MASK(VANILLA_SENSOR_ACCEL_Z) |
+        VANILLA_INPUT_MASK(VANILLA_SENSOR_GYRO_PITCH) | VANILLA_INPUT_MASK(VANILLA_SENSOR_GYRO_YAW) | VANILLA_INPUT_MASK(VANILLA_SENSOR_GYRO_ROLL));
 
     static int log_throttle = 0;
     if ((++log_throttle % 40) == 1) {
@@ -1,111 +1,440 @@
+// Decoder benchmark
+//
+// Decodes one or more H.264 captures with each decoder backend the frontend
+// can use, and reports per-frame decode latency (from avcodec_send_packet()
+// to the frame coming out of avcodec_receive_frame()), frames in flight and
+// throughput.
+//
+// In paced mode, packets are sent at 60 FPS like the console does, which
+// gives the latency the frontend actually sees. In unpaced mode, packets are
+// sent as fast as the decoder accepts them, which gives its throughput.
+//
+// Hardware frames are not transferred back to system memory, so the numbers
+// only cover the decoder itself.
+
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/avutil.h>
 #include <libavutil/time.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "menu/menu_game.h"
 
-int main(int argc, const char **argv)
+#define FRAME_INTERVAL_US 16667 // 1 / 60 FPS frame
+#define POLL_INTERVAL_US 500 // Arbitrary time to wait for a new frame
+
+enum {
+    MODE_PACED,
+    MODE_UNPACED,
+    MODE_COUNT
+};
+
+static const char *mode_names[MODE_COUNT] = {"paced", "unpaced"};
+
+typedef struct {
+    AVPacket **packets;
+    size_t count;
+} corpus_file_t;
+
+typedef struct {
+    const char *file;
+    const char *backend;
+    const char *decoder;
+    const char *mode;
+    int available;
+    size_t sent;
+    size_t received;
+    size_t errors;
+    double p50_ms;
+    double p95_ms;
+    double p99_ms;
+    double mean_ms;
+    double max_ms;
+    double inflight_avg;
+    size_t inflight_max;
+    double fps;
+    double wall_s;
+} result_t;
+
+typedef struct {
+    vpi_decode_state_t *s;
+    int64_t *send_time;
+    int64_t *latency;
+    size_t sent;
+    size_t received;
+    size_t measured;
+    size_t inflight_total;
+    size_t inflight_max;
+    size_t errors;
+} run_state_t;
+
+static void free_file(corpus_file_t *f)
 {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <file>\n", argv[0]);
-        return 1;
+    for (size_t i = 0; i < f->count; i++) {
+        av_packet_free(&f->packets[i]);
     }
+    free(f->packets);
+    f->packets = NULL;
+    f->count = 0;
+}
 
-    const char *fn = argv[1];
-
+static int load_file(const char *fn, corpus_file_t *out)
+{
     int err;
     AVFormatContext *fmt_ctx = 0;
 
+    memset(out, 0, sizeof(*out));
+
     err = avformat_open_input(&fmt_ctx, fn, 0, 0);
     if (err < 0) {
         fprintf(stderr, "avformat_open_input: %i\n", err);
-        return 1;
+        return err;
     }
 
     err = avformat_find_stream_info(fmt_ctx, NULL);
     if (err < 0) {
         fprintf(stderr, "avformat_find_stream_info: %i\n", err);
-        return 1;
+        goto exit;
     }
 
-    if (fmt_ctx->nb_streams != 1) {
-        fprintf(stderr, "Invalid stream count\n", err);
-        return 1;
+    int stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (stream_index < 0 || fmt_ctx->streams[stream_index]->codecpar->codec_id != AV_CODEC_ID_H264) {
+        fprintf(stderr, "%s: no H.264 stream\n", fn);
+        err = AVERROR_INVALIDDATA;
+        goto exit;
     }
-    AVStream *stream = fmt_ctx->streams[0];
-    if (stream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO && stream->codecpar->codec_id != AV_CODEC_ID_H264) {
-        fprintf(stderr, "Invalid stream 0\n", err);
-        return 1;
+
+    // Read everything up front so file I/O doesn't show up in the timing
+    size_t capacity = 0;
+    AVPacket *pkt = av_packet_alloc();
+    while ((err = av_read_frame(fmt_ctx, pkt)) >= 0) {
+        if (pkt->stream_index != stream_index) {
+            av_packet_unref(pkt);
+            continue;
+        }
+
+        if (out->count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            out->packets = realloc(out->packets, capacity * sizeof(AVPacket *));
+        }
+
+        out->packets[out->count++] = pkt;
+        pkt = av_packet_alloc();
     }
+    av_packet_free(&pkt);
 
-    vpi_decode_state_t s;
-    memset(&s, 0, sizeof(s));
+    if (err == AVERROR_EOF) {
+        err = 0;
+    } else {
+        fprintf(stderr, "av_read_frame: %i\n", err);
+    }
 
-    err = vpi_decode_init(&s);
+exit:
     if (err < 0) {
-        return 1;
+        // Don't hand back half a file
+        free_file(out);
     }
+    avformat_close_input(&fmt_ctx);
+    return err;
+}
 
-    int ret = 1;
-
-    AVPacket *pkt = av_packet_alloc();
-    int64_t pts = 0;
+static int receive_frames(run_state_t *r)
+{
+    int received = 0;
 
     while (1) {
-        err = av_read_frame(fmt_ctx, pkt);
-        if (err < 0) {
-            if (err == AVERROR_EOF) {
-                ret = 0;
-            } else {
-                fprintf(stderr, "av_read_frame: %i\n", err);
-            }
+        int err = avcodec_receive_frame(r->s->codec_ctx, r->s->frame);
+        if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) {
+            break;
+        } else if (err < 0) {
+            fprintf(stderr, "avcodec_receive_frame: %i\n", err);
+            r->errors++;
             break;
         }
 
-        if (pkt->stream_index != 0) {
-            continue;
+        // pts is the index of the packet the frame came from
+        int64_t now = av_gettime_relative();
+        int64_t index = r->s->frame->pts;
+        if (index >= 0 && (size_t) index < r->sent && r->received < r->sent) {
+            r->latency[r->measured++] = now - r->send_time[index];
         }
+        r->received++;
+        received++;
+
+        av_frame_unref(r->s->frame);
+    }
+
+    return received;
+}
+
+static void send_packet(run_state_t *r, AVPacket *src)
+{
+    AVPacket *pkt = av_packet_clone(src);
+    pkt->pts = r->sent;
+    pkt->dts = r->sent;
+
+    r->send_time[r->sent] = av_gettime_relative();
+    r->sent++;
 
-        // Retrieve frame from decoder
-        pkt->pts = pts++;
-        err = avcodec_send_packet(s.codec_ctx, pkt);
+    while (1) {
+        int err = avcodec_send_packet(r->s->codec_ctx, pkt);
+        if (err == AVERROR(EAGAIN)) {
+            // Decoder is full, make room and try again
+            if (!receive_frames(r)) {
+                usleep(POLL_INTERVAL_US);
+            }
+            continue;
+        }
         if (err < 0) {
             fprintf(stderr, "avcodec_send_packet: %i\n", err);
+            r->errors++;
+        }
+        break;
+    }
+
+    av_packet_free(&pkt);
+
+    size_t inflight = r->sent - r->received;
+    r->inflight_total += inflight;
+    if (inflight > r->inflight_max) {
+        r->inflight_max = inflight;
+    }
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_ms(const int64_t *sorted, size_t count, double p)
+{
+    if (!count) {
+        return 0;
+    }
+    size_t i = (size_t) (p * (count - 1) + 0.5);
+    return sorted[i] / 1000.0;
+}
+
+static void run(const char *fn, const corpus_file_t *f, int backend, int mode, result_t *res)
+{
+    memset(res, 0, sizeof(*res));
+    res->file = fn;
+    res->backend = vpi_decode_backend_name(backend);
+    res->mode = mode_names[mode];
+
+    vpi_decode_state_t s;
+    memset(&s, 0, sizeof(s));
+
+    if (vpi_decode_init_backend(&s, backend) < 0) {
+        return;
+    }
+
+    res->available = 1;
+    res->decoder = s.codec_ctx->codec->name;
+
+    run_state_t r;
+    memset(&r, 0, sizeof(r));
+    r.s = &s;
+    r.send_time = calloc(f->count, sizeof(int64_t));
+    r.latency = calloc(f->count, sizeof(int64_t));
+
+    int64_t start = av_gettime_relative();
+
+    for (size_t i = 0; i < f->count; i++) {
+        if (mode == MODE_PACED) {
+            // Wait for this packet's slot, picking up frames in the meantime
+            const int64_t deadline = start + (int64_t) i * FRAME_INTERVAL_US;
+            while (1) {
+                receive_frames(&r);
+
+                const int64_t now = av_gettime_relative();
+                if (now >= deadline) {
+                    break;
+                }
+                usleep(FFMIN(POLL_INTERVAL_US, deadline - now));
+            }
+        }
+
+        send_packet(&r, f->packets[i]);
+        receive_frames(&r);
+    }
+
+    // Drain whatever the decoder is still holding on to
+    avcodec_send_packet(s.codec_ctx, NULL);
+    while (r.received < r.sent) {
+        int64_t wait = av_gettime_relative();
+        while (!receive_frames(&r) && av_gettime_relative() < wait + FRAME_INTERVAL_US * 10) {
+            usleep(POLL_INTERVAL_US);
+        }
+        if (av_gettime_relative() >= wait + FRAME_INTERVAL_US * 10) {
             break;
         }
-        printf("    Sent: %li\n", pkt->pts);
-
-        const int64_t interval = 500; // Arbitrary time to wait for a new frame
-        const int64_t wait = av_gettime_relative();
-        const int64_t max_wait = 16667; // 1 / 60 FPS frame
-        while (1) {
-            err = avcodec_receive_frame(s.codec_ctx, s.frame);
-            if (err >= 0) {
-                printf("Received: %li\n", s.frame->pts);
+    }
+
+    int64_t end = av_gettime_relative();
+
+    size_t measured = r.measured;
+    qsort(r.latency, measured, sizeof(int64_t), compare_int64);
+
+    int64_t total = 0;
+    for (size_t i = 0; i < measured; i++) {
+        total += r.latency[i];
+    }
+
+    res->sent = r.sent;
+    res->received = r.received;
+    res->errors = r.errors;
+    res->p50_ms = percentile_ms(r.latency, measured, 0.50);
+    res->p95_ms = percentile_ms(r.latency, measured, 0.95);
+    res->p99_ms = percentile_ms(r.latency, measured, 0.99);
+    res->mean_ms = measured ? total / (double) measured / 1000.0 : 0;
+    res->max_ms = measured ? r.latency[measured - 1] / 1000.0 : 0;
+    res->inflight_avg = r.sent ? r.inflight_total / (double) r.sent : 0;
+    res->inflight_max = r.inflight_max;
+    res->wall_s = (end - start) / 1000000.0;
+    res->fps = res->wall_s > 0 ? r.received / res->wall_s : 0;
+
+    free(r.send_time);
+    free(r.latency);
+    vpi_decode_exit(&s);
+}
+
+static void write_json(FILE *out, const result_t *results, size_t count)
+{
+    fprintf(out, "{\n  \"ffmpeg\": \"%s\",\n  \"libavcodec\": \"%s\",\n  \"results\": [",
+            av_version_info(), LIBAVCODEC_IDENT);
+
+    for (size_t i = 0; i < count; i++) {
+        const result_t *r = &results[i];
+        fprintf(out, "%s\n    {\"file\": \"%s\", \"backend\": \"%s\", \"mode\": \"%s\", \"available\": %s",
+                i ? "," : "", r->file, r->backend, r->mode, r->available ? "true" : "false");
+        if (r->available) {
+            fprintf(out, ", \"decoder\": \"%s\", \"sent\": %zu, \"received\": %zu, \"errors\": %zu, "
+                         "\"latency_ms\": {\"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"mean\": %.3f, \"max\": %.3f}, "
+                         "\"inflight\": {\"avg\": %.2f, \"max\": %zu}, \"fps\": %.1f, \"wall_s\": %.3f",
+                    r->decoder, r->sent, r->received, r->errors,
+                    r->p50_ms, r->p95_ms, r->p99_ms, r->mean_ms, r->max_ms,
+                    r->inflight_avg, r->inflight_max, r->fps, r->wall_s);
+        }
+        fprintf(out, "}");
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-backend <name>|all] [-mode paced|unpaced|both] [-json <file>] <file> [<file>...]\n", argv0);
+    fprintf(stderr, "Backends:");
+    for (int i = 0; i < HWDEC_TYPE_COUNT; i++) {
+        fprintf(stderr, " %s", vpi_decode_backend_name(i));
+    }
+    fprintf(stderr, " auto\n");
+}
+
+int main(int argc, const char **argv)
+{
+    int backend_first = 0, backend_last = HWDEC_TYPE_COUNT - 1;
+    int mode_first = 0, mode_last = MODE_COUNT - 1;
+    const char *json_fn = NULL;
+    const char **files = calloc(argc, sizeof(const char *));
+    size_t file_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-backend") && i + 1 < argc) {
+            const char *name = argv[++i];
+            if (!strcmp(name, "all")) {
                 continue;
-            } else if (err != AVERROR(EAGAIN)) {
-                fprintf(stderr, "avcodec_receive_frame: %i\n", err);
-                goto fail;
             }
-
-            if (av_gettime_relative() + interval >= wait + max_wait) {
-                break;
+            int found = 0;
+            for (int b = -1; b < HWDEC_TYPE_COUNT; b++) {
+                if (!strcmp(name, vpi_decode_backend_name(b))) {
+                    backend_first = backend_last = b;
+                    found = 1;
+                    break;
+                }
+            }
+            if (!found) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "-mode") && i + 1 < argc) {
+            const char *name = argv[++i];
+            if (!strcmp(name, "paced")) {
+                mode_first = mode_last = MODE_PACED;
+            } else if (!strcmp(name, "unpaced")) {
+                mode_first = mode_last = MODE_UNPACED;
+            } else if (strcmp(name, "both")) {
+                usage(argv[0]);
+                return 1;
             }
+        } else if (!strcmp(argv[i], "-json") && i + 1 < argc) {
+            json_fn = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            files[file_count++] = argv[i];
+        }
+    }
 
-            usleep(interval);
+    if (!file_count) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t max_results = file_count * (backend_last - backend_first + 1) * MODE_COUNT;
+    result_t *results = calloc(max_results, sizeof(result_t));
+    size_t result_count = 0;
+
+    int ret = 0;
+
+    for (size_t f = 0; f < file_count; f++) {
+        corpus_file_t corpus;
+        if (load_file(files[f], &corpus) < 0) {
+            ret = 1;
+            continue;
         }
 
-        const int64_t gap = av_gettime_relative() - (wait + max_wait);
-        if (gap > 0) {
-            usleep(gap);
+        printf("%s: %zu packets\n", files[f], corpus.count);
+
+        for (int b = backend_first; b <= backend_last; b++) {
+            for (int m = mode_first; m <= mode_last; m++) {
+                result_t *r = &results[result_count++];
+                run(files[f], &corpus, b, m, r);
+
+                if (!r->available) {
+                    printf("  %-12s %-8s unavailable\n", r->backend, r->mode);
+                    break;
+                }
+
+                printf("  %-12s %-8s %-14s p50 %6.2fms p95 %6.2fms p99 %6.2fms max %6.2fms | in flight avg %.2f max %zu | %7.1f fps | %zu/%zu frames, %zu errors\n",
+                       r->backend, r->mode, r->decoder, r->p50_ms, r->p95_ms, r->p99_ms, r->max_ms,
+                       r->inflight_avg, r->inflight_max, r->fps, r->received, r->sent, r->errors);
+            }
         }
+
+        free_file(&corpus);
     }
 
-fail:
-    av_packet_free(&pkt);
-    vpi_decode_exit(&s);
+    if (json_fn) {
+        FILE *out = strcmp(json_fn, "-") ? fopen(json_fn, "w") : stdout;
+        if (out) {
+            write_json(out, results, result_count);
+            if (out != stdout) {
+                fclose(out);
+            }
+        } else {
+            fprintf(stderr, "Failed to open %s\n", json_fn);
+            ret = 1;
+        }
+    }
+
+    free(results);
+    free(files);
 
     return ret;
 }
@@ -97,6 +97,17 @@ typedef struct {
 	vui_power_state_t last_power_state;
 
 	uint16_t last_vibration_state;
+
+    // Fingers currently down on a direct touch screen, in the order they touched
+    SDL_FingerID fingers[VANILLA_MAX_TOUCH_POINTS];
+    vanilla_touch_t finger_points[VANILLA_MAX_TOUCH_POINTS];
+    size_t finger_count;
+
+    // Whether fingers[0] is still the finger that started the touch. The
+    // GamePad's screen is single-touch, so that's the only one the console
+    // sees, and once it lifts the touch ends until every finger is up. The
+    // others are tracked for frontend-side gestures.
+    int primary_finger_down;
 } vui_sdl_context_t;
 
 #ifdef VANILLA_CUDA_AVAILABLE
@@ -356,6 +367,10 @@ void vui_sdl_mic_set_enabled(vui_context_t *ctx, int enabled, void *userdata)
 	SDL_PauseAudioDevice(sdl_ctx->mic, !enabled);
 }
 
+static int metric_frames_presented = -1;
+static int metric_audio_underruns = -1;
+static int metric_audio_overruns = -1;
+
 void audio_callback(void *userdata, Uint8 *stream, int len)
 {
 	vui_sdl_context_t *sdl_ctx = (vui_sdl_context_t *) userdata;
@@ -371,6 +386,7 @@ void audio_callback(void *userdata, Uint8 *stream, int len)
         size_t min = w - AUDIO_BUFFER_COUNT + 1;
         if (r < min) {
             vanilla_log("  AUDIO SKIPPED FROM %zu TO %zu", r, min);
+            vanilla_metrics_add(metric_audio_overruns, 1);
             r = min;
         }
         memcpy(stream, sdl_ctx->audio_buffer[r % AUDIO_BUFFER_COUNT], len);
@@ -378,6 +394,7 @@ void audio_callback(void *userdata, Uint8 *stream, int len)
         atomic_store_explicit(&sdl_ctx->audio_rseq, r, memory_order_release);
     } else {
         memset(stream, 0, len);
+        vanilla_metrics_add(metric_audio_underruns, 1);
     }
 }
 
@@ -411,17 +428,117 @@ void mic_callback(void *userdata, Uint8 *stream, int len)
 	}
 }
 
+typedef struct {
+    vanilla_input_state_t state;
+    uint64_t mask;
+} vui_sdl_input_batch_t;
+
+static void vui_sdl_flush_input(vui_sdl_input_batch_t *batch)
+{
+    if (batch->mask) {
+        vanilla_set_input_state_masked(&batch->state, batch->mask);
+        batch->mask = 0;
+    }
+}
+
+static void vui_sdl_queue_button(vui_sdl_input_batch_t *batch, int button, int32_t value)
+{
+    uint64_t bit = VANILLA_INPUT_MASK(button);
+
+    // Don't let a release overwrite a press (or vice versa) from the same batch
+    if ((batch->mask & bit) && button < VANILLA_SENSOR_ACCEL_X && (batch->state.buttons[button] != 0) != (value != 0)) {
+        vui_sdl_flush_input(batch);
+    }
+
+    batch->state.buttons[button] = value;
+    batch->mask |= bit;
+}
+
+static void vui_sdl_queue_touches(vui_sdl_input_batch_t *batch, const vanilla_touch_t *points, size_t count)
+{
+    if ((batch->mask & VANILLA_INPUT_MASK_TOUCH) && (batch->state.touch_count > 0) != (count > 0)) {
+        vui_sdl_flush_input(batch);
+    }
+
+    memcpy(batch->state.touches, points, count * sizeof(vanilla_touch_t));
+    batch->state.touch_count = count;
+    batch->mask |= VANILLA_INPUT_MASK_TOUCH;
+}
+
+static void vui_sdl_handle_finger(vui_context_t *vui, vui_sdl_context_t *sdl_ctx, const SDL_TouchFingerEvent *ev, vui_sdl_input_batch_t *batch)
+{
+    // Only screens map to gamepad coordinates, ignore touchpads
+    if (SDL_GetTouchDeviceType(ev->touchId) != SDL_TOUCH_DEVICE_DIRECT) {
+        return;
+    }
+
+    SDL_Rect *dst_rect = &sdl_ctx->dst_rect;
+    if (dst_rect->w <= 0 || dst_rect->h <= 0) {
+        return;
+    }
+
+    size_t idx;
+    for (idx = 0; idx < sdl_ctx->finger_count; idx++) {
+        if (sdl_ctx->fingers[idx] == ev->fingerId) {
+            break;
+        }
+    }
+
+    if (ev->type == SDL_FINGERUP) {
+        if (idx == sdl_ctx->finger_count) {
+            return;
+        }
+
+        if (idx == 0) {
+            sdl_ctx->primary_finger_down = 0;
+        }
+
+        sdl_ctx->finger_count--;
+        memmove(&sdl_ctx->fingers[idx], &sdl_ctx->fingers[idx + 1], (sdl_ctx->finger_count - idx) * sizeof(SDL_FingerID));
+        memmove(&sdl_ctx->finger_points[idx], &sdl_ctx->finger_points[idx + 1], (sdl_ctx->finger_count - idx) * sizeof(vanilla_touch_t));
+    } else {
+        if (idx == sdl_ctx->finger_count) {
+            if (sdl_ctx->finger_count == VANILLA_MAX_TOUCH_POINTS) {
+                return;
+            }
+            if (sdl_ctx->finger_count == 0) {
+                sdl_ctx->primary_finger_down = 1;
+            }
+            sdl_ctx->fingers[idx] = ev->fingerId;
+            sdl_ctx->finger_count++;
+        }
+
+        // Finger coordinates are normalized to the window, translate to logical coords
+        int win_w, win_h;
+        SDL_GetWindowSize(sdl_ctx->window, &win_w, &win_h);
+        int wx = ev->x * win_w;
+        int wy = ev->y * win_h;
+        sdl_ctx->finger_points[idx].x = (wx - dst_rect->x) * vui->screen_width / dst_rect->w;
+        sdl_ctx->finger_points[idx].y = (wy - dst_rect->y) * vui->screen_height / dst_rect->h;
+    }
+
+    if (batch) {
+        vui_sdl_queue_touches(batch, sdl_ctx->finger_points, sdl_ctx->primary_finger_down ? 1 : 0);
+    }
+}
+
 int vui_sdl_event_thread(void *data)
 {
     vui_context_t *vui = (vui_context_t *) data;
     vui_sdl_context_t *sdl_ctx = (vui_sdl_context_t *) vui->platform_data;
 
+    // Game input from this batch of events is handed to Vanilla as one
+    // update, so e.g. all three gyro axes land in the same HID packet
+    vui_sdl_input_batch_t input;
+    input.mask = 0;
+
     SDL_Event ev;
     // while (!vui->quit) {
         // while (SDL_WaitEventTimeout(&ev, 100)) {
         while (SDL_PollEvent(&ev)) {
             switch (ev.type) {
             case SDL_QUIT:
+                vui_sdl_flush_input(&input);
                 vanilla_stop();
                 vui_quit(vui);
                 return 0;
@@ -438,16 +555,18 @@ int vui_sdl_event_thread(void *data)
                     tr_y = (ev.button.y - dst_rect->y) * vui->screen_height / dst_rect->h;
 
                     if (vui->game_mode) {
-                        // In game mode, pass clicks directly to Vanilla
-                        int x, y;
-                        if (ev.button.button == SDL_BUTTON_LEFT && (ev.type == SDL_MOUSEBUTTONDOWN || ev.type == SDL_MOUSEMOTION)) {
-                            x = tr_x;
-                            y = tr_y;
-                        } else {
-                            x = -1;
-                            y = -1;
+                        // In game mode, pass clicks directly to Vanilla. Touch
+                        // screens are handled through their finger events.
+                        if (ev.button.which != SDL_TOUCH_MOUSEID) {
+                            vanilla_touch_t point;
+                            size_t count = 0;
+                            if (ev.button.button == SDL_BUTTON_LEFT && (ev.type == SDL_MOUSEBUTTONDOWN || ev.type == SDL_MOUSEMOTION)) {
+                                point.x = tr_x;
+                                point.y = tr_y;
+                                count = 1;
+                            }
+                            vui_sdl_queue_touches(&input, &point, count);
                         }
-                        vanilla_set_touch(x, y);
                     } else {
                         // Otherwise, handle ourselves
                         if (ev.type == SDL_MOUSEBUTTONDOWN)
@@ -542,7 +661,7 @@ int vui_sdl_event_thread(void *data)
                             }
 
                             if (vui->game_mode) {
-                                vanilla_set_button(vanilla_btn, ev.cbutton.state == SDL_PRESSED ? INT16_MAX : 0);
+                                vui_sdl_queue_button(&input, vanilla_btn, ev.cbutton.state == SDL_PRESSED ? INT16_MAX : 0);
                             } else if (ev.cbutton.state == SDL_PRESSED) {
                                 vui_process_keydown(vui, vanilla_btn);
                             } else {
@@ -566,7 +685,7 @@ int vui_sdl_event_thread(void *data)
                     Sint16 axis_value = ev.caxis.value;
                     if (vanilla_axis != -1) {
                         if (vui->game_mode) {
-                            vanilla_set_button(vanilla_axis, axis_value);
+                            vui_sdl_queue_button(&input, vanilla_axis, axis_value);
                         } else if (vanilla_axis == SDL_CONTROLLER_AXIS_LEFTX) {
                             if (axis_value < 0)
                                 vui_process_keydown(vui, VANILLA_AXIS_L_LEFT);
@@ -589,15 +708,21 @@ int vui_sdl_event_thread(void *data)
                     }
                 }
                 break;
+            case SDL_FINGERDOWN:
+            case SDL_FINGERMOTION:
+            case SDL_FINGERUP:
+                // Always track fingers, but only pass them to Vanilla in game mode
+                vui_sdl_handle_finger(vui, sdl_ctx, &ev.tfinger, vui->game_mode ? &input : NULL);
+                break;
             case SDL_CONTROLLERSENSORUPDATE:
                 if (ev.csensor.sensor == SDL_SENSOR_ACCEL) {
-                    vanilla_set_button(VANILLA_SENSOR_ACCEL_X, pack_float(ev.csensor.data[0]));
-                    vanilla_set_button(VANILLA_SENSOR_ACCEL_Y, pack_float(ev.csensor.data[1]));
-                    vanilla_set_button(VANILLA_SENSOR_ACCEL_Z, pack_float(ev.csensor.data[2]));
+                    vui_sdl_queue_button(&input, VANILLA_SENSOR_ACCEL_X, pack_float(ev.csensor.data[0]));
+                    vui_sdl_queue_button(&input, VANILLA_SENSOR_ACCEL_Y, pack_float(ev.csensor.data[1]));
+                    vui_sdl_queue_button(&input, VANILLA_SENSOR_ACCEL_Z, pack_float(ev.csensor.data[2]));
                 } else if (ev.csensor.sensor == SDL_SENSOR_GYRO) {
-                    vanilla_set_button(VANILLA_SENSOR_GYRO_PITCH, pack_float(ev.csensor.data[0]));
-                    vanilla_set_button(VANILLA_SENSOR_GYRO_YAW, pack_float(ev.csensor.data[1]));
-                    vanilla_set_button(VANILLA_SENSOR_GYRO_ROLL, pack_float(ev.csensor.data[2]));
+                    vui_sdl_queue_button(&input, VANILLA_SENSOR_GYRO_PITCH, pack_float(ev.csensor.data[0]));
+                    vui_sdl_queue_button(&input, VANILLA_SENSOR_GYRO_YAW, pack_float(ev.csensor.data[1]));
+                    vui_sdl_queue_button(&input, VANILLA_SENSOR_GYRO_ROLL, pack_float(ev.csensor.data[2]));
                 }
                 break;
             case SDL_KEYDOWN:
@@ -624,7 +749,7 @@ int vui_sdl_event_thread(void *data)
                             vpi_menu_action(vui, (vpi_extra_action_t) vanilla_btn);
                     } else if (vanilla_btn != -1) {
                         if (vui->game_mode) {
-                            vanilla_set_button(vanilla_btn, ev.type == SDL_KEYDOWN ? INT16_MAX : 0);
+                            vui_sdl_queue_button(&input, vanilla_btn, ev.type == SDL_KEYDOWN ? INT16_MAX : 0);
                         } else if (ev.type == SDL_KEYDOWN) {
                             vui_process_keydown(vui, vanilla_btn);
                         } else {
@@ -665,6 +790,8 @@ int vui_sdl_event_thread(void *data)
         }
     // }
 
+    vui_sdl_flush_input(&input);
+
     return 0;
 }
 
@@ -719,6 +846,10 @@ int vui_init_sdl(vui_context_t *ctx, int fullscreen)
         return -1;
     }
 
+    metric_frames_presented = vanilla_metrics_counter("vanilla_gui_frames_total{state=\"presented\"}", "Video frames by what happened to them after decoding");
+    metric_audio_underruns = vanilla_metrics_counter("vanilla_gui_audio_underruns_total", "Audio callbacks that had no audio buffered and played silence");
+    metric_audio_overruns = vanilla_metrics_counter("vanilla_gui_audio_overruns_total", "Audio callbacks that skipped buffers because playback fell behind");
+
     vui_sdl_context_t *sdl_ctx = malloc(sizeof(vui_sdl_context_t));
     memset(sdl_ctx, 0, sizeof(vui_sdl_context_t));
     ctx->platform_data = sdl_ctx;
@@ -1878,6 +2009,8 @@ int vui_update_sdl(vui_context_t *vui)
 #endif // VANILLA_CUDA_AVAILABLE
 
     int handle_final_blit = 1;
+    int present_traced = 0;
+    uint32_t present_frame_id = 0;
     if (!vui->game_mode) {
 
 #ifdef VANILLA_DRM_AVAILABLE
@@ -1924,6 +2057,13 @@ int vui_update_sdl(vui_context_t *vui)
             && sdl_ctx->present_frame_sequence != vpi_present_frame_sequence
             && vpi_present_frame->format != -1) {
 			av_frame_move_ref(sdl_ctx->frame, vpi_present_frame);
+
+            // Trace from picking up a new frame until it has been presented
+            present_frame_id = (uint32_t) (uintptr_t) sdl_ctx->frame->opaque;
+            vanilla_trace_begin("present", present_frame_id);
+            present_traced = 1;
+
+            vanilla_metrics_add(metric_frames_presented, 1);
 		}
         sdl_ctx->present_frame_sequence = vpi_present_frame_sequence;
         pthread_mutex_unlock(&vpi_present_frame_mutex);
@@ -2120,6 +2260,10 @@ int vui_update_sdl(vui_context_t *vui)
         SDL_RenderPresent(renderer);
     }
 
+    if (present_traced) {
+        vanilla_trace_end("present", present_frame_id);
+    }
+
     // Frame limiter to save CPU cycles
     const Uint32 target = 5; // No need to update faster than 200Hz (gamepad polls at 180Hz, but this is easier to calculate)
     Uint32 frame_delta = SDL_GetTicks() - last_update_time;
@@ -14,6 +14,7 @@
 #include <unistd.h>
 
 #include "gamepad.h"
+#include "log.h"
 #include "vanilla.h"
 #include "util.h"
 
@@ -83,28 +84,16 @@ static void *handle_queued_audio(void *data)
 		pthread_mutex_unlock(&queued_audio_mutex);
 
 		// Set up remaining default parameters
-		ap.format = 6;
-		ap.mono = 1;
-		ap.vibrate = 0;
-		ap.type = TYPE_AUDIO; // Audio data
-		ap.timestamp = 0; // Gamepad actually sends no timestamp
-		ap.payload_size = MIC_PAYLOAD_SIZE;
-
 		static unsigned int seq_id = 0;
-		ap.seq_id = seq_id++;
-
-		// Reverse bits on params
-		ap.format = reverse_bits(ap.format, 3);
-		ap.seq_id = reverse_bits(ap.seq_id, 10);
-		ap.payload_size = reverse_bits(ap.payload_size, 16);//ntohs(ap.payload_size);
-		// ap.timestamp = reverse_bits(ap.timestamp, 32); // Not necessary because timestamp is 0
-
-		// Further reverse bits
-		unsigned char *bytes = (unsigned char *) &ap;
-		const size_t header_sz = sizeof(AudioPacket) - sizeof(ap.payload);
-		for (int i = 0; i < 4; i++) { // 4 instead of 8 because ap.timestamp == 0
-			bytes[i] = (unsigned char) reverse_bits(bytes[i], 8);
-		}
+		AudioHeader header;
+		header.format = 6;
+		header.mono = 1;
+		header.vibrate = 0;
+		header.type = TYPE_AUDIO; // Audio data
+		header.seq_id = seq_id++;
+		header.payload_size = MIC_PAYLOAD_SIZE;
+		header.timestamp = 0; // Gamepad actually sends no timestamp
+		encode_audio_header(&header, ap.header);
 
 		// Console expects 512 bytes every 16 ms so make sure we achieve that interval
 		static struct timeval last;
@@ -118,7 +107,7 @@ static void *handle_queued_audio(void *data)
 		gettimeofday(&last, 0);
 
 		// Send packet to console
-		send_to_console(ctx->socket_aud, &ap, header_sz + MIC_PAYLOAD_SIZE, PORT_AUD);
+		send_to_console(ctx->socket_aud, &ap, AUDIO_HEADER_SIZE + MIC_PAYLOAD_SIZE, PORT_AUD);
 
     	pthread_mutex_lock(&queued_audio_mutex);
 	}
@@ -130,24 +119,12 @@ static void *handle_queued_audio(void *data)
 
 void handle_audio_packet(gamepad_context_t *ctx, unsigned char *data, size_t len)
 {
-    //
-    // === IMPORTANT NOTE! ===
-    //
-    // This for loop skips ap->format, ap->seq_id, and ap->timestamp to save processing.
-    // If you want those, you'll have to adjust this loop.
-    //
-    for (int byte = 0; byte < 2; byte++) {
-        data[byte] = (unsigned char) reverse_bits(data[byte], 8);
-    }
+    AudioHeader header;
+    decode_audio_header(data, &header);
 
     AudioPacket *ap = (AudioPacket *) data;
 
-    // ap->format = reverse_bits(ap->format, 3);
-    // ap->seq_id = reverse_bits(ap->seq_id, 10);
-    ap->payload_size = ntohs(ap->payload_size);
-    // ap->timestamp = reverse_bits(ap->timestamp, 32);
-
-    if (ap->type == TYPE_VIDEO) {
+    if (header.type == TYPE_VIDEO) {
         AudioPacketVideoFormat *avp = (AudioPacketVideoFormat *) ap->payload;
         avp->timestamp = ntohl(avp->timestamp);
         avp->video_format = ntohl(avp->video_format);
@@ -156,11 +133,11 @@ void handle_audio_packet(gamepad_context_t *ctx, unsigned char *data, size_t len
         return;
     }
 
-    if (ap->payload_size) {
-        push_event(ctx->event_loop, VANILLA_EVENT_AUDIO, ap->payload, ap->payload_size);
+    if (header.payload_size) {
+        push_event(ctx->event_loop, VANILLA_EVENT_AUDIO, ap->payload, header.payload_size);
     }
 
-    uint8_t vibrate_val = ap->vibrate;
+    uint8_t vibrate_val = header.vibrate;
     push_event(ctx->event_loop, VANILLA_EVENT_VIBRATE, &vibrate_val, sizeof(vibrate_val));
 }
 
@@ -176,12 +153,12 @@ void *listen_audio(void *x)
 	pthread_t mic_thread;
 	int mic_thread_created = 1;
 	if (pthread_create(&mic_thread, 0, handle_queued_audio, info) != 0) {
-		vanilla_log("Failed to create mic thread");
+		VLOG_ERROR(VANILLA_LOG_AUDIO, "Failed to create mic thread");
 		mic_thread_created = 0;
 	}
 
     do {
-        size = recv(info->socket_aud, data, sizeof(data), 0);
+        size = recv_from_console(info->socket_aud, data, sizeof(data), PORT_AUD);
         if (size > 0) {
             handle_audio_packet(info, data, size);
         }
@@ -5,20 +5,15 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#pragma pack(push, 1)
+#include "gamepad.h"
+#include "packet.h"
+
 typedef struct {
-    unsigned format : 3;
-    unsigned mono : 1;
-    unsigned vibrate : 1;
-    unsigned type : 1;
-    unsigned seq_id : 10;
-    unsigned payload_size : 16;
-    unsigned timestamp : 32;
+    uint8_t header[AUDIO_HEADER_SIZE]; // See decode_audio_header()
     unsigned char payload[2048];
 } AudioPacket;
 const static unsigned int TYPE_AUDIO = 0;
 const static unsigned int TYPE_VIDEO = 1;
-#pragma pack(pop)
 
 typedef struct {
     uint32_t timestamp;
@@ -28,6 +23,7 @@ typedef struct {
 } AudioPacketVideoFormat;
 
 void *listen_audio(void *x);
+void handle_audio_packet(gamepad_context_t *ctx, unsigned char *data, size_t len);
 int send_audio_packet(const void *data, size_t len);
 
 #endif // GAMEPAD_AUDIO_H
@@ -0,0 +1,218 @@
+#include "capture.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio.h"
+#include "command.h"
+#include "fec.h"
+#include "log.h"
+#include "video.h"
+
+#include "util.h"
+
+static char capture_path[4096] = {0};
+static FILE *capture_file = NULL;
+static uint64_t capture_start = 0;
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void write_le(uint8_t *out, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        out[i] = (value >> (i * 8)) & 0xFF;
+    }
+}
+
+static uint64_t read_le(const uint8_t *in, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= ((uint64_t) in[i]) << (i * 8);
+    }
+    return value;
+}
+
+void set_capture_file(const char *path)
+{
+    pthread_mutex_lock(&capture_mutex);
+    if (path) {
+        snprintf(capture_path, sizeof(capture_path), "%s", path);
+    } else {
+        capture_path[0] = 0;
+    }
+    pthread_mutex_unlock(&capture_mutex);
+}
+
+int capture_open()
+{
+    int ret = VANILLA_SUCCESS;
+
+    pthread_mutex_lock(&capture_mutex);
+
+    const char *path = capture_path;
+    if (!path[0]) {
+        path = getenv("VANILLA_CAPTURE_FILE");
+    }
+
+    if (path && path[0]) {
+        capture_file = fopen(path, "wb");
+        if (capture_file) {
+            fwrite(CAPTURE_SIGNATURE, 1, CAPTURE_SIGNATURE_SIZE, capture_file);
+            capture_start = get_monotonic_nanos();
+            VLOG_INFO(VANILLA_LOG_GENERAL, "Capturing gamepad traffic to %s", path);
+        } else {
+            VLOG_ERROR(VANILLA_LOG_GENERAL, "Failed to open capture file %s", path);
+            ret = VANILLA_ERR_INVALID_ARGUMENT;
+        }
+    }
+
+    pthread_mutex_unlock(&capture_mutex);
+
+    return ret;
+}
+
+void capture_close()
+{
+    pthread_mutex_lock(&capture_mutex);
+    if (capture_file) {
+        fclose(capture_file);
+        capture_file = NULL;
+    }
+    pthread_mutex_unlock(&capture_mutex);
+}
+
+void capture_packet(uint16_t port, const void *data, size_t size)
+{
+    // Unlocked check so the common case (no capture) costs nothing
+    if (!capture_file) {
+        return;
+    }
+
+    // Replays only want what the console sent, not the pipe's parity
+    if (fec_is_parity(data, size)) {
+        return;
+    }
+
+    uint64_t now = get_monotonic_nanos();
+
+    uint8_t header[CAPTURE_RECORD_HEADER_SIZE];
+
+    pthread_mutex_lock(&capture_mutex);
+    if (capture_file) {
+        write_le(header, now - capture_start, 8);
+        write_le(header + 8, port, 2);
+        write_le(header + 10, size, 2);
+        fwrite(header, 1, sizeof(header), capture_file);
+        fwrite(data, 1, size, capture_file);
+    }
+    pthread_mutex_unlock(&capture_mutex);
+}
+
+void replay_internal(thread_data_t *data)
+{
+    clear_interrupt();
+
+    replay_args_t *args = (replay_args_t *) data->thread_data;
+
+    gamepad_context_t info;
+    info.event_loop = data->event_loop;
+
+    // Nothing to send replies to, send_to_console() ignores these
+    info.socket_vid = -1;
+    info.socket_aud = -1;
+    info.socket_hid = -1;
+    info.socket_msg = -1;
+    info.socket_cmd = -1;
+    info.stream_vid = -1;
+
+    int ret = VANILLA_SUCCESS;
+
+    // handle_video_packet() holds on to the packets of the frame it's
+    // assembling, so they get a ring of their own just like in listen_video()
+    VideoPacket *video_packets = malloc(sizeof(VideoPacket) * VIDEO_PACKET_QUEUE_MAX);
+    size_t video_packet_index = 0;
+    uint32_t video_frame_id = 0;
+
+    FILE *file = fopen(args->path, "rb");
+
+    uint8_t signature[CAPTURE_SIGNATURE_SIZE];
+    if (!file || fread(signature, 1, sizeof(signature), file) != sizeof(signature)
+        || memcmp(signature, CAPTURE_SIGNATURE, CAPTURE_SIGNATURE_SIZE) != 0) {
+        VLOG_ERROR(VANILLA_LOG_GENERAL, "Failed to open capture file %s", args->path);
+        ret = VANILLA_ERR_INVALID_ARGUMENT;
+        goto exit;
+    }
+
+    if (!video_packets) {
+        ret = VANILLA_ERR_OUT_OF_MEMORY;
+        goto exit;
+    }
+
+    int cnn = VANILLA_ERR_CONNECTED;
+    push_event(data->event_loop, VANILLA_EVENT_ERROR, &cnn, sizeof(cnn));
+
+    uint8_t header[CAPTURE_RECORD_HEADER_SIZE];
+    static uint8_t packet[CAPTURE_MAX_PACKET_SIZE];
+    size_t packet_count = 0;
+    uint64_t replay_start = get_monotonic_nanos();
+
+    while (!is_interrupted() && fread(header, 1, sizeof(header), file) == sizeof(header)) {
+        uint64_t timestamp = read_le(header, 8);
+        uint16_t port = read_le(header + 8, 2);
+        uint16_t size = read_le(header + 10, 2);
+
+        if (size > sizeof(packet)) {
+            VLOG_ERROR(VANILLA_LOG_GENERAL, "Capture record too large (%u bytes), stopping replay", size);
+            break;
+        }
+
+        if (fread(packet, 1, size, file) != size) {
+            VLOG_WARN(VANILLA_LOG_GENERAL, "Capture file ends in the middle of a record");
+            break;
+        }
+
+        if (args->realtime) {
+            sleep_until_nanos(replay_start + timestamp);
+        } else {
+            // Don't outrun the frontend, or the event loop starts dropping
+            // events and the replay is no longer deterministic
+            wait_for_event_space(data->event_loop, 2);
+        }
+
+        if (port == PORT_VID) {
+            VideoPacket *vp = &video_packets[video_packet_index % VIDEO_PACKET_QUEUE_MAX];
+            memcpy(vp, packet, MIN(size, sizeof(VideoPacket)));
+            if (video_header_frame_begin(vp->header)) {
+                video_frame_id++;
+            }
+            handle_video_packet(&info, vp, video_frame_id);
+            video_packet_index++;
+        } else if (port == PORT_AUD) {
+            handle_audio_packet(&info, packet, size);
+        } else if (port == PORT_CMD) {
+            handle_command_packet(&info, info.socket_cmd, (CmdHeader *) packet);
+        }
+
+        packet_count++;
+    }
+
+    uint64_t elapsed = get_monotonic_nanos() - replay_start;
+    VLOG_INFO(VANILLA_LOG_GENERAL, "Replayed %zu packets in %.3f ms", packet_count, elapsed / 1000000.0);
+
+    // Let the frontend know the "console" has gone away
+    ret = VANILLA_ERR_DISCONNECTED;
+
+exit:
+    if (file) {
+        fclose(file);
+    }
+    free(video_packets);
+    free(args);
+
+    push_event(data->event_loop, VANILLA_EVENT_ERROR, &ret, sizeof(ret));
+
+    // Wait for interrupt so frontend has a chance to receive event
+    wait_for_interrupt();
+}
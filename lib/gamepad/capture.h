@@ -0,0 +1,32 @@
+#ifndef GAMEPAD_CAPTURE_H
+#define GAMEPAD_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gamepad.h"
+
+// Capture files start with this 8-byte signature, followed by records of:
+//   uint64_t timestamp (nanoseconds since the capture started, little endian)
+//   uint16_t port      (gamepad port the datagram arrived on, little endian)
+//   uint16_t size      (datagram size, little endian)
+//   uint8_t  data[size]
+#define CAPTURE_SIGNATURE "VNLCAP\x00\x01"
+#define CAPTURE_SIGNATURE_SIZE 8
+#define CAPTURE_RECORD_HEADER_SIZE 12
+#define CAPTURE_MAX_PACKET_SIZE 4096
+
+typedef struct
+{
+    int realtime;
+    char path[];
+} replay_args_t;
+
+void set_capture_file(const char *path);
+int capture_open();
+void capture_close();
+void capture_packet(uint16_t port, const void *data, size_t size);
+
+void replay_internal(thread_data_t *data);
+
+#endif // GAMEPAD_CAPTURE_H
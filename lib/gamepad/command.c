@@ -12,6 +12,7 @@
 #include <string.h>
 
 #include "gamepad.h"
+#include "log.h"
 #include "vanilla.h"
 #include "util.h"
 
@@ -60,7 +61,7 @@ void send_generic_response(int skt, CmdHeader *response)
 void handle_generic_packet(gamepad_context_t *info, int skt, GenericPacket *request)
 {
     GenericCmdHeader *gen_cmd = &request->generic_cmd_header;
-    vanilla_log("magic: %x, flags: %x, service ID: %u, method ID: %u", gen_cmd->magic_0x7E, gen_cmd->flags, gen_cmd->service_id, gen_cmd->method_id);
+    VLOG_DEBUG(VANILLA_LOG_COMMAND, "magic: %x, flags: %x, service ID: %u, method ID: %u", gen_cmd->magic_0x7E, gen_cmd->flags, gen_cmd->service_id, gen_cmd->method_id);
 
     // Prepare response
     GenericPacket response;
@@ -170,13 +171,13 @@ void handle_generic_packet(gamepad_context_t *info, int skt, GenericPacket *requ
         }
         case METHOD_ID_PERIPHERAL_UPDATE_EEPROM:
         {
-            vanilla_log("5,12 - index: %u, length: %u", response.payload[0], response.payload[1]);
+            VLOG_DEBUG(VANILLA_LOG_COMMAND, "5,12 - index: %u, length: %u", response.payload[0], response.payload[1]);
             response.generic_cmd_header.error_code = 0;
             break;
         }
         case METHOD_ID_PERIPHERAL_SET_REMOCON:
         {
-            vanilla_log("5,24 - str1: %s, str2: %s", response.payload, response.payload + 5);
+            VLOG_DEBUG(VANILLA_LOG_COMMAND, "5,24 - str1: %s, str2: %s", response.payload, response.payload + 5);
             response.generic_cmd_header.error_code = 0;
             break;
         }
@@ -193,13 +194,12 @@ void handle_generic_packet(gamepad_context_t *info, int skt, GenericPacket *requ
 
 void handle_uac_uvc_packet(gamepad_context_t *info, int skt, UvcUacPacket *request)
 {
-    vanilla_log("uac/uvc - mic_enable: %u, mic_freq: %u, mic_mute: %u, mic_volume: %i, mic_volume2: %i", request->uac_uvc.mic_enable, request->uac_uvc.mic_freq, request->uac_uvc.mic_mute, request->uac_uvc.mic_volume, request->uac_uvc.mic_volume_2);
+    VLOG_DEBUG(VANILLA_LOG_COMMAND, "uac/uvc - mic_enable: %u, mic_freq: %u, mic_mute: %u, mic_volume: %i, mic_volume2: %i", request->uac_uvc.mic_enable, request->uac_uvc.mic_freq, request->uac_uvc.mic_mute, request->uac_uvc.mic_volume, request->uac_uvc.mic_volume_2);
 
 	uint8_t mic_enabled = request->uac_uvc.mic_enable;
 	push_event(info->event_loop, VANILLA_EVENT_MIC, &mic_enabled, sizeof(mic_enabled));
 
-	print_hex(&request->uac_uvc, sizeof(request->uac_uvc));
-	vanilla_log_no_newline("\n");
+	print_hex(VANILLA_LOG_COMMAND, &request->uac_uvc, sizeof(request->uac_uvc));
 
 	// TODO: Create real response instead of using canned data
 	static const size_t uvc_resp_size = 16;
@@ -220,14 +220,14 @@ void handle_uac_uvc_packet(gamepad_context_t *info, int skt, UvcUacPacket *reque
 
 void handle_time_packet(int skt, TimePacket *request)
 {
-    vanilla_log("time - days: %u, padding: %u, seconds: %u", request->time.days_counter, request->time.padding, request->time.seconds_counter);
+    VLOG_DEBUG(VANILLA_LOG_COMMAND, "time - days: %u, padding: %u, seconds: %u", request->time.days_counter, request->time.padding, request->time.seconds_counter);
 
     send_quick_response(skt, &request->cmd_header);
 }
 
 void handle_command_packet(gamepad_context_t *info, int skt, CmdHeader *request)
 {
-	vanilla_log("packet_type: %u, query_type: %u, payload_size: 0x%X", request->packet_type, request->query_type, request->payload_size);
+	VLOG_DEBUG(VANILLA_LOG_COMMAND, "packet_type: %u, query_type: %u, payload_size: 0x%X", request->packet_type, request->query_type, request->payload_size);
     switch (request->packet_type)
     {
     case PACKET_TYPE_REQUEST:
@@ -250,7 +250,7 @@ void handle_command_packet(gamepad_context_t *info, int skt, CmdHeader *request)
             break;
         }
         default:
-            vanilla_log("[Command] Unhandled request command: %u", request->query_type);
+            VLOG_WARN(VANILLA_LOG_COMMAND, "[Command] Unhandled request command: %u", request->query_type);
         }
         break;
     case PACKET_TYPE_RESPONSE:
@@ -268,7 +268,7 @@ void handle_command_packet(gamepad_context_t *info, int skt, CmdHeader *request)
 		//		 Real gamepad attempts 5 times in 33ms intervals if ACK is not received
         break;
     default:
-        vanilla_log("Unhandled command packet type: %u", request->packet_type);
+        VLOG_WARN(VANILLA_LOG_COMMAND, "Unhandled command packet type: %u", request->packet_type);
     }
 }
 
@@ -281,7 +281,7 @@ void *listen_command(void *x)
 
     do
     {
-        size = recv(info->socket_cmd, data, sizeof(data), 0);
+        size = recv_from_console(info->socket_cmd, data, sizeof(data), PORT_CMD);
         if (size > 0) {
             CmdHeader *header = (CmdHeader *)data;
             handle_command_packet(info, info->socket_cmd, header);
@@ -5,6 +5,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "gamepad.h"
+
 typedef struct
 {
     // Little endian
@@ -204,6 +206,7 @@ enum MethodIDPeripheral
 };
 
 void *listen_command(void *x);
+void handle_command_packet(gamepad_context_t *info, int skt, CmdHeader *request);
 
 void set_region(int region);
 
@@ -0,0 +1,154 @@
+#include "fec.h"
+
+#include <string.h>
+
+static void xor_bytes(uint8_t *out, const uint8_t *in, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        out[i] ^= in[i];
+    }
+}
+
+int fec_is_parity(const void *data, size_t size)
+{
+    return size >= FEC_HEADER_SIZE && memcmp(data, FEC_SIGNATURE, FEC_SIGNATURE_SIZE) == 0;
+}
+
+void fec_encoder_reset(fec_encoder_t *enc)
+{
+    memset(enc->payload, 0, enc->payload_size);
+    enc->count = 0;
+    enc->payload_size = 0;
+    enc->size_xor = 0;
+}
+
+int fec_encoder_add(fec_encoder_t *enc, const uint8_t *data, size_t size)
+{
+    if (size < 2 || size > FEC_DATAGRAM_MAX || enc->count == FEC_GROUP_MAX) {
+        return 0;
+    }
+
+    // The payload past the end of earlier packets is still zero
+    xor_bytes(enc->payload, data, size);
+    if (size > enc->payload_size) {
+        enc->payload_size = size;
+    }
+    enc->size_xor ^= size;
+    enc->seq_ids[enc->count] = fec_seq_id(data);
+    enc->count++;
+
+    return 1;
+}
+
+size_t fec_encoder_finish(fec_encoder_t *enc, uint8_t *out)
+{
+    if (enc->count == 0) {
+        return 0;
+    }
+
+    memcpy(out, FEC_SIGNATURE, FEC_SIGNATURE_SIZE);
+    uint8_t *header = out + FEC_SIGNATURE_SIZE;
+    header[0] = enc->count;
+    header[1] = 0;
+    header[2] = enc->size_xor >> 8;
+    header[3] = enc->size_xor;
+    header[4] = enc->payload_size >> 8;
+    header[5] = enc->payload_size;
+
+    uint8_t *p = out + FEC_HEADER_SIZE;
+    for (size_t i = 0; i < enc->count; i++) {
+        p[0] = enc->seq_ids[i] >> 8;
+        p[1] = enc->seq_ids[i];
+        p += 2;
+    }
+
+    memcpy(p, enc->payload, enc->payload_size);
+    p += enc->payload_size;
+
+    fec_encoder_reset(enc);
+
+    return p - out;
+}
+
+void fec_decoder_reset(fec_decoder_t *dec)
+{
+    dec->active = 0;
+    for (size_t i = 0; i < FEC_WINDOW; i++) {
+        dec->slots[i].size = 0;
+    }
+}
+
+void fec_decoder_store(fec_decoder_t *dec, const uint8_t *data, size_t size)
+{
+    if (size < 2 || size > FEC_DATAGRAM_MAX) {
+        return;
+    }
+
+    uint16_t seq_id = fec_seq_id(data);
+    fec_slot_t *slot = &dec->slots[seq_id % FEC_WINDOW];
+    slot->seq_id = seq_id;
+    slot->size = size;
+    memcpy(slot->data, data, size);
+}
+
+static const fec_slot_t *find_slot(const fec_decoder_t *dec, uint16_t seq_id)
+{
+    const fec_slot_t *slot = &dec->slots[seq_id % FEC_WINDOW];
+    return (slot->size && slot->seq_id == seq_id) ? slot : NULL;
+}
+
+size_t fec_decoder_recover(fec_decoder_t *dec, const uint8_t *parity, size_t size, uint8_t *out, size_t out_size)
+{
+    const uint8_t *header = parity + FEC_SIGNATURE_SIZE;
+    size_t count = header[0];
+    uint16_t size_xor = (header[2] << 8) | header[3];
+    size_t payload_size = (header[4] << 8) | header[5];
+
+    // Truncated or malformed
+    if (count == 0 || count > FEC_GROUP_MAX || payload_size > FEC_DATAGRAM_MAX
+        || size != FEC_HEADER_SIZE + count * 2 + payload_size) {
+        return 0;
+    }
+
+    const uint8_t *seq_ids = parity + FEC_HEADER_SIZE;
+    const uint8_t *payload = seq_ids + count * 2;
+
+    int missing = -1;
+    for (size_t i = 0; i < count; i++) {
+        uint16_t seq_id = (seq_ids[i * 2] << 8) | seq_ids[i * 2 + 1];
+        if (!find_slot(dec, seq_id)) {
+            if (missing != -1) {
+                return 0;
+            }
+            missing = seq_id;
+        }
+    }
+
+    if (missing == -1) {
+        return 0;
+    }
+
+    uint8_t rebuilt[FEC_DATAGRAM_MAX];
+    memcpy(rebuilt, payload, payload_size);
+    for (size_t i = 0; i < count; i++) {
+        uint16_t seq_id = (seq_ids[i * 2] << 8) | seq_ids[i * 2 + 1];
+        const fec_slot_t *slot = find_slot(dec, seq_id);
+        if (slot) {
+            xor_bytes(rebuilt, slot->data, slot->size);
+            size_xor ^= slot->size;
+        }
+    }
+
+    // What's left of the sizes is the missing packet's, which has to agree
+    // with the seq_id it was rebuilt with
+    size_t rebuilt_size = size_xor;
+    if (rebuilt_size < 2 || rebuilt_size > payload_size || fec_seq_id(rebuilt) != missing) {
+        return 0;
+    }
+
+    fec_decoder_store(dec, rebuilt, rebuilt_size);
+
+    rebuilt_size = rebuilt_size < out_size ? rebuilt_size : out_size;
+    memcpy(out, rebuilt, rebuilt_size);
+    return rebuilt_size;
+}
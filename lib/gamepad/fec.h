@@ -0,0 +1,82 @@
+#ifndef GAMEPAD_FEC_H
+#define GAMEPAD_FEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// XOR parity for the video and audio packets vanilla-pipe relays over UDP.
+// After every group of packets (or every video frame, whichever ends first)
+// the pipe sends one parity packet to the same port, which lets libvanilla
+// rebuild any single packet of the group that went missing.
+//
+// Parity packets start with FEC_SIGNATURE, followed by (big endian):
+//   uint8_t  count         (packets in the group)
+//   uint8_t  reserved
+//   uint16_t size_xor      (the sizes of every packet XORed together)
+//   uint16_t payload_size  (size of the largest packet)
+//   uint16_t seq_id[count] (each packet's seq_id, as read by fec_seq_id())
+//   uint8_t  payload[payload_size] (every packet XORed together, zero padded)
+//
+
+#define FEC_SIGNATURE "\xffVNLFEC\x01"
+#define FEC_SIGNATURE_SIZE 8
+#define FEC_HEADER_SIZE (FEC_SIGNATURE_SIZE + 6)
+#define FEC_GROUP_MAX 32
+#define FEC_DATAGRAM_MAX 4096
+#define FEC_PARITY_MAX (FEC_HEADER_SIZE + FEC_GROUP_MAX * 2 + FEC_DATAGRAM_MAX)
+
+// Enough to still hold every packet of a group a parity packet refers to
+#define FEC_WINDOW 64
+
+typedef struct
+{
+    size_t count;
+    size_t payload_size;
+    uint16_t size_xor;
+    uint16_t seq_ids[FEC_GROUP_MAX];
+    uint8_t payload[FEC_DATAGRAM_MAX];
+} fec_encoder_t;
+
+typedef struct
+{
+    uint16_t seq_id;
+    uint16_t size; // 0 if empty
+    uint8_t data[FEC_DATAGRAM_MAX];
+} fec_slot_t;
+
+typedef struct
+{
+    int active;
+    fec_slot_t slots[FEC_WINDOW];
+    uint8_t scratch[FEC_PARITY_MAX];
+} fec_decoder_t;
+
+// Video and audio headers both start with a 10-bit seq_id in the same place
+static inline uint16_t fec_seq_id(const uint8_t *data)
+{
+    return ((data[0] << 8) | data[1]) & 0x3FF;
+}
+
+int fec_is_parity(const void *data, size_t size);
+
+void fec_encoder_reset(fec_encoder_t *enc);
+
+// Adds a packet to the current group, returning 0 if it can't be protected
+int fec_encoder_add(fec_encoder_t *enc, const uint8_t *data, size_t size);
+
+// Writes the current group's parity packet to `out` (which must hold
+// FEC_PARITY_MAX bytes) and starts a new group. Returns its size, or 0 if
+// the group was empty.
+size_t fec_encoder_finish(fec_encoder_t *enc, uint8_t *out);
+
+void fec_decoder_reset(fec_decoder_t *dec);
+
+// Remembers a packet in case it's needed to rebuild another one
+void fec_decoder_store(fec_decoder_t *dec, const uint8_t *data, size_t size);
+
+// Rebuilds the packet missing from a parity packet's group into `out`.
+// Returns its size, or 0 if nothing or more than one packet is missing.
+size_t fec_decoder_recover(fec_decoder_t *dec, const uint8_t *parity, size_t size, uint8_t *out, size_t out_size);
+
+#endif // GAMEPAD_FEC_H
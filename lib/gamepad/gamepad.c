@@ -8,11 +8,22 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/select.h>
+#endif
+
 #include "audio.h"
+#include "capture.h"
 #include "command.h"
+#include "fec.h"
+#include "impair.h"
 #include "input.h"
+#include "log.h"
+#include "metrics.h"
 #include "video.h"
 
 #include "../pipe/def.h"
@@ -21,6 +32,10 @@
 static uint32_t SERVER_ADDRESS = 0;
 static const int MAX_PIPE_RETRY = 5;
 
+// The pipe is already listening by the time it says it's connected, so this
+// only has to cover the round trip
+#define VIDEO_STREAM_CONNECT_TIMEOUT_US 500000
+
 char wireless_interface[128];
 
 #define EVENT_BUFFER_SIZE 65536
@@ -74,7 +89,7 @@ void send_to_sockaddr(int fd, const void *data, size_t data_size, const sockaddr
     if (sent == -1) {
 		int err = skterr();
 		if (err != 111) { // 111 is connection refused, occurs if we lose connection, but we'll already know that for other reasons so we don't need to spam the console with this error
-			vanilla_log("Failed to send to Wii U socket: fd: %d, errno: %i", fd, skterr());
+			VLOG_ERROR(VANILLA_LOG_NETWORK, "Failed to send to Wii U socket: fd: %d, errno: %i", fd, skterr());
 		}
     }
 }
@@ -84,6 +99,11 @@ void send_to_console(int fd, const void *data, size_t data_size, uint16_t port)
     sockaddr_u addr;
     size_t addr_size;
 
+    // Replays have no console to answer
+    if (fd == -1) {
+        return;
+    }
+
     in_port_t console_port = port - 100;
 
     create_server_sockaddr(&addr, &addr_size, console_port, 0);
@@ -91,6 +111,72 @@ void send_to_console(int fd, const void *data, size_t data_size, uint16_t port)
     send_to_sockaddr(fd, data, data_size, &addr, addr_size);
 }
 
+// A pipe relaying over UDP may add parity packets to these, see fec.h. Each
+// is only ever received on its own thread.
+static fec_decoder_t fec_vid;
+static fec_decoder_t fec_aud;
+static int metric_fec_recovered_vid = -1;
+static int metric_fec_recovered_aud = -1;
+
+static ssize_t recv_datagram(int fd, void *data, size_t data_size, uint16_t port)
+{
+    if (impair_is_active(port)) {
+        return impair_recv(fd, data, data_size, port);
+    }
+
+    ssize_t size = recv(fd, data, data_size, 0);
+    if (size > 0) {
+        capture_packet(port, data, size);
+    }
+    return size;
+}
+
+ssize_t recv_from_console(int fd, void *data, size_t data_size, uint16_t port)
+{
+    fec_decoder_t *fec = NULL;
+    int metric_recovered = -1;
+    if (port == PORT_VID) {
+        fec = &fec_vid;
+        metric_recovered = metric_fec_recovered_vid;
+    } else if (port == PORT_AUD) {
+        fec = &fec_aud;
+        metric_recovered = metric_fec_recovered_aud;
+    }
+
+    if (!fec) {
+        return recv_datagram(fd, data, data_size, port);
+    }
+
+    while (1) {
+        // Parity packets can be bigger than the packets they protect, so once
+        // the pipe is known to be sending them, receive into a bigger buffer
+        uint8_t *buf = fec->active ? fec->scratch : data;
+        size_t buf_size = fec->active ? sizeof(fec->scratch) : data_size;
+
+        ssize_t size = recv_datagram(fd, buf, buf_size, port);
+        if (size <= 0) {
+            return size;
+        }
+
+        if (fec_is_parity(buf, size)) {
+            fec->active = 1;
+            size = fec_decoder_recover(fec, buf, size, data, data_size);
+            if (size > 0) {
+                metrics_add(metric_recovered, 1);
+                return size;
+            }
+            continue;
+        }
+
+        if (buf != data) {
+            size = MIN(size, data_size);
+            memcpy(data, buf, size);
+        }
+        fec_decoder_store(fec, data, size);
+        return size;
+    }
+}
+
 void set_socket_rcvtimeo(int skt, uint64_t microseconds)
 {
 #ifdef _WIN32
@@ -116,12 +202,12 @@ int create_socket(int *socket_out, in_port_t port, int pipe)
 
     int skt = socket(domain, SOCK_DGRAM, 0);
     if (skt == -1) {
-        vanilla_log("FAILED TO CREATE SOCKET: %i", skterr());
+        VLOG_ERROR(VANILLA_LOG_NETWORK, "FAILED TO CREATE SOCKET: %i", skterr());
         return VANILLA_ERR_BAD_SOCKET;
     }
 
     if (bind(skt, (const struct sockaddr *) &addr, addr_size) == -1) {
-        vanilla_log("FAILED TO BIND PORT %u: %i", port, skterr());
+        VLOG_ERROR(VANILLA_LOG_NETWORK, "FAILED TO BIND PORT %u: %i", port, skterr());
         close(skt);
         return VANILLA_ERR_BAD_SOCKET;
     }
@@ -151,6 +237,64 @@ int create_socket(int *socket_out, in_port_t port, int pipe)
     return VANILLA_SUCCESS;
 }
 
+static void set_socket_blocking(int skt, int blocking)
+{
+#ifdef _WIN32
+    u_long nonblocking = !blocking;
+    ioctlsocket(skt, FIONBIO, &nonblocking);
+#else
+    int flags = fcntl(skt, F_GETFL, 0);
+    fcntl(skt, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+#endif
+}
+
+// Connects to the pipe's reassembled video stream, giving up quickly rather
+// than waiting out the kernel's SYN retries
+static int connect_video_stream()
+{
+    sockaddr_u addr;
+    size_t addr_size;
+
+    create_sockaddr(&addr, &addr_size, SERVER_ADDRESS, VANILLA_PIPE_VIDEO_STREAM_PORT, 0, 0);
+
+    int skt = socket(AF_INET, SOCK_STREAM, 0);
+    if (skt == -1) {
+        return -1;
+    }
+
+    set_socket_blocking(skt, 0);
+    if (connect(skt, (const struct sockaddr *) &addr, addr_size) == -1) {
+#ifdef _WIN32
+        if (skterr() != WSAEWOULDBLOCK) {
+#else
+        if (skterr() != EINPROGRESS) {
+#endif
+            close(skt);
+            return -1;
+        }
+
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(skt, &fds);
+        struct timeval tv = {0};
+        tv.tv_usec = VIDEO_STREAM_CONNECT_TIMEOUT_US;
+
+        int error = 0;
+        socklen_t error_size = sizeof(error);
+        if (select(skt + 1, NULL, &fds, NULL, &tv) <= 0
+            || getsockopt(skt, SOL_SOCKET, SO_ERROR, (char *) &error, &error_size) == -1
+            || error != 0) {
+            close(skt);
+            return -1;
+        }
+    }
+    set_socket_blocking(skt, 1);
+
+    set_socket_rcvtimeo(skt, 250000);
+
+    return skt;
+}
+
 int send_pipe_cc(int skt, vanilla_pipe_command_t *cmd, size_t cmd_size, int wait_for_reply)
 {
     sockaddr_u addr;
@@ -166,7 +310,7 @@ int send_pipe_cc(int skt, vanilla_pipe_command_t *cmd, size_t cmd_size, int wait
 
     for (int retries = 0; retries < MAX_PIPE_RETRY; retries++) {
         if (sendto(skt, (const char *) cmd, cmd_size, 0, (const struct sockaddr *) &addr, addr_size) == -1) {
-            vanilla_log("Failed to write control code to socket");
+            VLOG_ERROR(VANILLA_LOG_NETWORK, "Failed to write control code to socket");
             return 0;
         }
 
@@ -179,7 +323,7 @@ int send_pipe_cc(int skt, vanilla_pipe_command_t *cmd, size_t cmd_size, int wait
             return 1;
         }
 
-        vanilla_log("STILL WAITING FOR REPLY");
+        VLOG_INFO(VANILLA_LOG_NETWORK, "STILL WAITING FOR REPLY");
 
         sleep(1);
     }
@@ -206,7 +350,7 @@ int connect_to_backend(int *socket, vanilla_pipe_command_t *cmd, size_t cmd_size
     set_socket_rcvtimeo(pipe_cc_skt, 2000000);
 
     if (!send_pipe_cc(pipe_cc_skt, cmd, cmd_size, 1)) {
-        vanilla_log("FAILED TO BIND TO PIPE");
+        VLOG_ERROR(VANILLA_LOG_NETWORK, "FAILED TO BIND TO PIPE");
         close(pipe_cc_skt);
         return VANILLA_ERR_PIPE_UNRESPONSIVE;
     }
@@ -223,6 +367,20 @@ void wait_for_interrupt()
     }
 }
 
+static void log_sync_progress(const vanilla_pipe_sync_progress_t *progress, vanilla_pipe_sync_progress_t *last)
+{
+    if (!memcmp(progress, last, sizeof(*progress))) {
+        return;
+    }
+    *last = *progress;
+
+    if (progress->state == VANILLA_PIPE_SYNC_TRYING_PIN) {
+        VLOG_INFO(VANILLA_LOG_NETWORK, "SYNC: TRYING CONSOLE %u OF %u (%i DBM)", progress->attempt, progress->candidates, progress->signal);
+    } else {
+        VLOG_INFO(VANILLA_LOG_NETWORK, "SYNC: SCANNING (%u CONSOLES FOUND)", progress->candidates);
+    }
+}
+
 void sync_internal(thread_data_t *data)
 {
     clear_interrupt();
@@ -238,6 +396,7 @@ void sync_internal(thread_data_t *data)
     int skt = -1;
 
     vanilla_sync_event_t syncdata;
+    vanilla_pipe_sync_progress_t last_progress = {.state = 0xFF};
 
     syncdata.status = connect_to_backend(&skt, &cmd, sizeof(cmd.control_code) + sizeof(cmd.sync));
 
@@ -259,6 +418,11 @@ void sync_internal(thread_data_t *data)
             } else if (recv_cmd.control_code == VANILLA_PIPE_CC_PING) {
                 // Pipe is still responsive but hasn't found anything yet
                 retries = -1;
+
+                // Newer pipes say how far along they are
+                if (read_size >= (ssize_t) (sizeof(recv_cmd.control_code) + sizeof(recv_cmd.sync_progress))) {
+                    log_sync_progress(&recv_cmd.sync_progress, &last_progress);
+                }
             }
 
             if (is_interrupted()) {
@@ -309,6 +473,58 @@ int install_polkit_internal(thread_data_t *data, int install)
 	return ret;
 }
 
+int get_pipe_stats_internal(uint32_t server_address, vanilla_pipe_stats_t *stats)
+{
+    // Uses its own socket rather than VANILLA_PIPE_CMD_CLIENT_PORT, which a
+    // connection may already have bound
+    int pipe_is_local = (server_address == VANILLA_ADDRESS_LOCAL);
+    sockaddr_u server_addr, client_addr;
+    size_t server_addr_size, client_addr_size;
+    create_sockaddr(&server_addr, &server_addr_size, pipe_is_local ? INADDR_ANY : server_address, VANILLA_PIPE_CMD_SERVER_PORT, pipe_is_local, 0);
+    create_sockaddr(&client_addr, &client_addr_size, INADDR_ANY, pipe_is_local ? VANILLA_PIPE_STATS_CLIENT_PORT : 0, pipe_is_local, 1);
+
+    int skt = socket(pipe_is_local ? AF_UNIX : AF_INET, SOCK_DGRAM, 0);
+    if (skt == -1) {
+        VLOG_ERROR(VANILLA_LOG_NETWORK, "FAILED TO CREATE SOCKET: %i", skterr());
+        return VANILLA_ERR_BAD_SOCKET;
+    }
+
+    if (bind(skt, (const struct sockaddr *) &client_addr, client_addr_size) == -1) {
+        VLOG_ERROR(VANILLA_LOG_NETWORK, "FAILED TO BIND STATS SOCKET: %i", skterr());
+        close(skt);
+        return VANILLA_ERR_BAD_SOCKET;
+    }
+
+    set_socket_rcvtimeo(skt, 250000);
+
+    int ret = VANILLA_ERR_PIPE_UNRESPONSIVE;
+    vanilla_pipe_command_t cmd;
+    for (int retries = 0; retries < MAX_PIPE_RETRY; retries++) {
+        cmd.control_code = VANILLA_PIPE_CC_STATS;
+        if (sendto(skt, (const char *) &cmd, sizeof(cmd.control_code), 0, (const struct sockaddr *) &server_addr, server_addr_size) == -1) {
+            VLOG_ERROR(VANILLA_LOG_NETWORK, "Failed to write control code to socket");
+            break;
+        }
+
+        ssize_t read_size = recv(skt, (char *) &cmd, sizeof(cmd), 0);
+        if (read_size == sizeof(cmd.control_code) + sizeof(cmd.stats) && cmd.control_code == VANILLA_PIPE_CC_STATS) {
+            memcpy(stats, &cmd.stats, sizeof(*stats));
+            vanilla_pipe_stats_from_wire(stats);
+            ret = VANILLA_SUCCESS;
+            break;
+        }
+    }
+
+    close(skt);
+#ifndef _WIN32
+    if (pipe_is_local) {
+        unlink(client_addr.un.sun_path);
+    }
+#endif
+
+    return ret;
+}
+
 void connect_as_gamepad_internal(thread_data_t *data)
 {
     clear_interrupt();
@@ -321,6 +537,7 @@ void connect_as_gamepad_internal(thread_data_t *data)
     int ret = VANILLA_SUCCESS;
 
     int pipe_cc_skt = -1;
+    int video_stream_offered = 0;
     vanilla_pipe_command_t cmd;
     cmd.control_code = VANILLA_PIPE_CC_CONNECT;
 
@@ -342,17 +559,20 @@ void connect_as_gamepad_internal(thread_data_t *data)
 #else
                 if (r != EAGAIN) {
 #endif
-                    vanilla_log("FAILED TO GET CONNECTED STATE: %i", r);
+                    VLOG_ERROR(VANILLA_LOG_NETWORK, "FAILED TO GET CONNECTED STATE: %i", r);
                     ret = VANILLA_ERR_PIPE_UNRESPONSIVE;
                     break;
                 }
             } else if (connected_state.control_code == VANILLA_PIPE_CC_CONNECTED) {
+                if (read_size >= (ssize_t) (sizeof(connected_state.control_code) + sizeof(connected_state.connected))) {
+                    video_stream_offered = (connected_state.connected.flags & VANILLA_PIPE_CONNECTED_VIDEO_STREAM) != 0;
+                }
                 ret = VANILLA_SUCCESS;
                 sleep(1);
                 break;
             }
 
-            vanilla_log("STILL WAITING FOR CONNECTED STATE");
+            VLOG_INFO(VANILLA_LOG_NETWORK, "STILL WAITING FOR CONNECTED STATE");
         }
     }
 
@@ -364,8 +584,23 @@ void connect_as_gamepad_internal(thread_data_t *data)
         if (create_socket(&info.socket_aud, PORT_AUD, 0) != VANILLA_SUCCESS) goto exit_hid;
         if (create_socket(&info.socket_cmd, PORT_CMD, 0) != VANILLA_SUCCESS) goto exit_aud;
 
+        // A remote pipe may offer whole frames over TCP instead of relaying
+        // every video packet
+        info.stream_vid = -1;
+        if (video_stream_offered && SERVER_ADDRESS != VANILLA_ADDRESS_LOCAL) {
+            info.stream_vid = connect_video_stream();
+            if (info.stream_vid != -1) {
+                VLOG_INFO(VANILLA_LOG_NETWORK, "RECEIVING REASSEMBLED VIDEO FROM PIPE");
+            }
+        }
+
         pthread_t video_thread, audio_thread, input_thread, msg_thread, cmd_thread;
 
+        capture_open();
+        impair_open();
+        fec_decoder_reset(&fec_vid);
+        fec_decoder_reset(&fec_aud);
+
         int cnn = VANILLA_ERR_CONNECTED;
         push_event(data->event_loop, VANILLA_EVENT_ERROR, &cnn, sizeof(cnn));
 
@@ -406,6 +641,13 @@ void connect_as_gamepad_internal(thread_data_t *data)
         pthread_join(input_thread, NULL);
         pthread_join(cmd_thread, NULL);
 
+        capture_close();
+        impair_close();
+
+        if (info.stream_vid != -1) {
+            close(info.stream_vid);
+        }
+
 exit_cmd:
         close(info.socket_cmd);
 
@@ -438,6 +680,16 @@ exit:
     wait_for_interrupt();
 }
 
+static int metric_event_drops = -1;
+
+void init_gamepad_metrics()
+{
+    metric_event_drops = metrics_counter("vanilla_event_queue_drops_total", "Events discarded because the frontend didn't read them in time");
+    metric_fec_recovered_vid = metrics_counter("vanilla_fec_recovered_total{port=\"vid\"}", "Packets lost between the pipe and the frontend that were rebuilt from parity");
+    metric_fec_recovered_aud = metrics_counter("vanilla_fec_recovered_total{port=\"aud\"}", "Packets lost between the pipe and the frontend that were rebuilt from parity");
+    init_video_metrics();
+}
+
 int acquire_event(event_loop_t *loop, vanilla_event_t **event)
 {
 	int ret = VANILLA_SUCCESS;
@@ -447,7 +699,8 @@ int acquire_event(event_loop_t *loop, vanilla_event_t **event)
 	// Prevent rollover by skipping oldest event if necessary
 	if (loop->new_index == loop->used_index + VANILLA_MAX_EVENT_COUNT) {
 		vanilla_free_event(&loop->events[loop->used_index % VANILLA_MAX_EVENT_COUNT]);
-		vanilla_log("SKIPPED EVENT TO PREVENT ROLLOVER (%lu > %lu + %lu)", loop->new_index, loop->used_index, VANILLA_MAX_EVENT_COUNT);
+		VLOG_WARN(VANILLA_LOG_GENERAL, "SKIPPED EVENT TO PREVENT ROLLOVER (%zu > %zu + %d)", loop->new_index, loop->used_index, VANILLA_MAX_EVENT_COUNT);
+		metrics_add(metric_event_drops, 1);
 		loop->used_index++;
 	}
 
@@ -495,6 +748,7 @@ int push_event(event_loop_t *loop, int type, const void *data, size_t size)
 	ev->type = type;
 	memcpy(ev->data, data, size);
 	ev->size = size;
+	ev->frame_id = 0;
 
 	ret = release_event(loop);
 
@@ -521,11 +775,15 @@ int get_event(event_loop_t *loop, vanilla_event_t *event, int wait)
             event->type = pull_event->type;
             event->data = pull_event->data;
             event->size = pull_event->size;
+            event->frame_id = pull_event->frame_id;
 
             pull_event->data = NULL;
 
             loop->used_index++;
             ret = 1;
+
+            // Wake anything in wait_for_event_space()
+            pthread_cond_broadcast(&loop->waitcond);
         }
     }
 
@@ -534,6 +792,23 @@ int get_event(event_loop_t *loop, vanilla_event_t *event, int wait)
     return ret;
 }
 
+void wait_for_event_space(event_loop_t *loop, size_t count)
+{
+    pthread_mutex_lock(&loop->mutex);
+    while (loop->active && !is_interrupted() && loop->new_index + count > loop->used_index + VANILLA_MAX_EVENT_COUNT) {
+        // Time out periodically since nothing signals an interrupt
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 100000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&loop->waitcond, &loop->mutex, &deadline);
+    }
+    pthread_mutex_unlock(&loop->mutex);
+}
+
 void *get_event_buffer()
 {
     void *buf = NULL;
@@ -569,7 +844,7 @@ void init_event_buffer_arena()
         if (!EVENT_BUFFER_ARENA[i]) {
             EVENT_BUFFER_ARENA[i] = malloc(EVENT_BUFFER_SIZE);
         } else {
-            vanilla_log("CRITICAL: Buffer wasn't returned to the arena");
+            VLOG_ERROR(VANILLA_LOG_GENERAL, "CRITICAL: Buffer wasn't returned to the arena");
         }
     }
 }
@@ -581,7 +856,7 @@ void free_event_buffer_arena()
             free(EVENT_BUFFER_ARENA[i]);
             EVENT_BUFFER_ARENA[i] = NULL;
         } else {
-            vanilla_log("CRITICAL: Buffer wasn't returned to the arena");
+            VLOG_ERROR(VANILLA_LOG_GENERAL, "CRITICAL: Buffer wasn't returned to the arena");
         }
     }
 }
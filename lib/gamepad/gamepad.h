@@ -3,6 +3,7 @@
 
 #include <pthread.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -41,6 +42,7 @@ typedef struct
     int socket_hid;
     int socket_msg;
     int socket_cmd;
+    int stream_vid;
 } gamepad_context_t;
 
 typedef struct thread_data_t thread_data_t;
@@ -65,13 +67,18 @@ typedef union {
 void sync_internal(thread_data_t *data);
 void connect_as_gamepad_internal(thread_data_t *data);
 int install_polkit_internal(thread_data_t *data, int install);
+int get_pipe_stats_internal(uint32_t server_address, vanilla_pipe_stats_t *stats);
 void create_server_sockaddr(sockaddr_u *addr, size_t *size, uint16_t port, int delete);
 void send_to_sockaddr(int fd, const void *data, size_t data_size, const sockaddr_u *sockaddr, size_t sockaddr_size);
 void send_to_console(int fd, const void *data, size_t data_size, uint16_t port);
+ssize_t recv_from_console(int fd, void *data, size_t data_size, uint16_t port);
+void wait_for_interrupt();
+void init_gamepad_metrics();
 int push_event(event_loop_t *loop, int type, const void *data, size_t size);
 int get_event(event_loop_t *loop, vanilla_event_t *event, int wait);
 int acquire_event(event_loop_t *loop, vanilla_event_t **event);
 int release_event(event_loop_t *loop);
+void wait_for_event_space(event_loop_t *loop, size_t count);
 
 void init_event_buffer_arena();
 void free_event_buffer_arena();
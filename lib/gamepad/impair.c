@@ -0,0 +1,450 @@
+#include "impair.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/select.h>
+#include <sys/socket.h>
+#endif
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "gamepad.h"
+#include "log.h"
+#include "util.h"
+
+// Queues start out small and double whenever delay and jitter keep more
+// packets in flight than fit, up to a limit that's several seconds of video
+#define IMPAIR_QUEUE_SIZE 128
+#define IMPAIR_QUEUE_MAX 16384
+#define IMPAIR_PACKET_SIZE 4096
+#define IMPAIR_REPORT_INTERVAL_NS 1000000000ULL
+
+// How long past its own release a packet held back for reordering waits for
+// another one to overtake it
+#define IMPAIR_REORDER_WINDOW_NS 10000000ULL
+
+typedef struct
+{
+    uint64_t release;
+    size_t size;
+    uint8_t data[IMPAIR_PACKET_SIZE];
+} impaired_packet_t;
+
+typedef struct
+{
+    const char *name;
+    uint16_t port;
+
+    // Packets waiting to be handed over, in release order
+    impaired_packet_t *queue;
+    size_t queue_capacity;
+    size_t queue_head;
+    size_t queue_count;
+    uint64_t last_release;
+
+    // Packet held back to be delivered after the next one
+    impaired_packet_t *held;
+    int held_copies;
+    uint64_t held_deadline;
+
+    impaired_packet_t *scratch;
+
+    int bad_state;
+    uint64_t rng;
+
+    uint64_t received;
+    uint64_t lost;
+    uint64_t burst_lost;
+    uint64_t reordered;
+    uint64_t duplicated;
+    uint64_t overflowed;
+    uint64_t total_delay;
+    uint64_t last_report;
+} impair_port_t;
+
+static vanilla_impairment_t impair_config = {0};
+static int impair_config_set = 0;
+static pthread_mutex_t impair_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int impair_enabled = 0;
+static vanilla_impairment_t impair_active;
+static impair_port_t impair_ports[] = {
+    {.name = "vid", .port = PORT_VID},
+    {.name = "aud", .port = PORT_AUD},
+    {.name = "cmd", .port = PORT_CMD},
+};
+#define IMPAIR_PORT_COUNT (sizeof(impair_ports) / sizeof(impair_ports[0]))
+
+static uint64_t next_random(impair_port_t *p)
+{
+    // xorshift64*
+    p->rng ^= p->rng >> 12;
+    p->rng ^= p->rng << 25;
+    p->rng ^= p->rng >> 27;
+    return p->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static float random_float(impair_port_t *p)
+{
+    return (next_random(p) >> 40) / (float) (1 << 24);
+}
+
+static impair_port_t *get_port(uint16_t port)
+{
+    for (size_t i = 0; i < IMPAIR_PORT_COUNT; i++) {
+        if (impair_ports[i].port == port) {
+            return &impair_ports[i];
+        }
+    }
+    return NULL;
+}
+
+static int parse_impairment(const char *str, vanilla_impairment_t *config)
+{
+    // Format is comma separated key=value pairs, e.g. "loss=0.02,delay=5000,seed=1"
+    memset(config, 0, sizeof(*config));
+
+    while (*str) {
+        const char *equals = strchr(str, '=');
+        if (!equals) {
+            return 0;
+        }
+
+        size_t key_len = equals - str;
+        char *end;
+        double value = strtod(equals + 1, &end);
+
+        if (key_len == 4 && !memcmp(str, "loss", 4)) {
+            config->loss = value;
+        } else if (key_len == 11 && !memcmp(str, "burst_enter", 11)) {
+            config->burst_enter = value;
+        } else if (key_len == 10 && !memcmp(str, "burst_exit", 10)) {
+            config->burst_exit = value;
+        } else if (key_len == 10 && !memcmp(str, "burst_loss", 10)) {
+            config->burst_loss = value;
+        } else if (key_len == 7 && !memcmp(str, "reorder", 7)) {
+            config->reorder = value;
+        } else if (key_len == 3 && !memcmp(str, "dup", 3)) {
+            config->duplicate = value;
+        } else if (key_len == 5 && !memcmp(str, "delay", 5)) {
+            config->delay_us = value;
+        } else if (key_len == 6 && !memcmp(str, "jitter", 6)) {
+            config->jitter_us = value;
+        } else if (key_len == 4 && !memcmp(str, "seed", 4)) {
+            config->seed = value;
+        } else {
+            return 0;
+        }
+
+        str = end;
+        if (*str == ',') {
+            str++;
+        } else if (*str) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int config_is_active(const vanilla_impairment_t *c)
+{
+    return c->loss > 0 || c->burst_enter > 0 || c->reorder > 0 || c->duplicate > 0 || c->delay_us || c->jitter_us;
+}
+
+void set_impairment(const vanilla_impairment_t *config)
+{
+    pthread_mutex_lock(&impair_mutex);
+    if (config) {
+        impair_config = *config;
+        impair_config_set = 1;
+    } else {
+        impair_config_set = 0;
+    }
+    pthread_mutex_unlock(&impair_mutex);
+}
+
+int impair_open()
+{
+    vanilla_impairment_t config;
+    int have_config;
+
+    pthread_mutex_lock(&impair_mutex);
+    config = impair_config;
+    have_config = impair_config_set;
+    pthread_mutex_unlock(&impair_mutex);
+
+    if (!have_config) {
+        const char *env = getenv("VANILLA_IMPAIR");
+        if (!env || !env[0]) {
+            return VANILLA_SUCCESS;
+        }
+
+        if (!parse_impairment(env, &config)) {
+            VLOG_ERROR(VANILLA_LOG_NETWORK, "Invalid VANILLA_IMPAIR, expected e.g. \"loss=0.01,delay=2000,jitter=1000,seed=1\"");
+            return VANILLA_ERR_INVALID_ARGUMENT;
+        }
+    }
+
+    if (!config_is_active(&config)) {
+        return VANILLA_SUCCESS;
+    }
+
+    uint64_t now = get_monotonic_nanos();
+
+    for (size_t i = 0; i < IMPAIR_PORT_COUNT; i++) {
+        impair_port_t *p = &impair_ports[i];
+
+        p->queue = malloc(sizeof(impaired_packet_t) * IMPAIR_QUEUE_SIZE);
+        p->held = malloc(sizeof(impaired_packet_t));
+        p->scratch = malloc(sizeof(impaired_packet_t));
+        if (!p->queue || !p->held || !p->scratch) {
+            impair_close();
+            return VANILLA_ERR_OUT_OF_MEMORY;
+        }
+
+        p->queue_capacity = IMPAIR_QUEUE_SIZE;
+        p->queue_head = 0;
+        p->queue_count = 0;
+        p->last_release = 0;
+        p->held_copies = 0;
+        p->bad_state = 0;
+
+        // Each port gets its own deterministic sequence (xorshift can't start at 0)
+        p->rng = ((uint64_t) config.seed << 16) ^ p->port ^ 0x9E3779B97F4A7C15ULL;
+
+        p->received = p->lost = p->burst_lost = p->reordered = 0;
+        p->duplicated = p->overflowed = p->total_delay = 0;
+        p->last_report = now;
+    }
+
+    impair_active = config;
+    impair_enabled = 1;
+
+    VLOG_INFO(VANILLA_LOG_NETWORK, "Impairing gamepad traffic: loss %.3f, burst enter %.3f exit %.3f loss %.3f, reorder %.3f, duplicate %.3f, delay %uus, jitter %uus, seed %u",
+                config.loss, config.burst_enter, config.burst_exit, config.burst_loss,
+                config.reorder, config.duplicate, config.delay_us, config.jitter_us, config.seed);
+
+    return VANILLA_SUCCESS;
+}
+
+void impair_close()
+{
+    impair_enabled = 0;
+
+    for (size_t i = 0; i < IMPAIR_PORT_COUNT; i++) {
+        impair_port_t *p = &impair_ports[i];
+        free(p->queue);
+        free(p->held);
+        free(p->scratch);
+        p->queue = NULL;
+        p->held = NULL;
+        p->scratch = NULL;
+    }
+}
+
+int impair_is_active(uint16_t port)
+{
+    return impair_enabled && get_port(port);
+}
+
+static int grow_queue(impair_port_t *p)
+{
+    if (p->queue_capacity >= IMPAIR_QUEUE_MAX) {
+        return 0;
+    }
+
+    size_t capacity = p->queue_capacity * 2;
+    impaired_packet_t *queue = malloc(sizeof(impaired_packet_t) * capacity);
+    if (!queue) {
+        return 0;
+    }
+
+    // Unwrap the ring so the new one starts at the head
+    for (size_t i = 0; i < p->queue_count; i++) {
+        impaired_packet_t *from = &p->queue[(p->queue_head + i) % p->queue_capacity];
+        queue[i].release = from->release;
+        queue[i].size = from->size;
+        memcpy(queue[i].data, from->data, from->size);
+    }
+
+    free(p->queue);
+    p->queue = queue;
+    p->queue_capacity = capacity;
+    p->queue_head = 0;
+
+    VLOG_INFO(VANILLA_LOG_NETWORK, "IMPAIR %s: queue grown to %zu packets", p->name, capacity);
+
+    return 1;
+}
+
+static void enqueue_packet(impair_port_t *p, const impaired_packet_t *pkt, uint64_t release)
+{
+    if (p->queue_count == p->queue_capacity && !grow_queue(p)) {
+        p->overflowed++;
+        return;
+    }
+
+    impaired_packet_t *slot = &p->queue[(p->queue_head + p->queue_count) % p->queue_capacity];
+    slot->release = release;
+    slot->size = pkt->size;
+    memcpy(slot->data, pkt->data, pkt->size);
+    p->queue_count++;
+}
+
+static void release_held_packet(impair_port_t *p, uint64_t release)
+{
+    for (int i = 0; i < p->held_copies; i++) {
+        enqueue_packet(p, p->held, release);
+    }
+    p->held_copies = 0;
+}
+
+static void impair_packet(impair_port_t *p, impaired_packet_t *pkt, uint64_t now)
+{
+    const vanilla_impairment_t *c = &impair_active;
+
+    p->received++;
+
+    // Gilbert-Elliott: the good state loses `loss`, the bad state `burst_loss`.
+    // With no bad state configured, this is plain Bernoulli loss.
+    if (c->burst_enter > 0) {
+        if (p->bad_state) {
+            if (random_float(p) < c->burst_exit) {
+                p->bad_state = 0;
+            }
+        } else if (random_float(p) < c->burst_enter) {
+            p->bad_state = 1;
+        }
+    }
+
+    float loss = p->bad_state ? c->burst_loss : c->loss;
+    if (loss > 0 && random_float(p) < loss) {
+        p->lost++;
+        if (p->bad_state) {
+            p->burst_lost++;
+        }
+        return;
+    }
+
+    int64_t delay = (int64_t) c->delay_us * 1000;
+    if (c->jitter_us) {
+        int64_t jitter = (int64_t) c->jitter_us * 1000;
+        delay += (int64_t) (next_random(p) % (uint64_t) (jitter * 2 + 1)) - jitter;
+    }
+    if (delay < 0) {
+        delay = 0;
+    }
+
+    // Jitter alone never reorders, that's what `reorder` is for
+    uint64_t release = MAX(now + delay, p->last_release);
+
+    int copies = 1;
+    if (c->duplicate > 0 && random_float(p) < c->duplicate) {
+        copies++;
+        p->duplicated++;
+    }
+
+    if (!p->held_copies && c->reorder > 0 && random_float(p) < c->reorder) {
+        memcpy(p->held, pkt, sizeof(*pkt));
+        p->held_copies = copies;
+        p->held_deadline = release + IMPAIR_REORDER_WINDOW_NS;
+        p->reordered++;
+        return;
+    }
+
+    for (int i = 0; i < copies; i++) {
+        enqueue_packet(p, pkt, release);
+    }
+    p->total_delay += release - now;
+    p->last_release = release;
+
+    release_held_packet(p, release);
+}
+
+static void report_stats(impair_port_t *p, uint64_t now)
+{
+    if (now - p->last_report < IMPAIR_REPORT_INTERVAL_NS) {
+        return;
+    }
+
+    if (p->received) {
+        size_t passed = p->received - p->lost;
+        VLOG_INFO(VANILLA_LOG_NETWORK, "IMPAIR %s: %llu received, %llu lost (%llu in bursts), %llu reordered, %llu duplicated, %llu overflowed, avg delay %.2fms",
+                    p->name,
+                    (unsigned long long) p->received, (unsigned long long) p->lost, (unsigned long long) p->burst_lost,
+                    (unsigned long long) p->reordered, (unsigned long long) p->duplicated, (unsigned long long) p->overflowed,
+                    passed ? p->total_delay / (double) passed / 1000000.0 : 0.0);
+    }
+
+    p->received = p->lost = p->burst_lost = p->reordered = 0;
+    p->duplicated = p->overflowed = p->total_delay = 0;
+    p->last_report = now;
+}
+
+ssize_t impair_recv(int fd, void *data, size_t data_size, uint16_t port)
+{
+    impair_port_t *p = get_port(port);
+
+    while (!is_interrupted()) {
+        uint64_t now = get_monotonic_nanos();
+
+        report_stats(p, now);
+
+        if (p->held_copies && p->held_deadline <= now) {
+            // Nothing followed the held packet in time, so stop holding it
+            release_held_packet(p, MAX(now, p->last_release));
+        }
+
+        if (p->queue_count && p->queue[p->queue_head].release <= now) {
+            impaired_packet_t *next = &p->queue[p->queue_head];
+            size_t size = MIN(next->size, data_size);
+            memcpy(data, next->data, size);
+            p->queue_head = (p->queue_head + 1) % p->queue_capacity;
+            p->queue_count--;
+            return size;
+        }
+
+        if (p->queue_count || p->held_copies) {
+            // Wait for a new packet, or until the next release or the held
+            // packet is due
+            uint64_t due = p->queue_count ? p->queue[p->queue_head].release : UINT64_MAX;
+            if (p->held_copies) {
+                due = MIN(due, p->held_deadline);
+            }
+
+            uint64_t wait = due - now;
+            struct timeval tv;
+            tv.tv_sec = wait / 1000000000ULL;
+            tv.tv_usec = (wait % 1000000000ULL) / 1000;
+
+            fd_set fds;
+            FD_ZERO(&fds);
+            FD_SET(fd, &fds);
+            if (select(fd + 1, &fds, NULL, NULL, &tv) <= 0) {
+                continue;
+            }
+        }
+
+        ssize_t size = recv(fd, (void *) p->scratch->data, MIN(data_size, IMPAIR_PACKET_SIZE), 0);
+        if (size <= 0) {
+            if (p->queue_count || p->held_copies) {
+                continue;
+            }
+
+            return size;
+        }
+
+        // Captures record what actually arrived, before any impairment
+        capture_packet(port, p->scratch->data, size);
+
+        p->scratch->size = size;
+        impair_packet(p, p->scratch, get_monotonic_nanos());
+    }
+
+    return -1;
+}
@@ -0,0 +1,16 @@
+#ifndef GAMEPAD_IMPAIR_H
+#define GAMEPAD_IMPAIR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "vanilla.h"
+
+void set_impairment(const vanilla_impairment_t *config);
+int impair_open();
+void impair_close();
+int impair_is_active(uint16_t port);
+ssize_t impair_recv(int fd, void *data, size_t data_size, uint16_t port);
+
+#endif // GAMEPAD_IMPAIR_H
@@ -4,20 +4,30 @@
 #include <winsock2.h>
 #else
 #include <arpa/inet.h>
+#include <sched.h>
 #endif
 
 #include <math.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "gamepad.h"
 #include "vanilla.h"
 #include "util.h"
 
-#define TOUCHSCREEN_POINTS 10
+#define TOUCHSCREEN_POINTS VANILLA_MAX_TOUCH_POINTS
+
+// Roughly 180Hz, same as the original gamepad
+#define INPUT_INTERVAL_NS (1000000000ULL / 180)
+
+// In eager mode, never send packets closer together than this (at most twice
+// the regular rate) so bursts of changes can't flood the console
+#define INPUT_EAGER_MIN_INTERVAL_NS (INPUT_INTERVAL_NS / 2)
 
 #pragma pack(push, 1)
 
@@ -39,17 +49,6 @@ typedef struct {
     signed char unknown[6];
 } InputPacketMagnet;
 
-typedef struct {
-    uint16_t pad;
-    uint16_t extra;
-    uint16_t value;
-} TouchCoord;
-
-typedef struct {
-    TouchCoord x;
-    TouchCoord y;
-} TouchPoint;
-
 typedef struct {
     int16_t x;
     int16_t y;
@@ -60,11 +59,6 @@ typedef struct {
     TouchPointPacked points[TOUCHSCREEN_POINTS];
 } TouchScreenState;
 
-pthread_mutex_t button_mtx;
-int32_t current_buttons[VANILLA_BTN_COUNT] = {0};
-int current_touch_x = -1;
-int current_touch_y = -1;
-
 typedef struct {
     // Big endian
     uint16_t seq_id;
@@ -88,19 +82,245 @@ typedef struct {
 
 #pragma pack(pop)
 
+_Static_assert(sizeof(InputPacket) == INPUT_PACKET_SIZE, "Input packets are 128 bytes");
+_Static_assert(sizeof(TouchPointPacked) == sizeof(uint32_t), "Packed touch points are stored as 32-bit words");
+
+typedef struct {
+    int32_t buttons[VANILLA_BTN_COUNT];
+    uint32_t touchscreen[TOUCHSCREEN_POINTS];
+    uint16_t battery;
+} input_state_t;
+
+// Input state shared between the frontend's threads and the input thread.
+//
+// This is a seqlock: writers make `input_seq` odd while they update the
+// state and even again when done, and the input thread retries its copy if
+// the sequence was odd or changed underneath it. Writers only ever wait on
+// each other (for the few nanoseconds it takes to store a value), never on
+// the input thread, so a high-rate sensor thread can't be held up by a
+// packet being built. Anyone who keeps finding the sequence odd yields after
+// a short spin, in case the writer holding it was preempted (on a single core
+// it can't finish until it's scheduled again).
+//
+// Touch points and battery status are stored already packed into their
+// TouchScreenState form, so they're only packed once per change rather than
+// on every tick.
+static _Atomic uint32_t input_seq = 0;
+static struct {
+    _Atomic int32_t buttons[VANILLA_BTN_COUNT];
+    _Atomic uint32_t touchscreen[TOUCHSCREEN_POINTS];
+    _Atomic uint16_t battery; // Bits to OR into the last touch point's X coordinate
+} shared_input = {0};
+
+#define INPUT_SPIN_LIMIT 64
+
+static void input_backoff(int *spins)
+{
+    if (++(*spins) < INPUT_SPIN_LIMIT) {
+        return;
+    }
+    *spins = 0;
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+static void begin_input_write()
+{
+    int spins = 0;
+    uint32_t seq = atomic_load_explicit(&input_seq, memory_order_relaxed);
+    while (1) {
+        if (!(seq & 1) && atomic_compare_exchange_weak_explicit(&input_seq, &seq, seq + 1, memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
+        input_backoff(&spins);
+        seq = atomic_load_explicit(&input_seq, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release);
+}
+
+static void end_input_write()
+{
+    atomic_fetch_add_explicit(&input_seq, 1, memory_order_release);
+}
+
+static void read_input_state(input_state_t *state)
+{
+    int spins = 0;
+    uint32_t seq;
+    while (1) {
+        seq = atomic_load_explicit(&input_seq, memory_order_acquire);
+        if (seq & 1) {
+            input_backoff(&spins);
+            continue;
+        }
+
+        for (int i = 0; i < VANILLA_BTN_COUNT; i++) {
+            state->buttons[i] = atomic_load_explicit(&shared_input.buttons[i], memory_order_relaxed);
+        }
+        for (int i = 0; i < TOUCHSCREEN_POINTS; i++) {
+            state->touchscreen[i] = atomic_load_explicit(&shared_input.touchscreen[i], memory_order_relaxed);
+        }
+        state->battery = atomic_load_explicit(&shared_input.battery, memory_order_relaxed);
+
+        atomic_thread_fence(memory_order_acquire);
+        if (seq == atomic_load_explicit(&input_seq, memory_order_relaxed)) {
+            break;
+        }
+        input_backoff(&spins);
+    }
+}
+
+static int eager_input = 0;
+static int input_changed = 0;
+static pthread_mutex_t input_wake_mtx;
+static pthread_cond_t input_wake_cond;
+static pthread_once_t input_wake_once = PTHREAD_ONCE_INIT;
+
+static void init_input_wake()
+{
+    pthread_mutex_init(&input_wake_mtx, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#ifndef __APPLE__
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+    pthread_cond_init(&input_wake_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+void set_eager_input(int enabled)
+{
+    pthread_once(&input_wake_once, init_input_wake);
+
+    pthread_mutex_lock(&input_wake_mtx);
+    eager_input = enabled;
+    input_changed = 0;
+    pthread_mutex_unlock(&input_wake_mtx);
+}
+
+static void notify_input_changed()
+{
+    pthread_once(&input_wake_once, init_input_wake);
+
+    pthread_mutex_lock(&input_wake_mtx);
+    if (eager_input) {
+        input_changed = 1;
+        pthread_cond_signal(&input_wake_cond);
+    }
+    pthread_mutex_unlock(&input_wake_mtx);
+}
+
+// Sleeps until `deadline` or until the input state changes in eager mode,
+// returns non-zero if woken early by a change
+static int wait_for_input_deadline(uint64_t deadline)
+{
+    pthread_mutex_lock(&input_wake_mtx);
+
+    if (!eager_input) {
+        pthread_mutex_unlock(&input_wake_mtx);
+        sleep_until_nanos(deadline);
+        return 0;
+    }
+
+    while (!input_changed) {
+        uint64_t now = get_monotonic_nanos();
+        if (now >= deadline) {
+            break;
+        }
+
+        struct timespec spec;
+#ifdef __APPLE__
+        // No monotonic condition variables, convert to a wall clock deadline
+        clock_gettime(CLOCK_REALTIME, &spec);
+        uint64_t abs = (uint64_t) spec.tv_sec * 1000000000ULL + spec.tv_nsec + (deadline - now);
+#else
+        uint64_t abs = deadline;
+#endif
+        spec.tv_sec = abs / 1000000000ULL;
+        spec.tv_nsec = abs % 1000000000ULL;
+        pthread_cond_timedwait(&input_wake_cond, &input_wake_mtx, &spec);
+    }
+
+    int woken = input_changed;
+    input_changed = 0;
+
+    pthread_mutex_unlock(&input_wake_mtx);
+
+    return woken;
+}
+
 void set_button_state(int button, int32_t value)
 {
-    pthread_mutex_lock(&button_mtx);
-    current_buttons[button] = value;
-    pthread_mutex_unlock(&button_mtx);
+    begin_input_write();
+    int changed = atomic_exchange_explicit(&shared_input.buttons[button], value, memory_order_relaxed) != value;
+    end_input_write();
+
+    if (changed) {
+        notify_input_changed();
+    }
+}
+
+static void pack_touchscreen(const vanilla_touch_t *points, size_t count, uint32_t out[TOUCHSCREEN_POINTS]);
+static uint16_t pack_battery_status(int status);
+
+static int store_touchscreen(const uint32_t touchscreen[TOUCHSCREEN_POINTS])
+{
+    int changed = 0;
+    for (int i = 0; i < TOUCHSCREEN_POINTS; i++) {
+        changed |= atomic_exchange_explicit(&shared_input.touchscreen[i], touchscreen[i], memory_order_relaxed) != touchscreen[i];
+    }
+    return changed;
+}
+
+_Static_assert(VANILLA_BTN_COUNT < 63, "Input mask can't represent every button");
+
+void set_input_state(const vanilla_input_state_t *state, uint64_t mask)
+{
+    int changed = 0;
+
+    uint32_t touchscreen[TOUCHSCREEN_POINTS];
+    if (mask & VANILLA_INPUT_MASK_TOUCH) {
+        pack_touchscreen(state->touches, state->touch_count, touchscreen);
+    }
+
+    begin_input_write();
+    for (int i = 0; i < VANILLA_BTN_COUNT; i++) {
+        if (mask & VANILLA_INPUT_MASK(i)) {
+            changed |= atomic_exchange_explicit(&shared_input.buttons[i], state->buttons[i], memory_order_relaxed) != state->buttons[i];
+        }
+    }
+    if (mask & VANILLA_INPUT_MASK_TOUCH) {
+        changed |= store_touchscreen(touchscreen);
+    }
+    end_input_write();
+
+    if (changed) {
+        notify_input_changed();
+    }
+}
+
+void set_touches(const vanilla_touch_t *points, size_t count)
+{
+    uint32_t touchscreen[TOUCHSCREEN_POINTS];
+    pack_touchscreen(points, count, touchscreen);
+
+    begin_input_write();
+    int changed = store_touchscreen(touchscreen);
+    end_input_write();
+
+    if (changed) {
+        notify_input_changed();
+    }
 }
 
 void set_touch_state(int x, int y)
 {
-    pthread_mutex_lock(&button_mtx);
-    current_touch_x = x;
-    current_touch_y = y;
-    pthread_mutex_unlock(&button_mtx);
+    vanilla_touch_t point = {x, y};
+    set_touches(&point, 1);
 }
 
 static inline void int32_to_s24_le(uint8_t out[3], int32_t v)
@@ -131,11 +351,6 @@ static inline void pack_gyroscope(InputPacketGyroscope *gyro, int32_t yaw, int32
     int32_to_s24_le(gyro->roll, roll);
 }
 
-static inline uint16_t pack_touchcoord(TouchCoord *unpacked)
-{
-    return ((uint16_t) ((unpacked->pad & 0x1u) | ((unpacked->extra & 0x7u) << 1) | ((unpacked->value & 0xFFFu) << 4)));
-}
-
 uint16_t resolve_axis_value(float axis, float neg, float pos, int flip)
 {
     float val = axis < 0 ? axis / 32768.0f : axis / 32767.0f;
@@ -192,51 +407,78 @@ float unpack_float(int32_t x)
     return f;
 }
 
-int current_battery_status = VANILLA_BATTERY_STATUS_CHARGING;
-void set_battery_status(int status)
+static uint16_t encode_touch_coord(int pad, int extra, int value)
 {
-    pthread_mutex_lock(&button_mtx);
-    current_battery_status = status;
-    pthread_mutex_unlock(&button_mtx);
+    // pad:1 extra:3 value:12, most significant bit first, stored little endian
+    uint16_t word = ((pad & 0x1) << 15) | ((extra & 0x7) << 12) | (value & 0xFFF);
+    uint8_t bytes[2] = {word & 0xFF, word >> 8};
+
+    uint16_t packed;
+    memcpy(&packed, bytes, sizeof(packed));
+    return packed;
 }
 
-void send_input(int socket_hid, const sockaddr_u *addr, size_t addr_size)
+// The GamePad's screen is resistive, so the console averages the ten slots as
+// samples of a single touch. Every slot gets the primary (first valid) point,
+// anything else would read as a phantom point between two fingers.
+static void pack_touchscreen(const vanilla_touch_t *points, size_t count, uint32_t out[TOUCHSCREEN_POINTS])
 {
-    InputPacket ip;
-    memset(&ip, 0, sizeof(ip));
-
-    static uint16_t seq_id = 0;
+    const vanilla_touch_t *p = NULL;
+    for (size_t i = 0; i < count; i++) {
+        if (points[i].x >= 0 && points[i].y >= 0) {
+            p = &points[i];
+            break;
+        }
+    }
 
-    pthread_mutex_lock(&button_mtx);
+    TouchPointPacked packed[TOUCHSCREEN_POINTS];
+    memset(packed, 0, sizeof(packed));
 
-    TouchPoint touchscreen[TOUCHSCREEN_POINTS];
-    memset(touchscreen, 0, sizeof(touchscreen));
-    touchscreen[9].x.extra = reverse_bits(current_battery_status, 3);
+    if (p) {
+        for (int i = 0; i < TOUCHSCREEN_POINTS; i++) {
+            int extra_x = (i == 1) ? 7 : 0;
+            int extra_y = (i == 0) ? 2 : ((i == 1) ? 3 : 0);
 
-    if (current_touch_x >= 0 && current_touch_y >= 0) {
-        for (int i = 0; i < 10; i++) {
-            touchscreen[i].x.pad = 1;
-            touchscreen[i].y.pad = 1;
-            touchscreen[i].x.value = reverse_bits(scale_x_touch_value(current_touch_x), 12);
-            touchscreen[i].y.value = reverse_bits(scale_y_touch_value(current_touch_y), 12);
+            packed[i].x = encode_touch_coord(1, extra_x, scale_x_touch_value(p->x));
+            packed[i].y = encode_touch_coord(1, extra_y, scale_y_touch_value(p->y));
         }
-
-        touchscreen[0].y.extra = reverse_bits(2, 3);
-        touchscreen[1].x.extra = reverse_bits(7, 3);
-        touchscreen[1].y.extra = reverse_bits(3, 3);
     }
 
-    for (int i = 0; i < TOUCHSCREEN_POINTS; i++) {
-        ip.touchscreen.points[i].x = pack_touchcoord(&touchscreen[i].x);
-        ip.touchscreen.points[i].y = pack_touchcoord(&touchscreen[i].y);
-    }
+    memcpy(out, packed, sizeof(packed));
+}
 
-    unsigned char *touchscreen_bytes = (unsigned char *)(&ip.touchscreen);
-    for (int byte = 0; byte < sizeof(ip.touchscreen); byte += 2) {
-        unsigned char first = (unsigned char)reverse_bits(touchscreen_bytes[byte], 8);
-        touchscreen_bytes[byte] = (unsigned char)reverse_bits(touchscreen_bytes[byte + 1], 8);
-        touchscreen_bytes[byte + 1] = first;
+static uint16_t pack_battery_status(int status)
+{
+    return encode_touch_coord(0, status, 0);
+}
+
+void set_battery_status(int status)
+{
+    uint16_t battery = pack_battery_status(status);
+
+    begin_input_write();
+    int changed = atomic_exchange_explicit(&shared_input.battery, battery, memory_order_relaxed) != battery;
+    end_input_write();
+
+    if (changed) {
+        notify_input_changed();
     }
+}
+
+size_t build_input_packet(void *data, uint16_t seq_id)
+{
+    InputPacket ip;
+    memset(&ip, 0, sizeof(ip));
+
+    // Take a consistent copy and build the packet from it without holding anything
+    input_state_t state;
+    read_input_state(&state);
+    const int32_t *current_buttons = state.buttons;
+
+    // Touch points were packed when they were set, only the battery status
+    // (which shares the last point) needs merging in
+    memcpy(&ip.touchscreen, state.touchscreen, sizeof(ip.touchscreen));
+    ip.touchscreen.points[TOUCHSCREEN_POINTS - 1].x |= state.battery;
 
     uint16_t button_mask = 0;
 
@@ -282,32 +524,106 @@ void send_input(int socket_hid, const sockaddr_u *addr, size_t addr_size)
     int32_t roll = (unpack_float(current_buttons[VANILLA_SENSOR_GYRO_ROLL]) * (180.0f/M_PI)) / ((200.0f * 6.0f) / 154000.0f);
     pack_gyroscope(&ip.gyroscope, yaw, pitch, roll);
 
-    pthread_mutex_unlock(&button_mtx);
-
     ip.seq_id = htons(seq_id);
-    seq_id++;
 
     ip.fw_version_neg = 215;
 
-    send_to_sockaddr(socket_hid, &ip, sizeof(ip), addr, addr_size);
+    memcpy(data, &ip, sizeof(ip));
+    return sizeof(ip);
+}
+
+void send_input(int socket_hid, const sockaddr_u *addr, size_t addr_size)
+{
+    static uint16_t seq_id = 0;
+
+    InputPacket ip;
+    size_t size = build_input_packet(&ip, seq_id);
+    seq_id++;
+
+    send_to_sockaddr(socket_hid, &ip, size, addr, addr_size);
+}
+
+static pthread_mutex_t input_stats_mtx = PTHREAD_MUTEX_INITIALIZER;
+static vanilla_input_stats_t input_stats;
+
+static void record_input_interval(uint64_t interval_ns)
+{
+    uint32_t us = interval_ns / 1000;
+
+    pthread_mutex_lock(&input_stats_mtx);
+    if (input_stats.count == 0 || us < input_stats.min_us) input_stats.min_us = us;
+    if (us > input_stats.max_us) input_stats.max_us = us;
+    input_stats.total_us += us;
+    input_stats.count++;
+    input_stats.buckets[MIN(us / VANILLA_INPUT_HISTOGRAM_BUCKET_US, VANILLA_INPUT_HISTOGRAM_BUCKETS - 1)]++;
+    pthread_mutex_unlock(&input_stats_mtx);
+}
+
+static void record_missed_deadline()
+{
+    pthread_mutex_lock(&input_stats_mtx);
+    input_stats.missed_deadlines++;
+    pthread_mutex_unlock(&input_stats_mtx);
+}
+
+void get_input_stats(vanilla_input_stats_t *stats)
+{
+    pthread_mutex_lock(&input_stats_mtx);
+    memcpy(stats, &input_stats, sizeof(vanilla_input_stats_t));
+    pthread_mutex_unlock(&input_stats_mtx);
+}
+
+void reset_input_stats()
+{
+    pthread_mutex_lock(&input_stats_mtx);
+    memset(&input_stats, 0, sizeof(input_stats));
+    pthread_mutex_unlock(&input_stats_mtx);
 }
 
 void *listen_input(void *x)
 {
     gamepad_context_t *info = (gamepad_context_t *) x;
 
-    pthread_mutex_init(&button_mtx, NULL);
-
     sockaddr_u addr;
     size_t addr_size;
     create_server_sockaddr(&addr, &addr_size, PORT_HID - 100, 0);
 
+    reset_input_stats();
+
+    pthread_once(&input_wake_once, init_input_wake);
+
+    uint64_t last_send = 0;
+    uint64_t deadline = get_monotonic_nanos();
+
     do {
+        uint64_t now = get_monotonic_nanos();
+        if (last_send) {
+            record_input_interval(now - last_send);
+        }
+        last_send = now;
+
         send_input(info->socket_hid, &addr, addr_size);
-        usleep(5555); // Roughly 180Hz, same as the original gamepad
-    } while (!is_interrupted());
 
-    pthread_mutex_destroy(&button_mtx);
+        // Advance along a fixed schedule rather than sleeping a fixed amount
+        // after each send, so the time spent packing and sending doesn't
+        // accumulate as drift.
+        deadline += INPUT_INTERVAL_NS;
+
+        now = get_monotonic_nanos();
+        if (now > deadline + INPUT_INTERVAL_NS) {
+            // We fell more than a whole period behind (e.g. the thread was
+            // descheduled). Re-align instead of bursting packets to catch up.
+            record_missed_deadline();
+            deadline = now;
+        }
+
+        if (wait_for_input_deadline(deadline)) {
+            // Input changed in eager mode, send it now (respecting the rate
+            // limit) and restart the regular schedule from this packet
+            sleep_until_nanos(last_send + INPUT_EAGER_MIN_INTERVAL_NS);
+            deadline = get_monotonic_nanos();
+        }
+    } while (!is_interrupted());
 
     pthread_exit(NULL);
 
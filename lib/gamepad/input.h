@@ -1,11 +1,22 @@
 #ifndef GAMEPAD_INPUT_H
 #define GAMEPAD_INPUT_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "vanilla.h"
+
+#define INPUT_PACKET_SIZE 128
+
 void *listen_input(void *x);
+size_t build_input_packet(void *data, uint16_t seq_id);
 void set_button_state(int button, int32_t value);
 void set_touch_state(int x, int y);
+void set_touches(const vanilla_touch_t *points, size_t count);
+void set_input_state(const vanilla_input_state_t *state, uint64_t mask);
 void set_battery_status(int status);
+void set_eager_input(int enabled);
+void get_input_stats(vanilla_input_stats_t *stats);
+void reset_input_stats();
 
 #endif // GAMEPAD_INPUT_H
\ No newline at end of file
@@ -0,0 +1,146 @@
+#ifndef GAMEPAD_PACKET_H
+#define GAMEPAD_PACKET_H
+
+#include <stdint.h>
+
+//
+// The gamepad's packet headers are packed most significant bit first, which
+// is the opposite of how GCC and Clang lay out bitfields on little endian
+// machines. Rather than bit-reversing headers into (and out of) a bitfield
+// struct, these read and write each field from big endian words, so the
+// layout doesn't depend on the compiler and no bit reversal is needed.
+//
+
+#define VIDEO_HEADER_SIZE 8
+#define AUDIO_HEADER_SIZE 8
+
+typedef struct
+{
+    uint8_t magic;
+    uint8_t packet_type;
+    uint16_t seq_id;
+    uint8_t init;
+    uint8_t frame_begin;
+    uint8_t chunk_end;
+    uint8_t frame_end;
+    uint8_t has_timestamp;
+    uint16_t payload_size;
+    uint32_t timestamp;
+} VideoHeader;
+
+typedef struct
+{
+    uint8_t header[VIDEO_HEADER_SIZE]; // See decode_video_header()
+    uint8_t extended_header[8];
+    uint8_t payload[2048];
+} VideoPacket;
+
+typedef struct
+{
+    uint8_t format;
+    uint8_t mono;
+    uint8_t vibrate;
+    uint8_t type;
+    uint16_t seq_id;
+    uint16_t payload_size;
+    uint32_t timestamp;
+} AudioHeader;
+
+static inline uint16_t read_be16(const uint8_t *in)
+{
+    return (uint16_t) ((in[0] << 8) | in[1]);
+}
+
+static inline uint32_t read_be32(const uint8_t *in)
+{
+    return ((uint32_t) in[0] << 24) | ((uint32_t) in[1] << 16) | ((uint32_t) in[2] << 8) | in[3];
+}
+
+static inline void write_be16(uint8_t *out, uint16_t value)
+{
+    out[0] = value >> 8;
+    out[1] = value;
+}
+
+static inline void write_be32(uint8_t *out, uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+// magic:4 packet_type:2 seq_id:10 init:1 frame_begin:1 chunk_end:1
+// frame_end:1 has_timestamp:1 payload_size:11 timestamp:32
+static inline void decode_video_header(const uint8_t *in, VideoHeader *h)
+{
+    uint32_t w = read_be32(in);
+    h->magic = w >> 28;
+    h->packet_type = (w >> 26) & 0x3;
+    h->seq_id = (w >> 16) & 0x3FF;
+    h->init = (w >> 15) & 1;
+    h->frame_begin = (w >> 14) & 1;
+    h->chunk_end = (w >> 13) & 1;
+    h->frame_end = (w >> 12) & 1;
+    h->has_timestamp = (w >> 11) & 1;
+    h->payload_size = w & 0x7FF;
+    h->timestamp = read_be32(in + 4);
+}
+
+static inline void encode_video_header(const VideoHeader *h, uint8_t *out)
+{
+    uint32_t w = ((uint32_t) (h->magic & 0xF) << 28)
+        | ((uint32_t) (h->packet_type & 0x3) << 26)
+        | ((uint32_t) (h->seq_id & 0x3FF) << 16)
+        | ((uint32_t) (h->init & 1) << 15)
+        | ((uint32_t) (h->frame_begin & 1) << 14)
+        | ((uint32_t) (h->chunk_end & 1) << 13)
+        | ((uint32_t) (h->frame_end & 1) << 12)
+        | ((uint32_t) (h->has_timestamp & 1) << 11)
+        | (h->payload_size & 0x7FF);
+    write_be32(out, w);
+    write_be32(out + 4, h->timestamp);
+}
+
+// For peeking at single fields without decoding the whole header
+static inline int video_header_frame_begin(const uint8_t *in)
+{
+    return (in[2] >> 6) & 1;
+}
+
+static inline int video_header_frame_end(const uint8_t *in)
+{
+    return (in[2] >> 4) & 1;
+}
+
+static inline uint16_t video_header_payload_size(const uint8_t *in)
+{
+    return read_be16(in + 2) & 0x7FF;
+}
+
+// format:3 mono:1 vibrate:1 type:1 seq_id:10 payload_size:16 timestamp:32
+static inline void decode_audio_header(const uint8_t *in, AudioHeader *h)
+{
+    uint16_t w = read_be16(in);
+    h->format = w >> 13;
+    h->mono = (w >> 12) & 1;
+    h->vibrate = (w >> 11) & 1;
+    h->type = (w >> 10) & 1;
+    h->seq_id = w & 0x3FF;
+    h->payload_size = read_be16(in + 2);
+    h->timestamp = read_be32(in + 4);
+}
+
+static inline void encode_audio_header(const AudioHeader *h, uint8_t *out)
+{
+    uint16_t w = ((h->format & 0x7) << 13)
+        | ((h->mono & 1) << 12)
+        | ((h->vibrate & 1) << 11)
+        | ((h->type & 1) << 10)
+        | (h->seq_id & 0x3FF);
+    write_be16(out, w);
+    write_be16(out + 2, h->payload_size);
+    write_be32(out + 4, h->timestamp);
+}
+
+#endif // GAMEPAD_PACKET_H
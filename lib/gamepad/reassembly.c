@@ -0,0 +1,46 @@
+#include "reassembly.h"
+
+#include <string.h>
+
+void video_frame_begin(video_frame_t *frame, uint16_t seq_id)
+{
+    frame->seq = seq_id;
+    frame->seq_end = -1;
+    memset(frame->packets, 0, sizeof(frame->packets));
+}
+
+int video_frame_add(video_frame_t *frame, const VideoHeader *header, VideoPacket *vp, int *missing)
+{
+    frame->packets[header->seq_id] = vp;
+
+    if (header->frame_end)
+        frame->seq_end = header->seq_id;
+
+    if (frame->seq == -1 || frame->seq_end == -1) {
+        return VIDEO_FRAME_PENDING;
+    }
+
+    int current_index = frame->seq;
+    while (1) {
+        if (!frame->packets[current_index]) {
+            if (missing) *missing = current_index;
+            return VIDEO_FRAME_INCOMPLETE;
+        }
+
+        if (current_index == frame->seq_end) {
+            return VIDEO_FRAME_COMPLETE;
+        }
+
+        current_index = video_seq_next(current_index);
+    }
+}
+
+int video_packet_is_idr(const VideoPacket *vp)
+{
+    for (size_t i = 0; i < sizeof(vp->extended_header); i++) {
+        if (vp->extended_header[i] == 0x80) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef GAMEPAD_REASSEMBLY_H
+#define GAMEPAD_REASSEMBLY_H
+
+#include "packet.h"
+
+// Every value a 10-bit seq_id can take
+#define VIDEO_SEQ_COUNT 1024
+
+#define VIDEO_FRAME_PENDING 0
+#define VIDEO_FRAME_COMPLETE 1
+#define VIDEO_FRAME_INCOMPLETE -1
+
+//
+// Tracks which packets of the current video frame have arrived. libvanilla
+// and vanilla-pipe both reassemble frames with this, so they always agree on
+// whether a frame is whole.
+//
+typedef struct
+{
+    VideoPacket *packets[VIDEO_SEQ_COUNT];
+    int seq;
+    int seq_end;
+} video_frame_t;
+
+#define VIDEO_FRAME_INIT {.seq = -1, .seq_end = -1}
+
+// Starts a new frame at the packet with frame_begin set
+void video_frame_begin(video_frame_t *frame, uint16_t seq_id);
+
+// Stores a packet of the current frame. Once the frame_end packet has been
+// seen this returns whether every packet in between has too, setting
+// `missing` to the first seq_id that hasn't if not.
+int video_frame_add(video_frame_t *frame, const VideoHeader *header, VideoPacket *vp, int *missing);
+
+// Whether the packet belongs to an IDR (instantaneous decoder refresh) frame
+int video_packet_is_idr(const VideoPacket *vp);
+
+static inline int video_seq_next(int seq)
+{
+    return (seq + 1) % VIDEO_SEQ_COUNT;
+}
+
+#endif // GAMEPAD_REASSEMBLY_H
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include "video.h"
 
 #ifdef _WIN32
@@ -16,8 +18,13 @@
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "capture.h"
 #include "gamepad.h"
+#include "log.h"
+#include "metrics.h"
+#include "reassembly.h"
 #include "vanilla.h"
+#include "trace.h"
 #include "util.h"
 
 #if defined(_WIN32)
@@ -29,36 +36,29 @@
 #define htobe32(x) OSSwapHostToBigInt32(x)
 #endif // __APPLE__
 
-typedef struct
-{
-    unsigned magic : 4;
-    unsigned packet_type : 2;
-    unsigned seq_id : 10;
-    unsigned init : 1;
-    unsigned frame_begin : 1;
-    unsigned chunk_end : 1;
-    unsigned frame_end : 1;
-    unsigned has_timestamp : 1;
-    unsigned payload_size : 11;
-    unsigned timestamp : 32;
-    uint8_t extended_header[8];
-    uint8_t payload[2048];
-} VideoPacket;
-
-static pthread_mutex_t idr_mutex;
+static pthread_mutex_t idr_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int idr_is_queued = 0;
 
-#define VIDEO_PACKET_QUEUE_MAX 1024
 static VideoPacket video_packet_queue[VIDEO_PACKET_QUEUE_MAX];
+static uint32_t video_packet_frame_ids[VIDEO_PACKET_QUEUE_MAX];
 static size_t video_packet_min = 0;
 static size_t video_packet_max = 0;
 static pthread_mutex_t video_packet_mutex;
 static pthread_cond_t video_packet_cond;
 
+static int metric_frames_complete = -1;
+static int metric_frames_incomplete = -1;
+
 static const uint8_t VANILLA_PPS_PARAMS[] = {
     0x00, 0x00, 0x00, 0x01, 0x68, 0xee, 0x06, 0x0c, 0xe8
 };
 
+void init_video_metrics()
+{
+    metric_frames_complete = metrics_counter("vanilla_video_frames_total{state=\"complete\"}", "Video frames reassembled from console packets");
+    metric_frames_incomplete = metrics_counter("vanilla_video_frames_total{state=\"incomplete\"}", "Video frames reassembled from console packets");
+}
+
 void request_idr()
 {
     pthread_mutex_lock(&idr_mutex);
@@ -70,7 +70,7 @@ void send_idr_request_to_console(int socket_msg)
 {
     // Make an IDR request to the Wii U?
     unsigned char idr_request[] = {1, 0, 0, 0}; // Undocumented
-    vanilla_log("SENDING IDR");
+    VLOG_INFO(VANILLA_LOG_VIDEO, "SENDING IDR");
     send_to_console(socket_msg, idr_request, sizeof(idr_request), PORT_MSG);
 }
 
@@ -147,47 +147,40 @@ static uint8_t *write_slice_nal(int is_idr, int frame_decode_num, uint8_t *out)
     return out;
 }
 
-void handle_video_packet(gamepad_context_t *ctx, VideoPacket *vp)
+uint8_t *write_escaped_payload(uint8_t *out, const uint8_t *data, size_t size)
 {
-    //
-    // === IMPORTANT NOTE! ===
-    //
-    // This for loop skips vp->magic, vp->packet_type, and vp->timestamp to save processing.
-    // If you want those, you'll have to adjust this loop.
-    //
-    uint8_t *data = (uint8_t *) vp;
-    for (size_t i = 0; i < 4; i++) {
-        data[i] = reverse_bits(data[i], 8);
-    }
-
-    // vp->magic = reverse_bits(vp->magic, 4);
-    // vp->packet_type = reverse_bits(vp->packet_type, 2);
-    // vp->timestamp = reverse_bits(vp->timestamp, 32);
-    vp->seq_id = reverse_bits(vp->seq_id, 10);
-    vp->payload_size = reverse_bits(vp->payload_size, 11);
-
-    // Check if packet is IDR (instantaneous decoder refresh)
-    int is_idr = 0;
-    for (int i = 0; i < sizeof(vp->extended_header); i++) {
-        if (vp->extended_header[i] == 0x80) {
-            is_idr = 1;
-            break;
+    // Insert emulation prevention bytes, the two bytes before `out` must
+    // already be part of the NAL unit
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] <= 3 && *(out - 2) == 0 && *(out - 1) == 0) {
+            *out = 3;
+            out++;
         }
+        *out = data[i];
+        out++;
     }
+    return out;
+}
+
+void handle_video_packet(gamepad_context_t *ctx, VideoPacket *vp, uint32_t frame_id)
+{
+    VideoHeader header;
+    decode_video_header(vp->header, &header);
+
+    int is_idr = video_packet_is_idr(vp);
 
     // Check if this is the beginning of the packet
-    static VideoPacket *video_segments[VIDEO_PACKET_QUEUE_MAX];
-    static int video_packet_seq = -1;
-    static int video_packet_seq_end = -1;
+    static video_frame_t frame = VIDEO_FRAME_INIT;
     static int video_complete_frame = 0;
 
 	static uint8_t frame_decode_num = 0;
 
-    if (vp->frame_begin) {
-        video_packet_seq = vp->seq_id;
-        video_packet_seq_end = -1;
+    static uint64_t frame_start = 0;
+
+    if (header.frame_begin) {
+        frame_start = get_monotonic_nanos();
 
-        memset(video_segments, 0, sizeof(video_segments));
+        video_frame_begin(&frame, header.seq_id);
 
 		frame_decode_num++;
 
@@ -206,39 +199,22 @@ void handle_video_packet(gamepad_context_t *ctx, VideoPacket *vp)
     }
     pthread_mutex_unlock(&idr_mutex);
 
-    // vanilla_log("set seq_id %i = %p", vp->seq_id, vp);
-    video_segments[vp->seq_id] = vp;
-
-	if (vp->frame_end)
-        video_packet_seq_end = vp->seq_id;
-
-    if (video_packet_seq != -1 && video_packet_seq_end != -1) {
-        int complete_frame = 1;
-        {
-            int current_index = video_packet_seq;
-            while (1) {
-                if (!video_segments[current_index]) {
-                    complete_frame = 0;
-                    vanilla_log("damn, incomplete frame (missing %i)", current_index);
-                    break;
-                }
-
-                if (current_index == video_packet_seq_end) {
-                    break;
-                }
-
-                current_index = (current_index + 1) % VIDEO_PACKET_QUEUE_MAX;
-            }
-        }
-
-        if (complete_frame) {
+    int missing;
+    int state = video_frame_add(&frame, &header, vp, &missing);
+    if (state != VIDEO_FRAME_PENDING) {
+        if (state == VIDEO_FRAME_INCOMPLETE) {
+            VLOG_WARN(VANILLA_LOG_VIDEO, "damn, incomplete frame (missing %i)", missing);
+            metrics_add(metric_frames_incomplete, 1);
+        } else {
             video_complete_frame = 1;
+            metrics_add(metric_frames_complete, 1);
 
 			// Encapsulate packet data into NAL unit
 			vanilla_event_t *event;
 			int ret = acquire_event(ctx->event_loop, &event);
 
 			event->type = VANILLA_EVENT_VIDEO;
+			event->frame_id = frame_id;
 
 			uint8_t *video_packet = event->data;
 
@@ -268,8 +244,8 @@ void handle_video_packet(gamepad_context_t *ctx, VideoPacket *vp)
                 nals_current = write_slice_nal(is_idr, frame_decode_num, nals_current);
 
 				// Get pointer to first packet's payload
-				int current_index = video_packet_seq;
-				uint8_t *from = video_segments[current_index]->payload;
+				int current_index = frame.seq;
+				uint8_t *from = frame.packets[current_index]->payload;
 
 				memcpy(nals_current, from, 2);
 				nals_current += 2;
@@ -277,24 +253,18 @@ void handle_video_packet(gamepad_context_t *ctx, VideoPacket *vp)
 				// Escape codes
 				int byte = 2;
 				while (1) {
-					uint8_t *data = video_segments[current_index]->payload;
-					size_t pkt_size = video_segments[current_index]->payload_size;
-					while (byte < pkt_size) {
-						if (data[byte] <= 3 && *(nals_current - 2) == 0 && *(nals_current - 1) == 0) {
-							*nals_current = 3;
-							nals_current++;
-						}
-						*nals_current = data[byte];
-						nals_current++;
-						byte++;
+					uint8_t *data = frame.packets[current_index]->payload;
+					size_t pkt_size = video_header_payload_size(frame.packets[current_index]->header);
+					if (byte < pkt_size) {
+						nals_current = write_escaped_payload(nals_current, data + byte, pkt_size - byte);
 					}
 
-					if (current_index == video_packet_seq_end) {
+					if (current_index == frame.seq_end) {
 						break;
 					}
 
 					byte = 0;
-					current_index = (current_index + 1) % VIDEO_PACKET_QUEUE_MAX;
+					current_index = video_seq_next(current_index);
 				}
 
 				event->size = (nals_current - video_packet);
@@ -314,23 +284,23 @@ void handle_video_packet(gamepad_context_t *ctx, VideoPacket *vp)
 				// *(uint32_t*)out = htobe32(slice_header);
 				// out += sizeof(uint32_t);
 
-				int i = video_packet_seq;
+				int i = frame.seq;
 
 				size_t offset = 0;
 				while (1) {
-					uint8_t *data = video_segments[i]->payload;
-					size_t sz = video_segments[i]->payload_size - offset;
+					uint8_t *data = frame.packets[i]->payload;
+					size_t sz = video_header_payload_size(frame.packets[i]->header) - offset;
 
 					memcpy(out, data + offset, sz);
 					out += sz;
 
 					offset = 0;
 
-					if (i == video_packet_seq_end) {
+					if (i == frame.seq_end) {
 						break;
 					}
 
-					i = (i + 1) % VIDEO_PACKET_QUEUE_MAX;
+					i = video_seq_next(i);
 				}
 
 				// Go back and write size
@@ -341,14 +311,14 @@ void handle_video_packet(gamepad_context_t *ctx, VideoPacket *vp)
 
 			// vanilla_log_no_newline("a few bytes from the packet:");
 			// for (size_t i = 0; i < 64; i++) {
-			// 	// vanilla_log_no_newline(" %02x", video_segments[video_packet_seq]->payload[i] & 0xFF);
+			// 	// vanilla_log_no_newline(" %02x", frame.packets[frame.seq]->payload[i] & 0xFF);
 			// 	vanilla_log_no_newline(" %02x", video_packet[i] & 0xFF);
 			// }
 			// vanilla_log_no_newline("\n");
 
 			release_event(ctx->event_loop);
-        } else {
-            // We didn't receive the complete frame so we'll skip it here
+
+			trace_complete("reassemble", frame_id, frame_start);
         }
     }
 }
@@ -362,9 +332,10 @@ void *consume_video_packets(void *data)
     while (!is_interrupted()) {
         while (video_packet_min < video_packet_max) {
             VideoPacket *vp = &video_packet_queue[video_packet_min % VIDEO_PACKET_QUEUE_MAX];
+            uint32_t frame_id = video_packet_frame_ids[video_packet_min % VIDEO_PACKET_QUEUE_MAX];
 
             pthread_mutex_unlock(&video_packet_mutex);
-            handle_video_packet(ctx, vp);
+            handle_video_packet(ctx, vp, frame_id);
             pthread_mutex_lock(&video_packet_mutex);
 
             video_packet_min++;
@@ -392,27 +363,99 @@ size_t generate_h264_header(void *data, size_t size)
     return (uintptr_t) output - (uintptr_t) data;
 }
 
+// Buffers the pipe's video stream so it can be split back into packets
+static uint8_t video_stream_buffer[65536 + 2];
+static size_t video_stream_start = 0;
+static size_t video_stream_end = 0;
+
+// Returns the next packet from the pipe's video stream, 0 if the pipe closed
+// it (or the connection failed), or -1 if nothing arrived in time
+static ssize_t recv_from_video_stream(int fd, VideoPacket *vp)
+{
+    while (1) {
+        size_t available = video_stream_end - video_stream_start;
+        if (available >= 2) {
+            size_t size = read_be16(video_stream_buffer + video_stream_start);
+            if (available >= 2 + size) {
+                const uint8_t *data = video_stream_buffer + video_stream_start + 2;
+                video_stream_start += 2 + size;
+                if (size == 0) {
+                    continue;
+                }
+
+                size = MIN(size, sizeof(VideoPacket));
+                memcpy(vp, data, size);
+                capture_packet(PORT_VID, vp, size);
+                return size;
+            }
+        }
+
+        // Make room for the rest of the packet
+        memmove(video_stream_buffer, video_stream_buffer + video_stream_start, available);
+        video_stream_start = 0;
+        video_stream_end = available;
+
+        ssize_t read_size = recv(fd, video_stream_buffer + video_stream_end, sizeof(video_stream_buffer) - video_stream_end, 0);
+        if (read_size == 0) {
+            return 0;
+        }
+        if (read_size < 0) {
+#ifdef _WIN32
+            return WSAGetLastError() == WSAETIMEDOUT ? -1 : 0;
+#else
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? -1 : 0;
+#endif
+        }
+        video_stream_end += read_size;
+    }
+}
+
 void *listen_video(void *x)
 {
     // Receive video
     gamepad_context_t *info = (gamepad_context_t *) x;
     ssize_t size;
 
-    pthread_mutex_init(&idr_mutex, NULL);
     pthread_mutex_init(&video_packet_mutex, NULL);
     pthread_cond_init(&video_packet_cond, NULL);
 
     pthread_t video_consumer_thread;
     pthread_create(&video_consumer_thread, 0, consume_video_packets, info);
+#ifndef __APPLE__
+    // macOS can only name the calling thread, see connect_as_gamepad_internal()
+    pthread_setname_np(video_consumer_thread, "vanilla-reasm");
+#endif
+
+    // Frames get their trace ID here, and it travels with each packet through
+    // the queue so the reassembly thread uses the same one
+    uint32_t recv_frame_id = 0;
+
+    video_stream_start = 0;
+    video_stream_end = 0;
 
     do {
         VideoPacket *vp = &video_packet_queue[video_packet_max % VIDEO_PACKET_QUEUE_MAX];
-        size = recv(info->socket_vid, (void *) vp, sizeof(VideoPacket), 0);
+        if (info->stream_vid != -1) {
+            size = recv_from_video_stream(info->stream_vid, vp);
+            if (size == 0) {
+                VLOG_WARN(VANILLA_LOG_VIDEO, "LOST VIDEO STREAM FROM PIPE, FALLING BACK TO UDP");
+                close(info->stream_vid);
+                info->stream_vid = -1;
+            }
+        } else {
+            size = recv_from_console(info->socket_vid, (void *) vp, sizeof(VideoPacket), PORT_VID);
+        }
         if (size > 0) {
+            if (video_header_frame_begin(vp->header)) {
+                recv_frame_id++;
+                trace_instant("video_first_packet", recv_frame_id);
+            }
+            video_packet_frame_ids[video_packet_max % VIDEO_PACKET_QUEUE_MAX] = recv_frame_id;
+
             pthread_mutex_lock(&video_packet_mutex);
             video_packet_max++;
             if (video_packet_max == video_packet_min + VIDEO_PACKET_QUEUE_MAX) {
-                vanilla_log("WARNING: ROLLED OVER VIDEO PACKET QUEUE");
+                VLOG_WARN(VANILLA_LOG_VIDEO, "WARNING: ROLLED OVER VIDEO PACKET QUEUE");
             }
             pthread_cond_broadcast(&video_packet_cond);
             pthread_mutex_unlock(&video_packet_mutex);
@@ -428,7 +471,6 @@ void *listen_video(void *x)
 
     pthread_cond_destroy(&video_packet_cond);
     pthread_mutex_destroy(&video_packet_mutex);
-    pthread_mutex_destroy(&idr_mutex);
 
     pthread_exit(NULL);
 
@@ -4,8 +4,17 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "gamepad.h"
+#include "packet.h"
+
+#define VIDEO_PACKET_QUEUE_MAX 1024
+
 void *listen_video(void *x);
+// `frame_id` is the trace ID the receiving thread gave this packet's frame
+void handle_video_packet(gamepad_context_t *ctx, VideoPacket *vp, uint32_t frame_id);
+uint8_t *write_escaped_payload(uint8_t *out, const uint8_t *data, size_t size);
 void request_idr();
+void init_video_metrics();
 size_t generate_sps_params(void *data, size_t size);
 size_t generate_pps_params(void *data, size_t size);
 size_t generate_h264_header(void *data, size_t size);
@@ -0,0 +1,773 @@
+#define _GNU_SOURCE
+
+#include "log.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "util.h"
+
+// Messages are captured into a fixed ring by any number of threads without
+// locking (a bounded MPSC queue where each slot carries a sequence number), and
+// formatted and written out by a single logging thread. If the ring is full,
+// messages are dropped and counted rather than blocking the caller.
+#define LOG_RING_SIZE 512 // Must be a power of two
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+#define LOG_MAX_ARGS 16
+#define LOG_TEXT_SIZE 864
+#define LOG_LINE_SIZE 2048
+
+// Each callsite may log this many messages per window, the rest are counted
+// and reported with the next message that gets through. Errors and warnings
+// get a much bigger budget, so a burst of failures still shows what failed
+// while a tight failure loop can't flood the ring.
+#define LOG_RATE_LIMIT 10
+#define LOG_RATE_LIMIT_WARN 200
+#define LOG_RATE_WINDOW_NS 1000000000ULL
+
+#define LOG_IDLE_WAIT_NS 50000000L
+#define LOG_FLUSH_TIMEOUT_NS 1000000000ULL
+
+enum {
+    LOG_FLAG_NEWLINE = 1,
+    LOG_FLAG_TEXT = 2,
+};
+
+enum {
+    LOG_LENGTH_NONE,
+    LOG_LENGTH_HH,
+    LOG_LENGTH_H,
+    LOG_LENGTH_L,
+    LOG_LENGTH_LL,
+    LOG_LENGTH_J,
+    LOG_LENGTH_Z,
+    LOG_LENGTH_T,
+    LOG_LENGTH_LONG_DOUBLE,
+};
+
+typedef union
+{
+    long long i;
+    unsigned long long u;
+    double d;
+    const void *p;
+} log_arg_t;
+
+typedef struct
+{
+    // Slot i is free for the producer claiming position `sequence + i`, and
+    // holds a finished record once that becomes `sequence + i + 1`. Storing
+    // it relative to i means the zero-initialized ring starts out valid.
+    _Atomic size_t sequence;
+    const char *format;
+    uint32_t suppressed;
+    uint8_t category;
+    uint8_t level;
+    uint8_t flags;
+    uint8_t arg_count;
+    log_arg_t args[LOG_MAX_ARGS];
+
+    // Strings referenced by arguments are copied in here
+    char text[LOG_TEXT_SIZE];
+} log_record_t;
+
+typedef struct
+{
+    char flags[8];
+    int width;
+    int precision;
+    int width_star;
+    int precision_star;
+    int length;
+    char conversion;
+} log_spec_t;
+
+_Atomic uint8_t log_levels[VANILLA_LOG_CATEGORY_COUNT] = {
+    VANILLA_LOG_LEVEL_INFO,
+    VANILLA_LOG_LEVEL_INFO,
+    VANILLA_LOG_LEVEL_INFO,
+    VANILLA_LOG_LEVEL_INFO,
+    VANILLA_LOG_LEVEL_INFO,
+    VANILLA_LOG_LEVEL_INFO,
+    VANILLA_LOG_LEVEL_INFO,
+};
+
+static const char *log_category_names[VANILLA_LOG_CATEGORY_COUNT] = {
+    "general",
+    "video",
+    "audio",
+    "input",
+    "command",
+    "network",
+    "pipe",
+};
+
+static const char *log_level_names[] = {
+    "error",
+    "warn",
+    "info",
+    "debug",
+    "trace",
+};
+
+static log_record_t log_ring[LOG_RING_SIZE];
+static _Atomic size_t log_enqueue_pos = 0;
+static _Atomic size_t log_written_pos = 0;
+static _Atomic uint32_t log_dropped = 0;
+static _Atomic log_sink_t log_sink = NULL;
+
+static pthread_once_t log_init_once = PTHREAD_ONCE_INIT;
+static _Atomic int log_started = 0;
+static int log_synchronous = 0;
+static pthread_t log_thread;
+static _Atomic int log_thread_waiting = 0;
+static pthread_mutex_t log_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_wait_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t log_synchronous_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t log_now()
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t) spec.tv_sec * 1000000000ULL + spec.tv_nsec;
+}
+
+static int is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Parses the conversion spec after a '%', returning the first character after it
+static const char *parse_spec(const char *p, log_spec_t *spec)
+{
+    memset(spec, 0, sizeof(log_spec_t));
+    spec->width = -1;
+    spec->precision = -1;
+
+    size_t flag_count = 0;
+    while (*p && strchr("-+ #0", *p)) {
+        if (flag_count < sizeof(spec->flags) - 1) {
+            spec->flags[flag_count++] = *p;
+        }
+        p++;
+    }
+
+    if (*p == '*') {
+        spec->width_star = 1;
+        p++;
+    } else if (is_digit(*p)) {
+        spec->width = 0;
+        while (is_digit(*p)) {
+            spec->width = spec->width * 10 + (*p++ - '0');
+        }
+    }
+
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->precision_star = 1;
+            p++;
+        } else {
+            spec->precision = 0;
+            while (is_digit(*p)) {
+                spec->precision = spec->precision * 10 + (*p++ - '0');
+            }
+        }
+    }
+
+    switch (*p) {
+    case 'h':
+        p++;
+        spec->length = LOG_LENGTH_H;
+        if (*p == 'h') {
+            p++;
+            spec->length = LOG_LENGTH_HH;
+        }
+        break;
+    case 'l':
+        p++;
+        spec->length = LOG_LENGTH_L;
+        if (*p == 'l') {
+            p++;
+            spec->length = LOG_LENGTH_LL;
+        }
+        break;
+    case 'j':
+        p++;
+        spec->length = LOG_LENGTH_J;
+        break;
+    case 'z':
+        p++;
+        spec->length = LOG_LENGTH_Z;
+        break;
+    case 't':
+        p++;
+        spec->length = LOG_LENGTH_T;
+        break;
+    case 'L':
+        p++;
+        spec->length = LOG_LENGTH_LONG_DOUBLE;
+        break;
+    }
+
+    spec->conversion = *p;
+    if (*p) {
+        p++;
+    }
+
+    return p;
+}
+
+static int is_value_conversion(char c)
+{
+    return c && strchr("diuxXocspfFeEgGaA", c);
+}
+
+static int spec_arg_count(const log_spec_t *spec)
+{
+    return spec->width_star + spec->precision_star + 1;
+}
+
+static void capture_args(log_record_t *record, const char *format, va_list args)
+{
+    size_t text_used = 0;
+    int n = 0;
+
+    for (const char *p = format; *p; ) {
+        if (*p++ != '%') {
+            continue;
+        }
+
+        log_spec_t spec;
+        p = parse_spec(p, &spec);
+
+        if (spec.conversion == '%') {
+            continue;
+        }
+        if (spec.conversion == 'n') {
+            (void) va_arg(args, void *);
+            continue;
+        }
+
+        if (!is_value_conversion(spec.conversion) || n + spec_arg_count(&spec) > LOG_MAX_ARGS) {
+            // Anything after this point is written out as-is
+            break;
+        }
+
+        int precision = spec.precision;
+        if (spec.width_star) {
+            record->args[n++].i = va_arg(args, int);
+        }
+        if (spec.precision_star) {
+            precision = va_arg(args, int);
+            record->args[n++].i = precision;
+        }
+
+        log_arg_t *v = &record->args[n++];
+
+        switch (spec.conversion) {
+        case 'd':
+        case 'i':
+            switch (spec.length) {
+            case LOG_LENGTH_HH: v->i = (signed char) va_arg(args, int); break;
+            case LOG_LENGTH_H: v->i = (short) va_arg(args, int); break;
+            case LOG_LENGTH_L: v->i = va_arg(args, long); break;
+            case LOG_LENGTH_LL: v->i = va_arg(args, long long); break;
+            case LOG_LENGTH_J: v->i = va_arg(args, intmax_t); break;
+            case LOG_LENGTH_Z:
+            case LOG_LENGTH_T: v->i = va_arg(args, ptrdiff_t); break;
+            default: v->i = va_arg(args, int); break;
+            }
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            switch (spec.length) {
+            case LOG_LENGTH_HH: v->u = (unsigned char) va_arg(args, unsigned int); break;
+            case LOG_LENGTH_H: v->u = (unsigned short) va_arg(args, unsigned int); break;
+            case LOG_LENGTH_L: v->u = va_arg(args, unsigned long); break;
+            case LOG_LENGTH_LL: v->u = va_arg(args, unsigned long long); break;
+            case LOG_LENGTH_J: v->u = va_arg(args, uintmax_t); break;
+            case LOG_LENGTH_Z:
+            case LOG_LENGTH_T: v->u = va_arg(args, size_t); break;
+            default: v->u = va_arg(args, unsigned int); break;
+            }
+            break;
+        case 'c':
+            v->i = va_arg(args, int);
+            break;
+        case 's':
+        {
+            const char *s = va_arg(args, const char *);
+            if (!s) {
+                s = "(null)";
+            }
+
+            size_t available = LOG_TEXT_SIZE - text_used;
+            if (available == 0) {
+                // Point at the terminator of the last string copied
+                v->u = text_used - 1;
+                break;
+            }
+
+            // Strings with a precision needn't be terminated
+            size_t len = strnlen(s, precision >= 0 ? (size_t) precision : available - 1);
+            if (len > available - 1) {
+                len = available - 1;
+            }
+
+            memcpy(record->text + text_used, s, len);
+            record->text[text_used + len] = 0;
+            v->u = text_used;
+            text_used += len + 1;
+            break;
+        }
+        case 'p':
+            v->p = va_arg(args, void *);
+            break;
+        default:
+            // Floating point
+            if (spec.length == LOG_LENGTH_LONG_DOUBLE) {
+                v->d = (double) va_arg(args, long double);
+            } else {
+                v->d = va_arg(args, double);
+            }
+            break;
+        }
+    }
+
+    record->arg_count = n;
+}
+
+static size_t render_record(const log_record_t *record, char *out, size_t size)
+{
+    size_t used = 0;
+
+    if (record->flags & LOG_FLAG_TEXT) {
+        used = strnlen(record->text, MIN(size - 1, LOG_TEXT_SIZE));
+        memcpy(out, record->text, used);
+    } else {
+        int n = 0;
+        const char *p = record->format;
+        while (*p && used < size - 1) {
+            if (*p != '%') {
+                out[used++] = *p++;
+                continue;
+            }
+
+            const char *start = p++;
+            log_spec_t spec;
+            p = parse_spec(p, &spec);
+
+            if (spec.conversion == '%') {
+                out[used++] = '%';
+                continue;
+            }
+            if (spec.conversion == 'n') {
+                continue;
+            }
+            if (!is_value_conversion(spec.conversion) || n + spec_arg_count(&spec) > record->arg_count) {
+                // Arguments weren't captured past here
+                p = start;
+                size_t remaining = strnlen(p, size - 1 - used);
+                memcpy(out + used, p, remaining);
+                used += remaining;
+                break;
+            }
+
+            // Rebuild the spec with any '*' resolved, and integers widened to
+            // match how they were captured
+            int width = spec.width_star ? (int) record->args[n++].i : spec.width;
+            int precision = spec.precision_star ? (int) record->args[n++].i : spec.precision;
+            log_arg_t v = record->args[n++];
+
+            char spec_text[48];
+            size_t spec_len = snprintf(spec_text, sizeof(spec_text), "%%%s", spec.flags);
+            if (spec.width_star || width >= 0) {
+                spec_len += snprintf(spec_text + spec_len, sizeof(spec_text) - spec_len, "%d", width);
+            }
+            if (precision >= 0) {
+                spec_len += snprintf(spec_text + spec_len, sizeof(spec_text) - spec_len, ".%d", precision);
+            }
+            if (strchr("diuxXo", spec.conversion)) {
+                spec_len += snprintf(spec_text + spec_len, sizeof(spec_text) - spec_len, "ll");
+            }
+            snprintf(spec_text + spec_len, sizeof(spec_text) - spec_len, "%c", spec.conversion);
+
+            int written;
+            switch (spec.conversion) {
+            case 'd':
+            case 'i':
+                written = snprintf(out + used, size - used, spec_text, v.i);
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                written = snprintf(out + used, size - used, spec_text, v.u);
+                break;
+            case 'c':
+                written = snprintf(out + used, size - used, spec_text, (int) v.i);
+                break;
+            case 's':
+                written = snprintf(out + used, size - used, spec_text, record->text + v.u);
+                break;
+            case 'p':
+                written = snprintf(out + used, size - used, spec_text, v.p);
+                break;
+            default:
+                written = snprintf(out + used, size - used, spec_text, v.d);
+                break;
+            }
+
+            if (written > 0) {
+                used += MIN((size_t) written, size - 1 - used);
+            }
+        }
+    }
+
+    if (record->suppressed) {
+        int written = snprintf(out + used, size - used, " (%u similar messages suppressed)", record->suppressed);
+        if (written > 0) {
+            used += MIN((size_t) written, size - 1 - used);
+        }
+    }
+
+    out[used] = 0;
+    return used;
+}
+
+static void default_sink(int category, int level, const char *text, int newline)
+{
+    fputs(text, stdout);
+    if (newline) {
+        fputc('\n', stdout);
+    }
+}
+
+static void emit(int category, int level, const char *text, int newline)
+{
+    log_sink_t sink = atomic_load_explicit(&log_sink, memory_order_acquire);
+    if (!sink) {
+        sink = default_sink;
+    }
+    sink(category, level, text, newline);
+}
+
+static void emit_record(const log_record_t *record)
+{
+    char line[LOG_LINE_SIZE];
+    render_record(record, line, sizeof(line));
+    emit(record->category, record->level, line, record->flags & LOG_FLAG_NEWLINE);
+}
+
+static int has_record(size_t pos)
+{
+    log_record_t *record = &log_ring[pos & LOG_RING_MASK];
+    size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire) + (pos & LOG_RING_MASK);
+    return sequence == pos + 1;
+}
+
+static void *log_thread_main(void *arg)
+{
+    size_t pos = 0;
+
+    while (1) {
+        if (!has_record(pos)) {
+            uint32_t dropped = atomic_exchange(&log_dropped, 0);
+            if (dropped) {
+                char line[64];
+                snprintf(line, sizeof(line), "%u log messages dropped", dropped);
+                emit(VANILLA_LOG_GENERAL, VANILLA_LOG_LEVEL_WARN, line, 1);
+            }
+
+            fflush(stdout);
+
+            pthread_mutex_lock(&log_wait_mutex);
+            atomic_store(&log_thread_waiting, 1);
+            if (!has_record(pos)) {
+                // Producers don't take the mutex, so a wakeup can be missed.
+                // The timeout bounds how long that can delay a message.
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_nsec += LOG_IDLE_WAIT_NS;
+                if (deadline.tv_nsec >= 1000000000L) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000L;
+                }
+                pthread_cond_timedwait(&log_wait_cond, &log_wait_mutex, &deadline);
+            }
+            atomic_store(&log_thread_waiting, 0);
+            pthread_mutex_unlock(&log_wait_mutex);
+            continue;
+        }
+
+        log_record_t *record = &log_ring[pos & LOG_RING_MASK];
+        emit_record(record);
+
+        // Hand the slot back to producers for the next lap of the ring
+        atomic_store_explicit(&record->sequence, pos + LOG_RING_SIZE - (pos & LOG_RING_MASK), memory_order_release);
+        pos++;
+        atomic_store_explicit(&log_written_pos, pos, memory_order_release);
+    }
+
+    return NULL;
+}
+
+static void log_start()
+{
+    const char *env = getenv("VANILLA_LOG");
+    if (env && env[0]) {
+        if (log_parse_levels(env) != VANILLA_SUCCESS) {
+            fprintf(stderr, "Invalid VANILLA_LOG, expected e.g. \"info,video=debug,command=trace\"\n");
+        }
+    }
+
+    if (pthread_create(&log_thread, NULL, log_thread_main, NULL) == 0) {
+        pthread_detach(log_thread);
+#ifndef __APPLE__
+        pthread_setname_np(log_thread, "vanilla-log");
+#endif
+        atexit(log_flush);
+    } else {
+        // Still better to log on the calling thread than not at all
+        log_synchronous = 1;
+    }
+
+    atomic_store(&log_started, 1);
+}
+
+void log_init()
+{
+    pthread_once(&log_init_once, log_start);
+}
+
+static int allow_callsite(log_callsite_t *callsite, int level, uint32_t *suppressed)
+{
+    uint64_t now = log_now();
+    uint64_t window_start = atomic_load_explicit(&callsite->window_start, memory_order_relaxed);
+    if (now - window_start >= LOG_RATE_WINDOW_NS) {
+        if (atomic_compare_exchange_strong(&callsite->window_start, &window_start, now)) {
+            atomic_store_explicit(&callsite->count, 0, memory_order_relaxed);
+        }
+    }
+
+    uint32_t limit = (level <= VANILLA_LOG_LEVEL_WARN) ? LOG_RATE_LIMIT_WARN : LOG_RATE_LIMIT;
+    if (atomic_fetch_add_explicit(&callsite->count, 1, memory_order_relaxed) >= limit) {
+        atomic_fetch_add_explicit(&callsite->suppressed, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    *suppressed = atomic_exchange_explicit(&callsite->suppressed, 0, memory_order_relaxed);
+    return 1;
+}
+
+static log_record_t *claim_record(size_t *claimed_pos)
+{
+    size_t pos = atomic_load_explicit(&log_enqueue_pos, memory_order_relaxed);
+    while (1) {
+        log_record_t *record = &log_ring[pos & LOG_RING_MASK];
+        size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire) + (pos & LOG_RING_MASK);
+        ptrdiff_t diff = (ptrdiff_t) (sequence - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&log_enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                *claimed_pos = pos;
+                return record;
+            }
+        } else if (diff < 0) {
+            // The logging thread hasn't caught up with a full lap
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&log_enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+static void commit_record(log_record_t *record, size_t pos)
+{
+    atomic_store_explicit(&record->sequence, pos + 1 - (pos & LOG_RING_MASK), memory_order_release);
+
+    if (atomic_load_explicit(&log_thread_waiting, memory_order_relaxed) && atomic_exchange(&log_thread_waiting, 0)) {
+        pthread_cond_signal(&log_wait_cond);
+    }
+}
+
+static log_record_t *begin_record(int category, int level, uint8_t flags, uint32_t suppressed, log_record_t *synchronous_record, size_t *pos)
+{
+    if (!atomic_load_explicit(&log_started, memory_order_acquire)) {
+        log_init();
+    }
+
+    log_record_t *record;
+    if (log_synchronous) {
+        record = synchronous_record;
+    } else {
+        record = claim_record(pos);
+        if (!record) {
+            atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+            return NULL;
+        }
+    }
+
+    record->category = category;
+    record->level = level;
+    record->flags = flags;
+    record->suppressed = suppressed;
+    return record;
+}
+
+static void end_record(log_record_t *record, size_t pos)
+{
+    if (log_synchronous) {
+        pthread_mutex_lock(&log_synchronous_mutex);
+        emit_record(record);
+        pthread_mutex_unlock(&log_synchronous_mutex);
+    } else {
+        commit_record(record, pos);
+    }
+}
+
+void log_write_va(log_callsite_t *callsite, int category, int level, const char *format, va_list args)
+{
+    uint32_t suppressed = 0;
+    if (callsite && !allow_callsite(callsite, level, &suppressed)) {
+        return;
+    }
+
+    log_record_t synchronous_record;
+    size_t pos;
+    log_record_t *record = begin_record(category, level, LOG_FLAG_NEWLINE, suppressed, &synchronous_record, &pos);
+    if (!record) {
+        return;
+    }
+
+    record->format = format;
+    capture_args(record, format, args);
+
+    end_record(record, pos);
+}
+
+void log_write(log_callsite_t *callsite, int category, int level, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    log_write_va(callsite, category, level, format, args);
+    va_end(args);
+}
+
+void log_write_text(int category, int level, const char *text, int newline)
+{
+    if (!LOG_ENABLED(category, level)) {
+        return;
+    }
+
+    log_record_t synchronous_record;
+    size_t pos;
+    log_record_t *record = begin_record(category, level, LOG_FLAG_TEXT | (newline ? LOG_FLAG_NEWLINE : 0), 0, &synchronous_record, &pos);
+    if (!record) {
+        return;
+    }
+
+    size_t len = strnlen(text, LOG_TEXT_SIZE - 1);
+    memcpy(record->text, text, len);
+    record->text[len] = 0;
+
+    end_record(record, pos);
+}
+
+void log_set_level(int category, int level)
+{
+    if (level < VANILLA_LOG_LEVEL_ERROR) {
+        level = VANILLA_LOG_LEVEL_ERROR;
+    } else if (level > VANILLA_LOG_LEVEL_TRACE) {
+        level = VANILLA_LOG_LEVEL_TRACE;
+    }
+
+    if (category < 0) {
+        for (int i = 0; i < VANILLA_LOG_CATEGORY_COUNT; i++) {
+            atomic_store(&log_levels[i], level);
+        }
+    } else if (category < VANILLA_LOG_CATEGORY_COUNT) {
+        atomic_store(&log_levels[category], level);
+    }
+}
+
+int log_get_level(int category)
+{
+    if (category < 0 || category >= VANILLA_LOG_CATEGORY_COUNT) {
+        return -1;
+    }
+    return atomic_load(&log_levels[category]);
+}
+
+static int find_name(const char *name, size_t len, const char **names, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (strlen(names[i]) == len && !strncasecmp(name, names[i], len)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int log_parse_levels(const char *spec)
+{
+    const char *p = spec;
+    while (*p) {
+        const char *end = strchr(p, ',');
+        if (!end) {
+            end = p + strlen(p);
+        }
+
+        const char *equals = memchr(p, '=', end - p);
+        int category = -1;
+        const char *level_name = p;
+        if (equals) {
+            category = find_name(p, equals - p, log_category_names, VANILLA_LOG_CATEGORY_COUNT);
+            if (category == -1) {
+                return VANILLA_ERR_INVALID_ARGUMENT;
+            }
+            level_name = equals + 1;
+        }
+
+        int level = find_name(level_name, end - level_name, log_level_names, sizeof(log_level_names) / sizeof(log_level_names[0]));
+        if (level == -1) {
+            return VANILLA_ERR_INVALID_ARGUMENT;
+        }
+
+        log_set_level(category, level);
+
+        p = *end ? end + 1 : end;
+    }
+
+    return VANILLA_SUCCESS;
+}
+
+void log_set_sink(log_sink_t sink)
+{
+    atomic_store_explicit(&log_sink, sink, memory_order_release);
+}
+
+void log_flush()
+{
+    if (!atomic_load(&log_started) || log_synchronous || pthread_equal(pthread_self(), log_thread)) {
+        return;
+    }
+
+    size_t target = atomic_load(&log_enqueue_pos);
+    uint64_t deadline = log_now() + LOG_FLUSH_TIMEOUT_NS;
+    while (atomic_load_explicit(&log_written_pos, memory_order_acquire) < target && log_now() < deadline) {
+        pthread_cond_signal(&log_wait_cond);
+
+        struct timespec wait = {0, 1000000};
+        nanosleep(&wait, NULL);
+    }
+
+    fflush(stdout);
+}
@@ -0,0 +1,92 @@
+#ifndef VANILLA_LOG_H
+#define VANILLA_LOG_H
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "vanilla.h"
+
+// Messages above this level are compiled out entirely. Override with e.g.
+// -DVANILLA_LOG_MAX_LEVEL=VANILLA_LOG_LEVEL_INFO to strip debug logging from
+// hot loops in release builds.
+#ifndef VANILLA_LOG_MAX_LEVEL
+#define VANILLA_LOG_MAX_LEVEL VANILLA_LOG_LEVEL_DEBUG
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LOG_PRINTF_FORMAT(fmt_index, arg_index) __attribute__((format(printf, fmt_index, arg_index)))
+// An empty message (e.g. a blank line) is fine to log
+#define LOG_ALLOW_EMPTY_FORMAT_BEGIN _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wformat-zero-length\"")
+#define LOG_ALLOW_EMPTY_FORMAT_END _Pragma("GCC diagnostic pop")
+#else
+#define LOG_PRINTF_FORMAT(fmt_index, arg_index)
+#define LOG_ALLOW_EMPTY_FORMAT_BEGIN
+#define LOG_ALLOW_EMPTY_FORMAT_END
+#endif
+
+// Per-callsite state for rate limiting repeated messages
+typedef struct
+{
+    _Atomic uint64_t window_start;
+    _Atomic uint32_t count;
+    _Atomic uint32_t suppressed;
+} log_callsite_t;
+
+extern _Atomic uint8_t log_levels[VANILLA_LOG_CATEGORY_COUNT];
+
+// A function rather than part of the macro, or every error callsite would warn
+// that comparing 0 with a uint8_t is always true
+static inline int log_level_enabled(int category, int level)
+{
+    return level <= atomic_load_explicit(&log_levels[category], memory_order_relaxed);
+}
+
+#define LOG_ENABLED(category, level) \
+    ((int) (level) <= (int) VANILLA_LOG_MAX_LEVEL && log_level_enabled(category, level))
+
+// `format` must be a string literal. Arguments are captured in binary form and
+// only formatted later on the logging thread, so the caller never blocks on
+// terminal or file I/O.
+#define VLOG(category, level, format, ...) \
+    do { \
+        if (LOG_ENABLED(category, level)) { \
+            static log_callsite_t log_callsite_; \
+            LOG_ALLOW_EMPTY_FORMAT_BEGIN \
+            log_write(&log_callsite_, category, level, "" format "" __VA_OPT__(,) __VA_ARGS__); \
+            LOG_ALLOW_EMPTY_FORMAT_END \
+        } \
+    } while (0)
+
+#define VLOG_ERROR(category, ...)   VLOG(category, VANILLA_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define VLOG_WARN(category, ...)    VLOG(category, VANILLA_LOG_LEVEL_WARN, __VA_ARGS__)
+#define VLOG_INFO(category, ...)    VLOG(category, VANILLA_LOG_LEVEL_INFO, __VA_ARGS__)
+#define VLOG_DEBUG(category, ...)   VLOG(category, VANILLA_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define VLOG_TRACE(category, ...)   VLOG(category, VANILLA_LOG_LEVEL_TRACE, __VA_ARGS__)
+
+// Starts the logging thread and applies levels from VANILLA_LOG. Logging works
+// without calling this, but levels from the environment only apply after it.
+void log_init();
+
+void log_write(log_callsite_t *callsite, int category, int level, const char *format, ...) LOG_PRINTF_FORMAT(4, 5);
+void log_write_va(log_callsite_t *callsite, int category, int level, const char *format, va_list args);
+
+// For text that's already formatted (or whose format isn't a literal). The text
+// is copied, and is written without a trailing newline if `newline` is 0.
+void log_write_text(int category, int level, const char *text, int newline);
+
+void log_set_level(int category, int level);
+int log_get_level(int category);
+
+// Parses a spec like "debug" or "info,video=debug,command=trace"
+int log_parse_levels(const char *spec);
+
+// Receives each formatted message on the logging thread. The default sink
+// writes to stdout.
+typedef void (*log_sink_t)(int category, int level, const char *text, int newline);
+void log_set_sink(log_sink_t sink);
+
+// Blocks until every message logged so far has been written
+void log_flush();
+
+#endif // VANILLA_LOG_H
@@ -0,0 +1,542 @@
+#define _GNU_SOURCE
+
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "log.h"
+#include "util.h"
+#include "vanilla.h"
+
+// Each thread that records a metric claims a shard of slots that only it
+// writes to, so threads never contend on a cache line. Shards of exited
+// threads keep their values and are handed to new threads. Scrapes sum every
+// shard.
+#define METRICS_MAX 128
+#define METRICS_MAX_SLOTS 1024
+#define METRICS_MAX_SHARDS 32
+#define METRICS_MAX_BUCKETS 16
+#define METRICS_NAME_SIZE 128
+#define METRICS_HELP_SIZE 128
+
+enum {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,
+};
+
+enum {
+    METRICS_SHARD_FREE,
+    METRICS_SHARD_ACTIVE,
+};
+
+typedef struct
+{
+    char name[METRICS_NAME_SIZE];
+    char help[METRICS_HELP_SIZE];
+    int type;
+    int slot;
+    size_t bucket_count;
+    double bounds[METRICS_MAX_BUCKETS];
+    _Atomic uint64_t gauge;
+} metric_t;
+
+typedef struct
+{
+    _Atomic int state;
+    _Atomic uint64_t slots[METRICS_MAX_SLOTS];
+} metrics_shard_t;
+
+static metric_t metrics[METRICS_MAX];
+static _Atomic int metric_count = 0;
+static int slot_count = 0;
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// The last shard is shared by any threads beyond METRICS_MAX_SHARDS - 1
+static metrics_shard_t metrics_shards[METRICS_MAX_SHARDS];
+static pthread_key_t metrics_shard_key;
+static pthread_once_t metrics_key_once = PTHREAD_ONCE_INIT;
+
+static int metrics_server_socket = -1;
+static _Atomic int metrics_server_running = 0;
+static pthread_t metrics_server_thread;
+static char metrics_server_path[108];
+
+static uint64_t double_to_bits(double d)
+{
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+static double bits_to_double(uint64_t u)
+{
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+static void release_shard(void *data)
+{
+    metrics_shard_t *shard = (metrics_shard_t *) data;
+    atomic_store(&shard->state, METRICS_SHARD_FREE);
+}
+
+static void init_shard_key()
+{
+    pthread_key_create(&metrics_shard_key, release_shard);
+}
+
+static metrics_shard_t *get_shard()
+{
+    pthread_once(&metrics_key_once, init_shard_key);
+
+    metrics_shard_t *shard = pthread_getspecific(metrics_shard_key);
+    if (shard) {
+        return shard;
+    }
+
+    for (int i = 0; i < METRICS_MAX_SHARDS - 1; i++) {
+        int expected = METRICS_SHARD_FREE;
+        if (atomic_compare_exchange_strong(&metrics_shards[i].state, &expected, METRICS_SHARD_ACTIVE)) {
+            pthread_setspecific(metrics_shard_key, &metrics_shards[i]);
+            return &metrics_shards[i];
+        }
+    }
+
+    return &metrics_shards[METRICS_MAX_SHARDS - 1];
+}
+
+static int register_metric(const char *name, const char *help, int type, const double *bounds, size_t bound_count)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&metrics_mutex);
+
+    int count = atomic_load(&metric_count);
+    for (int i = 0; i < count; i++) {
+        if (!strcmp(metrics[i].name, name)) {
+            ret = (metrics[i].type == type) ? i : -1;
+            goto exit;
+        }
+    }
+
+    // Histograms use one slot per bucket, one for +Inf and one for the sum
+    size_t slots = (type == METRIC_HISTOGRAM) ? bound_count + 2 : 1;
+    if (count == METRICS_MAX || slot_count + slots > METRICS_MAX_SLOTS || bound_count > METRICS_MAX_BUCKETS || strlen(name) >= METRICS_NAME_SIZE) {
+        VLOG_ERROR(VANILLA_LOG_GENERAL, "Failed to register metric %s", name);
+        goto exit;
+    }
+
+    metric_t *m = &metrics[count];
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    snprintf(m->help, sizeof(m->help), "%s", help ? help : "");
+    m->type = type;
+    m->slot = slot_count;
+    m->bucket_count = bound_count;
+    if (bound_count) {
+        memcpy(m->bounds, bounds, bound_count * sizeof(double));
+    }
+    atomic_store(&m->gauge, double_to_bits(0));
+
+    slot_count += slots;
+    atomic_store(&metric_count, count + 1);
+    ret = count;
+
+exit:
+    pthread_mutex_unlock(&metrics_mutex);
+    return ret;
+}
+
+int metrics_counter(const char *name, const char *help)
+{
+    return register_metric(name, help, METRIC_COUNTER, NULL, 0);
+}
+
+int metrics_gauge(const char *name, const char *help)
+{
+    return register_metric(name, help, METRIC_GAUGE, NULL, 0);
+}
+
+int metrics_histogram(const char *name, const char *help, const double *bounds, size_t bound_count)
+{
+    return register_metric(name, help, METRIC_HISTOGRAM, bounds, bound_count);
+}
+
+static int is_valid(int metric, int type)
+{
+    return metric >= 0 && metric < atomic_load_explicit(&metric_count, memory_order_acquire) && metrics[metric].type == type;
+}
+
+void metrics_add(int metric, uint64_t value)
+{
+    if (!is_valid(metric, METRIC_COUNTER)) {
+        return;
+    }
+
+    metrics_shard_t *shard = get_shard();
+    atomic_fetch_add_explicit(&shard->slots[metrics[metric].slot], value, memory_order_relaxed);
+}
+
+void metrics_set(int metric, double value)
+{
+    if (!is_valid(metric, METRIC_GAUGE)) {
+        return;
+    }
+
+    atomic_store_explicit(&metrics[metric].gauge, double_to_bits(value), memory_order_relaxed);
+}
+
+void metrics_observe(int metric, double value)
+{
+    if (!is_valid(metric, METRIC_HISTOGRAM)) {
+        return;
+    }
+
+    const metric_t *m = &metrics[metric];
+    size_t bucket = 0;
+    while (bucket < m->bucket_count && value > m->bounds[bucket]) {
+        bucket++;
+    }
+
+    metrics_shard_t *shard = get_shard();
+    atomic_fetch_add_explicit(&shard->slots[m->slot + bucket], 1, memory_order_relaxed);
+
+    _Atomic uint64_t *sum = &shard->slots[m->slot + m->bucket_count + 1];
+    uint64_t old = atomic_load_explicit(sum, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(sum, &old, double_to_bits(bits_to_double(old) + value), memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static uint64_t sum_slot(int slot)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < METRICS_MAX_SHARDS; i++) {
+        total += atomic_load_explicit(&metrics_shards[i].slots[slot], memory_order_relaxed);
+    }
+    return total;
+}
+
+static double sum_double_slot(int slot)
+{
+    double total = 0;
+    for (int i = 0; i < METRICS_MAX_SHARDS; i++) {
+        total += bits_to_double(atomic_load_explicit(&metrics_shards[i].slots[slot], memory_order_relaxed));
+    }
+    return total;
+}
+
+typedef struct
+{
+    char *buf;
+    size_t size;
+    size_t used;
+} metrics_writer_t;
+
+static void write_text(metrics_writer_t *w, const char *format, ...) LOG_PRINTF_FORMAT(2, 3);
+static void write_text(metrics_writer_t *w, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(w->used < w->size ? w->buf + w->used : NULL, w->used < w->size ? w->size - w->used : 0, format, args);
+    va_end(args);
+
+    if (len > 0) {
+        w->used += len;
+    }
+}
+
+// Splits `name{labels}` into its family name and labels
+static void split_name(const char *name, char *family, size_t family_size, const char **labels, size_t *labels_len)
+{
+    const char *brace = strchr(name, '{');
+    size_t family_len = brace ? (size_t) (brace - name) : strlen(name);
+    snprintf(family, family_size, "%.*s", (int) family_len, name);
+
+    if (brace) {
+        *labels = brace + 1;
+        const char *end = strrchr(brace, '}');
+        *labels_len = end ? (size_t) (end - *labels) : strlen(*labels);
+    } else {
+        *labels = "";
+        *labels_len = 0;
+    }
+}
+
+static const char *type_name(int type)
+{
+    switch (type) {
+    case METRIC_COUNTER: return "counter";
+    case METRIC_GAUGE: return "gauge";
+    default: return "histogram";
+    }
+}
+
+size_t metrics_render(char *buf, size_t size)
+{
+    metrics_writer_t w = {buf, size, 0};
+
+    pthread_mutex_lock(&metrics_mutex);
+
+    int count = atomic_load(&metric_count);
+    for (int i = 0; i < count; i++) {
+        const metric_t *m = &metrics[i];
+
+        char family[METRICS_NAME_SIZE];
+        const char *labels;
+        size_t labels_len;
+        split_name(m->name, family, sizeof(family), &labels, &labels_len);
+
+        // Only describe each family once, even when it has several label sets
+        int described = 0;
+        for (int j = 0; j < i && !described; j++) {
+            char other[METRICS_NAME_SIZE];
+            const char *other_labels;
+            size_t other_labels_len;
+            split_name(metrics[j].name, other, sizeof(other), &other_labels, &other_labels_len);
+            described = !strcmp(family, other);
+        }
+        if (!described) {
+            if (m->help[0]) {
+                write_text(&w, "# HELP %s %s\n", family, m->help);
+            }
+            write_text(&w, "# TYPE %s %s\n", family, type_name(m->type));
+        }
+
+        switch (m->type) {
+        case METRIC_COUNTER:
+            write_text(&w, "%s %llu\n", m->name, (unsigned long long) sum_slot(m->slot));
+            break;
+        case METRIC_GAUGE:
+            write_text(&w, "%s %.9g\n", m->name, bits_to_double(atomic_load_explicit(&m->gauge, memory_order_relaxed)));
+            break;
+        case METRIC_HISTOGRAM:
+        {
+            const char *separator = labels_len ? "," : "";
+            uint64_t cumulative = 0;
+            for (size_t b = 0; b <= m->bucket_count; b++) {
+                cumulative += sum_slot(m->slot + b);
+                if (b < m->bucket_count) {
+                    write_text(&w, "%s_bucket{%.*s%sle=\"%.9g\"} %llu\n", family, (int) labels_len, labels, separator, m->bounds[b], (unsigned long long) cumulative);
+                } else {
+                    write_text(&w, "%s_bucket{%.*s%sle=\"+Inf\"} %llu\n", family, (int) labels_len, labels, separator, (unsigned long long) cumulative);
+                }
+            }
+
+            double sum = sum_double_slot(m->slot + m->bucket_count + 1);
+            if (labels_len) {
+                write_text(&w, "%s_sum{%.*s} %.9g\n", family, (int) labels_len, labels, sum);
+                write_text(&w, "%s_count{%.*s} %llu\n", family, (int) labels_len, labels, (unsigned long long) cumulative);
+            } else {
+                write_text(&w, "%s_sum %.9g\n", family, sum);
+                write_text(&w, "%s_count %llu\n", family, (unsigned long long) cumulative);
+            }
+            break;
+        }
+        }
+    }
+
+    pthread_mutex_unlock(&metrics_mutex);
+
+    return w.used;
+}
+
+#ifdef _WIN32
+
+int metrics_serve(const char *address)
+{
+    VLOG_ERROR(VANILLA_LOG_GENERAL, "Serving metrics is not supported on this platform");
+    return VANILLA_ERR_GENERIC;
+}
+
+void metrics_stop()
+{
+}
+
+#else
+
+static void serve_client(int client)
+{
+    // Scrapers send a single GET, which doesn't need parsing. Just wait for
+    // the end of the request so closing doesn't reset the connection.
+    struct timeval tv = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    char request[2048];
+    size_t request_len = 0;
+    while (request_len < sizeof(request) - 1) {
+        ssize_t r = recv(client, request + request_len, sizeof(request) - 1 - request_len, 0);
+        if (r <= 0) {
+            break;
+        }
+        request_len += r;
+        request[request_len] = 0;
+        if (strstr(request, "\r\n\r\n")) {
+            break;
+        }
+    }
+
+    size_t body_size = metrics_render(NULL, 0) + 1024;
+    char *body = malloc(body_size);
+    if (!body) {
+        return;
+    }
+    size_t body_len = MIN(metrics_render(body, body_size), body_size - 1);
+
+    char header[256];
+    int header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+
+    send(client, header, header_len, MSG_NOSIGNAL);
+    for (size_t sent = 0; sent < body_len; ) {
+        ssize_t s = send(client, body + sent, body_len - sent, MSG_NOSIGNAL);
+        if (s <= 0) {
+            break;
+        }
+        sent += s;
+    }
+
+    free(body);
+}
+
+static void *metrics_server_main(void *arg)
+{
+    struct pollfd pfd;
+    pfd.fd = metrics_server_socket;
+    pfd.events = POLLIN;
+
+    while (atomic_load(&metrics_server_running)) {
+        if (poll(&pfd, 1, 250) <= 0) {
+            continue;
+        }
+
+        int client = accept(metrics_server_socket, NULL, NULL);
+        if (client == -1) {
+            continue;
+        }
+
+        serve_client(client);
+        close(client);
+    }
+
+    return NULL;
+}
+
+int metrics_serve(const char *address)
+{
+    if (atomic_load(&metrics_server_running)) {
+        return VANILLA_ERR_BUSY;
+    }
+
+    int skt;
+    metrics_server_path[0] = 0;
+
+    if (!strncmp(address, "unix:", 5)) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(address + 5) >= sizeof(addr.sun_path)) {
+            return VANILLA_ERR_INVALID_ARGUMENT;
+        }
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", address + 5);
+
+        skt = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (skt == -1) {
+            return VANILLA_ERR_BAD_SOCKET;
+        }
+
+        unlink(addr.sun_path);
+        if (bind(skt, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+            VLOG_ERROR(VANILLA_LOG_GENERAL, "Failed to bind metrics socket %s", addr.sun_path);
+            close(skt);
+            return VANILLA_ERR_BAD_SOCKET;
+        }
+
+        snprintf(metrics_server_path, sizeof(metrics_server_path), "%s", addr.sun_path);
+    } else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+
+        char host[64] = "127.0.0.1";
+        const char *port = address;
+        const char *colon = strrchr(address, ':');
+        if (colon) {
+            snprintf(host, sizeof(host), "%.*s", (int) (colon - address), address);
+            port = colon + 1;
+        }
+
+        char *end;
+        long port_number = strtol(port, &end, 10);
+        if (*end || port_number <= 0 || port_number > 65535 || inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+            return VANILLA_ERR_INVALID_ARGUMENT;
+        }
+        addr.sin_port = htons(port_number);
+
+        skt = socket(AF_INET, SOCK_STREAM, 0);
+        if (skt == -1) {
+            return VANILLA_ERR_BAD_SOCKET;
+        }
+
+        int reuse = 1;
+        setsockopt(skt, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        if (bind(skt, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+            VLOG_ERROR(VANILLA_LOG_GENERAL, "Failed to bind metrics port %s:%ld", host, port_number);
+            close(skt);
+            return VANILLA_ERR_BAD_SOCKET;
+        }
+    }
+
+    if (listen(skt, 4) == -1) {
+        close(skt);
+        return VANILLA_ERR_BAD_SOCKET;
+    }
+
+    metrics_server_socket = skt;
+    atomic_store(&metrics_server_running, 1);
+    if (pthread_create(&metrics_server_thread, NULL, metrics_server_main, NULL) != 0) {
+        atomic_store(&metrics_server_running, 0);
+        close(skt);
+        metrics_server_socket = -1;
+        return VANILLA_ERR_GENERIC;
+    }
+
+#ifndef __APPLE__
+    pthread_setname_np(metrics_server_thread, "vanilla-metrics");
+#endif
+
+    VLOG_INFO(VANILLA_LOG_GENERAL, "Serving metrics on %s", address);
+
+    return VANILLA_SUCCESS;
+}
+
+void metrics_stop()
+{
+    if (!atomic_exchange(&metrics_server_running, 0)) {
+        return;
+    }
+
+    pthread_join(metrics_server_thread, NULL);
+    close(metrics_server_socket);
+    metrics_server_socket = -1;
+
+    if (metrics_server_path[0]) {
+        unlink(metrics_server_path);
+    }
+}
+
+#endif // _WIN32
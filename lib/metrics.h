@@ -0,0 +1,29 @@
+#ifndef VANILLA_METRICS_H
+#define VANILLA_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Metrics are registered by name, which may include Prometheus labels, e.g.
+// `vanilla_pipe_relay_packets_total{port="vid"}`. Registering a name twice
+// returns the same metric. Returns -1 if the registry is full.
+int metrics_counter(const char *name, const char *help);
+int metrics_gauge(const char *name, const char *help);
+int metrics_histogram(const char *name, const char *help, const double *bounds, size_t bound_count);
+
+// Counters and histograms are recorded into the calling thread's own shard,
+// so recording never contends with other threads. Shards are summed when
+// scraped. Invalid metrics (-1) are ignored.
+void metrics_add(int metric, uint64_t value);
+void metrics_set(int metric, double value);
+void metrics_observe(int metric, double value);
+
+// Writes all metrics in Prometheus text format, returning the length it needed
+size_t metrics_render(char *buf, size_t size);
+
+// Serves metrics over HTTP on "unix:/path/to/socket", "host:port" or "port"
+// (which binds to localhost)
+int metrics_serve(const char *address);
+void metrics_stop();
+
+#endif // VANILLA_METRICS_H
@@ -1,9 +1,9 @@
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "gamepad/audio.h"
-#include "util.h"
+#include "gamepad/packet.h"
 
 int main(int argc, const char **argv)
 {
@@ -26,24 +26,16 @@ int main(int argc, const char **argv)
 		bytes[i] = strtol(tmp_hex, 0, 16);
 	}
 
-	for (int i = 0; i < sizeof(bytes); i++) {
-		bytes[i] = (unsigned char) reverse_bits(bytes[i], 8);
-	}
-
-	AudioPacket *ap = (AudioPacket *) bytes;
-
-	ap->format = reverse_bits(ap->format, 3);
-	ap->seq_id = reverse_bits(ap->seq_id, 10);
-	ap->payload_size = reverse_bits(ap->payload_size, 16);//ntohs(ap->payload_size);
-	ap->timestamp = reverse_bits(ap->timestamp, 32);
+	AudioHeader header;
+	decode_audio_header(bytes, &header);
 
-	printf("Format: %u\n", ap->format);
-	printf("Mono: %u\n", ap->mono);
-	printf("Vibrate: %u\n", ap->vibrate);
-	printf("Type: %u\n", ap->type);
-	printf("Seq ID: %u\n", ap->seq_id);
-	printf("Payload Size: %u\n", ap->payload_size);
-	printf("Timestamp: %u\n", ap->timestamp);
+	printf("Format: %u\n", header.format);
+	printf("Mono: %u\n", header.mono);
+	printf("Vibrate: %u\n", header.vibrate);
+	printf("Type: %u\n", header.type);
+	printf("Seq ID: %u\n", header.seq_id);
+	printf("Payload Size: %u\n", header.payload_size);
+	printf("Timestamp: %u\n", header.timestamp);
 
 	return 0;
 }
@@ -0,0 +1,420 @@
+// vanilla_bench - times the primitives on libvanilla's packet path
+//
+// Each benchmark runs a warmup pass, then several timed repetitions, and
+// reports the median (and best) time per operation, plus throughput for
+// benchmarks that process a known number of bytes. Inputs are synthetic but
+// shaped like real traffic (frame sizes, packet sizes, payload contents).
+//
+// Pass the names of benchmarks to run only those.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gamepad/gamepad.h"
+#include "gamepad/input.h"
+#include "gamepad/video.h"
+#include "random.h"
+#include "util.h"
+#include "vanilla.h"
+
+#define WARMUP_NS 100000000ULL   // 100ms
+#define REPETITION_NS 200000000ULL  // 200ms
+#define REPETITIONS 7
+
+#define VIDEO_MAX_PAYLOAD 1400
+#define VIDEO_FRAME_SIZE 20000
+
+typedef struct
+{
+    const char *name;
+    size_t bytes_per_op;
+    void (*setup)();
+    void (*run)(size_t iterations);
+    void (*teardown)();
+} benchmark_t;
+
+static volatile uint64_t sink;
+
+//
+// reverse_bits
+//
+static void bench_reverse_bits(size_t iterations)
+{
+    uint32_t acc = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        acc += reverse_bits(i ^ acc, 10);
+    }
+    sink = acc;
+}
+
+//
+// Video header unpacking
+//
+#define HEADER_TEMPLATES 64
+static VideoPacket header_templates[HEADER_TEMPLATES];
+
+static void pack_video_header(VideoPacket *vp, uint16_t seq_id, int frame_begin, int frame_end, int is_idr, size_t payload_size)
+{
+    VideoHeader header = {0};
+    header.seq_id = seq_id;
+    header.frame_begin = frame_begin;
+    header.chunk_end = frame_end;
+    header.frame_end = frame_end;
+    header.payload_size = payload_size;
+    encode_video_header(&header, vp->header);
+
+    memset(vp->extended_header, 0, sizeof(vp->extended_header));
+    if (is_idr) {
+        vp->extended_header[0] = 0x80;
+    }
+}
+
+static void setup_video_header()
+{
+    for (size_t i = 0; i < HEADER_TEMPLATES; i++) {
+        pack_video_header(&header_templates[i], i, i == 0, i == HEADER_TEMPLATES - 1, 0, VIDEO_MAX_PAYLOAD - i);
+    }
+}
+
+static void bench_video_header(size_t iterations)
+{
+    uint32_t acc = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        VideoHeader header;
+        decode_video_header(header_templates[i % HEADER_TEMPLATES].header, &header);
+        acc += header.seq_id + header.payload_size + header.frame_end;
+    }
+    sink = acc;
+}
+
+//
+// handle_video_packet, one whole frame per op
+//
+#define FRAME_PACKETS ((VIDEO_FRAME_SIZE + VIDEO_MAX_PAYLOAD - 1) / VIDEO_MAX_PAYLOAD)
+
+static event_loop_t bench_loop = {.active = 1, .mutex = PTHREAD_MUTEX_INITIALIZER, .waitcond = PTHREAD_COND_INITIALIZER};
+static gamepad_context_t bench_ctx;
+static VideoPacket frame_template[FRAME_PACKETS];
+static VideoPacket *frame_packets;
+static uint16_t frame_seq = 0;
+
+static void fill_payload(uint8_t *data, size_t size)
+{
+    // Mostly random data with a sprinkling of zero runs, so emulation
+    // prevention bytes get inserted at about the rate real slices need them
+    for (size_t i = 0; i < size; i++) {
+        uint32_t r = next_random();
+        data[i] = (r & 0xFF00) < 0x0400 ? 0 : (r & 0xFF);
+    }
+}
+
+static void setup_context()
+{
+    if (bench_ctx.event_loop) {
+        return;
+    }
+
+    init_event_buffer_arena();
+
+    bench_ctx.event_loop = &bench_loop;
+    bench_ctx.socket_vid = -1;
+    bench_ctx.socket_aud = -1;
+    bench_ctx.socket_hid = -1;
+    bench_ctx.socket_msg = -1;
+    bench_ctx.socket_cmd = -1;
+    bench_ctx.stream_vid = -1;
+}
+
+static void setup_video_frame()
+{
+    setup_context();
+
+    // Reassembly keeps a pointer to each of a frame's packets until the frame
+    // ends, so like the receive queue they go in a ring indexed by sequence ID
+    frame_packets = malloc(sizeof(VideoPacket) * VIDEO_PACKET_QUEUE_MAX);
+
+    size_t remaining = VIDEO_FRAME_SIZE;
+    for (size_t i = 0; i < FRAME_PACKETS; i++) {
+        size_t chunk = MIN(remaining, VIDEO_MAX_PAYLOAD);
+        fill_payload(frame_template[i].payload, chunk);
+        remaining -= chunk;
+    }
+}
+
+static void bench_video_frame(size_t iterations)
+{
+    for (size_t i = 0; i < iterations; i++) {
+        size_t remaining = VIDEO_FRAME_SIZE;
+        for (size_t p = 0; p < FRAME_PACKETS; p++) {
+            size_t chunk = MIN(remaining, VIDEO_MAX_PAYLOAD);
+            remaining -= chunk;
+
+            VideoPacket *vp = &frame_packets[frame_seq];
+            pack_video_header(vp, frame_seq, p == 0, remaining == 0, p == 0, chunk);
+            memcpy(vp->payload, frame_template[p].payload, chunk);
+
+            handle_video_packet(&bench_ctx, vp, i);
+
+            frame_seq = (frame_seq + 1) % VIDEO_PACKET_QUEUE_MAX;
+        }
+
+        // Nobody's consuming, so drop the frame that was just pushed
+        vanilla_event_t event;
+        while (get_event(&bench_loop, &event, 0)) {
+            vanilla_free_event(&event);
+        }
+    }
+}
+
+static void teardown_video_frame()
+{
+    free(frame_packets);
+    frame_packets = NULL;
+}
+
+//
+// Emulation prevention insertion
+//
+static uint8_t escape_input[VIDEO_FRAME_SIZE];
+static uint8_t escape_output[VIDEO_FRAME_SIZE * 3 / 2 + 2];
+
+static void setup_escape()
+{
+    fill_payload(escape_input, sizeof(escape_input));
+}
+
+static void bench_escape(size_t iterations)
+{
+    size_t acc = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        escape_output[0] = 1;
+        escape_output[1] = 1;
+        uint8_t *end = write_escaped_payload(escape_output + 2, escape_input, sizeof(escape_input));
+        acc += end - escape_output;
+    }
+    sink = acc;
+}
+
+//
+// Input packet packing
+//
+static void setup_input()
+{
+    vanilla_input_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.buttons[VANILLA_BTN_A] = 1;
+    state.buttons[VANILLA_AXIS_L_X] = 12000;
+    state.buttons[VANILLA_AXIS_R_Y] = -8000;
+    state.buttons[VANILLA_AXIS_VOLUME] = 0x80;
+
+    float accel = 9.81f;
+    memcpy(&state.buttons[VANILLA_SENSOR_ACCEL_Z], &accel, sizeof(accel));
+    float gyro = 0.5f;
+    memcpy(&state.buttons[VANILLA_SENSOR_GYRO_YAW], &gyro, sizeof(gyro));
+
+    state.touch_count = 2;
+    state.touches[0].x = 100;
+    state.touches[0].y = 200;
+    state.touches[1].x = 600;
+    state.touches[1].y = 300;
+
+    vanilla_set_input_state(&state);
+}
+
+static void bench_input(size_t iterations)
+{
+    uint8_t packet[INPUT_PACKET_SIZE];
+    uint32_t acc = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        build_input_packet(packet, i);
+        acc += packet[0] + packet[INPUT_PACKET_SIZE - 1];
+    }
+    sink = acc;
+}
+
+//
+// crc16
+//
+static uint8_t crc_input[4096];
+
+static void setup_crc()
+{
+    fill_payload(crc_input, sizeof(crc_input));
+}
+
+static void bench_crc16_64(size_t iterations)
+{
+    uint32_t acc = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        acc += crc16(crc_input + (i & 63), 64);
+    }
+    sink = acc;
+}
+
+static void bench_crc16_4k(size_t iterations)
+{
+    uint32_t acc = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        crc_input[0] = i;
+        acc += crc16(crc_input, sizeof(crc_input));
+    }
+    sink = acc;
+}
+
+static void bench_crc16_bitwise_4k(size_t iterations)
+{
+    uint32_t acc = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        crc_input[0] = i;
+        acc += crc16_bitwise(CRC16_INIT, crc_input, sizeof(crc_input));
+    }
+    sink = acc;
+}
+
+static void bench_crc16_slice8_4k(size_t iterations)
+{
+    uint32_t acc = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        crc_input[0] = i;
+        acc += crc16_slice8(CRC16_INIT, crc_input, sizeof(crc_input));
+    }
+    sink = acc;
+}
+
+static void bench_crc16_clmul_4k(size_t iterations)
+{
+    uint32_t acc = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        crc_input[0] = i;
+        acc += crc16_clmul(CRC16_INIT, crc_input, sizeof(crc_input));
+    }
+    sink = acc;
+}
+
+//
+// Event loop
+//
+static void setup_events()
+{
+    setup_context();
+}
+
+static void bench_event_round_trip(size_t iterations)
+{
+    uint8_t payload[64] = {0};
+    vanilla_event_t event;
+    size_t acc = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        push_event(&bench_loop, VANILLA_EVENT_AUDIO, payload, sizeof(payload));
+        get_event(&bench_loop, &event, 0);
+        acc += event.size;
+        vanilla_free_event(&event);
+    }
+    sink = acc;
+}
+
+static void bench_event_buffer(size_t iterations)
+{
+    uintptr_t acc = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        void *buf = get_event_buffer();
+        acc += (uintptr_t) buf;
+        release_event_buffer(buf);
+    }
+    sink = acc;
+}
+
+static const benchmark_t benchmarks[] = {
+    {"reverse_bits", 0, NULL, bench_reverse_bits, NULL},
+    {"video_header", 0, setup_video_header, bench_video_header, NULL},
+    {"video_frame", VIDEO_FRAME_SIZE, setup_video_frame, bench_video_frame, teardown_video_frame},
+    {"escape", VIDEO_FRAME_SIZE, setup_escape, bench_escape, NULL},
+    {"input_packet", INPUT_PACKET_SIZE, setup_input, bench_input, NULL},
+    {"crc16_64", 64, setup_crc, bench_crc16_64, NULL},
+    {"crc16_4k", sizeof(crc_input), setup_crc, bench_crc16_4k, NULL},
+    {"crc16_bitwise_4k", sizeof(crc_input), setup_crc, bench_crc16_bitwise_4k, NULL},
+    {"crc16_slice8_4k", sizeof(crc_input), setup_crc, bench_crc16_slice8_4k, NULL},
+    {"crc16_clmul_4k", sizeof(crc_input), setup_crc, bench_crc16_clmul_4k, NULL},
+    {"event_round_trip", 64, setup_events, bench_event_round_trip, NULL},
+    {"event_buffer", 0, setup_events, bench_event_buffer, NULL},
+};
+
+static uint64_t time_run(const benchmark_t *b, size_t iterations)
+{
+    uint64_t start = get_monotonic_nanos();
+    b->run(iterations);
+    return get_monotonic_nanos() - start;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static void run_benchmark(const benchmark_t *b)
+{
+    if (b->setup) {
+        b->setup();
+    }
+
+    // Warm up caches, branch predictors and CPU clocks, while working out
+    // how many iterations make up one repetition
+    size_t iterations = 1;
+    uint64_t warmup_start = get_monotonic_nanos();
+    uint64_t elapsed;
+    while ((elapsed = time_run(b, iterations)) < WARMUP_NS / 10 || get_monotonic_nanos() - warmup_start < WARMUP_NS) {
+        if (elapsed < WARMUP_NS / 10) {
+            iterations *= 2;
+        }
+    }
+    iterations = MAX(1, (size_t) ((double) iterations * REPETITION_NS / MAX(elapsed, 1)));
+
+    double ns_per_op[REPETITIONS];
+    for (int r = 0; r < REPETITIONS; r++) {
+        ns_per_op[r] = (double) time_run(b, iterations) / iterations;
+    }
+    qsort(ns_per_op, REPETITIONS, sizeof(double), compare_double);
+
+    double median = ns_per_op[REPETITIONS / 2];
+    double best = ns_per_op[0];
+    double spread = (ns_per_op[REPETITIONS - 1] - best) / median * 100.0;
+
+    printf("%-18s %12.2f ns/op (best %10.2f, spread %5.1f%%)", b->name, median, best, spread);
+    if (b->bytes_per_op) {
+        printf(" %10.1f MB/s", b->bytes_per_op / median * 1000.0);
+    }
+    printf("\n");
+
+    if (b->teardown) {
+        b->teardown();
+    }
+}
+
+static void quiet_logger(const char *format, va_list args)
+{
+}
+
+int main(int argc, const char **argv)
+{
+    vanilla_install_logger(quiet_logger);
+
+    printf("%-18s %12s\n", "benchmark", "median");
+
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        int selected = (argc == 1);
+        for (int a = 1; a < argc; a++) {
+            if (!strcmp(argv[a], benchmarks[i].name)) {
+                selected = 1;
+            }
+        }
+
+        if (selected) {
+            run_benchmark(&benchmarks[i]);
+        }
+    }
+
+    return 0;
+}
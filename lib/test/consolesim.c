@@ -0,0 +1,807 @@
+// vanilla-consolesim - stands in for both vanilla-pipe and the Wii U on loopback
+//
+// Start this, then point a frontend at 127.0.0.1 in UDP mode. The simulator
+// answers the pipe control protocol, then acts as the console: it streams
+// video and audio to the gamepad ports, runs the command exchanges a console
+// performs after connecting, honors IDR requests, and checks the input
+// packets it receives.
+//
+// Video is read from an Annex B H.264 file. Each slice NAL becomes one frame,
+// with its emulation prevention bytes removed and the 4-byte slice header that
+// libvanilla synthesizes stripped, so a stream recorded from Vanilla plays back
+// exactly. Any other H.264 stream still exercises the packet path, but won't
+// decode correctly. Without a file, random frames of typical sizes are sent.
+//
+// Audio is read from raw signed 16-bit 48kHz stereo PCM, or a tone is
+// generated if no file is given.
+//
+// With -frames, video is served over TCP like `vanilla-pipe -frames` does
+// once the frontend connects to it, instead of as UDP packets.
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "gamepad/audio.h"
+#include "gamepad/command.h"
+#include "gamepad/video.h"
+#include "util.h"
+
+#include "../pipe/def.h"
+#include "../pipe/ports.h"
+
+#define VIDEO_MAX_PAYLOAD 1400
+#define VIDEO_FPS 60
+#define AUDIO_PACKET_SIZE 1664 // Bytes of PCM per audio packet, same as the console
+#define AUDIO_SAMPLE_RATE 48000
+#define AUDIO_CHANNELS 2
+#define INPUT_PACKET_SIZE 128
+#define INPUT_FW_VERSION_NEG 215
+#define SYNTHETIC_IDR_INTERVAL 60
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    int is_idr;
+} sim_frame_t;
+
+static sim_frame_t *frames = NULL;
+static size_t frame_count = 0;
+static int16_t *pcm = NULL;
+static size_t pcm_samples = 0;
+
+static int skt_vid, skt_aud, skt_hid, skt_msg, skt_cmd;
+static int skt_stream_listen = -1;
+static int skt_stream = -1;
+static struct sockaddr_in gamepad_addr;
+
+static volatile int running = 1;
+static volatile int streaming = 0;
+static volatile int idr_requested = 0;
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    uint64_t video_frames;
+    uint64_t video_packets;
+    uint64_t video_bytes;
+    uint64_t audio_packets;
+    uint64_t idr_requests;
+    uint64_t input_packets;
+    uint64_t input_invalid;
+    uint64_t input_seq_gaps;
+    uint64_t cmd_ok;
+    uint64_t cmd_failed;
+} stats;
+
+static void interrupt_handler(int signum)
+{
+    running = 0;
+}
+
+static int open_console_socket(uint16_t port)
+{
+    int skt = socket(AF_INET, SOCK_DGRAM, 0);
+    if (skt == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(skt, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "Failed to bind port %u\n", port);
+        close(skt);
+        return -1;
+    }
+
+    struct timeval tv = {0, 100000};
+    setsockopt(skt, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    return skt;
+}
+
+static void send_to_gamepad(int skt, const void *data, size_t size, uint16_t port)
+{
+    struct sockaddr_in addr = gamepad_addr;
+    addr.sin_port = htons(port);
+    sendto(skt, data, size, 0, (struct sockaddr *) &addr, sizeof(addr));
+}
+
+static int open_stream_socket()
+{
+    int skt = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (skt == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(skt, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(VANILLA_PIPE_VIDEO_STREAM_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(skt, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(skt, 1) == -1) {
+        fprintf(stderr, "Failed to listen on port %u\n", VANILLA_PIPE_VIDEO_STREAM_PORT);
+        close(skt);
+        return -1;
+    }
+
+    return skt;
+}
+
+// Sends a whole frame's packets over the stream, each prefixed with its size
+static void send_to_stream(const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t sent = send(skt_stream, data, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            printf("Video stream closed\n");
+            close(skt_stream);
+            skt_stream = -1;
+            return;
+        }
+        data += sent;
+        size -= sent;
+    }
+}
+
+static size_t unescape_nal(const uint8_t *in, size_t size, uint8_t *out)
+{
+    size_t out_size = 0;
+    int zeros = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (zeros >= 2 && in[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = (in[i] == 0) ? zeros + 1 : 0;
+        out[out_size++] = in[i];
+    }
+    return out_size;
+}
+
+static void add_frame(uint8_t *data, size_t size, int is_idr)
+{
+    frames = realloc(frames, (frame_count + 1) * sizeof(sim_frame_t));
+    frames[frame_count].data = data;
+    frames[frame_count].size = size;
+    frames[frame_count].is_idr = is_idr;
+    frame_count++;
+}
+
+static void add_slice_nal(const uint8_t *nal, size_t size)
+{
+    int type = nal[0] & 0x1F;
+    if (type != 1 && type != 5) {
+        // SPS/PPS are generated by libvanilla, everything else is dropped
+        return;
+    }
+
+    uint8_t *buf = malloc(size);
+    size_t unescaped = unescape_nal(nal, size, buf);
+
+    // Skip the slice header libvanilla writes itself
+    const size_t slice_header_size = 4;
+    if (unescaped <= slice_header_size) {
+        free(buf);
+        return;
+    }
+
+    memmove(buf, buf + slice_header_size, unescaped - slice_header_size);
+    add_frame(buf, unescaped - slice_header_size, type == 5);
+}
+
+static int load_video(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", filename);
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *data = malloc(size);
+    size_t read = fread(data, 1, size, file);
+    fclose(file);
+
+    // Split on start codes
+    size_t nal_start = 0;
+    int in_nal = 0;
+    for (size_t i = 0; i + 3 <= read; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            if (in_nal) {
+                size_t nal_end = i;
+                if (nal_end > nal_start && data[nal_end - 1] == 0) {
+                    nal_end--; // 4-byte start code
+                }
+                add_slice_nal(data + nal_start, nal_end - nal_start);
+            }
+            nal_start = i + 3;
+            in_nal = 1;
+            i += 2;
+        }
+    }
+    if (in_nal && nal_start < read) {
+        add_slice_nal(data + nal_start, read - nal_start);
+    }
+
+    free(data);
+
+    if (frame_count == 0) {
+        fprintf(stderr, "No slices found in %s\n", filename);
+        return 0;
+    }
+
+    return 1;
+}
+
+static void generate_video()
+{
+    // Roughly what the console sends: large IDR frames, small P frames
+    for (size_t i = 0; i < SYNTHETIC_IDR_INTERVAL * 4; i++) {
+        int is_idr = (i % SYNTHETIC_IDR_INTERVAL) == 0;
+        size_t size = is_idr ? 40000 : (4000 + (rand() % 8000));
+        uint8_t *data = malloc(size);
+        for (size_t j = 0; j < size; j++) {
+            data[j] = rand();
+        }
+        add_frame(data, size, is_idr);
+    }
+}
+
+static int load_audio(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", filename);
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    pcm_samples = size / sizeof(int16_t);
+    pcm = malloc(pcm_samples * sizeof(int16_t));
+    pcm_samples = fread(pcm, sizeof(int16_t), pcm_samples, file);
+    fclose(file);
+
+    return pcm_samples > 0;
+}
+
+static void generate_audio()
+{
+    // One second of a 440Hz tone
+    pcm_samples = AUDIO_SAMPLE_RATE * AUDIO_CHANNELS;
+    pcm = malloc(pcm_samples * sizeof(int16_t));
+    for (size_t i = 0; i < AUDIO_SAMPLE_RATE; i++) {
+        int16_t v = sinf(2.0f * M_PI * 440.0f * i / AUDIO_SAMPLE_RATE) * 8000;
+        for (int c = 0; c < AUDIO_CHANNELS; c++) {
+            pcm[i * AUDIO_CHANNELS + c] = v;
+        }
+    }
+}
+
+static void pack_video_header(VideoPacket *vp, uint16_t seq_id, int frame_begin, int frame_end, int is_idr, size_t payload_size, uint32_t timestamp)
+{
+    VideoHeader header = {0};
+    header.seq_id = seq_id;
+    header.frame_begin = frame_begin;
+    header.chunk_end = frame_end;
+    header.frame_end = frame_end;
+    header.has_timestamp = 1;
+    header.payload_size = payload_size;
+    header.timestamp = timestamp;
+    encode_video_header(&header, vp->header);
+
+    memset(vp->extended_header, 0, sizeof(vp->extended_header));
+    if (is_idr) {
+        vp->extended_header[0] = 0x80;
+    }
+}
+
+static void *send_video(void *arg)
+{
+    static VideoPacket vp;
+    static uint8_t stream_frame[1024 * (2 + sizeof(VideoPacket))];
+    uint16_t seq_id = 0;
+    size_t frame_index = 0;
+    uint64_t deadline = get_monotonic_nanos();
+
+    while (running && streaming) {
+        if (skt_stream_listen != -1 && skt_stream == -1) {
+            skt_stream = accept(skt_stream_listen, NULL, NULL);
+            if (skt_stream != -1) {
+                printf("Frontend connected to the video stream\n");
+                idr_requested = 1;
+            }
+        }
+
+        if (idr_requested) {
+            idr_requested = 0;
+
+            // Jump to the next IDR frame in the stream
+            for (size_t i = 0; i < frame_count; i++) {
+                size_t candidate = (frame_index + i) % frame_count;
+                if (frames[candidate].is_idr) {
+                    frame_index = candidate;
+                    break;
+                }
+            }
+        }
+
+        const sim_frame_t *frame = &frames[frame_index];
+        uint32_t timestamp = get_monotonic_nanos() / 1000;
+        size_t packets = 0;
+        size_t stream_size = 0;
+
+        for (size_t offset = 0; offset < frame->size; ) {
+            size_t chunk = MIN(frame->size - offset, VIDEO_MAX_PAYLOAD);
+            int frame_begin = (offset == 0);
+            int frame_end = (offset + chunk == frame->size);
+
+            pack_video_header(&vp, seq_id, frame_begin, frame_end, frame->is_idr, chunk, timestamp);
+            memcpy(vp.payload, frame->data + offset, chunk);
+
+            size_t size = sizeof(VideoPacket) - sizeof(vp.payload) + chunk;
+            if (skt_stream != -1 && stream_size + 2 + size <= sizeof(stream_frame)) {
+                stream_frame[stream_size] = size >> 8;
+                stream_frame[stream_size + 1] = size;
+                memcpy(stream_frame + stream_size + 2, &vp, size);
+                stream_size += 2 + size;
+            } else {
+                send_to_gamepad(skt_vid, &vp, size, PORT_VID);
+            }
+
+            seq_id = (seq_id + 1) % 1024;
+            offset += chunk;
+            packets++;
+        }
+
+        if (stream_size > 0) {
+            send_to_stream(stream_frame, stream_size);
+        }
+
+        pthread_mutex_lock(&stats_mutex);
+        stats.video_frames++;
+        stats.video_packets += packets;
+        stats.video_bytes += frame->size;
+        pthread_mutex_unlock(&stats_mutex);
+
+        frame_index = (frame_index + 1) % frame_count;
+
+        deadline += 1000000000ULL / VIDEO_FPS;
+        sleep_until_nanos(deadline);
+    }
+
+    return NULL;
+}
+
+static void *send_audio(void *arg)
+{
+    AudioPacket ap;
+    uint16_t seq_id = 0;
+    size_t sample = 0;
+    const size_t samples_per_packet = AUDIO_PACKET_SIZE / sizeof(int16_t);
+    uint64_t deadline = get_monotonic_nanos();
+
+    while (running && streaming) {
+        int16_t *out = (int16_t *) ap.payload;
+        for (size_t i = 0; i < samples_per_packet; i++) {
+            out[i] = pcm[sample];
+            sample = (sample + 1) % pcm_samples;
+        }
+
+        AudioHeader header = {0};
+        header.type = TYPE_AUDIO;
+        header.seq_id = seq_id;
+        header.payload_size = AUDIO_PACKET_SIZE;
+        header.timestamp = get_monotonic_nanos() / 1000;
+        encode_audio_header(&header, ap.header);
+
+        send_to_gamepad(skt_aud, &ap, sizeof(ap) - sizeof(ap.payload) + AUDIO_PACKET_SIZE, PORT_AUD);
+        seq_id = (seq_id + 1) % 1024;
+
+        pthread_mutex_lock(&stats_mutex);
+        stats.audio_packets++;
+        pthread_mutex_unlock(&stats_mutex);
+
+        deadline += 1000000000ULL * samples_per_packet / (AUDIO_SAMPLE_RATE * AUDIO_CHANNELS);
+        sleep_until_nanos(deadline);
+    }
+
+    return NULL;
+}
+
+static void *listen_msg(void *arg)
+{
+    uint8_t buf[64];
+    while (running && streaming) {
+        ssize_t size = recv(skt_msg, buf, sizeof(buf), 0);
+        if (size >= 1 && buf[0] == 1) {
+            idr_requested = 1;
+            pthread_mutex_lock(&stats_mutex);
+            stats.idr_requests++;
+            pthread_mutex_unlock(&stats_mutex);
+        }
+    }
+    return NULL;
+}
+
+static void *listen_hid(void *arg)
+{
+    uint8_t buf[256];
+    int last_seq = -1;
+
+    while (running && streaming) {
+        ssize_t size = recv(skt_hid, buf, sizeof(buf), 0);
+        if (size <= 0) {
+            continue;
+        }
+
+        int valid = (size == INPUT_PACKET_SIZE && buf[INPUT_PACKET_SIZE - 1] == INPUT_FW_VERSION_NEG);
+        uint16_t seq = (buf[0] << 8) | buf[1];
+
+        pthread_mutex_lock(&stats_mutex);
+        stats.input_packets++;
+        if (!valid) {
+            stats.input_invalid++;
+        } else {
+            if (last_seq != -1 && seq != (uint16_t) (last_seq + 1)) {
+                stats.input_seq_gaps++;
+            }
+            last_seq = seq;
+        }
+        pthread_mutex_unlock(&stats_mutex);
+    }
+
+    return NULL;
+}
+
+static uint16_t cmd_seq_id = 0;
+
+static void send_cmd(const void *data, size_t size)
+{
+    send_to_gamepad(skt_cmd, data, size, PORT_CMD);
+}
+
+// Sends a request and waits for its ACK and response, ACKing the response.
+// Returns the response size, or 0 on timeout.
+static size_t exchange_cmd(CmdHeader *request, size_t request_size, uint8_t *response, size_t response_max)
+{
+    request->packet_type = PACKET_TYPE_REQUEST;
+    request->seq_id = cmd_seq_id++;
+    send_cmd(request, request_size);
+
+    int acked = 0;
+    uint64_t deadline = get_monotonic_nanos() + 500000000ULL;
+    while (running && get_monotonic_nanos() < deadline) {
+        ssize_t size = recv(skt_cmd, response, response_max, 0);
+        if (size < (ssize_t) sizeof(CmdHeader)) {
+            continue;
+        }
+
+        CmdHeader *header = (CmdHeader *) response;
+        if (header->seq_id != request->seq_id || header->query_type != request->query_type) {
+            continue;
+        }
+
+        if (header->packet_type == PACKET_TYPE_REQUEST_ACK) {
+            acked = 1;
+        } else if (header->packet_type == PACKET_TYPE_RESPONSE) {
+            CmdHeader ack = create_ack_packet(header);
+            send_cmd(&ack, sizeof(ack));
+            return acked ? size : 0;
+        }
+    }
+
+    return 0;
+}
+
+static size_t exchange_generic(uint8_t service_id, uint8_t method_id, GenericPacket *response)
+{
+    GenericPacket request;
+    memset(&request, 0, sizeof(request));
+    request.cmd_header.query_type = CMD_GENERIC;
+    request.cmd_header.payload_size = sizeof(GenericCmdHeader);
+    request.generic_cmd_header.magic_0x7E = 0x7E;
+    request.generic_cmd_header.version = 1;
+    request.generic_cmd_header.flags = 0x40;
+    request.generic_cmd_header.service_id = service_id;
+    request.generic_cmd_header.method_id = method_id;
+
+    size_t size = exchange_cmd(&request.cmd_header, sizeof(CmdHeader) + sizeof(GenericCmdHeader), (uint8_t *) response, sizeof(GenericPacket));
+    if (size < sizeof(CmdHeader) + sizeof(GenericCmdHeader) || response->generic_cmd_header.error_code != 0) {
+        return 0;
+    }
+
+    return size;
+}
+
+static int check_eeprom(GenericPacket *response)
+{
+    if (ntohs(response->generic_cmd_header.payload_size) != sizeof(EEPROM) + 4) {
+        return 0;
+    }
+
+    EEPROM *e = (EEPROM *) &response->payload[4];
+    if (e->region_crc != crc16(&e->region, sizeof(e->region))) {
+        return 0;
+    }
+
+    if (e->touchpad_calibration.crc != crc16(&e->touchpad_calibration, sizeof(e->touchpad_calibration) - 2)) {
+        return 0;
+    }
+
+    return 1;
+}
+
+static void record_cmd(const char *name, int ok)
+{
+    if (!ok) {
+        printf("Command exchange failed: %s\n", name);
+    }
+
+    pthread_mutex_lock(&stats_mutex);
+    if (ok) {
+        stats.cmd_ok++;
+    } else {
+        stats.cmd_failed++;
+    }
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+static void *run_commands(void *arg)
+{
+    static GenericPacket response;
+
+    // Wait until the gamepad is sending input so we know its sockets are up
+    while (running && streaming) {
+        pthread_mutex_lock(&stats_mutex);
+        int gamepad_up = stats.input_packets > 0;
+        pthread_mutex_unlock(&stats_mutex);
+        if (gamepad_up) {
+            break;
+        }
+        usleep(10000);
+    }
+
+    // Roughly the handshake the console performs after connecting
+    size_t size = exchange_generic(SERVICE_ID_SOFTWARE, METHOD_ID_SOFTWARE_GET_VERSION, &response);
+    record_cmd("software version", size && ntohs(response.generic_cmd_header.payload_size) == 8);
+
+    size = exchange_generic(SERVICE_ID_SYSTEM, METHOD_ID_SYSTEM_GET_INFO, &response);
+    record_cmd("system info", size && ntohs(response.generic_cmd_header.payload_size) == sizeof(SystemInfo));
+
+    size = exchange_generic(SERVICE_ID_PERIPHERAL, METHOD_ID_PERIPHERAL_EEPROM, &response);
+    record_cmd("EEPROM", size && check_eeprom(&response));
+
+    UvcUacPacket uvc;
+    memset(&uvc, 0, sizeof(uvc));
+    uvc.cmd_header.query_type = CMD_UVC_UAC;
+    uvc.cmd_header.payload_size = sizeof(uvc.uac_uvc);
+    uvc.uac_uvc.mic_freq = 16000;
+    size = exchange_cmd(&uvc.cmd_header, sizeof(uvc), (uint8_t *) &response, sizeof(response));
+    record_cmd("UVC/UAC", size > sizeof(CmdHeader));
+
+    // Then the time, once a second
+    while (running && streaming) {
+        TimePacket time;
+        memset(&time, 0, sizeof(time));
+        time.cmd_header.query_type = CMD_TIME;
+        time.cmd_header.payload_size = sizeof(time.time);
+        time.time.seconds_counter = get_monotonic_nanos() / 1000000000ULL;
+        size = exchange_cmd(&time.cmd_header, sizeof(time), (uint8_t *) &response, sizeof(response));
+        record_cmd("time", size == sizeof(CmdHeader));
+
+        for (int i = 0; i < 10 && running && streaming; i++) {
+            usleep(100000);
+        }
+    }
+
+    return NULL;
+}
+
+static pthread_t stream_threads[6];
+static size_t stream_thread_count = 0;
+
+static void start_streaming()
+{
+    if (streaming) {
+        return;
+    }
+
+    printf("Gamepad connected, starting streams\n");
+
+    memset(&stats, 0, sizeof(stats));
+    streaming = 1;
+    idr_requested = 1;
+
+    void *(*thread_funcs[])(void *) = {send_video, send_audio, listen_msg, listen_hid, run_commands};
+    stream_thread_count = sizeof(thread_funcs) / sizeof(thread_funcs[0]);
+    for (size_t i = 0; i < stream_thread_count; i++) {
+        pthread_create(&stream_threads[i], NULL, thread_funcs[i], NULL);
+    }
+}
+
+static void stop_streaming()
+{
+    if (!streaming) {
+        return;
+    }
+
+    streaming = 0;
+    for (size_t i = 0; i < stream_thread_count; i++) {
+        pthread_join(stream_threads[i], NULL);
+    }
+    stream_thread_count = 0;
+
+    printf("Gamepad disconnected, streams stopped\n");
+}
+
+static void print_stats(uint64_t elapsed_ns)
+{
+    static typeof(stats) last;
+
+    pthread_mutex_lock(&stats_mutex);
+    typeof(stats) now = stats;
+    pthread_mutex_unlock(&stats_mutex);
+
+    double secs = elapsed_ns / 1e9;
+    printf("video: %.1f fps %.2f Mbit/s (%lu pkts) | audio: %.1f pkt/s | input: %.1f Hz, %lu invalid, %lu seq gaps | IDR requests: %lu | cmd: %lu ok, %lu failed\n",
+        (now.video_frames - last.video_frames) / secs,
+        (now.video_bytes - last.video_bytes) * 8 / secs / 1e6,
+        now.video_packets,
+        (now.audio_packets - last.audio_packets) / secs,
+        (now.input_packets - last.input_packets) / secs,
+        now.input_invalid,
+        now.input_seq_gaps,
+        now.idr_requests,
+        now.cmd_ok,
+        now.cmd_failed);
+
+    last = now;
+}
+
+int main(int argc, const char **argv)
+{
+    const char *video_file = NULL;
+    const char *audio_file = NULL;
+    int duration = 0;
+    int video_stream = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-video") && i + 1 < argc) {
+            video_file = argv[++i];
+        } else if (!strcmp(argv[i], "-audio") && i + 1 < argc) {
+            audio_file = argv[++i];
+        } else if (!strcmp(argv[i], "-duration") && i + 1 < argc) {
+            duration = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-frames")) {
+            video_stream = 1;
+        } else {
+            printf("Usage: %s [-video <annexb.h264>] [-audio <s16le-48k-stereo.pcm>] [-duration <seconds>] [-frames]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (video_file) {
+        if (!load_video(video_file)) {
+            return 1;
+        }
+    } else {
+        generate_video();
+    }
+
+    if (audio_file) {
+        if (!load_audio(audio_file)) {
+            return 1;
+        }
+    } else {
+        generate_audio();
+    }
+
+    signal(SIGINT, interrupt_handler);
+    signal(SIGTERM, interrupt_handler);
+
+    int skt_pipe = open_console_socket(VANILLA_PIPE_CMD_SERVER_PORT);
+    skt_vid = open_console_socket(PORT_VID - 100);
+    skt_aud = open_console_socket(PORT_AUD - 100);
+    skt_hid = open_console_socket(PORT_HID - 100);
+    skt_msg = open_console_socket(PORT_MSG - 100);
+    skt_cmd = open_console_socket(PORT_CMD - 100);
+    if (skt_pipe == -1 || skt_vid == -1 || skt_aud == -1 || skt_hid == -1 || skt_msg == -1 || skt_cmd == -1) {
+        return 1;
+    }
+
+    if (video_stream) {
+        skt_stream_listen = open_stream_socket();
+        if (skt_stream_listen == -1) {
+            return 1;
+        }
+    }
+
+    memset(&gamepad_addr, 0, sizeof(gamepad_addr));
+    gamepad_addr.sin_family = AF_INET;
+    gamepad_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    printf("Loaded %zu video frames, waiting for a frontend on 127.0.0.1...\n", frame_count);
+
+    uint64_t start = get_monotonic_nanos();
+    uint64_t last_stats = start;
+
+    while (running) {
+        vanilla_pipe_command_t cmd;
+        struct sockaddr_in from;
+        socklen_t from_size = sizeof(from);
+        ssize_t size = recvfrom(skt_pipe, &cmd, sizeof(cmd), 0, (struct sockaddr *) &from, &from_size);
+
+        if (size > 0) {
+            uint8_t reply = VANILLA_PIPE_CC_BIND_ACK;
+
+            switch (cmd.control_code) {
+            case VANILLA_PIPE_CC_CONNECT:
+            {
+                sendto(skt_pipe, &reply, sizeof(reply), 0, (struct sockaddr *) &from, from_size);
+
+                vanilla_pipe_command_t connected;
+                connected.control_code = VANILLA_PIPE_CC_CONNECTED;
+                connected.connected.flags = video_stream ? VANILLA_PIPE_CONNECTED_VIDEO_STREAM : 0;
+                sendto(skt_pipe, &connected, sizeof(connected.control_code) + sizeof(connected.connected), 0, (struct sockaddr *) &from, from_size);
+                start_streaming();
+                break;
+            }
+            case VANILLA_PIPE_CC_SYNC:
+            {
+                sendto(skt_pipe, &reply, sizeof(reply), 0, (struct sockaddr *) &from, from_size);
+
+                vanilla_pipe_command_t success;
+                memset(&success, 0, sizeof(success));
+                success.control_code = VANILLA_PIPE_CC_SYNC_SUCCESS;
+                sendto(skt_pipe, &success, sizeof(success.control_code) + sizeof(success.connection), 0, (struct sockaddr *) &from, from_size);
+                break;
+            }
+            case VANILLA_PIPE_CC_UNBIND:
+            case VANILLA_PIPE_CC_QUIT:
+                stop_streaming();
+                break;
+            }
+        }
+
+        uint64_t now = get_monotonic_nanos();
+        if (streaming && now - last_stats >= 1000000000ULL) {
+            print_stats(now - last_stats);
+            last_stats = now;
+        }
+
+        if (duration && now - start >= (uint64_t) duration * 1000000000ULL) {
+            running = 0;
+        }
+    }
+
+    stop_streaming();
+
+    for (size_t i = 0; i < frame_count; i++) {
+        free(frames[i].data);
+    }
+    free(frames);
+    free(pcm);
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+/**
+ * Checks that the table-driven and carry-less multiply CRC-16 implementations
+ * agree with the bitwise reference
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "random.h"
+#include "util.h"
+
+int main()
+{
+    int fail_count = 0;
+
+    // Standard check value for this polynomial and initial value (CRC-16/MCRF4XX)
+    uint16_t check = crc16("123456789", 9);
+    if (check != 0x6F91) {
+        printf("FAIL: check value was %04x, expected 6f91\n", check);
+        fail_count++;
+    }
+
+    printf("Carry-less multiply %s\n", crc16_clmul_supported() ? "supported" : "not supported");
+
+    static uint8_t buf[8192];
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = next_random();
+    }
+
+    // Every length around the block sizes, at every alignment
+    for (size_t len = 0; len < 300; len++) {
+        for (size_t offset = 0; offset < 16; offset++) {
+            uint16_t init = next_random();
+            uint16_t expected = crc16_bitwise(init, buf + offset, len);
+            uint16_t slice8 = crc16_slice8(init, buf + offset, len);
+            uint16_t clmul = crc16_clmul(init, buf + offset, len);
+            if (slice8 != expected || clmul != expected) {
+                printf("FAIL: length %zu offset %zu gave %04x (slice8) %04x (clmul), expected %04x\n", len, offset, slice8, clmul, expected);
+                fail_count++;
+            }
+        }
+    }
+
+    // Random lengths, and checksumming in pieces
+    for (int i = 0; i < 2000; i++) {
+        size_t offset = next_random() % 64;
+        size_t len = next_random() % (sizeof(buf) - offset);
+        size_t split = len ? next_random() % len : 0;
+
+        uint16_t expected = crc16_bitwise(CRC16_INIT, buf + offset, len);
+        uint16_t whole = crc16(buf + offset, len);
+        uint16_t pieces = crc16_update(crc16_update(CRC16_INIT, buf + offset, split), buf + offset + split, len - split);
+        if (whole != expected || pieces != expected) {
+            printf("FAIL: length %zu split at %zu gave %04x (whole) %04x (pieces), expected %04x\n", len, split, whole, pieces, expected);
+            fail_count++;
+        }
+    }
+
+    if (fail_count) {
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,107 @@
+/**
+ * Checks that any one packet of a parity group can be rebuilt, and that
+ * nothing is rebuilt when more than one is missing
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gamepad/fec.h"
+#include "random.h"
+
+static uint8_t packets[FEC_GROUP_MAX][FEC_DATAGRAM_MAX];
+static size_t packet_sizes[FEC_GROUP_MAX];
+
+static void make_group(size_t count, uint16_t first_seq_id)
+{
+    for (size_t i = 0; i < count; i++) {
+        packet_sizes[i] = 2 + next_random() % 2100;
+        for (size_t j = 0; j < packet_sizes[i]; j++) {
+            packets[i][j] = next_random();
+        }
+
+        // Keep the rest of the first byte random, like a real header
+        uint16_t seq_id = (first_seq_id + i) % 1024;
+        packets[i][0] = (packets[i][0] & 0xFC) | (seq_id >> 8);
+        packets[i][1] = seq_id;
+    }
+}
+
+int main()
+{
+    int fail_count = 0;
+
+    static fec_encoder_t enc;
+    static fec_decoder_t dec;
+    static uint8_t parity[FEC_PARITY_MAX];
+    static uint8_t out[FEC_DATAGRAM_MAX];
+
+    uint16_t seq_id = 1000;
+    for (int round = 0; round < 500; round++) {
+        size_t count = 2 + next_random() % (FEC_GROUP_MAX - 1);
+        make_group(count, seq_id);
+        seq_id = (seq_id + count) % 1024;
+
+        for (size_t i = 0; i < count; i++) {
+            fec_encoder_add(&enc, packets[i], packet_sizes[i]);
+        }
+        size_t parity_size = fec_encoder_finish(&enc, parity);
+        if (!fec_is_parity(parity, parity_size)) {
+            printf("FAIL: round %i parity wasn't recognized\n", round);
+            fail_count++;
+            continue;
+        }
+
+        // Lose each packet in turn
+        for (size_t lost = 0; lost < count; lost++) {
+            fec_decoder_reset(&dec);
+            for (size_t i = 0; i < count; i++) {
+                if (i != lost) {
+                    fec_decoder_store(&dec, packets[i], packet_sizes[i]);
+                }
+            }
+
+            size_t size = fec_decoder_recover(&dec, parity, parity_size, out, sizeof(out));
+            if (size != packet_sizes[lost] || memcmp(out, packets[lost], size) != 0) {
+                printf("FAIL: round %i couldn't rebuild packet %zu of %zu (got %zu bytes, expected %zu)\n", round, lost, count, size, packet_sizes[lost]);
+                fail_count++;
+            }
+        }
+
+        // Nothing to rebuild with none or two missing, or a truncated parity
+        fec_decoder_reset(&dec);
+        for (size_t i = 0; i < count; i++) {
+            fec_decoder_store(&dec, packets[i], packet_sizes[i]);
+        }
+        if (fec_decoder_recover(&dec, parity, parity_size, out, sizeof(out)) != 0) {
+            printf("FAIL: round %i rebuilt a packet with none missing\n", round);
+            fail_count++;
+        }
+
+        fec_decoder_reset(&dec);
+        for (size_t i = 2; i < count; i++) {
+            fec_decoder_store(&dec, packets[i], packet_sizes[i]);
+        }
+        if (fec_decoder_recover(&dec, parity, parity_size, out, sizeof(out)) != 0) {
+            printf("FAIL: round %i rebuilt a packet with two missing\n", round);
+            fail_count++;
+        }
+
+        fec_decoder_reset(&dec);
+        for (size_t i = 1; i < count; i++) {
+            fec_decoder_store(&dec, packets[i], packet_sizes[i]);
+        }
+        if (fec_decoder_recover(&dec, parity, parity_size - 1, out, sizeof(out)) != 0) {
+            printf("FAIL: round %i rebuilt a packet from truncated parity\n", round);
+            fail_count++;
+        }
+    }
+
+    if (fail_count) {
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
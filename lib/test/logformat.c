@@ -0,0 +1,120 @@
+/**
+ * Checks that messages formatted on the logging thread from captured arguments
+ * match what printf would have produced on the calling thread
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+
+static char last_line[2048];
+static int line_count = 0;
+
+static void capture_sink(int category, int level, const char *text, int newline)
+{
+    snprintf(last_line, sizeof(last_line), "%s", text);
+    line_count++;
+}
+
+static int fail_count = 0;
+
+#define CHECK_FORMAT(format, ...) \
+    do { \
+        char expected[2048]; \
+        snprintf(expected, sizeof(expected), format __VA_OPT__(,) __VA_ARGS__); \
+        log_write(NULL, VANILLA_LOG_GENERAL, VANILLA_LOG_LEVEL_INFO, format __VA_OPT__(,) __VA_ARGS__); \
+        log_flush(); \
+        if (strcmp(expected, last_line)) { \
+            printf("FAIL: \"%s\" gave \"%s\", expected \"%s\"\n", format, last_line, expected); \
+            fail_count++; \
+        } \
+    } while (0)
+
+int main()
+{
+    log_set_sink(capture_sink);
+    log_init();
+
+    CHECK_FORMAT("plain text");
+    CHECK_FORMAT("100%% done");
+    CHECK_FORMAT("%d %i %u", -42, 17, 4000000000u);
+    CHECK_FORMAT("%hhd %hd %hhu %hu", -5, -300, 250, 65000);
+    CHECK_FORMAT("%ld %lu %lld %llu", -123456789L, 123456789UL, -1234567890123LL, 18446744073709551615ULL);
+    CHECK_FORMAT("%zu %zd %jd %td", (size_t) 99, (ptrdiff_t) -99, (intmax_t) -7, (ptrdiff_t) 12);
+    CHECK_FORMAT("%x %X %o %#x %08X", 0xbeef, 0xBEEF, 8, 255, 0xABC);
+    CHECK_FORMAT("[%5d] [%-5d] [%+d] [% d] [%05d]", 42, 42, 42, 42, 42);
+    CHECK_FORMAT("[%*d] [%-*d] [%*d]", 6, 1, 6, 2, -6, 3);
+    CHECK_FORMAT("%c%c%c", 'a', 'b', 'c');
+    CHECK_FORMAT("%s and %s", "first", "second");
+    CHECK_FORMAT("[%10s] [%-10s] [%.3s] [%.*s]", "right", "left", "truncate", 2, "star");
+    CHECK_FORMAT("%f %.2f %e %g %G %a", 3.14159, 2.5, 12345.678, 0.0001, 1e20, 1.0);
+    CHECK_FORMAT("%8.3f|%-8.1f|%+.0f", 3.14159, -2.25, 9.5);
+    CHECK_FORMAT("%p", (void *) 0x1234);
+
+    // Passing NULL for %s is undefined for printf, so there's nothing to compare
+    // against, but the logging thread shouldn't crash on it. It's volatile so
+    // the compiler doesn't see the NULL and warn about it.
+    const char *volatile null_string = NULL;
+    log_write(NULL, VANILLA_LOG_GENERAL, VANILLA_LOG_LEVEL_INFO, "[%s]", null_string);
+    log_flush();
+    if (strcmp(last_line, "[(null)]")) {
+        printf("FAIL: NULL string gave \"%s\"\n", last_line);
+        fail_count++;
+    }
+
+    // Strings that aren't terminated within their precision
+    char unterminated[4] = {'a', 'b', 'c', 'd'};
+    CHECK_FORMAT("%.*s!", 4, unterminated);
+
+    // More arguments than are captured are left unformatted, so just make sure
+    // the ones that were captured came out right
+    log_write(NULL, VANILLA_LOG_GENERAL, VANILLA_LOG_LEVEL_INFO, "%d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18);
+    log_flush();
+    if (strncmp(last_line, "1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 ", 39)) {
+        printf("FAIL: too many arguments gave \"%s\"\n", last_line);
+        fail_count++;
+    }
+
+    // Disabled levels never reach the sink
+    log_set_level(-1, VANILLA_LOG_LEVEL_WARN);
+    int before = line_count;
+    VLOG_INFO(VANILLA_LOG_VIDEO, "should be filtered %d", 1);
+    VLOG_WARN(VANILLA_LOG_VIDEO, "should be logged %d", 2);
+    log_flush();
+    if (line_count != before + 1 || strcmp(last_line, "should be logged 2")) {
+        printf("FAIL: level filtering gave %d lines, last \"%s\"\n", line_count - before, last_line);
+        fail_count++;
+    }
+
+    // Repeats from one callsite are limited
+    log_set_level(-1, VANILLA_LOG_LEVEL_INFO);
+    before = line_count;
+    for (int i = 0; i < 1000; i++) {
+        VLOG_INFO(VANILLA_LOG_VIDEO, "repeated %d", i);
+    }
+    log_flush();
+    if (line_count - before > 20) {
+        printf("FAIL: rate limiting let %d of 1000 messages through\n", line_count - before);
+        fail_count++;
+    }
+
+    // Warnings get a much bigger budget, so a burst of failures isn't hidden
+    before = line_count;
+    for (int i = 0; i < 100; i++) {
+        VLOG_WARN(VANILLA_LOG_VIDEO, "failed %d", i);
+    }
+    log_flush();
+    if (line_count - before != 100) {
+        printf("FAIL: rate limiting let %d of 100 warnings through\n", line_count - before);
+        fail_count++;
+    }
+
+    if (fail_count) {
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
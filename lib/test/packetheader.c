@@ -0,0 +1,146 @@
+/**
+ * Checks the packet header codecs against known-good wire bytes, and that every
+ * field survives a round trip
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gamepad/packet.h"
+#include "random.h"
+
+static int fail_count = 0;
+
+static void check_bytes(const char *name, const uint8_t *got, const uint8_t *expected, size_t size)
+{
+    if (memcmp(got, expected, size)) {
+        printf("FAIL: %s encoded as", name);
+        for (size_t i = 0; i < size; i++) {
+            printf(" %02x", got[i]);
+        }
+        printf(", expected");
+        for (size_t i = 0; i < size; i++) {
+            printf(" %02x", expected[i]);
+        }
+        printf("\n");
+        fail_count++;
+    }
+}
+
+static void check_field(const char *name, uint32_t got, uint32_t expected)
+{
+    if (got != expected) {
+        printf("FAIL: %s decoded as %u, expected %u\n", name, got, expected);
+        fail_count++;
+    }
+}
+
+static void golden_video()
+{
+    // Alternating bit patterns so a field shifted by one lands on the wrong value
+    static const uint8_t wire[VIDEO_HEADER_SIZE] = {0xf5, 0x55, 0xac, 0xab, 0x12, 0x34, 0x56, 0x78};
+
+    VideoHeader h;
+    decode_video_header(wire, &h);
+    check_field("video magic", h.magic, 0xF);
+    check_field("video packet_type", h.packet_type, 1);
+    check_field("video seq_id", h.seq_id, 0x155);
+    check_field("video init", h.init, 1);
+    check_field("video frame_begin", h.frame_begin, 0);
+    check_field("video chunk_end", h.chunk_end, 1);
+    check_field("video frame_end", h.frame_end, 0);
+    check_field("video has_timestamp", h.has_timestamp, 1);
+    check_field("video payload_size", h.payload_size, 0x4AB);
+    check_field("video timestamp", h.timestamp, 0x12345678);
+    check_field("video peeked frame_begin", video_header_frame_begin(wire), 0);
+    check_field("video peeked payload_size", video_header_payload_size(wire), 0x4AB);
+
+    uint8_t out[VIDEO_HEADER_SIZE];
+    encode_video_header(&h, out);
+    check_bytes("video header", out, wire, sizeof(wire));
+
+    // First packet of a frame, as the console sends it
+    static const uint8_t first[VIDEO_HEADER_SIZE] = {0x00, 0x7b, 0x4d, 0x78, 0x00, 0x00, 0x00, 0x00};
+    VideoHeader f = {0};
+    f.seq_id = 123;
+    f.frame_begin = 1;
+    f.has_timestamp = 1;
+    f.payload_size = 1400;
+    encode_video_header(&f, out);
+    check_bytes("first video packet", out, first, sizeof(first));
+    check_field("video peeked frame_begin", video_header_frame_begin(out), 1);
+}
+
+static void golden_audio()
+{
+    static const uint8_t wire[AUDIO_HEADER_SIZE] = {0xd6, 0xab, 0x12, 0x34, 0x89, 0xab, 0xcd, 0xef};
+
+    AudioHeader h;
+    decode_audio_header(wire, &h);
+    check_field("audio format", h.format, 6);
+    check_field("audio mono", h.mono, 1);
+    check_field("audio vibrate", h.vibrate, 0);
+    check_field("audio type", h.type, 1);
+    check_field("audio seq_id", h.seq_id, 0x2AB);
+    check_field("audio payload_size", h.payload_size, 0x1234);
+    check_field("audio timestamp", h.timestamp, 0x89ABCDEF);
+
+    uint8_t out[AUDIO_HEADER_SIZE];
+    encode_audio_header(&h, out);
+    check_bytes("audio header", out, wire, sizeof(wire));
+
+    // Microphone packet as sent by handle_queued_audio()
+    static const uint8_t mic[AUDIO_HEADER_SIZE] = {0xd0, 0x05, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
+    AudioHeader m = {0};
+    m.format = 6;
+    m.mono = 1;
+    m.seq_id = 5;
+    m.payload_size = 512;
+    encode_audio_header(&m, out);
+    check_bytes("mic audio packet", out, mic, sizeof(mic));
+}
+
+static void round_trip()
+{
+    seed_random(0x12345678);
+
+    for (int i = 0; i < 100000; i++) {
+        uint8_t wire[VIDEO_HEADER_SIZE];
+        for (size_t j = 0; j < sizeof(wire); j++) {
+            wire[j] = next_random();
+        }
+
+        // Every bit of the header belongs to a field, so any bytes round trip
+        VideoHeader v;
+        uint8_t out[VIDEO_HEADER_SIZE];
+        decode_video_header(wire, &v);
+        encode_video_header(&v, out);
+        if (memcmp(wire, out, sizeof(wire))) {
+            check_bytes("random video header", out, wire, sizeof(wire));
+            return;
+        }
+
+        AudioHeader a;
+        decode_audio_header(wire, &a);
+        encode_audio_header(&a, out);
+        if (memcmp(wire, out, sizeof(wire))) {
+            check_bytes("random audio header", out, wire, sizeof(wire));
+            return;
+        }
+    }
+}
+
+int main()
+{
+    golden_video();
+    golden_audio();
+    round_trip();
+
+    if (fail_count) {
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef VANILLA_TEST_RANDOM_H
+#define VANILLA_TEST_RANDOM_H
+
+#include <stdint.h>
+
+// xorshift32, so tests and benchmarks get the same inputs on every run and
+// every platform. Each of them is a single file, so the state isn't shared.
+static uint32_t rng_state = 0x9e3779b9;
+
+static inline void seed_random(uint32_t seed)
+{
+    // xorshift can't start at 0
+    rng_state = seed ? seed : 0x9e3779b9;
+}
+
+static inline uint32_t next_random()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+#endif // VANILLA_TEST_RANDOM_H
@@ -0,0 +1,100 @@
+// vanilla-replay - feeds a capture recorded with vanilla_set_capture_file()
+// (or VANILLA_CAPTURE_FILE) back through libvanilla and summarizes what came
+// out the other end
+//
+// By default the capture is replayed as fast as possible, which makes this a
+// throughput benchmark for the packet parsing and frame reassembly code. Pass
+// -realtime to replay at the original timing instead, e.g. to reproduce a bug
+// that depends on when packets arrived.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "vanilla.h"
+
+static void quiet_logger(const char *format, va_list args)
+{
+}
+
+int main(int argc, const char **argv)
+{
+    const char *path = NULL;
+    int realtime = 0;
+    int verbose = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-realtime")) {
+            realtime = 1;
+        } else if (!strcmp(argv[i], "-verbose")) {
+            verbose = 1;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if (!path) {
+        printf("Usage: %s [-realtime] [-verbose] <capture>\n", argv[0]);
+        return 1;
+    }
+
+    if (!verbose) {
+        vanilla_install_logger(quiet_logger);
+    }
+
+    int ret = vanilla_start_replay(path, realtime);
+    if (ret != VANILLA_SUCCESS) {
+        printf("Failed to start replay: %i\n", ret);
+        return 1;
+    }
+
+    size_t video_frames = 0, idr_frames = 0, video_bytes = 0;
+    size_t audio_packets = 0, audio_bytes = 0, vibrate_events = 0;
+    uint64_t start = get_monotonic_nanos();
+
+    int result = 0;
+
+    vanilla_event_t event;
+    while (vanilla_wait_event(&event)) {
+        if (event.type == VANILLA_EVENT_VIDEO) {
+            video_frames++;
+            video_bytes += event.size;
+
+            // IDR frames are prefixed with the SPS
+            if (event.size > 4 && (event.data[4] & 0x1F) == 7) {
+                idr_frames++;
+            }
+        } else if (event.type == VANILLA_EVENT_AUDIO) {
+            audio_packets++;
+            audio_bytes += event.size;
+        } else if (event.type == VANILLA_EVENT_VIBRATE) {
+            vibrate_events++;
+        } else if (event.type == VANILLA_EVENT_ERROR) {
+            int err = *(int *) event.data;
+            if (err != VANILLA_ERR_CONNECTED) {
+                if (err != VANILLA_ERR_DISCONNECTED) {
+                    printf("Replay failed: %i\n", err);
+                    result = 1;
+                }
+                vanilla_free_event(&event);
+                break;
+            }
+        }
+
+        vanilla_free_event(&event);
+    }
+
+    double seconds = (get_monotonic_nanos() - start) / 1000000000.0;
+
+    vanilla_stop();
+
+    printf("video: %zu frames (%zu IDR), %zu bytes\n", video_frames, idr_frames, video_bytes);
+    printf("audio: %zu packets, %zu bytes, %zu vibrate events\n", audio_packets, audio_bytes, vibrate_events);
+    if (seconds > 0) {
+        printf("elapsed: %.3f s, %.1f frames/s, %.2f MB/s of video\n",
+               seconds, video_frames / seconds, video_bytes / seconds / 1000000.0);
+    }
+
+    return result;
+}
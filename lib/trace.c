@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "util.h"
+#include "vanilla.h"
+
+// Each thread that records an event claims one of these rings and is the only
+// writer to it, so recording never locks or allocates. Rings of threads that
+// have exited are reused by new ones.
+#define TRACE_MAX_THREADS 16
+#define TRACE_RING_SIZE 8192
+
+enum {
+    TRACE_RING_FREE,
+    TRACE_RING_ACTIVE,
+    TRACE_RING_RETIRED,
+};
+
+typedef struct
+{
+    uint64_t timestamp;
+    uint64_t duration;
+    const char *name;
+    uint32_t frame;
+    char phase;
+} trace_event_t;
+
+typedef struct
+{
+    _Atomic int state;
+    _Atomic uint64_t head;
+    int tid;
+    char thread_name[32];
+    trace_event_t *events;
+} trace_ring_t;
+
+static trace_ring_t trace_rings[TRACE_MAX_THREADS];
+static _Atomic int trace_enabled = 0;
+static _Atomic int trace_next_tid = 1;
+static pthread_key_t trace_ring_key;
+static pthread_once_t trace_init_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t trace_alloc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int trace_allocated = 0;
+static const char *trace_session_path = NULL;
+
+static void retire_ring(void *data)
+{
+    trace_ring_t *ring = (trace_ring_t *) data;
+    atomic_store(&ring->state, TRACE_RING_RETIRED);
+}
+
+static void init_trace_key()
+{
+    pthread_key_create(&trace_ring_key, retire_ring);
+}
+
+static trace_ring_t *claim_ring()
+{
+    // Prefer rings that were never used so exited threads stay in the dump
+    static const int claimable[] = {TRACE_RING_FREE, TRACE_RING_RETIRED};
+
+    for (int c = 0; c < 2; c++) {
+        for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+            trace_ring_t *ring = &trace_rings[i];
+            int expected = claimable[c];
+            if (atomic_compare_exchange_strong(&ring->state, &expected, TRACE_RING_ACTIVE)) {
+                atomic_store(&ring->head, 0);
+                ring->tid = atomic_fetch_add(&trace_next_tid, 1);
+                ring->thread_name[0] = 0;
+#if defined(__linux__) && !defined(ANDROID)
+                pthread_getname_np(pthread_self(), ring->thread_name, sizeof(ring->thread_name));
+#endif
+                pthread_setspecific(trace_ring_key, ring);
+                return ring;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void record(const char *name, uint32_t frame, char phase, uint64_t timestamp, uint64_t duration)
+{
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+        return;
+    }
+
+    trace_ring_t *ring = (trace_ring_t *) pthread_getspecific(trace_ring_key);
+    if (!ring) {
+        ring = claim_ring();
+        if (!ring) {
+            // Out of rings, drop the event
+            return;
+        }
+    }
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    trace_event_t *ev = &ring->events[head % TRACE_RING_SIZE];
+    ev->timestamp = timestamp;
+    ev->duration = duration;
+    ev->name = name;
+    ev->frame = frame;
+    ev->phase = phase;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void trace_set_enabled(int enabled)
+{
+    pthread_once(&trace_init_once, init_trace_key);
+
+    if (enabled) {
+        pthread_mutex_lock(&trace_alloc_mutex);
+        if (!trace_allocated) {
+            // Allocated once and kept for the lifetime of the process, since
+            // other threads may still be recording into them
+            for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+                trace_rings[i].events = malloc(sizeof(trace_event_t) * TRACE_RING_SIZE);
+                if (!trace_rings[i].events) {
+                    pthread_mutex_unlock(&trace_alloc_mutex);
+                    VLOG_ERROR(VANILLA_LOG_GENERAL, "Failed to allocate trace buffers");
+                    return;
+                }
+            }
+            trace_allocated = 1;
+        }
+        pthread_mutex_unlock(&trace_alloc_mutex);
+    }
+
+    atomic_store(&trace_enabled, enabled ? 1 : 0);
+}
+
+int trace_is_enabled()
+{
+    return atomic_load_explicit(&trace_enabled, memory_order_relaxed);
+}
+
+void trace_begin(const char *name, uint32_t frame)
+{
+    record(name, frame, 'B', get_monotonic_nanos(), 0);
+}
+
+void trace_end(const char *name, uint32_t frame)
+{
+    record(name, frame, 'E', get_monotonic_nanos(), 0);
+}
+
+void trace_instant(const char *name, uint32_t frame)
+{
+    record(name, frame, 'i', get_monotonic_nanos(), 0);
+}
+
+void trace_complete(const char *name, uint32_t frame, uint64_t start)
+{
+    uint64_t now = get_monotonic_nanos();
+    record(name, frame, 'X', start, now > start ? now - start : 0);
+}
+
+int trace_dump(const char *path)
+{
+    pthread_mutex_lock(&trace_alloc_mutex);
+    int allocated = trace_allocated;
+    pthread_mutex_unlock(&trace_alloc_mutex);
+
+    if (!allocated) {
+        return VANILLA_ERR_INVALID_ARGUMENT;
+    }
+
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        VLOG_ERROR(VANILLA_LOG_GENERAL, "Failed to open trace file %s", path);
+        return VANILLA_ERR_INVALID_ARGUMENT;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    int first = 1;
+    for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+        trace_ring_t *ring = &trace_rings[i];
+        if (atomic_load(&ring->state) == TRACE_RING_FREE) {
+            continue;
+        }
+
+        // Events being written during the dump may be torn, which is fine for
+        // a diagnostic, but it's best to dump after the threads are done
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t start = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+        fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", ring->tid, ring->thread_name[0] ? ring->thread_name : "thread");
+        first = 0;
+
+        for (uint64_t j = start; j < head; j++) {
+            const trace_event_t *ev = &ring->events[j % TRACE_RING_SIZE];
+
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"vanilla\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%i",
+                    ev->name, ev->phase, ev->timestamp / 1000.0, ring->tid);
+            if (ev->phase == 'X') {
+                fprintf(file, ",\"dur\":%.3f", ev->duration / 1000.0);
+            } else if (ev->phase == 'i') {
+                fprintf(file, ",\"s\":\"t\"");
+            }
+            fprintf(file, ",\"args\":{\"frame\":%u}}", ev->frame);
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    return VANILLA_SUCCESS;
+}
+
+void trace_session_start()
+{
+    trace_session_path = getenv("VANILLA_TRACE_FILE");
+    if (trace_session_path && trace_session_path[0]) {
+        trace_set_enabled(1);
+    } else {
+        trace_session_path = NULL;
+    }
+}
+
+void trace_session_end()
+{
+    if (trace_session_path) {
+        if (trace_dump(trace_session_path) == VANILLA_SUCCESS) {
+            VLOG_INFO(VANILLA_LOG_GENERAL, "Wrote trace to %s", trace_session_path);
+        }
+        trace_session_path = NULL;
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef VANILLA_TRACE_H
+#define VANILLA_TRACE_H
+
+#include <stdint.h>
+
+void trace_set_enabled(int enabled);
+int trace_is_enabled();
+void trace_begin(const char *name, uint32_t frame);
+void trace_end(const char *name, uint32_t frame);
+void trace_instant(const char *name, uint32_t frame);
+void trace_complete(const char *name, uint32_t frame, uint64_t start);
+int trace_dump(const char *path);
+
+// Enables tracing if VANILLA_TRACE_FILE is set, and dumps to it when done
+void trace_session_start();
+void trace_session_end();
+
+#endif // VANILLA_TRACE_H
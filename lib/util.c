@@ -1,25 +1,36 @@
 #include "util.h"
 
+#include <errno.h>
 #include <math.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "log.h"
 #include "vanilla.h"
 
 // TODO: Static variables are undesirable
 int interrupted = 0;
 
+// Logging isn't async-signal-safe, so the handler only leaves this for the
+// next is_interrupted() call to report
+static _Atomic int interrupt_signalled = 0;
+
 void interrupt_handler(int signum)
 {
-    vanilla_log("INTERRUPT SIGNAL RECEIVED, CANCELLING...");
     interrupted = 1;
+    atomic_store(&interrupt_signalled, 1);
 }
 
 int is_interrupted()
 {
+    if (atomic_load_explicit(&interrupt_signalled, memory_order_relaxed) && atomic_exchange(&interrupt_signalled, 0)) {
+        VLOG_INFO(VANILLA_LOG_GENERAL, "INTERRUPT SIGNAL RECEIVED, CANCELLING...");
+    }
     return interrupted;
 }
 
@@ -44,15 +55,78 @@ void uninstall_interrupt_handler()
     signal(SIGINT, SIG_DFL);
 }
 
-uint16_t crc16(const void *data, size_t len)
+//
+// CRC-16 with reflected polynomial 0x8408 (x^16 + x^12 + x^5 + 1)
+//
+// crc16_slice8() processes 8 bytes per step using eight 256-entry tables.
+// For longer buffers, crc16_clmul() folds 16-byte blocks together with
+// carry-less multiplication (PCLMULQDQ on x86, PMULL on AArch64) and only
+// runs the final 16 bytes through the tables.
+//
+static uint16_t crc16_table[8][256];
+static int crc16_clmul_available = 0;
+static pthread_once_t crc16_once = PTHREAD_ONCE_INIT;
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CRC16_CLMUL_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC16_CLMUL_ARM
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+// Fold constants, x^n mod P bit-reflected into the top of a 64-bit word. Each
+// is one less than the fold distance because the product of two reflected
+// 64-bit values comes out shifted down by one bit.
+#define CRC16_K575 0x9822000000000000ULL // Fold by 512 bits, first half
+#define CRC16_K511 0x7f90000000000000ULL // Fold by 512 bits, second half
+#define CRC16_K191 0xa95d000000000000ULL // Fold by 128 bits, first half
+#define CRC16_K127 0x7eea000000000000ULL // Fold by 128 bits, second half
+
+// Below this, folding doesn't pay for itself
+#define CRC16_CLMUL_MIN_LEN 64
+
+static void crc16_init()
 {
-    const uint8_t *src = data;
-    uint16_t crc = 0xffff;
+    for (int b = 0; b < 256; b++) {
+        uint16_t crc = b;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0x8408 : 0);
+        }
+        crc16_table[0][b] = crc;
+    }
 
-    if (len == 0) {
-        return crc;
+    // Table k gives the CRC of a byte followed by k zero bytes
+    for (int k = 1; k < 8; k++) {
+        for (int b = 0; b < 256; b++) {
+            uint16_t prev = crc16_table[k - 1][b];
+            crc16_table[k][b] = (prev >> 8) ^ crc16_table[0][prev & 0xFF];
+        }
     }
 
+#if defined(CRC16_CLMUL_X86)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        crc16_clmul_available = (ecx & bit_PCLMUL) && (edx & bit_SSE2);
+    }
+#elif defined(CRC16_CLMUL_ARM)
+#if defined(__APPLE__)
+    crc16_clmul_available = 1;
+#elif defined(__linux__)
+    crc16_clmul_available = (getauxval(AT_HWCAP) & HWCAP_PMULL) != 0;
+#endif
+#endif
+}
+
+uint16_t crc16_bitwise(uint16_t crc, const void *data, size_t len)
+{
+    const uint8_t *src = data;
+
     while (len--) {
         crc ^= *src++;
         for (int i = 0; i < 8; i++) {
@@ -64,6 +138,168 @@ uint16_t crc16(const void *data, size_t len)
     return crc;
 }
 
+uint16_t crc16_slice8(uint16_t crc, const void *data, size_t len)
+{
+    pthread_once(&crc16_once, crc16_init);
+
+    const uint8_t *src = data;
+
+    while (len >= 8) {
+        uint32_t lo = (src[0] | (src[1] << 8) | ((uint32_t) src[2] << 16) | ((uint32_t) src[3] << 24)) ^ crc;
+        uint32_t hi = src[4] | (src[5] << 8) | ((uint32_t) src[6] << 16) | ((uint32_t) src[7] << 24);
+        crc = crc16_table[7][lo & 0xFF]
+            ^ crc16_table[6][(lo >> 8) & 0xFF]
+            ^ crc16_table[5][(lo >> 16) & 0xFF]
+            ^ crc16_table[4][lo >> 24]
+            ^ crc16_table[3][hi & 0xFF]
+            ^ crc16_table[2][(hi >> 8) & 0xFF]
+            ^ crc16_table[1][(hi >> 16) & 0xFF]
+            ^ crc16_table[0][hi >> 24];
+        src += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = (crc >> 8) ^ crc16_table[0][(crc ^ *src++) & 0xFF];
+    }
+
+    return crc;
+}
+
+#if defined(CRC16_CLMUL_X86)
+
+__attribute__((target("pclmul,sse2")))
+static inline __m128i crc16_fold_block(__m128i x, __m128i k, __m128i next)
+{
+    __m128i a = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i b = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(a, b), next);
+}
+
+__attribute__((target("pclmul,sse2")))
+static uint16_t crc16_fold(uint16_t crc, const uint8_t *src, size_t len)
+{
+    const __m128i k512 = _mm_set_epi64x(CRC16_K511, CRC16_K575);
+    const __m128i k128 = _mm_set_epi64x(CRC16_K127, CRC16_K191);
+
+    // Feeding the initial value into the first bytes is equivalent to
+    // starting the register with it
+    __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) src), _mm_cvtsi32_si128(crc));
+    __m128i x1 = _mm_loadu_si128((const __m128i *) (src + 16));
+    __m128i x2 = _mm_loadu_si128((const __m128i *) (src + 32));
+    __m128i x3 = _mm_loadu_si128((const __m128i *) (src + 48));
+    src += 64;
+    len -= 64;
+
+    // Four independent lanes, so the multiplies can overlap
+    while (len >= 64) {
+        x0 = crc16_fold_block(x0, k512, _mm_loadu_si128((const __m128i *) src));
+        x1 = crc16_fold_block(x1, k512, _mm_loadu_si128((const __m128i *) (src + 16)));
+        x2 = crc16_fold_block(x2, k512, _mm_loadu_si128((const __m128i *) (src + 32)));
+        x3 = crc16_fold_block(x3, k512, _mm_loadu_si128((const __m128i *) (src + 48)));
+        src += 64;
+        len -= 64;
+    }
+
+    __m128i x = crc16_fold_block(x0, k128, x1);
+    x = crc16_fold_block(x, k128, x2);
+    x = crc16_fold_block(x, k128, x3);
+
+    while (len >= 16) {
+        x = crc16_fold_block(x, k128, _mm_loadu_si128((const __m128i *) src));
+        src += 16;
+        len -= 16;
+    }
+
+    // What's left is congruent to everything so far, so its CRC is the CRC
+    uint8_t remainder[16];
+    _mm_storeu_si128((__m128i *) remainder, x);
+    crc = crc16_slice8(0, remainder, sizeof(remainder));
+
+    return crc16_slice8(crc, src, len);
+}
+
+#elif defined(CRC16_CLMUL_ARM)
+
+#ifdef __clang__
+#define CRC16_PMULL_TARGET __attribute__((target("aes")))
+#else
+#define CRC16_PMULL_TARGET __attribute__((target("+crypto")))
+#endif
+
+CRC16_PMULL_TARGET
+static inline uint64x2_t crc16_fold_block(uint64x2_t x, uint64_t k_lo, uint64_t k_hi, uint64x2_t next)
+{
+    uint64x2_t a = vreinterpretq_u64_p128(vmull_p64((poly64_t) vgetq_lane_u64(x, 0), (poly64_t) k_lo));
+    uint64x2_t b = vreinterpretq_u64_p128(vmull_p64((poly64_t) vgetq_lane_u64(x, 1), (poly64_t) k_hi));
+    return veorq_u64(veorq_u64(a, b), next);
+}
+
+CRC16_PMULL_TARGET
+static uint16_t crc16_fold(uint16_t crc, const uint8_t *src, size_t len)
+{
+    // See the x86 version above for how this works
+    uint64x2_t x0 = veorq_u64(vreinterpretq_u64_u8(vld1q_u8(src)), vsetq_lane_u64(crc, vdupq_n_u64(0), 0));
+    uint64x2_t x1 = vreinterpretq_u64_u8(vld1q_u8(src + 16));
+    uint64x2_t x2 = vreinterpretq_u64_u8(vld1q_u8(src + 32));
+    uint64x2_t x3 = vreinterpretq_u64_u8(vld1q_u8(src + 48));
+    src += 64;
+    len -= 64;
+
+    while (len >= 64) {
+        x0 = crc16_fold_block(x0, CRC16_K575, CRC16_K511, vreinterpretq_u64_u8(vld1q_u8(src)));
+        x1 = crc16_fold_block(x1, CRC16_K575, CRC16_K511, vreinterpretq_u64_u8(vld1q_u8(src + 16)));
+        x2 = crc16_fold_block(x2, CRC16_K575, CRC16_K511, vreinterpretq_u64_u8(vld1q_u8(src + 32)));
+        x3 = crc16_fold_block(x3, CRC16_K575, CRC16_K511, vreinterpretq_u64_u8(vld1q_u8(src + 48)));
+        src += 64;
+        len -= 64;
+    }
+
+    uint64x2_t x = crc16_fold_block(x0, CRC16_K191, CRC16_K127, x1);
+    x = crc16_fold_block(x, CRC16_K191, CRC16_K127, x2);
+    x = crc16_fold_block(x, CRC16_K191, CRC16_K127, x3);
+
+    while (len >= 16) {
+        x = crc16_fold_block(x, CRC16_K191, CRC16_K127, vreinterpretq_u64_u8(vld1q_u8(src)));
+        src += 16;
+        len -= 16;
+    }
+
+    uint8_t remainder[16];
+    vst1q_u8(remainder, vreinterpretq_u8_u64(x));
+    crc = crc16_slice8(0, remainder, sizeof(remainder));
+
+    return crc16_slice8(crc, src, len);
+}
+
+#endif
+
+int crc16_clmul_supported()
+{
+    pthread_once(&crc16_once, crc16_init);
+    return crc16_clmul_available;
+}
+
+uint16_t crc16_clmul(uint16_t crc, const void *data, size_t len)
+{
+#if defined(CRC16_CLMUL_X86) || defined(CRC16_CLMUL_ARM)
+    if (len >= CRC16_CLMUL_MIN_LEN && crc16_clmul_supported()) {
+        return crc16_fold(crc, data, len);
+    }
+#endif
+    return crc16_slice8(crc, data, len);
+}
+
+uint16_t crc16_update(uint16_t crc, const void *data, size_t len)
+{
+    return crc16_clmul(crc, data, len);
+}
+
+uint16_t crc16(const void *data, size_t len)
+{
+    return crc16_update(CRC16_INIT, data, len);
+}
+
 size_t get_millis()
 {
     size_t            ms; // Milliseconds
@@ -82,27 +318,79 @@ size_t get_millis()
     return (s * 1000) + ms;
 }
 
+uint64_t get_monotonic_nanos()
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t) spec.tv_sec * 1000000000ULL + spec.tv_nsec;
+}
+
+void sleep_until_nanos(uint64_t deadline)
+{
+#ifdef TIMER_ABSTIME
+    // Sleep against an absolute deadline so scheduling jitter doesn't accumulate
+    struct timespec spec;
+    spec.tv_sec = deadline / 1000000000ULL;
+    spec.tv_nsec = deadline % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL) == EINTR) {
+    }
+#else
+    // No absolute sleep available (e.g. macOS), fall back to sleeping for the remainder
+    uint64_t now = get_monotonic_nanos();
+    if (deadline > now) {
+        struct timespec spec;
+        uint64_t remaining = deadline - now;
+        spec.tv_sec = remaining / 1000000000ULL;
+        spec.tv_nsec = remaining % 1000000000ULL;
+        nanosleep(&spec, NULL);
+    }
+#endif
+}
+
+#if defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_RBIT
+#else
+// Byte bit-reversal table, generated by the preprocessor
+#define R2(n) n, n + 2*64, n + 1*64, n + 3*64
+#define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
+#define R6(n) R4(n), R4(n + 2*4), R4(n + 1*4), R4(n + 3*4)
+static const uint8_t bit_reverse_table[256] = { R6(0), R6(2), R6(1), R6(3) };
+#undef R2
+#undef R4
+#undef R6
+#endif
+
 uint32_t reverse_bits(uint32_t b, int bit_count)
 {
-    uint32_t mask = 0b11111111111111110000000000000000;
-    b = (b & mask) >> 16 | (b & ~mask) << 16;
-    mask = 0b11111111000000001111111100000000;
-    b = (b & mask) >> 8 | (b & ~mask) << 8;
-    mask = 0b11110000111100001111000011110000;
-    b = (b & mask) >> 4 | (b & ~mask) << 4;
-    mask = 0b11001100110011001100110011001100;
-    b = (b & mask) >> 2 | (b & ~mask) << 2;
-    mask = 0b10101010101010101010101010101010;
-    b = (b & mask) >> 1 | (b & ~mask) << 1;
+#ifdef HAVE_RBIT
+    __asm__("rbit %w0, %w1" : "=r"(b) : "r"(b));
+#else
+    b = ((uint32_t) bit_reverse_table[b & 0xFF] << 24)
+        | ((uint32_t) bit_reverse_table[(b >> 8) & 0xFF] << 16)
+        | ((uint32_t) bit_reverse_table[(b >> 16) & 0xFF] << 8)
+        | bit_reverse_table[b >> 24];
+#endif
 
     b >>= 32 - bit_count;
     return b;
 }
 
-void print_hex(const void *data, size_t len)
+void print_hex(int category, const void *data, size_t len)
 {
+    if (!LOG_ENABLED(category, VANILLA_LOG_LEVEL_DEBUG)) {
+        return;
+    }
+
+    // Formatted as one line rather than a log call per byte
+    static const char digits[] = "0123456789ABCDEF";
+    char line[513];
     const unsigned char *c = (const unsigned char *) data;
-    for (size_t i = 0; i < len; i++) {
-        vanilla_log_no_newline("%02X", c[i]);
+    size_t count = MIN(len, (sizeof(line) - 1) / 2);
+    for (size_t i = 0; i < count; i++) {
+        line[i * 2] = digits[c[i] >> 4];
+        line[i * 2 + 1] = digits[c[i] & 0xF];
     }
+    line[count * 2] = 0;
+
+    log_write_text(category, VANILLA_LOG_LEVEL_DEBUG, line, 1);
 }
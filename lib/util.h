@@ -20,10 +20,25 @@ void force_interrupt();
 void install_interrupt_handler();
 void uninstall_interrupt_handler();
 size_t get_millis();
+uint64_t get_monotonic_nanos();
+void sleep_until_nanos(uint64_t deadline);
 unsigned int reverse_bits(unsigned int b, int bit_count);
 
-uint16_t crc16(const void* data, size_t len);
+// CRC-16 with reflected polynomial 0x8408 and initial value 0xFFFF, as used
+// by the gamepad's EEPROM. Pass the result of crc16_update() back in to
+// checksum data in pieces.
+#define CRC16_INIT 0xFFFF
+uint16_t crc16(const void *data, size_t len);
+uint16_t crc16_update(uint16_t crc, const void *data, size_t len);
 
-void print_hex(const void *data, size_t len);
+// Individual implementations, for testing and benchmarking. crc16_clmul()
+// falls back to crc16_slice8() when the CPU has no carry-less multiply.
+uint16_t crc16_bitwise(uint16_t crc, const void *data, size_t len);
+uint16_t crc16_slice8(uint16_t crc, const void *data, size_t len);
+uint16_t crc16_clmul(uint16_t crc, const void *data, size_t len);
+int crc16_clmul_supported();
+
+// Logs `data` as hex at debug level
+void print_hex(int category, const void *data, size_t len);
 
 #endif // VANILLA_UTIL_H
\ No newline at end of file
@@ -8,15 +8,21 @@
 
 #include <pthread.h>
 #include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "gamepad/audio.h"
+#include "gamepad/capture.h"
 #include "gamepad/command.h"
 #include "gamepad/gamepad.h"
+#include "gamepad/impair.h"
 #include "gamepad/input.h"
 #include "gamepad/video.h"
+#include "log.h"
+#include "metrics.h"
+#include "trace.h"
 #include "util.h"
 #include "vanilla.h"
 
@@ -34,7 +40,7 @@ void *start_event_loop(void *arg)
         int r = WSAStartup(MAKEWORD(2, 2), &wsaData);
         if (r != 0) {
             char buf[100];
-            vanilla_log("Failed to WSAStartup: %i", r);
+            VLOG_ERROR(VANILLA_LOG_NETWORK, "Failed to WSAStartup: %i", r);
             pthread_mutex_unlock(&main_mutex);
             goto exit;
         }
@@ -54,8 +60,12 @@ void *start_event_loop(void *arg)
 
     data->event_loop = &event_loop;
 
+    trace_session_start();
+
     data->thread_start(data);
 
+    trace_session_end();
+
     free(data);
 
     pthread_mutex_lock(&event_loop.mutex);
@@ -87,6 +97,9 @@ int vanilla_start_internal(uint32_t server_address, vanilla_bssid_t bssid, vanil
     if (pthread_mutex_trylock(&main_mutex) == 0) {
         pthread_t other;
 
+        log_init();
+        init_gamepad_metrics();
+
         thread_data_t *data = malloc(sizeof(thread_data_t));
         data->server_address = server_address;
         data->thread_start = thread_start;
@@ -122,6 +135,25 @@ int vanilla_start(uint32_t server_address, vanilla_bssid_t bssid, vanilla_psk_t
     return vanilla_start_internal(server_address, bssid, psk, connect_as_gamepad_internal, 0);
 }
 
+int vanilla_start_replay(const char *path, int realtime)
+{
+    size_t path_size = strlen(path) + 1;
+    replay_args_t *args = malloc(sizeof(replay_args_t) + path_size);
+    if (!args) {
+        return VANILLA_ERR_OUT_OF_MEMORY;
+    }
+
+    args->realtime = realtime;
+    memcpy(args->path, path, path_size);
+
+    int ret = vanilla_start_internal(0, (vanilla_bssid_t){.bssid = {0}}, (vanilla_psk_t){.psk = {0}}, replay_internal, args);
+    if (ret != VANILLA_SUCCESS) {
+        free(args);
+    }
+
+    return ret;
+}
+
 void vanilla_stop()
 {
     // Signal to all other threads to exit gracefully
@@ -142,23 +174,65 @@ void vanilla_set_touch(int x, int y)
     set_touch_state(x, y);
 }
 
+void vanilla_set_touches(const vanilla_touch_t *points, size_t count)
+{
+    set_touches(points, count);
+}
+
+void vanilla_set_input_state(const vanilla_input_state_t *state)
+{
+    set_input_state(state, VANILLA_INPUT_MASK_ALL);
+}
+
+void vanilla_set_input_state_masked(const vanilla_input_state_t *state, uint64_t mask)
+{
+    set_input_state(state, mask);
+}
+
+void vanilla_set_eager_input(int enabled)
+{
+    set_eager_input(enabled);
+}
+
 void default_logger(const char *format, va_list args)
 {
     vprintf(format, args);
 }
 
 void (*custom_logger)(const char *, va_list) = default_logger;
-void vanilla_log(const char *format, ...)
+
+static void call_custom_logger(const char *format, ...)
 {
     va_list va;
     va_start(va, format);
 
-    if (custom_logger) {
-        custom_logger(format, va);
-        custom_logger("\n", va);
+    void (*logger)(const char *, va_list) = custom_logger;
+    if (logger) {
+        logger(format, va);
+    }
+
+    va_end(va);
+}
+
+static void custom_logger_sink(int category, int level, const char *text, int newline)
+{
+    call_custom_logger(newline ? "%s\n" : "%s", text);
+}
+
+void vanilla_log(const char *format, ...)
+{
+    if (!LOG_ENABLED(VANILLA_LOG_GENERAL, VANILLA_LOG_LEVEL_INFO)) {
+        return;
     }
 
+    // The format string may not outlive this call, so it's formatted here
+    char text[1024];
+    va_list va;
+    va_start(va, format);
+    vsnprintf(text, sizeof(text), format, va);
     va_end(va);
+
+    log_write_text(VANILLA_LOG_GENERAL, VANILLA_LOG_LEVEL_INFO, text, 1);
 }
 
 void vanilla_log_no_newline(const char *format, ...)
@@ -173,14 +247,70 @@ void vanilla_log_no_newline(const char *format, ...)
 
 void vanilla_log_no_newline_va(const char *format, va_list args)
 {
-    if (custom_logger) {
-        custom_logger(format, args);
+    if (!LOG_ENABLED(VANILLA_LOG_GENERAL, VANILLA_LOG_LEVEL_INFO)) {
+        return;
     }
+
+    char text[1024];
+    vsnprintf(text, sizeof(text), format, args);
+
+    log_write_text(VANILLA_LOG_GENERAL, VANILLA_LOG_LEVEL_INFO, text, 0);
 }
 
 void vanilla_install_logger(void (*logger)(const char *, va_list))
 {
     custom_logger = logger;
+    log_set_sink(custom_logger_sink);
+}
+
+void vanilla_set_log_level(int category, int level)
+{
+    log_set_level(category, level);
+}
+
+void vanilla_flush_log()
+{
+    log_flush();
+}
+
+int vanilla_metrics_serve(const char *address)
+{
+    return metrics_serve(address);
+}
+
+void vanilla_metrics_stop()
+{
+    metrics_stop();
+}
+
+int vanilla_metrics_counter(const char *name, const char *help)
+{
+    return metrics_counter(name, help);
+}
+
+int vanilla_metrics_gauge(const char *name, const char *help)
+{
+    return metrics_gauge(name, help);
+}
+
+int vanilla_metrics_histogram(const char *name, const char *help, const double *bounds, size_t bound_count)
+{
+    return metrics_histogram(name, help, bounds, bound_count);
+}
+
+void vanilla_metrics_add(int metric, uint64_t value)
+{
+    metrics_add(metric, value);
+}
+
+void vanilla_metrics_set(int metric, double value)
+{
+    metrics_set(metric, value);
+}
+
+void vanilla_metrics_observe(int metric, double value)
+{
+    metrics_observe(metric, value);
 }
 
 void vanilla_request_idr()
@@ -260,3 +390,58 @@ void vanilla_set_wireless_interface(const char *intf)
 {
     strcpy(wireless_interface, intf);
 }
+
+void vanilla_get_input_stats(vanilla_input_stats_t *stats)
+{
+    get_input_stats(stats);
+}
+
+int vanilla_get_pipe_stats(uint32_t server_address, vanilla_pipe_stats_t *stats)
+{
+    return get_pipe_stats_internal(server_address, stats);
+}
+
+void vanilla_set_capture_file(const char *path)
+{
+    set_capture_file(path);
+}
+
+void vanilla_set_impairment(const vanilla_impairment_t *config)
+{
+    set_impairment(config);
+}
+
+void vanilla_trace_set_enabled(int enabled)
+{
+    trace_set_enabled(enabled);
+}
+
+void vanilla_trace_begin(const char *name, uint32_t frame_id)
+{
+    trace_begin(name, frame_id);
+}
+
+void vanilla_trace_end(const char *name, uint32_t frame_id)
+{
+    trace_end(name, frame_id);
+}
+
+void vanilla_trace_instant(const char *name, uint32_t frame_id)
+{
+    trace_instant(name, frame_id);
+}
+
+uint64_t vanilla_trace_now()
+{
+    return get_monotonic_nanos();
+}
+
+void vanilla_trace_complete(const char *name, uint32_t frame_id, uint64_t start)
+{
+    trace_complete(name, frame_id, start);
+}
+
+int vanilla_trace_dump(const char *path)
+{
+    return trace_dump(path);
+}
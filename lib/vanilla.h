@@ -77,6 +77,27 @@ enum VanillaEvent
 	VANILLA_EVENT_MIC
 };
 
+enum VanillaLogLevel
+{
+    VANILLA_LOG_LEVEL_ERROR,
+    VANILLA_LOG_LEVEL_WARN,
+    VANILLA_LOG_LEVEL_INFO,
+    VANILLA_LOG_LEVEL_DEBUG,
+    VANILLA_LOG_LEVEL_TRACE
+};
+
+enum VanillaLogCategory
+{
+    VANILLA_LOG_GENERAL,
+    VANILLA_LOG_VIDEO,
+    VANILLA_LOG_AUDIO,
+    VANILLA_LOG_INPUT,
+    VANILLA_LOG_COMMAND,
+    VANILLA_LOG_NETWORK,
+    VANILLA_LOG_PIPE,
+    VANILLA_LOG_CATEGORY_COUNT
+};
+
 enum VanillaRegion
 {
     VANILLA_REGION_JAPAN         = 0,
@@ -103,8 +124,86 @@ typedef struct
     int type;
     uint8_t *data;
     size_t size;
+    uint32_t frame_id; // For VANILLA_EVENT_VIDEO, identifies the frame in traces
 } vanilla_event_t;
 
+#define VANILLA_MAX_TOUCH_POINTS 10
+
+typedef struct
+{
+    int x;
+    int y;
+} vanilla_touch_t;
+
+typedef struct
+{
+    int32_t buttons[VANILLA_BTN_COUNT];
+    vanilla_touch_t touches[VANILLA_MAX_TOUCH_POINTS];
+    size_t touch_count;
+} vanilla_input_state_t;
+
+#define VANILLA_INPUT_MASK(button)  (1ULL << (button))
+#define VANILLA_INPUT_MASK_TOUCH    (1ULL << 63)
+#define VANILLA_INPUT_MASK_ALL      (~0ULL)
+
+#define VANILLA_INPUT_HISTOGRAM_BUCKETS     32
+#define VANILLA_INPUT_HISTOGRAM_BUCKET_US   250
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t total_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t missed_deadlines;
+    uint64_t buckets[VANILLA_INPUT_HISTOGRAM_BUCKETS];
+} vanilla_input_stats_t;
+
+// Ports the pipe relays, in the order they appear in vanilla_pipe_stats_t
+enum VanillaRelayPort
+{
+    VANILLA_RELAY_PORT_VID,
+    VANILLA_RELAY_PORT_AUD,
+    VANILLA_RELAY_PORT_MSG,
+    VANILLA_RELAY_PORT_CMD,
+    VANILLA_RELAY_PORT_HID,
+    VANILLA_RELAY_PORT_COUNT
+};
+
+#define VANILLA_RELAY_DWELL_BUCKETS     10
+#define VANILLA_RELAY_DWELL_BUCKET_US   16
+
+// Everything is 64-bit so the layout is the same on every ABI, these are sent
+// over the network as-is (apart from byte order)
+typedef struct
+{
+    uint64_t datagrams;
+    uint64_t bytes;
+    uint64_t send_errors;
+    uint64_t recv_timeouts;
+    uint64_t max_burst;
+    uint64_t dwell[VANILLA_RELAY_DWELL_BUCKETS];
+} vanilla_relay_stats_t;
+
+typedef struct
+{
+    vanilla_relay_stats_t to_frontend[VANILLA_RELAY_PORT_COUNT];
+    vanilla_relay_stats_t to_console[VANILLA_RELAY_PORT_COUNT];
+} vanilla_pipe_stats_t;
+
+typedef struct
+{
+    float loss;             // Probability of dropping a packet
+    float burst_enter;      // Per-packet probability of entering a loss burst (0 disables bursts)
+    float burst_exit;       // Per-packet probability of leaving a loss burst
+    float burst_loss;       // Probability of dropping a packet during a burst
+    float reorder;          // Probability of delivering a packet after the one following it
+    float duplicate;        // Probability of delivering a packet twice
+    uint32_t delay_us;      // Fixed delay added to every packet
+    uint32_t jitter_us;     // Random delay variation (+/-), never reorders packets by itself
+    uint32_t seed;          // Seed for the random generator, same seed gives the same decisions
+} vanilla_impairment_t;
+
 #pragma pack(push, 1)
 typedef struct { unsigned char bssid[6]; } vanilla_bssid_t;
 typedef struct { unsigned char psk[32]; } vanilla_psk_t;
@@ -160,6 +259,51 @@ void vanilla_set_button(int button, int32_t value);
  */
 void vanilla_set_touch(int x, int y);
 
+/**
+ * Set up to VANILLA_MAX_TOUCH_POINTS touch points at once
+ *
+ * This can be called from another thread while vanilla_start() is running.
+ *
+ * The GamePad has a single-touch resistive screen, and the console treats every
+ * touch slot of the input packet as a sample of that one touch. So only the
+ * primary point (the first one that isn't disabled) is sent, in every slot,
+ * exactly like vanilla_set_touch(). Pass fingers in the order they went down
+ * and the rest are ignored. Points follow the same rules as
+ * vanilla_set_touch(), with a `count` of 0 releasing the screen.
+ */
+void vanilla_set_touches(const vanilla_touch_t *points, size_t count);
+
+/**
+ * Replace the whole button/axis/touch state at once
+ *
+ * This can be called from another thread while vanilla_start() is running.
+ *
+ * Values have the same meaning as in vanilla_set_button() and vanilla_set_touches().
+ * The new state is published atomically, so every packet sent to the console
+ * reflects either the previous state or this one, never a mix of both.
+ */
+void vanilla_set_input_state(const vanilla_input_state_t *state);
+
+/**
+ * Atomically replace part of the button/axis/touch state
+ *
+ * Only the buttons/axes whose VANILLA_INPUT_MASK() bit is set in `mask` are
+ * taken from `state`, plus the touch points if VANILLA_INPUT_MASK_TOUCH is set.
+ * Everything else keeps its current value.
+ */
+void vanilla_set_input_state_masked(const vanilla_input_state_t *state, uint64_t mask);
+
+/**
+ * Enable or disable eager input mode
+ *
+ * By default, input is sent to the console on a fixed ~180Hz schedule, so a
+ * change made with vanilla_set_button() or vanilla_set_touch() can wait up to
+ * one tick (~5.5ms) before it's sent. In eager mode, a change wakes the input
+ * thread to send a packet immediately (rate-limited to at most twice the
+ * regular rate), after which the regular schedule continues from that packet.
+ */
+void vanilla_set_eager_input(int enabled);
+
 /**
  * Logging function
  */
@@ -169,9 +313,57 @@ void vanilla_log_no_newline_va(const char *format, va_list args);
 
 /**
  * Install custom logger
+ *
+ * Messages are formatted and handed to the logger on a dedicated logging
+ * thread, one complete line per call.
  */
 void vanilla_install_logger(void (*logger)(const char *, va_list args));
 
+/**
+ * Set the most verbose level logged for a category (VANILLA_LOG_*), or for
+ * all categories if `category` is -1. Defaults to VANILLA_LOG_LEVEL_INFO.
+ *
+ * Levels can also be set with the VANILLA_LOG environment variable, e.g.
+ * VANILLA_LOG=debug or VANILLA_LOG=warn,video=debug,command=trace.
+ * Repeated messages from the same place are limited to a few per second.
+ */
+void vanilla_set_log_level(int category, int level);
+
+/**
+ * Wait until all messages logged so far have reached the logger
+ */
+void vanilla_flush_log();
+
+/**
+ * Serve metrics in Prometheus text format over HTTP
+ *
+ * `address` is "unix:/path/to/socket", "host:port", or just a port to listen
+ * on localhost. The library reports event queue drops and video frame counts,
+ * and frontends can add their own metrics with the functions below.
+ */
+int vanilla_metrics_serve(const char *address);
+void vanilla_metrics_stop();
+
+/**
+ * Register a metric, returning an ID to record it with (or -1 on failure)
+ *
+ * `name` may include Prometheus labels, e.g. `frames_total{kind="dropped"}`,
+ * and registering the same name again returns the same ID. Histogram `bounds`
+ * are the upper bounds of each bucket, in ascending order (at most 16).
+ */
+int vanilla_metrics_counter(const char *name, const char *help);
+int vanilla_metrics_gauge(const char *name, const char *help);
+int vanilla_metrics_histogram(const char *name, const char *help, const double *bounds, size_t bound_count);
+
+/**
+ * Record a metric. These are cheap enough to call per packet or per frame:
+ * each thread records into its own counters, which are only summed when
+ * metrics are scraped.
+ */
+void vanilla_metrics_add(int metric, uint64_t value);
+void vanilla_metrics_set(int metric, double value);
+void vanilla_metrics_observe(int metric, double value);
+
 /**
  * Request an IDR (instant decoder refresh) video frame from the console
  */
@@ -203,6 +395,89 @@ size_t vanilla_generate_h264_header(void *data, size_t size);
  */
 void vanilla_send_audio(const void *data, size_t size);
 
+/**
+ * Retrieve timing statistics for the input packets sent to the console
+ *
+ * `buckets` is a histogram of the interval between consecutive sends, each
+ * bucket covering VANILLA_INPUT_HISTOGRAM_BUCKET_US microseconds (the last
+ * bucket also counts anything longer). The target interval is ~5555us.
+ * Statistics are reset every time a connection is started.
+ */
+void vanilla_get_input_stats(vanilla_input_stats_t *stats);
+
+/**
+ * Retrieve the pipe's relay statistics for each port and direction
+ *
+ * `recv_timeouts` counts every 250ms a port went without receiving anything
+ * and `max_burst` is the most datagrams relayed from one wakeup. `dwell` is a
+ * histogram of the time from the pipe receiving a datagram to sending it on,
+ * bucket `i` covering up to VANILLA_RELAY_DWELL_BUCKET_US << i microseconds
+ * (the last bucket also counts anything longer). Statistics are reset every
+ * time the pipe connects to the console.
+ *
+ * Can be called while connected. Returns VANILLA_ERR_PIPE_UNRESPONSIVE if the
+ * pipe doesn't reply.
+ */
+int vanilla_get_pipe_stats(uint32_t server_address, vanilla_pipe_stats_t *stats);
+
+/**
+ * Record every datagram received from the console to a capture file
+ *
+ * Takes effect from the next vanilla_start(). Each datagram is written before
+ * it's parsed, tagged with its port and a monotonic timestamp. Pass NULL to
+ * stop capturing. If no path is set, the VANILLA_CAPTURE_FILE environment
+ * variable is used instead.
+ */
+void vanilla_set_capture_file(const char *path);
+
+/**
+ * Replay a capture file through the video/audio/command handlers
+ *
+ * Behaves like vanilla_start() against a console that only sends what was
+ * captured: events are delivered through the usual event loop, and a
+ * VANILLA_ERR_DISCONNECTED error is pushed once the capture has been
+ * exhausted. Nothing is sent anywhere.
+ *
+ * If `realtime` is non-zero, packets are fed at their original timing.
+ * Otherwise they're fed as fast as possible.
+ */
+int vanilla_start_replay(const char *path, int realtime);
+
+/**
+ * Impair the video, audio and command traffic received from the console
+ *
+ * Intended for testing loss recovery. Takes effect from the next
+ * vanilla_start(). Pass NULL to go back to the VANILLA_IMPAIR environment
+ * variable, which uses the same field names as comma separated key=value
+ * pairs (with `dup`, `delay` and `jitter` for the last three), e.g.
+ * "loss=0.01,burst_enter=0.005,burst_exit=0.2,burst_loss=0.8,delay=2000,seed=1".
+ * A summary of what was done to each stream is logged every second.
+ */
+void vanilla_set_impairment(const vanilla_impairment_t *config);
+
+/**
+ * Frame lifecycle tracing
+ *
+ * When enabled, trace points throughout the library (and any added by the
+ * frontend) are recorded into per-thread ring buffers, without locking or
+ * allocating. vanilla_trace_dump() writes them as Chrome trace JSON, which
+ * can be opened in chrome://tracing or Perfetto. Events are keyed by the
+ * `frame_id` of the video event they belong to (0 if none).
+ *
+ * Setting the VANILLA_TRACE_FILE environment variable enables tracing for
+ * each vanilla_start() and dumps to that file when it ends.
+ *
+ * `name` must be a string literal (or otherwise outlive the trace), and is
+ * written to the JSON as-is.
+ */
+void vanilla_trace_set_enabled(int enabled);
+void vanilla_trace_begin(const char *name, uint32_t frame_id);
+void vanilla_trace_end(const char *name, uint32_t frame_id);
+void vanilla_trace_instant(const char *name, uint32_t frame_id);
+uint64_t vanilla_trace_now();
+void vanilla_trace_complete(const char *name, uint32_t frame_id, uint64_t start);
+int vanilla_trace_dump(const char *path);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -1,11 +1,21 @@
 #ifndef VANILLA_PIPE_DEF_H
 #define VANILLA_PIPE_DEF_H
 
+#include <string.h>
 #include <vanilla.h>
 
 #define VANILLA_PIPE_CMD_SERVER_PORT 51000
 #define VANILLA_PIPE_CMD_CLIENT_PORT 51100
 
+// Where the frontend listens for VANILLA_PIPE_CC_STATS replies in local mode,
+// so it doesn't need the socket a connection is using
+#define VANILLA_PIPE_STATS_CLIENT_PORT 51101
+
+// With '-frames', the pipe reassembles video next to the console and serves
+// the packets of each complete frame over TCP, each prefixed with its size as
+// a big endian uint16
+#define VANILLA_PIPE_VIDEO_STREAM_PORT 51120
+
 #define VANILLA_PIPE_CC_SYNC 0x80
 #define VANILLA_PIPE_CC_CONNECT 0x81
 #define VANILLA_PIPE_CC_BIND_ACK 0x82
@@ -18,6 +28,7 @@
 #define VANILLA_PIPE_CC_DISCONNECTED 0x89
 #define VANILLA_PIPE_CC_INSTALL_POLKIT 0x8A
 #define VANILLA_PIPE_CC_UNINSTALL_POLKIT 0x8B
+#define VANILLA_PIPE_CC_STATS 0x8C
 #define VANILLA_PIPE_CC_QUIT 0x90
 
 #define VANILLA_PIPE_LOCAL_SOCKET "/tmp/vanilla-pipe_%i.sock"
@@ -34,14 +45,62 @@ typedef struct {
     int32_t status;
 } vanilla_pipe_status_info_t;
 
+#define VANILLA_PIPE_SYNC_SCANNING 0
+#define VANILLA_PIPE_SYNC_TRYING_PIN 1
+
+// Payload of VANILLA_PIPE_CC_CONNECTED, older pipes send the code on its own
+#define VANILLA_PIPE_CONNECTED_VIDEO_STREAM 0x01 // Whole frames are served on VANILLA_PIPE_VIDEO_STREAM_PORT
+
+typedef struct {
+    uint8_t flags;
+} vanilla_pipe_connected_info_t;
+
+// Optional payload of VANILLA_PIPE_CC_PING while syncing
+typedef struct {
+    uint8_t state;
+    uint8_t candidates; // Wii U consoles seen in the last scan
+    uint8_t attempt; // Which of them is being tried, starting from 1
+    int8_t signal; // Signal strength of that console in dBm
+} vanilla_pipe_sync_progress_t;
+
 typedef struct {
     uint8_t control_code;
     union{
         vanilla_pipe_sync_info_t sync;
         vanilla_connection_t connection;
         vanilla_pipe_status_info_t status;
+        vanilla_pipe_sync_progress_t sync_progress;
+        vanilla_pipe_stats_t stats;
+        vanilla_pipe_connected_info_t connected;
     };
 } vanilla_pipe_command_t;
 #pragma pack(pop)
 
+// vanilla_pipe_stats_t goes over the wire as big endian uint64s
+static inline void vanilla_pipe_stats_to_wire(vanilla_pipe_stats_t *stats)
+{
+    uint64_t *values = (uint64_t *) stats;
+    for (size_t i = 0; i < sizeof(*stats) / sizeof(uint64_t); i++) {
+        uint8_t b[8];
+        for (int j = 0; j < 8; j++) {
+            b[j] = values[i] >> (56 - j * 8);
+        }
+        memcpy(&values[i], b, sizeof(b));
+    }
+}
+
+static inline void vanilla_pipe_stats_from_wire(vanilla_pipe_stats_t *stats)
+{
+    uint64_t *values = (uint64_t *) stats;
+    for (size_t i = 0; i < sizeof(*stats) / sizeof(uint64_t); i++) {
+        uint8_t b[8];
+        memcpy(b, &values[i], sizeof(b));
+        uint64_t value = 0;
+        for (int j = 0; j < 8; j++) {
+            value = (value << 8) | b[j];
+        }
+        values[i] = value;
+    }
+}
+
 #endif // VANILLA_PIPE_DEF_H
@@ -0,0 +1,221 @@
+// vanilla-pipe-bench - measures the relay's CPU cost per Mbit over loopback
+//
+// Starts the relays bound to 127.0.0.1, plays the console from 127.0.0.2 by
+// sending video-sized datagrams at a steady bitrate, and receives them as the
+// frontend on 127.0.0.3. Reports the relay thread's CPU time divided by how
+// much video it relayed, which is the number to compare between relay changes
+// (absolute figures on a desktop are far lower than on the pipe's hardware).
+//
+// Usage: vanilla-pipe-bench [-seconds N] [-mbps N] [-fec GROUP_SIZE]
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../ports.h"
+#include "log.h"
+#include "relay.h"
+
+#define BENCH_RELAY_ADDRESS "127.0.0.1"
+#define BENCH_CONSOLE_ADDRESS "127.0.0.2"
+#define BENCH_FRONTEND_ADDRESS "127.0.0.3"
+
+#define BENCH_FRAME_RATE 60
+#define BENCH_DATAGRAM_SIZE 1400
+#define BENCH_FRAME_DATAGRAMS_MAX 256
+
+static int bench_seconds = 5;
+static int bench_mbps = 20;
+
+static volatile int bench_running = 1;
+static uint64_t bench_received_bytes;
+
+static int64_t bench_clock_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static int bench_socket(const char *address, in_port_t port)
+{
+    int skt = socket(AF_INET, SOCK_DGRAM, 0);
+    if (skt == -1) {
+        return -1;
+    }
+
+    struct sockaddr_in sa = {0};
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = inet_addr(address);
+    sa.sin_port = htons(port);
+    if (bind(skt, (const struct sockaddr *) &sa, sizeof(sa)) == -1) {
+        fprintf(stderr, "FAILED TO BIND %s:%u: %i\n", address, port, errno);
+        close(skt);
+        return -1;
+    }
+
+    int buffer_size = 4 * 1024 * 1024;
+    setsockopt(skt, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    setsockopt(skt, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+
+    return skt;
+}
+
+// Plays the frontend, counting every byte the relay delivers
+static void *bench_frontend(void *data)
+{
+    int skt = (int) (intptr_t) data;
+
+    struct timeval tv = {0};
+    tv.tv_usec = 100000;
+    setsockopt(skt, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    static uint8_t buf[65536];
+    while (bench_running) {
+        ssize_t r = recv(skt, buf, sizeof(buf), 0);
+        if (r > 0) {
+            __atomic_add_fetch(&bench_received_bytes, r, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+// Plays the console, sending each frame as one burst of datagrams every 1/60s
+// like the real thing does
+static void bench_console(int skt)
+{
+    size_t frame_bytes = (size_t) bench_mbps * 1000000 / 8 / BENCH_FRAME_RATE;
+    size_t frame_datagrams = (frame_bytes + BENCH_DATAGRAM_SIZE - 1) / BENCH_DATAGRAM_SIZE;
+    if (frame_datagrams > BENCH_FRAME_DATAGRAMS_MAX) {
+        frame_datagrams = BENCH_FRAME_DATAGRAMS_MAX;
+    }
+
+    struct sockaddr_in relay = {0};
+    relay.sin_family = AF_INET;
+    relay.sin_addr.s_addr = inet_addr(BENCH_RELAY_ADDRESS);
+    relay.sin_port = htons(PORT_VID);
+
+    static uint8_t payload[BENCH_FRAME_DATAGRAMS_MAX][BENCH_DATAGRAM_SIZE];
+    struct mmsghdr msgs[BENCH_FRAME_DATAGRAMS_MAX];
+    struct iovec iovs[BENCH_FRAME_DATAGRAMS_MAX];
+    memset(msgs, 0, sizeof(msgs));
+    for (size_t i = 0; i < frame_datagrams; i++) {
+        for (size_t j = 0; j < BENCH_DATAGRAM_SIZE; j++) {
+            payload[i][j] = rand();
+        }
+        iovs[i].iov_base = payload[i];
+        iovs[i].iov_len = BENCH_DATAGRAM_SIZE;
+        msgs[i].msg_hdr.msg_name = &relay;
+        msgs[i].msg_hdr.msg_namelen = sizeof(relay);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int64_t frame_interval = 1000000000LL / BENCH_FRAME_RATE;
+    int64_t end = bench_clock_ns() + bench_seconds * 1000000000LL;
+    int64_t next_frame = bench_clock_ns();
+    uint16_t seq_id = 0;
+    while (next_frame < end) {
+        // Only the sequence IDs and the frame end bit have to look real, FEC
+        // closes its groups on frame ends
+        for (size_t i = 0; i < frame_datagrams; i++) {
+            payload[i][0] = (payload[i][0] & 0xFC) | ((seq_id >> 8) & 0x3);
+            payload[i][1] = seq_id & 0xFF;
+            payload[i][2] = (i == frame_datagrams - 1) ? 0x10 : 0x00;
+            seq_id = (seq_id + 1) & 0x3FF;
+        }
+
+        size_t sent = 0;
+        while (sent < frame_datagrams) {
+            int r = sendmmsg(skt, msgs + sent, frame_datagrams - sent, 0);
+            if (r <= 0) {
+                break;
+            }
+            sent += r;
+        }
+
+        next_frame += frame_interval;
+        struct timespec wake = {next_frame / 1000000000LL, next_frame % 1000000000LL};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    int fec = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-seconds") && i + 1 < argc) {
+            bench_seconds = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-mbps") && i + 1 < argc) {
+            bench_mbps = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-fec") && i + 1 < argc) {
+            fec = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [-seconds N] [-mbps N] [-fec GROUP_SIZE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    log_init();
+    log_set_level(VANILLA_LOG_PIPE, VANILLA_LOG_LEVEL_WARN);
+
+    relay_set_fec(fec);
+
+    int console = bench_socket(BENCH_CONSOLE_ADDRESS, PORT_VID - 100);
+    int frontend = bench_socket(BENCH_FRONTEND_ADDRESS, PORT_VID);
+    if (console == -1 || frontend == -1) {
+        return 1;
+    }
+
+    struct relay_info info = {0};
+    info.wireless_interface = "lo";
+    info.address = inet_addr(BENCH_RELAY_ADDRESS);
+    info.console_address = inet_addr(BENCH_CONSOLE_ADDRESS);
+    info.client.in.sin_family = AF_INET;
+    info.client.in.sin_addr.s_addr = inet_addr(BENCH_FRONTEND_ADDRESS);
+    info.client_size = sizeof(info.client.in);
+    if (relay_start(&info) != 0) {
+        fprintf(stderr, "FAILED TO START RELAYS\n");
+        return 1;
+    }
+
+    pthread_t frontend_thread;
+    pthread_create(&frontend_thread, NULL, bench_frontend, (void *) (intptr_t) frontend);
+
+    bench_console(console);
+
+    // Let the relay catch up with whatever's still queued
+    usleep(200000);
+
+    double cpu = relay_get_cpu_seconds();
+    vanilla_pipe_stats_t stats;
+    relay_get_stats(&stats);
+    relay_stop();
+
+    bench_running = 0;
+    pthread_join(frontend_thread, NULL);
+
+    const vanilla_relay_stats_t *vid = &stats.to_frontend[VANILLA_RELAY_PORT_VID];
+    double mbit = vid->bytes * 8 / 1e6;
+    printf("relayed %.1f Mbit in %lu datagrams (%.1f Mbit received), %lu send errors\n",
+        mbit, (unsigned long) vid->datagrams, __atomic_load_n(&bench_received_bytes, __ATOMIC_RELAXED) * 8 / 1e6,
+        (unsigned long) vid->send_errors);
+    printf("relay cpu %.3f s, %.3f ms/Mbit\n", cpu, mbit > 0 ? cpu * 1000 / mbit : 0);
+
+    log_flush();
+
+    close(console);
+    close(frontend);
+
+    return 0;
+}
@@ -110,6 +110,10 @@ int send_discover(unsigned long xid, unsigned long requested)
 	packet.xid = xid;
 	if (requested)
 		add_simple_option(packet.options, DHCP_REQUESTED_IP, requested);
+	if (client_config.rapid_commit) {
+		uint8_t rapid_commit[] = {DHCP_RAPID_COMMIT, 0};
+		add_option_string(packet.options, rapid_commit);
+	}
 
 	add_requests(&packet);
 	LOG(LOG_DEBUG, "Sending discover...");
@@ -118,6 +122,26 @@ int send_discover(unsigned long xid, unsigned long requested)
 }
 
 
+/* Broadcasts a request for an address we had before, without a server id
+ * (RFC 2131 4.3.2 INIT-REBOOT) */
+int send_init_reboot(unsigned long xid, unsigned long requested)
+{
+	struct dhcpMessage packet;
+	struct in_addr addr;
+
+	init_packet(&packet, DHCPREQUEST);
+	packet.xid = xid;
+
+	add_simple_option(packet.options, DHCP_REQUESTED_IP, requested);
+
+	add_requests(&packet);
+	addr.s_addr = requested;
+	LOG(LOG_DEBUG, "Sending init-reboot for %s...", inet_ntoa(addr));
+	return raw_packet(&packet, INADDR_ANY, CLIENT_PORT, INADDR_BROADCAST,
+				SERVER_PORT, MAC_BCAST_ADDR, client_config.ifindex);
+}
+
+
 /* Broadcasts a DHCP request message */
 int send_selecting(unsigned long xid, unsigned long server, unsigned long requested)
 {
@@ -5,6 +5,7 @@
 
 unsigned long random_xid(void);
 int send_discover(unsigned long xid, unsigned long requested);
+int send_init_reboot(unsigned long xid, unsigned long requested);
 int send_selecting(unsigned long xid, unsigned long server, unsigned long requested);
 int send_renew(unsigned long xid, unsigned long server, unsigned long ciaddr);
 int send_renew(unsigned long xid, unsigned long server, unsigned long ciaddr);
@@ -30,6 +30,7 @@
 #include <paths.h>
 #include <sys/socket.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include "common.h"
 #include "pidfile.h"
@@ -44,6 +45,13 @@ long uptime(void)
 	return info.uptime;
 }
 
+unsigned long long uptime_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 
 /*
  * This function makes sure our first socket calls
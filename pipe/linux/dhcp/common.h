@@ -40,6 +40,7 @@ enum syslog_levels {
 #endif
 
 long uptime(void);
+unsigned long long uptime_ms(void);
 void background(const char *pidfile);
 void start_log_and_pid(const char *client_server, const char *pidfile);
 void background(const char *pidfile);
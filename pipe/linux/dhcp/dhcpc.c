@@ -47,7 +47,7 @@
 static int state;
 static unsigned long requested_ip; /* = 0 */
 static unsigned long server_addr;
-static unsigned long timeout;
+static unsigned long long timeout;
 static int packet_num; /* = 0 */
 static int fd = -1;
 
@@ -70,6 +70,37 @@ struct client_config_t client_config = {
 	fqdn: NULL,
 	ifindex: 0,
 	arp: "\0\0\0\0\0\0",		/* appease gcc-3.0 */
+	requested_ip: 0,
+	rapid_commit: 0,
+	timing: NULL,
+};
+
+#define TIMING(name, list) name##_ms: list, name##_count: sizeof(list) / sizeof(list[0])
+
+static const long default_discover_ms[] = {2000, 2000, 4000};
+static const long default_request_ms[] = {2000, 2000, 10000};
+static const long default_init_reboot_ms[] = {1000, 1000};
+
+const struct client_timing_t udhcpc_timing_default = {
+	TIMING(discover, default_discover_ms),
+	TIMING(request, default_request_ms),
+	TIMING(init_reboot, default_init_reboot_ms),
+	retry_ms: 60000,
+	nak_ms: 3000,
+};
+
+/* The console answers within a few milliseconds, so anything slower than
+ * that is a lost packet rather than a busy server */
+static const long console_discover_ms[] = {100, 200, 400, 800, 1600};
+static const long console_request_ms[] = {100, 200, 400, 800};
+static const long console_init_reboot_ms[] = {100, 200};
+
+const struct client_timing_t udhcpc_timing_console = {
+	TIMING(discover, console_discover_ms),
+	TIMING(request, console_request_ms),
+	TIMING(init_reboot, console_init_reboot_ms),
+	retry_ms: 1000,
+	nak_ms: 0,
 };
 
 #ifndef IN_BUSYBOX
@@ -163,7 +194,7 @@ static void perform_release(void)
 
 	change_mode(LISTEN_NONE);
 	state = RELEASED;
-	timeout = 0x7fffffff;
+	timeout = 0x7fffffff * 1000ULL;
 }
 
 
@@ -179,16 +210,18 @@ int udhcpc_main()
 {
 	uint8_t *temp, *message;
 	unsigned long t1 = 0, t2 = 0, xid = 0;
-	unsigned long start = 0, lease;
+	unsigned long lease;
+	unsigned long long start = 0;
 	fd_set rfds;
 	int retval;
 	struct timeval tv;
 	int c, len;
 	struct dhcpMessage packet;
 	struct in_addr temp_addr;
-	long now;
+	unsigned long long now;
 	int max_fd;
 	int sig;
+	const struct client_timing_t *timing = client_config.timing ? : &udhcpc_timing_default;
 
 	static const struct option arg_options[] = {
 		{"clientid",	required_argument,	0, 'c'},
@@ -300,16 +333,25 @@ int udhcpc_main()
 	/* setup the signal pipe */
 	udhcp_sp_setup();
 
-	state = INIT_SELECTING;
-	run_script(NULL, "deconfig");
+	packet_num = 0;
+	requested_ip = client_config.requested_ip;
+	if (requested_ip) {
+		/* The caller may already be using this address, so leave it be
+		 * unless the server tells us otherwise */
+		state = INIT_REBOOT;
+	} else {
+		state = INIT_SELECTING;
+		run_script(NULL, "deconfig");
+	}
 	change_mode(LISTEN_RAW);
 
 	timeout = 0;
 
 	for (;;) {
 
-		tv.tv_sec = timeout - uptime();
-		tv.tv_usec = 0;
+		now = uptime_ms();
+		tv.tv_sec = (timeout > now) ? (timeout - now) / 1000 : 0;
+		tv.tv_usec = (timeout > now) ? (timeout - now) % 1000 * 1000 : 0;
 
 		if (listen_mode != LISTEN_NONE && fd < 0) {
 			if (listen_mode == LISTEN_KERNEL)
@@ -323,24 +365,24 @@ int udhcpc_main()
 		}
 		max_fd = udhcp_sp_fd_set(&rfds, fd);
 
-		if (tv.tv_sec > 0) {
+		if (tv.tv_sec > 0 || tv.tv_usec > 0) {
 			DEBUG(LOG_INFO, "Waiting on select...");
 			retval = select(max_fd + 1, &rfds, NULL, NULL, &tv);
 		} else retval = 0; /* If we already timed out, fall through */
 
-		now = uptime();
+		now = uptime_ms();
 		if (retval == 0) {
 			/* timeout dropped to zero */
 			switch (state) {
 			case INIT_SELECTING:
-				if (packet_num < 3) {
+				if (packet_num < timing->discover_count) {
 					if (packet_num == 0)
 						xid = random_xid();
 
 					/* send discover packet */
 					send_discover(xid, requested_ip); /* broadcast */
 
-					timeout = now + ((packet_num == 2) ? 4 : 2);
+					timeout = now + timing->discover_ms[packet_num];
 					packet_num++;
 				} else {
 					run_script(NULL, "leasefail");
@@ -353,18 +395,37 @@ int udhcpc_main()
 				  	}
 					/* wait to try again */
 					packet_num = 0;
-					timeout = now + 60;
+					timeout = now + timing->retry_ms;
+				}
+				break;
+			case INIT_REBOOT:
+				if (packet_num < timing->init_reboot_count) {
+					if (packet_num == 0)
+						xid = random_xid();
+
+					send_init_reboot(xid, requested_ip); /* broadcast */
+
+					timeout = now + timing->init_reboot_ms[packet_num];
+					packet_num++;
+				} else {
+					/* nobody answered for our old lease, start from scratch */
+					LOG(LOG_INFO, "No reply to init-reboot, entering init state");
+					run_script(NULL, "deconfig");
+					state = INIT_SELECTING;
+					timeout = now;
+					requested_ip = 0;
+					packet_num = 0;
 				}
 				break;
 			case RENEW_REQUESTED:
 			case REQUESTING:
-				if (packet_num < 3) {
+				if (packet_num < timing->request_count) {
 					/* send request packet */
 					if (state == RENEW_REQUESTED)
 						send_renew(xid, server_addr, requested_ip); /* unicast */
 					else send_selecting(xid, server_addr, requested_ip); /* broadcast */
 
-					timeout = now + ((packet_num == 2) ? 10 : 2);
+					timeout = now + timing->request_ms[packet_num];
 					packet_num++;
 				} else {
 					/* timed out, go back to init state */
@@ -386,14 +447,14 @@ int udhcpc_main()
 				if ((t2 - t1) <= (lease / 14400 + 1)) {
 					/* timed out, enter rebinding state */
 					state = REBINDING;
-					timeout = now + (t2 - t1);
+					timeout = now + (t2 - t1) * 1000ULL;
 					DEBUG(LOG_INFO, "Entering rebinding state");
 				} else {
 					/* send a request packet */
 					send_renew(xid, server_addr, requested_ip); /* unicast */
 
 					t1 = (t2 - t1) / 2 + t1;
-					timeout = t1 + start;
+					timeout = t1 * 1000ULL + start;
 				}
 				break;
 			case REBINDING:
@@ -411,12 +472,12 @@ int udhcpc_main()
 					send_renew(xid, 0, requested_ip); /* broadcast */
 
 					t2 = (lease - t2) / 2 + t2;
-					timeout = t2 + start;
+					timeout = t2 * 1000ULL + start;
 				}
 				break;
 			case RELEASED:
 				/* yah, I know, *you* say it would never happen */
-				timeout = 0x7fffffff;
+				timeout = 0x7fffffff * 1000ULL;
 				break;
 			}
 		} else if (retval > 0 && listen_mode != LISTEN_NONE && FD_ISSET(fd, &rfds)) {
@@ -459,8 +520,15 @@ int udhcpc_main()
 					} else {
 						DEBUG(LOG_ERR, "No server ID in message");
 					}
+					break;
 				}
-				break;
+
+				/* A server doing Rapid Commit answers the discover with an ACK */
+				if (!(*message == DHCPACK && client_config.rapid_commit
+				      && get_option(&packet, DHCP_RAPID_COMMIT)))
+					break;
+				/* fall through */
+			case INIT_REBOOT:
 			case RENEW_REQUESTED:
 			case REQUESTING:
 			case RENEWING:
@@ -479,11 +547,13 @@ int udhcpc_main()
 
 					/* little fixed point for n * .875 */
 					t2 = (lease * 0x7) >> 3;
+					if ((temp = get_option(&packet, DHCP_SERVER_ID)))
+						memcpy(&server_addr, temp, 4);
 					temp_addr.s_addr = packet.yiaddr;
 					LOG(LOG_INFO, "Lease of %s obtained, lease time %ld",
 						inet_ntoa(temp_addr), lease);
 					start = now;
-					timeout = t1 + start;
+					timeout = t1 * 1000ULL + start;
 					requested_ip = packet.yiaddr;
 					run_script(&packet,
 						   ((state == RENEWING || state == REBINDING) ? "renew" : "bound"));
@@ -501,12 +571,13 @@ int udhcpc_main()
 					run_script(&packet, "nak");
 					if (state != REQUESTING)
 						run_script(NULL, "deconfig");
+					/* a NAK for an old lease is expected, so retry right away,
+					 * otherwise avoid excessive network traffic */
+					timeout = now + ((state == INIT_REBOOT) ? 0 : timing->nak_ms);
 					state = INIT_SELECTING;
-					timeout = now;
 					requested_ip = 0;
 					packet_num = 0;
 					change_mode(LISTEN_RAW);
-					sleep(3); /* avoid excessive network traffic */
 				}
 				break;
 			/* case BOUND, RELEASED: - ignore all packets */
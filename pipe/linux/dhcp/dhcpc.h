@@ -16,6 +16,24 @@
 #define RENEW_REQUESTED 6
 #define RELEASED	7
 
+/* How long to wait for a reply to each packet before sending the next one */
+struct client_timing_t {
+	const long *discover_ms;	/* Wait after each discover */
+	int discover_count;
+	const long *request_ms;		/* Wait after each request */
+	int request_count;
+	const long *init_reboot_ms;	/* Wait after each init-reboot request */
+	int init_reboot_count;
+	long retry_ms;			/* Wait before discovering again after no lease */
+	long nak_ms;			/* Wait before discovering again after a NAK */
+};
+
+/* udhcpc's original office LAN timers */
+extern const struct client_timing_t udhcpc_timing_default;
+
+/* Sub-second exponential backoff for a point to point link to the console */
+extern const struct client_timing_t udhcpc_timing_console;
+
 typedef void(*udhcpc_callback_t)(const char *name, char **envp, void *data);
 
 struct client_config_t {
@@ -32,6 +50,9 @@ struct client_config_t {
 	uint8_t *fqdn;			/* Optional fully qualified domain name to use */
 	int ifindex;			/* Index number of the interface to use */
 	uint8_t arp[6];			/* Our arp address */
+	unsigned long requested_ip;	/* Previous lease to INIT-REBOOT with, or 0 */
+	char rapid_commit;		/* Ask for a two message exchange (RFC 4039) */
+	const struct client_timing_t *timing;	/* Retransmit schedule, NULL for the default */
 };
 
 extern struct client_config_t client_config;
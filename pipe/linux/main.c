@@ -1,13 +1,20 @@
 #include <arpa/inet.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "gamepad/fec.h"
+#include "metrics.h"
+#include "relay.h"
 #include "vanilla.h"
 #include "wpa.h"
 
 int main(int argc, const char **argv)
 {
+    log_set_sink(pipe_log_sink);
+    log_init();
+
     if (geteuid() != 0) {
         nlprint("vanilla-pipe must be run as root");
         return 1;
@@ -39,20 +46,51 @@ int main(int argc, const char **argv)
         nlprint("");
         nlprint("External logging can be enabled with '-log <log-file>'.");
         nlprint("");
+        nlprint("Prometheus metrics can be served with '-metrics <address>', where the");
+        nlprint("address is 'unix:<path>', '<host>:<port>', or a port on localhost.");
+        nlprint("");
+        nlprint("With '-udp', '-frames' reassembles video frames before forwarding them to");
+        nlprint("the frontend over TCP, so packets lost between the pipe and the frontend");
+        nlprint("can't break up frames.");
+        nlprint("");
+        nlprint("With '-udp', '-fec <group-size>' follows every group of video and audio");
+        nlprint("packets with a parity packet, from which the frontend can rebuild one lost");
+        nlprint("packet per group. Group sizes from 2 to %i are allowed.", FEC_GROUP_MAX);
+        nlprint("");
+        nlprint("Log verbosity can be set per category with the VANILLA_LOG environment");
+        nlprint("variable, e.g. VANILLA_LOG=debug or VANILLA_LOG=info,pipe=debug.");
+        nlprint("");
 
         return 1;
     }
 
     int udp_mode = 0;
     int local_mode = 0;
+    int video_stream = 0;
+    int fec_group = 0;
     const char *wireless_interface = 0;
     const char *log_file = 0;
+    const char *metrics_address = 0;
 
     for (int i = 1; i < argc; i++) {
         if (!strcmp(argv[i], "-udp")) {
             udp_mode = 1;
         } else if (!strcmp(argv[i], "-local")) {
             local_mode = 1;
+        } else if (!strcmp(argv[i], "-frames")) {
+            video_stream = 1;
+        } else if (!strcmp(argv[i], "-fec")) {
+            i++;
+            if (i < argc) {
+                fec_group = atoi(argv[i]);
+            } else {
+                nlprint("-fec requires an argument");
+                return 1;
+            }
+            if (fec_group < 2 || fec_group > FEC_GROUP_MAX) {
+                nlprint("-fec group size must be between 2 and %i", FEC_GROUP_MAX);
+                return 1;
+            }
         } else if (!strcmp(argv[i], "-log")) {
             // Increment index
             i++;
@@ -62,6 +100,14 @@ int main(int argc, const char **argv)
                 nlprint("-log requires an argument");
                 return 1;
             }
+        } else if (!strcmp(argv[i], "-metrics")) {
+            i++;
+            if (i < argc) {
+                metrics_address = argv[i];
+            } else {
+                nlprint("-metrics requires an argument");
+                return 1;
+            }
         } else {
             wireless_interface = argv[i];
         }
@@ -72,12 +118,32 @@ int main(int argc, const char **argv)
         return 1;
     }
 
+    if (video_stream && !udp_mode) {
+        nlprint("'-frames' can only be used with '-udp'");
+        return 1;
+    }
+
+    if (fec_group && !udp_mode) {
+        nlprint("'-fec' can only be used with '-udp'");
+        return 1;
+    }
+
     if (!wireless_interface) {
         nlprint("Must identify a wireless interface to use");
         return 1;
     }
 
+    if (metrics_address && metrics_serve(metrics_address) != VANILLA_SUCCESS) {
+        nlprint("Failed to serve metrics on %s", metrics_address);
+        return 1;
+    }
+
+    relay_set_video_stream(video_stream);
+    relay_set_fec(fec_group);
+
     pipe_listen(local_mode, wireless_interface, log_file);
 
+    metrics_stop();
+
     return 0;
 }
\ No newline at end of file
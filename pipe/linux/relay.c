@@ -0,0 +1,842 @@
+#define _GNU_SOURCE
+
+#include "relay.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../def.h"
+#include "../ports.h"
+#include "gamepad/fec.h"
+#include "gamepad/packet.h"
+#include "metrics.h"
+#include "videostream.h"
+#include "wpa.h"
+
+// Older libc headers don't know about UDP segmentation offload yet
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+#define RELAY_PORT_COUNT VANILLA_RELAY_PORT_COUNT
+#define RELAY_DIRECTION_COUNT (RELAY_PORT_COUNT * 2)
+
+// Datagrams moved per recvmmsg()/sendmmsg() call
+#define RELAY_BATCH_SIZE 32
+#define RELAY_DATAGRAM_MAX 4096
+
+// With UDP_GRO the kernel hands us up to 64 KB of coalesced datagrams at once,
+// so those directions receive fewer, bigger messages out of the same buffer
+#define RELAY_GRO_BATCH_SIZE 8
+#define RELAY_GRO_DATAGRAM_MAX 65536
+#define RELAY_BUFFER_SIZE (RELAY_GRO_BATCH_SIZE * RELAY_GRO_DATAGRAM_MAX)
+
+// The kernel won't segment more than this many datagrams, or a super-packet
+// bigger than an IPv4 datagram can be, per UDP_SEGMENT send
+#define RELAY_GSO_SEGMENTS_MAX 64
+#define RELAY_GSO_BYTES_MAX 65507
+
+// Every datagram in one batch, after splitting up GRO super-packets
+#define RELAY_SEGMENTS_MAX (RELAY_GRO_BATCH_SIZE * RELAY_GSO_SEGMENTS_MAX)
+
+// Parity packets added to one batch at most, any more groups just get longer
+#define RELAY_PARITY_MAX 64
+
+// Batches relayed from one socket per wakeup before moving on to the others,
+// so a burst of video can't hold up input or audio for long
+#define RELAY_BATCHES_PER_WAKEUP 4
+
+// A port going this long without a datagram counts as one receive timeout, the
+// same as the SO_RCVTIMEO the relays used to block with
+#define RELAY_RECV_TIMEOUT_NS 250000000LL
+
+// Enough to hold an IDR frame's worth of fragments while the relay thread is
+// busy with another socket (the kernel caps this at net.core.rmem_max)
+#define RELAY_SOCKET_BUFFER (1024 * 1024)
+
+typedef struct {
+    relay_handler handler;
+    int from_socket;
+    int to_socket;
+    sockaddr_u to_address;
+    size_t to_address_size;
+    int batch_size;
+    size_t datagram_max;
+    int gro;
+    int gso;
+    size_t gso_size_max;
+    int to_video_stream;
+    fec_encoder_t *fec;
+    int fec_frames;
+    int metric_packets;
+    int metric_bytes;
+    int metric_errors;
+    int metric_parity;
+    vanilla_relay_stats_t *stats;
+    int64_t *last_receive_ns;
+    uint64_t burst;
+} relay_ports;
+
+// Same order as VanillaRelayPort
+static const in_port_t relay_port_list[RELAY_PORT_COUNT] = {PORT_VID, PORT_AUD, PORT_MSG, PORT_CMD, PORT_HID};
+
+static pthread_t relay_thread;
+static int relay_video_stream = 0;
+static int relay_fec_group = 0;
+static fec_encoder_t relay_fec_encoders[2];
+static int relay_wake_fd = -1;
+static int relay_epoll_fd = -1;
+static int relay_video_stream_open = 0;
+
+// Filled in by relay_start(), then only touched by the relay thread
+static relay_ports relay_directions[RELAY_DIRECTION_COUNT];
+static size_t relay_direction_count = 0;
+
+// Written by the relay thread and read by relay_get_stats(), so every access
+// is atomic. There's only one writer, so updates don't need to be RMWs.
+static vanilla_pipe_stats_t relay_stats;
+static int64_t relay_last_receive_ns[2][RELAY_PORT_COUNT];
+
+// Big enough for a UDP_GRO size and a receive timestamp, or a UDP_SEGMENT size
+typedef union {
+    char buf[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(struct timespec))];
+    struct cmsghdr align;
+} relay_control;
+
+// Only ever touched by the relay thread
+static struct mmsghdr relay_msgs[RELAY_BATCH_SIZE];
+static struct iovec relay_iovs[RELAY_BATCH_SIZE];
+static relay_control relay_recv_control[RELAY_BATCH_SIZE];
+static uint8_t relay_buffers[RELAY_BUFFER_SIZE];
+static int64_t relay_recv_ns[RELAY_BATCH_SIZE];
+static int relay_recv_segments[RELAY_BATCH_SIZE];
+
+// Received datagrams (with room for parity in between), and the messages
+// they're sent back out in
+static struct iovec relay_segments[RELAY_SEGMENTS_MAX + RELAY_PARITY_MAX];
+static struct iovec relay_segments_with_parity[RELAY_SEGMENTS_MAX + RELAY_PARITY_MAX];
+static uint8_t relay_parity[RELAY_PARITY_MAX][FEC_PARITY_MAX];
+static struct mmsghdr relay_send_msgs[RELAY_SEGMENTS_MAX + RELAY_PARITY_MAX];
+static relay_control relay_send_control[RELAY_SEGMENTS_MAX + RELAY_PARITY_MAX];
+static int relay_send_first[RELAY_SEGMENTS_MAX + RELAY_PARITY_MAX];
+static int relay_send_count[RELAY_SEGMENTS_MAX + RELAY_PARITY_MAX];
+
+static void relay_stat_add(uint64_t *stat, uint64_t value)
+{
+    __atomic_store_n(stat, __atomic_load_n(stat, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+static void relay_stat_max(uint64_t *stat, uint64_t value)
+{
+    if (value > __atomic_load_n(stat, __ATOMIC_RELAXED)) {
+        __atomic_store_n(stat, value, __ATOMIC_RELAXED);
+    }
+}
+
+static int64_t relay_clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const char *relay_port_name(in_port_t port)
+{
+    if (port == PORT_VID) return "vid";
+    if (port == PORT_AUD) return "aud";
+    if (port == PORT_HID) return "hid";
+    if (port == PORT_MSG) return "msg";
+    if (port == PORT_CMD) return "cmd";
+    return "unknown";
+}
+
+static void register_relay_metrics(relay_ports *ports, in_port_t port, const char *direction)
+{
+    char name[128];
+    const char *port_name = relay_port_name(port);
+
+    snprintf(name, sizeof(name), "vanilla_pipe_relay_packets_total{port=\"%s\",direction=\"%s\"}", port_name, direction);
+    ports->metric_packets = metrics_counter(name, "Datagrams relayed between the console and the frontend");
+
+    snprintf(name, sizeof(name), "vanilla_pipe_relay_bytes_total{port=\"%s\",direction=\"%s\"}", port_name, direction);
+    ports->metric_bytes = metrics_counter(name, "Bytes relayed between the console and the frontend");
+
+    snprintf(name, sizeof(name), "vanilla_pipe_relay_errors_total{port=\"%s\",direction=\"%s\"}", port_name, direction);
+    ports->metric_errors = metrics_counter(name, "Datagrams that couldn't be relayed");
+}
+
+static void create_ports(relay_ports *ports, int from_socket, int to_socket, const sockaddr_u *to_addr, size_t to_addr_size, vanilla_relay_stats_t *stats, int64_t *last_receive_ns)
+{
+    ports->from_socket = from_socket;
+    ports->to_socket = to_socket;
+    ports->to_address = *to_addr;
+    ports->to_address_size = to_addr_size;
+    ports->batch_size = RELAY_BATCH_SIZE;
+    ports->datagram_max = RELAY_DATAGRAM_MAX;
+    ports->gro = 0;
+    ports->gso = 0;
+    ports->gso_size_max = RELAY_GSO_BYTES_MAX;
+    ports->to_video_stream = 0;
+    ports->fec = NULL;
+    ports->fec_frames = 0;
+    ports->metric_parity = -1;
+    ports->metric_packets = -1;
+    ports->metric_bytes = -1;
+    ports->metric_errors = -1;
+    ports->stats = stats;
+    ports->last_receive_ns = last_receive_ns;
+    ports->burst = 0;
+}
+
+// Has the console socket coalesce video datagrams with UDP_GRO and the frontend
+// socket split them back up with UDP_SEGMENT, so a whole run of fragments
+// crosses the stack (and the relay) once instead of once per datagram. Either
+// half is skipped if the kernel doesn't support it.
+static void enable_udp_offload(relay_ports *ports)
+{
+    int on = 1;
+    if (setsockopt(ports->from_socket, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0) {
+        ports->gro = 1;
+        ports->batch_size = RELAY_GRO_BATCH_SIZE;
+        ports->datagram_max = RELAY_GRO_DATAGRAM_MAX;
+    }
+
+    // Kernels that predate UDP_SEGMENT would silently ignore the cmsg and
+    // send one giant datagram, so make sure it's understood before using it
+    int off = 0;
+    if (setsockopt(ports->to_socket, SOL_UDP, UDP_SEGMENT, &off, sizeof(off)) == 0) {
+        ports->gso = 1;
+    }
+
+    nlprint("VIDEO RELAY OFFLOAD: GRO %s, GSO %s", ports->gro ? "ON" : "OFF", ports->gso ? "ON" : "OFF");
+}
+
+int open_socket(int local, in_addr_t address, in_port_t port)
+{
+    sockaddr_u sa;
+    size_t sa_size;
+
+    int skt;
+    if (local) {
+        skt = socket(AF_UNIX, SOCK_DGRAM, 0);
+        sa.un.sun_family = AF_UNIX;
+        snprintf(sa.un.sun_path, sizeof(sa.un.sun_path) - 1, VANILLA_PIPE_LOCAL_SOCKET, port);
+        unlink(sa.un.sun_path);
+        sa_size = sizeof(struct sockaddr_un);
+    } else {
+        skt = socket(AF_INET, SOCK_DGRAM, 0);
+        sa.in.sin_family = AF_INET;
+        sa.in.sin_addr.s_addr = address;
+        sa.in.sin_port = htons(port);
+        sa_size = sizeof(struct sockaddr_in);
+    }
+    if (skt == -1) {
+        return -1;
+    }
+
+    if (bind(skt, (const struct sockaddr *) &sa, sa_size) == -1) {
+        nlprint("FAILED TO BIND PORT %u: %i", port, errno);
+        close(skt);
+        return -1;
+    } else {
+        // nlprint("BOUND PORT %u", port);
+    }
+
+    return skt;
+}
+
+// Opens both sockets for a port and fills in both directions
+static int open_relay_port(const struct relay_info *info, size_t index, relay_ports *to_frontend, relay_ports *to_console)
+{
+    in_port_t port = relay_port_list[index];
+
+    // Open an incoming port from the console
+    int from_console = open_socket(0, info->address, port);
+    if (from_console == -1) {
+        return -1;
+    }
+
+    setsockopt(from_console, SOL_SOCKET, SO_BINDTODEVICE, info->wireless_interface, strlen(info->wireless_interface));
+
+    // Open an incoming port from the frontend
+    int from_frontend = open_socket(0, info->address, port - 100);
+    if (from_frontend == -1) {
+        close(from_console);
+        return -1;
+    }
+
+    sockaddr_u console_addr;
+    memset(&console_addr.in, 0, sizeof(console_addr.in));
+    console_addr.in.sin_family = AF_INET;
+    console_addr.in.sin_addr.s_addr = info->console_address;
+    console_addr.in.sin_port = htons(port - 100);
+
+    sockaddr_u frontend_addr;
+    memset(&frontend_addr.in, 0, sizeof(frontend_addr.in));
+    frontend_addr.in.sin_family = AF_INET;
+    frontend_addr.in.sin_addr = info->client.in.sin_addr;
+    frontend_addr.in.sin_port = htons(port);
+
+    int buffer_size = RELAY_SOCKET_BUFFER;
+    setsockopt(from_console, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    setsockopt(from_frontend, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+    // Have the kernel stamp each datagram as it arrives, so dwell times include
+    // however long it sat in the socket buffer
+    int on = 1;
+    setsockopt(from_console, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    setsockopt(from_frontend, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+
+    create_ports(to_frontend, from_console, from_frontend, &frontend_addr, sizeof(struct sockaddr_in), &relay_stats.to_frontend[index], &relay_last_receive_ns[0][index]);
+    create_ports(to_console, from_frontend, from_console, &console_addr, sizeof(struct sockaddr_in), &relay_stats.to_console[index], &relay_last_receive_ns[1][index]);
+    if (port == PORT_VID) {
+        enable_udp_offload(to_frontend);
+    }
+
+    if (relay_fec_group && (port == PORT_VID || port == PORT_AUD)) {
+        to_frontend->fec = &relay_fec_encoders[port == PORT_VID ? 0 : 1];
+        to_frontend->fec_frames = (port == PORT_VID);
+        memset(to_frontend->fec, 0, sizeof(*to_frontend->fec));
+
+        char name[128];
+        snprintf(name, sizeof(name), "vanilla_pipe_relay_parity_packets_total{port=\"%s\"}", relay_port_name(port));
+        to_frontend->metric_parity = metrics_counter(name, "Parity packets sent to the frontend");
+    }
+    register_relay_metrics(to_frontend, port, "to_frontend");
+    register_relay_metrics(to_console, port, "to_console");
+
+    return 0;
+}
+
+static void log_send_failure(const relay_ports *ports)
+{
+    char ip[20];
+    inet_ntop(AF_INET, &ports->to_address.in.sin_addr, ip, sizeof(ip));
+    nlprint("FAILED TO SENDTO %s:%u (%i)", ip, ntohs(ports->to_address.in.sin_port), errno);
+}
+
+// Returns the size of the datagrams a GRO super-packet was made from, or `len`
+// if the message is just one datagram. `received_ns` is set to the kernel's
+// receive timestamp if there is one.
+static size_t relay_read_control(struct msghdr *hdr, size_t len, int64_t *received_ns)
+{
+    size_t size = len;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(hdr); cm; cm = CMSG_NXTHDR(hdr, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            int gso_size;
+            memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+            if (gso_size > 0) {
+                size = gso_size;
+            }
+        } else if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            *received_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        }
+    }
+    return size;
+}
+
+// Counts every RELAY_RECV_TIMEOUT_NS the port went without a datagram
+static void relay_record_receive(relay_ports *ports)
+{
+    int64_t now = relay_clock_ns(CLOCK_MONOTONIC_COARSE);
+    int64_t last = __atomic_load_n(ports->last_receive_ns, __ATOMIC_RELAXED);
+    if (last && now - last >= RELAY_RECV_TIMEOUT_NS) {
+        relay_stat_add(&ports->stats->recv_timeouts, (now - last) / RELAY_RECV_TIMEOUT_NS);
+    }
+    __atomic_store_n(ports->last_receive_ns, now, __ATOMIC_RELAXED);
+}
+
+// Puts the time from each datagram arriving until now in the dwell histogram
+static void relay_record_dwell(relay_ports *ports, int received)
+{
+    int64_t now = relay_clock_ns(CLOCK_REALTIME);
+    for (int i = 0; i < received; i++) {
+        int64_t dwell_us = (now - relay_recv_ns[i]) / 1000;
+        int bucket = 0;
+        while (bucket < VANILLA_RELAY_DWELL_BUCKETS - 1 && dwell_us > ((int64_t) VANILLA_RELAY_DWELL_BUCKET_US << bucket)) {
+            bucket++;
+        }
+        relay_stat_add(&ports->stats->dwell[bucket], relay_recv_segments[i]);
+    }
+}
+
+// Fills relay_send_msgs with the datagrams from `first` onwards. With GSO, each
+// run of equally sized datagrams (the last of which may be shorter, like the
+// kernel allows) goes out as one super-packet. Returns the message count.
+static int relay_prepare_send(relay_ports *ports, int first, int count)
+{
+    int msgs = 0;
+    for (int i = first; i < count; msgs++) {
+        size_t size = relay_segments[i].iov_len;
+        size_t total = size;
+        int n = 1;
+        if (ports->gso && size > 0 && size <= ports->gso_size_max) {
+            while (i + n < count && n < RELAY_GSO_SEGMENTS_MAX) {
+                size_t next = relay_segments[i + n].iov_len;
+                if (next == 0 || next > size || total + next > RELAY_GSO_BYTES_MAX) {
+                    break;
+                }
+                total += next;
+                n++;
+                if (next < size) {
+                    break;
+                }
+            }
+        }
+
+        struct msghdr *hdr = &relay_send_msgs[msgs].msg_hdr;
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->msg_name = &ports->to_address;
+        hdr->msg_namelen = ports->to_address_size;
+        hdr->msg_iov = &relay_segments[i];
+        hdr->msg_iovlen = n;
+
+        if (n > 1) {
+            hdr->msg_control = relay_send_control[msgs].buf;
+            hdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            struct cmsghdr *cm = CMSG_FIRSTHDR(hdr);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t gso_size = size;
+            memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+        }
+
+        relay_send_first[msgs] = i;
+        relay_send_count[msgs] = n;
+        i += n;
+    }
+    return msgs;
+}
+
+// Backs off after a super-packet was refused, returning whether its datagrams
+// should be retried
+static int relay_gso_fallback(relay_ports *ports, size_t gso_size, int error)
+{
+    if ((error == EMSGSIZE || error == EINVAL) && gso_size > 1 && gso_size <= ports->gso_size_max) {
+        // Segments have to fit the path MTU, so only offload smaller ones
+        nlprint("UDP GSO REFUSED %zu BYTE DATAGRAMS, SENDING THEM SINGLY", gso_size);
+        ports->gso_size_max = gso_size - 1;
+        return 1;
+    }
+
+    if (error == EINVAL || error == EIO || error == ENOPROTOOPT || error == EOPNOTSUPP) {
+        // No checksum offload on the outgoing interface, or no GSO at all
+        nlprint("UDP GSO UNAVAILABLE (%i), FALLING BACK TO SINGLE DATAGRAMS", error);
+        ports->gso = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Puts a parity packet after each group of datagrams, ending groups early at
+// the end of a video frame so a lost packet can be rebuilt before the next
+// frame starts. Returns the new datagram count.
+static int relay_add_parity(relay_ports *ports, int segments)
+{
+    int count = 0;
+    int parity = 0;
+    for (int i = 0; i < segments; i++) {
+        const uint8_t *data = relay_segments[i].iov_base;
+        size_t size = relay_segments[i].iov_len;
+        relay_segments_with_parity[count++] = relay_segments[i];
+
+        int added = fec_encoder_add(ports->fec, data, size);
+        int group_end = ports->fec->count >= (size_t) relay_fec_group
+            || (added && ports->fec_frames && size >= VIDEO_HEADER_SIZE && video_header_frame_end(data));
+        if (group_end && parity < RELAY_PARITY_MAX) {
+            relay_segments_with_parity[count].iov_base = relay_parity[parity];
+            relay_segments_with_parity[count].iov_len = fec_encoder_finish(ports->fec, relay_parity[parity]);
+            count++;
+            parity++;
+        }
+    }
+
+    memcpy(relay_segments, relay_segments_with_parity, count * sizeof(struct iovec));
+    metrics_add(ports->metric_parity, parity);
+    return count;
+}
+
+// Moves up to one batch of datagrams from `from_socket` to `to_socket`, in the
+// order they arrived. Returns how many messages were received.
+static int relay_batch(relay_ports *ports)
+{
+    for (int i = 0; i < ports->batch_size; i++) {
+        relay_iovs[i].iov_base = relay_buffers + i * ports->datagram_max;
+        relay_iovs[i].iov_len = ports->datagram_max;
+        memset(&relay_msgs[i].msg_hdr, 0, sizeof(relay_msgs[i].msg_hdr));
+        relay_msgs[i].msg_hdr.msg_iov = &relay_iovs[i];
+        relay_msgs[i].msg_hdr.msg_iovlen = 1;
+        relay_msgs[i].msg_hdr.msg_control = relay_recv_control[i].buf;
+        relay_msgs[i].msg_hdr.msg_controllen = sizeof(relay_recv_control[i].buf);
+    }
+
+    int received = recvmmsg(ports->from_socket, relay_msgs, ports->batch_size, MSG_DONTWAIT, NULL);
+    if (received <= 0) {
+        return 0;
+    }
+
+    relay_record_receive(ports);
+    int64_t received_ns = relay_clock_ns(CLOCK_REALTIME);
+
+    // Split GRO super-packets back into the datagrams they were made from
+    int segments = 0;
+    for (int i = 0; i < received; i++) {
+        uint8_t *data = relay_iovs[i].iov_base;
+        size_t len = relay_msgs[i].msg_len;
+        relay_recv_ns[i] = received_ns;
+        size_t gso_size = relay_read_control(&relay_msgs[i].msg_hdr, len, &relay_recv_ns[i]);
+        if (!ports->gro) {
+            gso_size = len;
+        }
+        int first_segment = segments;
+        size_t offset = 0;
+        do {
+            if (segments == RELAY_SEGMENTS_MAX) {
+                metrics_add(ports->metric_errors, 1);
+                break;
+            }
+            size_t size = len - offset < gso_size ? len - offset : gso_size;
+            relay_segments[segments].iov_base = data + offset;
+            relay_segments[segments].iov_len = size;
+            segments++;
+            offset += size;
+        } while (offset < len);
+        relay_recv_segments[i] = segments - first_segment;
+    }
+    ports->burst += segments;
+
+    // Whatever the video stream doesn't take, because no frontend is connected
+    // to it (or the one that was has gone), is relayed over UDP as usual
+    if (ports->to_video_stream) {
+        int streamed = 0;
+        uint64_t bytes = 0;
+        while (streamed < segments && video_stream_push(relay_segments[streamed].iov_base, relay_segments[streamed].iov_len)) {
+            bytes += relay_segments[streamed].iov_len;
+            streamed++;
+        }
+        metrics_add(ports->metric_packets, streamed);
+        metrics_add(ports->metric_bytes, bytes);
+        relay_stat_add(&ports->stats->datagrams, streamed);
+        relay_stat_add(&ports->stats->bytes, bytes);
+
+        if (streamed == segments) {
+            relay_record_dwell(ports, received);
+            return received;
+        }
+
+        segments -= streamed;
+        memmove(relay_segments, relay_segments + streamed, segments * sizeof(struct iovec));
+    }
+
+    if (ports->fec) {
+        segments = relay_add_parity(ports, segments);
+    }
+
+    int msgs = relay_prepare_send(ports, 0, segments);
+    int sent = 0;
+    while (sent < msgs) {
+        int r = sendmmsg(ports->to_socket, relay_send_msgs + sent, msgs - sent, 0);
+        if (r <= 0) {
+            int error = errno;
+            if (relay_send_count[sent] > 1 && relay_gso_fallback(ports, relay_segments[relay_send_first[sent]].iov_len, error)) {
+                msgs = relay_prepare_send(ports, relay_send_first[sent], segments);
+                sent = 0;
+                continue;
+            }
+
+            // Skip the datagrams that failed and carry on with the rest
+            errno = error;
+            log_send_failure(ports);
+            metrics_add(ports->metric_errors, relay_send_count[sent]);
+            relay_stat_add(&ports->stats->send_errors, relay_send_count[sent]);
+            sent++;
+            continue;
+        }
+
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        for (int i = sent; i < sent + r; i++) {
+            packets += relay_send_count[i];
+            bytes += relay_send_msgs[i].msg_len;
+        }
+        metrics_add(ports->metric_packets, packets);
+        metrics_add(ports->metric_bytes, bytes);
+        relay_stat_add(&ports->stats->datagrams, packets);
+        relay_stat_add(&ports->stats->bytes, bytes);
+
+        sent += r;
+    }
+
+    relay_record_dwell(ports, received);
+
+    return received;
+}
+
+static void handle_relay_ports(relay_handler *handler, uint32_t events)
+{
+    (void) events;
+
+    relay_ports *ports = (relay_ports *) handler;
+    ports->burst = 0;
+    for (int b = 0; b < RELAY_BATCHES_PER_WAKEUP; b++) {
+        if (relay_batch(ports) < ports->batch_size) {
+            break;
+        }
+    }
+    relay_stat_max(&ports->stats->max_burst, ports->burst);
+}
+
+// Publishes the relay thread's CPU time a few times a second, which divided by
+// the byte counters gives the relay's CPU cost per Mbit on the actual device
+#define RELAY_CPU_UPDATE_INTERVAL_NS 250000000LL
+
+static void update_relay_cpu(int metric, int64_t *next_update)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    int64_t now_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    if (now_ns < *next_update) {
+        return;
+    }
+    *next_update = now_ns + RELAY_CPU_UPDATE_INTERVAL_NS;
+
+    struct timespec cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    metrics_set(metric, cpu.tv_sec + cpu.tv_nsec / 1e9);
+}
+
+static void *relay_engine(void *data)
+{
+    (void) data;
+
+    int metric_cpu = metrics_gauge("vanilla_pipe_relay_cpu_seconds", "CPU time used by the relay thread");
+    int64_t next_cpu_update = 0;
+
+    struct epoll_event events[RELAY_DIRECTION_COUNT + 1];
+    int running = 1;
+    while (running) {
+        int n = epoll_wait(relay_epoll_fd, events, RELAY_DIRECTION_COUNT + 1, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            nlprint("RELAY EPOLL FAILED: %i", errno);
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            relay_handler *handler = (relay_handler *) events[i].data.ptr;
+            if (!handler) {
+                running = 0;
+                continue;
+            }
+
+            handler->handle(handler, events[i].events);
+        }
+
+        update_relay_cpu(metric_cpu, &next_cpu_update);
+    }
+
+    return NULL;
+}
+
+// Closes everything relay_open() opened
+static void relay_close()
+{
+    for (size_t i = 0; i < relay_direction_count; i++) {
+        __atomic_store_n(relay_directions[i].last_receive_ns, 0, __ATOMIC_RELAXED);
+    }
+
+    if (relay_video_stream_open) {
+        video_stream_stop();
+        relay_video_stream_open = 0;
+    }
+
+    // Each socket is the source of exactly one direction
+    for (size_t i = 0; i < relay_direction_count; i++) {
+        close(relay_directions[i].from_socket);
+    }
+    relay_direction_count = 0;
+
+    if (relay_epoll_fd != -1) {
+        close(relay_epoll_fd);
+        relay_epoll_fd = -1;
+    }
+    if (relay_wake_fd != -1) {
+        close(relay_wake_fd);
+        relay_wake_fd = -1;
+    }
+}
+
+// Opens every socket before the relay thread starts, so they're all ready by
+// the time the frontend is told it's connected
+static int relay_open(const struct relay_info *info)
+{
+    relay_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (relay_wake_fd == -1) {
+        nlprint("FAILED TO CREATE RELAY EVENTFD: %i", errno);
+        return -1;
+    }
+
+    relay_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (relay_epoll_fd == -1) {
+        nlprint("FAILED TO CREATE EPOLL: %i", errno);
+        relay_close();
+        return -1;
+    }
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(relay_epoll_fd, EPOLL_CTL_ADD, relay_wake_fd, &ev);
+
+    relay_ports *video_to_frontend = NULL;
+    int console_msg_socket = -1;
+
+    for (size_t i = 0; i < RELAY_PORT_COUNT; i++) {
+        relay_ports *to_frontend = &relay_directions[relay_direction_count];
+        relay_ports *to_console = &relay_directions[relay_direction_count + 1];
+
+        // Like before, a port that fails to open doesn't stop the others
+        if (open_relay_port(info, i, to_frontend, to_console) != 0) {
+            continue;
+        }
+
+        to_frontend->handler.handle = handle_relay_ports;
+        to_console->handler.handle = handle_relay_ports;
+
+        if (relay_port_list[i] == PORT_VID) {
+            video_to_frontend = to_frontend;
+        } else if (relay_port_list[i] == PORT_MSG) {
+            console_msg_socket = to_frontend->from_socket;
+        }
+
+        ev.data.ptr = &to_frontend->handler;
+        epoll_ctl(relay_epoll_fd, EPOLL_CTL_ADD, to_frontend->from_socket, &ev);
+        ev.data.ptr = &to_console->handler;
+        epoll_ctl(relay_epoll_fd, EPOLL_CTL_ADD, to_console->from_socket, &ev);
+
+        relay_direction_count += 2;
+    }
+
+    if (relay_video_stream && video_to_frontend && console_msg_socket != -1) {
+        if (video_stream_start(relay_epoll_fd, &info->client, console_msg_socket) == 0) {
+            video_to_frontend->to_video_stream = 1;
+            relay_video_stream_open = 1;
+        }
+    }
+
+    // Receive timeouts count from when the relays start
+    int64_t now = relay_clock_ns(CLOCK_MONOTONIC_COARSE);
+    for (size_t i = 0; i < relay_direction_count; i++) {
+        __atomic_store_n(relay_directions[i].last_receive_ns, now, __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+void relay_set_video_stream(int enabled)
+{
+    relay_video_stream = enabled;
+}
+
+void relay_set_fec(int group_size)
+{
+    relay_fec_group = group_size;
+}
+
+void relay_get_stats(vanilla_pipe_stats_t *stats)
+{
+    const uint64_t *from = (const uint64_t *) &relay_stats;
+    uint64_t *to = (uint64_t *) stats;
+    for (size_t i = 0; i < sizeof(*stats) / sizeof(uint64_t); i++) {
+        to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+    }
+
+    // Count the gap a port is in the middle of too, or one that stopped
+    // receiving altogether would never show any timeouts
+    int64_t now = relay_clock_ns(CLOCK_MONOTONIC_COARSE);
+    for (size_t i = 0; i < RELAY_PORT_COUNT; i++) {
+        int64_t last = __atomic_load_n(&relay_last_receive_ns[0][i], __ATOMIC_RELAXED);
+        if (last) {
+            stats->to_frontend[i].recv_timeouts += (now - last) / RELAY_RECV_TIMEOUT_NS;
+        }
+        last = __atomic_load_n(&relay_last_receive_ns[1][i], __ATOMIC_RELAXED);
+        if (last) {
+            stats->to_console[i].recv_timeouts += (now - last) / RELAY_RECV_TIMEOUT_NS;
+        }
+    }
+}
+
+double relay_get_cpu_seconds()
+{
+    clockid_t clock;
+    struct timespec cpu;
+    if (relay_wake_fd == -1 || pthread_getcpuclockid(relay_thread, &clock) != 0 || clock_gettime(clock, &cpu) != 0) {
+        return 0;
+    }
+    return cpu.tv_sec + cpu.tv_nsec / 1e9;
+}
+
+int relay_start(const struct relay_info *info)
+{
+    uint64_t *stats = (uint64_t *) &relay_stats;
+    for (size_t i = 0; i < sizeof(relay_stats) / sizeof(uint64_t); i++) {
+        __atomic_store_n(&stats[i], 0, __ATOMIC_RELAXED);
+    }
+
+    if (relay_open(info) != 0) {
+        return -1;
+    }
+
+    if (pthread_create(&relay_thread, NULL, relay_engine, NULL) != 0) {
+        relay_close();
+        return -1;
+    }
+    pthread_setname_np(relay_thread, "vanilla-relay");
+
+    nlprint("STARTED RELAYS");
+
+    return 0;
+}
+
+int relay_serving_video_stream()
+{
+    return relay_video_stream_open;
+}
+
+void relay_stop()
+{
+    if (relay_wake_fd == -1) {
+        return;
+    }
+
+    uint64_t one = 1;
+    if (write(relay_wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        // The thread would never notice, so joining it would hang
+        nlprint("FAILED TO WAKE RELAY THREAD: %i", errno);
+        return;
+    }
+    pthread_join(relay_thread, NULL);
+
+    relay_close();
+
+    nlprint("STOPPED RELAYS");
+}
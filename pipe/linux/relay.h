@@ -0,0 +1,56 @@
+#ifndef VANILLA_PIPE_RELAY_H
+#define VANILLA_PIPE_RELAY_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/un.h>
+
+#include "../def.h"
+
+typedef union {
+    struct sockaddr_in in;
+    struct sockaddr_un un;
+} sockaddr_u;
+
+struct relay_info {
+    const char *wireless_interface;
+    in_addr_t address; // Where the relays bind, normally INADDR_ANY
+    in_addr_t console_address;
+    sockaddr_u client;
+    size_t client_size;
+};
+
+// Anything the relay thread waits on, epoll events point at one of these
+typedef struct relay_handler relay_handler;
+struct relay_handler {
+    void (*handle)(relay_handler *handler, uint32_t events);
+};
+
+int open_socket(int local, in_addr_t address, in_port_t port);
+
+// Reassemble video and serve it over TCP rather than relaying each packet
+// (only applies to UDP mode)
+void relay_set_video_stream(int enabled);
+
+// Follow every `group_size` video and audio packets sent to the frontend with
+// a parity packet (only applies to UDP mode, 0 disables)
+void relay_set_fec(int group_size);
+
+// Relays every gamepad port between the console and the frontend on a single
+// thread until relay_stop() is called. Every socket is open by the time this
+// returns.
+int relay_start(const struct relay_info *info);
+void relay_stop();
+
+// Whether relay_start() is serving reassembled video over TCP
+int relay_serving_video_stream();
+
+// CPU time the relay thread has used since relay_start()
+double relay_get_cpu_seconds();
+
+// Copies the relay statistics since the last relay_start(), safe to call from
+// any thread
+void relay_get_stats(vanilla_pipe_stats_t *stats);
+
+#endif // VANILLA_PIPE_RELAY_H
@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+
+#include "videostream.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../def.h"
+#include "../ports.h"
+#include "gamepad/reassembly.h"
+#include "metrics.h"
+#include "wpa.h"
+
+// Enough for a few IDR frames to queue up behind a slow frontend
+#define VIDEO_STREAM_BUFFER_SIZE (2 * 1024 * 1024)
+
+static int stream_epoll_fd = -1;
+static int stream_listen_fd = -1;
+static int stream_client_fd = -1;
+static struct in_addr stream_client_addr;
+static int stream_console_msg_socket = -1;
+static relay_handler stream_listen_handler;
+static relay_handler stream_client_handler;
+
+// Reassembly state, mirroring handle_video_packet()
+static VideoPacket stream_packets[VIDEO_SEQ_COUNT];
+static uint16_t stream_packet_sizes[VIDEO_SEQ_COUNT];
+static video_frame_t stream_frame = VIDEO_FRAME_INIT;
+static int stream_frame_sent = 0;
+static int stream_complete_frame = 0;
+
+// Bytes waiting to be written to the frontend
+static uint8_t stream_buffer[VIDEO_STREAM_BUFFER_SIZE];
+static size_t stream_buffer_start = 0;
+static size_t stream_buffer_end = 0;
+
+static int metric_frames_sent = -1;
+static int metric_frames_dropped = -1;
+
+static void request_idr_from_console()
+{
+    // Same request libvanilla makes in send_idr_request_to_console()
+    static const uint8_t idr_request[] = {1, 0, 0, 0};
+
+    struct sockaddr_in console_addr;
+    memset(&console_addr, 0, sizeof(console_addr));
+    console_addr.sin_family = AF_INET;
+    console_addr.sin_addr.s_addr = inet_addr("192.168.1.10");
+    console_addr.sin_port = htons(PORT_MSG - 100);
+
+    sendto(stream_console_msg_socket, idr_request, sizeof(idr_request), 0, (const struct sockaddr *) &console_addr, sizeof(console_addr));
+}
+
+static void watch_client(uint32_t events)
+{
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.ptr = &stream_client_handler;
+    epoll_ctl(stream_epoll_fd, EPOLL_CTL_MOD, stream_client_fd, &ev);
+}
+
+static void close_client()
+{
+    if (stream_client_fd == -1) {
+        return;
+    }
+
+    nlprint("VIDEO STREAM CLIENT DISCONNECTED");
+    close(stream_client_fd);
+    stream_client_fd = -1;
+    stream_buffer_start = 0;
+    stream_buffer_end = 0;
+}
+
+// libvanilla falls back to UDP once its connection fails, so the relay takes
+// over again until a frontend (e.g. a restarted one) connects again
+static void fail_client()
+{
+    if (stream_client_fd != -1) {
+        close_client();
+        nlprint("VIDEO STREAM FAILED, RELAYING VIDEO OVER UDP UNTIL A FRONTEND RECONNECTS");
+    }
+}
+
+// Writes as much of the buffer as the socket will take without blocking
+static void flush_client()
+{
+    while (stream_buffer_start < stream_buffer_end) {
+        ssize_t sent = send(stream_client_fd, stream_buffer + stream_buffer_start, stream_buffer_end - stream_buffer_start, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                watch_client(EPOLLIN | EPOLLOUT);
+                return;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            fail_client();
+            return;
+        }
+        stream_buffer_start += sent;
+    }
+
+    stream_buffer_start = 0;
+    stream_buffer_end = 0;
+    watch_client(EPOLLIN);
+}
+
+// Queues every packet of the current frame, or nothing if they don't all fit
+static int queue_frame()
+{
+    size_t size = 0;
+    for (int i = stream_frame.seq; ; i = video_seq_next(i)) {
+        size += 2 + stream_packet_sizes[i];
+        if (i == stream_frame.seq_end) {
+            break;
+        }
+    }
+
+    if (stream_buffer_end + size > sizeof(stream_buffer)) {
+        memmove(stream_buffer, stream_buffer + stream_buffer_start, stream_buffer_end - stream_buffer_start);
+        stream_buffer_end -= stream_buffer_start;
+        stream_buffer_start = 0;
+        if (stream_buffer_end + size > sizeof(stream_buffer)) {
+            return 0;
+        }
+    }
+
+    for (int i = stream_frame.seq; ; i = video_seq_next(i)) {
+        uint8_t *out = stream_buffer + stream_buffer_end;
+        out[0] = stream_packet_sizes[i] >> 8;
+        out[1] = stream_packet_sizes[i];
+        memcpy(out + 2, &stream_packets[i], stream_packet_sizes[i]);
+        stream_buffer_end += 2 + stream_packet_sizes[i];
+        if (i == stream_frame.seq_end) {
+            break;
+        }
+    }
+
+    return 1;
+}
+
+int video_stream_push(const uint8_t *data, size_t size)
+{
+    if (stream_client_fd == -1) {
+        return 0;
+    }
+
+    if (size < VIDEO_HEADER_SIZE) {
+        return 1;
+    }
+
+    VideoHeader header;
+    decode_video_header(data, &header);
+
+    if (size > sizeof(VideoPacket)) {
+        size = sizeof(VideoPacket);
+    }
+    VideoPacket *vp = &stream_packets[header.seq_id];
+    memcpy(vp, data, size);
+    stream_packet_sizes[header.seq_id] = size;
+
+    if (header.frame_begin) {
+        if (stream_frame.seq != -1 && !stream_frame_sent) {
+            metrics_add(metric_frames_dropped, 1);
+        }
+
+        video_frame_begin(&stream_frame, header.seq_id);
+        stream_frame_sent = 0;
+
+        // Like libvanilla, there's no use forwarding frames that depend on
+        // one that never made it, so wait for the next IDR instead
+        if (!stream_complete_frame && !video_packet_is_idr(vp)) {
+            request_idr_from_console();
+            return 1;
+        }
+
+        stream_complete_frame = 0;
+    }
+
+    if (stream_frame_sent) {
+        return 1;
+    }
+
+    if (video_frame_add(&stream_frame, &header, vp, NULL) != VIDEO_FRAME_COMPLETE) {
+        return 1;
+    }
+
+    stream_frame_sent = 1;
+    if (!queue_frame()) {
+        // The frontend isn't keeping up, drop the frame and resync from an IDR
+        metrics_add(metric_frames_dropped, 1);
+        return 1;
+    }
+
+    stream_complete_frame = 1;
+    metrics_add(metric_frames_sent, 1);
+    flush_client();
+    return 1;
+}
+
+static void handle_client(relay_handler *handler, uint32_t events)
+{
+    (void) handler;
+
+    if (events & EPOLLIN) {
+        // The frontend never sends anything, so this is just for noticing
+        // when it goes away
+        uint8_t discard[256];
+        ssize_t read_size = recv(stream_client_fd, discard, sizeof(discard), MSG_DONTWAIT);
+        if (read_size == 0 || (read_size == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            fail_client();
+            return;
+        }
+    }
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        fail_client();
+        return;
+    }
+
+    if (events & EPOLLOUT) {
+        flush_client();
+    }
+}
+
+static void handle_listen(relay_handler *handler, uint32_t events)
+{
+    (void) handler;
+    (void) events;
+
+    struct sockaddr_in addr;
+    socklen_t addr_size = sizeof(addr);
+    int skt = accept4(stream_listen_fd, (struct sockaddr *) &addr, &addr_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (skt == -1) {
+        return;
+    }
+
+    // Only the frontend that asked for the connection gets the video
+    if (addr.sin_addr.s_addr != stream_client_addr.s_addr) {
+        close(skt);
+        return;
+    }
+
+    // A reconnecting frontend replaces the old connection
+    close_client();
+
+    int one = 1;
+    setsockopt(skt, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    stream_client_fd = skt;
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &stream_client_handler;
+    epoll_ctl(stream_epoll_fd, EPOLL_CTL_ADD, stream_client_fd, &ev);
+
+    // Start the new frontend off with an IDR frame
+    stream_frame_sent = 1;
+    stream_complete_frame = 0;
+
+    nlprint("VIDEO STREAM CLIENT CONNECTED");
+}
+
+int video_stream_start(int epoll_fd, const sockaddr_u *client, int console_msg_socket)
+{
+    metric_frames_sent = metrics_counter("vanilla_pipe_video_stream_frames_total{state=\"sent\"}", "Reassembled video frames sent to the frontend");
+    metric_frames_dropped = metrics_counter("vanilla_pipe_video_stream_frames_total{state=\"dropped\"}", "Reassembled video frames sent to the frontend");
+
+    int skt = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (skt == -1) {
+        nlprint("FAILED TO CREATE VIDEO STREAM SOCKET: %i", errno);
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(skt, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(VANILLA_PIPE_VIDEO_STREAM_PORT);
+
+    if (bind(skt, (const struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(skt, 1) == -1) {
+        nlprint("FAILED TO LISTEN FOR VIDEO STREAM ON PORT %u: %i", VANILLA_PIPE_VIDEO_STREAM_PORT, errno);
+        close(skt);
+        return -1;
+    }
+
+    stream_epoll_fd = epoll_fd;
+    stream_listen_fd = skt;
+    stream_client_fd = -1;
+    stream_client_addr = client->in.sin_addr;
+    stream_console_msg_socket = console_msg_socket;
+    stream_listen_handler.handle = handle_listen;
+    stream_client_handler.handle = handle_client;
+    stream_buffer_start = 0;
+    stream_buffer_end = 0;
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &stream_listen_handler;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stream_listen_fd, &ev);
+
+    nlprint("SERVING REASSEMBLED VIDEO ON PORT %u", VANILLA_PIPE_VIDEO_STREAM_PORT);
+
+    return 0;
+}
+
+void video_stream_stop()
+{
+    close_client();
+
+    if (stream_listen_fd != -1) {
+        close(stream_listen_fd);
+        stream_listen_fd = -1;
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef VANILLA_PIPE_VIDEOSTREAM_H
+#define VANILLA_PIPE_VIDEOSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "relay.h"
+
+// Reassembles video next to the console and serves each complete frame to the
+// frontend over TCP (see VANILLA_PIPE_VIDEO_STREAM_PORT), so a lossy link to
+// the frontend can't lose individual packets of a frame. Runs on the relay
+// thread, using its epoll instance. Whenever no frontend is connected (or its
+// connection failed), video goes back to being relayed until one connects.
+int video_stream_start(int epoll_fd, const sockaddr_u *client, int console_msg_socket);
+void video_stream_stop();
+
+// Takes one video packet from the console. Returns 0 if no frontend is
+// receiving the stream, in which case the packet should be relayed instead.
+int video_stream_push(const uint8_t *data, size_t size);
+
+#endif // VANILLA_PIPE_VIDEOSTREAM_H
@@ -10,23 +10,28 @@
 #include <netlink/genl/genl.h>
 #include <netlink/route/addr.h>
 #include <pthread.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/eventfd.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include <wpa_ctrl.h>
 
 #include "../def.h"
 #include "../ports.h"
 #include "dhcp/dhcpc.h"
+#include "metrics.h"
+#include "relay.h"
 #include "util.h"
 #include "vanilla.h"
 #include "wpa.h"
@@ -44,22 +49,11 @@ static const char *wpa_ctrl_interface = "/var/run/wpa_supplicant_drc";
 static pthread_mutex_t running_mutex;
 static pthread_mutex_t main_loop_mutex;
 static pthread_mutex_t action_mutex;
-static pthread_mutex_t relay_mutex;
 static int running = 0;
 static int main_loop = 0;
-static int relay_running = 0;
 
-typedef union {
-    struct sockaddr_in in;
-    struct sockaddr_un un;
-} sockaddr_u;
-
-typedef struct {
-    int from_socket;
-    int to_socket;
-    sockaddr_u to_address;
-    size_t to_address_size;
-} relay_ports;
+// Written by interrupt() so threads waiting in poll() notice right away
+static int interrupt_fd = -1;
 
 struct sync_args {
     const char *wireless_interface;
@@ -75,40 +69,76 @@ struct sync_args {
     size_t client_size;
 };
 
-struct relay_info {
-    const char *wireless_interface;
-    int local;
-    sockaddr_u client;
-    size_t client_size;
-    in_port_t port;
-};
-
 #define THREADRESULT(x) ((void *) (uintptr_t) (x))
 
-static const char *ext_logfile = 0;
-void nlprint(const char *fmt, ...)
+size_t get_home_directory_file(const char *filename, char *buf, size_t buf_size);
+void bytes_to_str(unsigned char *data, size_t data_size, const char *separator, char *output);
+
+static int metric_associated = -1;
+static int metric_reconnects = -1;
+static int metric_dhcp_seconds = -1;
+static int metric_dhcp_failures = -1;
+
+static const double dhcp_seconds_buckets[] = {0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2, 5, 10, 30};
+
+static void register_pipe_metrics()
 {
-    va_list args;
-    va_start(args, fmt);
+    metric_associated = metrics_gauge("vanilla_pipe_associated", "Whether the pipe is associated with the console");
+    metric_reconnects = metrics_counter("vanilla_pipe_reconnects_total", "Times the console disconnected and the pipe started reconnecting");
+    metric_dhcp_seconds = metrics_histogram("vanilla_pipe_dhcp_seconds", "Time taken to get a DHCP lease from the console", dhcp_seconds_buckets, sizeof(dhcp_seconds_buckets) / sizeof(dhcp_seconds_buckets[0]));
+    metric_dhcp_failures = metrics_counter("vanilla_pipe_dhcp_failures_total", "DHCP attempts that didn't get a lease");
+}
 
-    if (ext_logfile) {
-		va_list a2;
-		va_copy(a2, args);
+static double monotonic_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
 
+static const char *ext_logfile = 0;
+void pipe_log_sink(int category, int level, const char *text, int newline)
+{
+    // Runs on the logging thread, so reopening the log file for each line
+    // doesn't hold up anything else
+    if (ext_logfile) {
         FILE *f = fopen(ext_logfile, "a");
         if (f) {
-            vfprintf(f, fmt, a2);
-            fprintf(f, "\n");
+            fputs(text, f);
+            if (newline) {
+                fputc('\n', f);
+            }
             fclose(f);
         }
+    }
 
-		va_end(a2);
+    fputs(text, stderr);
+    if (newline) {
+        fputc('\n', stderr);
     }
+}
 
-    vfprintf(stderr, fmt, args);
-    fprintf(stderr, "\n");
+static void wake_interrupted()
+{
+    uint64_t one = 1;
+    if (interrupt_fd == -1) {
+        return;
+    }
 
-    va_end(args);
+    // EAGAIN means the counter is full, so it's readable anyway
+    if (write(interrupt_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        nlprint("FAILED TO WAKE INTERRUPTED THREAD: %i", errno);
+    }
+}
+
+// Clears every wakeup written so far, so interrupt_fd only polls readable again
+// once there's a new one
+static void drain_interrupted()
+{
+    uint64_t count;
+    if (read(interrupt_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        nlprint("FAILED TO CLEAR INTERRUPT WAKEUP: %i", errno);
+    }
 }
 
 int is_interrupted()
@@ -119,17 +149,9 @@ int is_interrupted()
     return r;
 }
 
-int are_relays_running()
-{
-    pthread_mutex_lock(&relay_mutex);
-    int r = relay_running;
-    pthread_mutex_unlock(&relay_mutex);
-    return r;
-}
-
 void vanilla_pipe_wpa_msg(char *msg, size_t len)
 {
-    nlprint("%.*s", len, msg);
+    nlprint("%.*s", (int) len, msg);
 }
 
 void wpa_ctrl_command(struct wpa_ctrl *ctrl, const char *cmd, char *buf, size_t *buf_len)
@@ -145,6 +167,7 @@ void quit_loop()
     main_loop = 0;
     pthread_mutex_unlock(&main_loop_mutex);
     pthread_mutex_unlock(&running_mutex);
+    wake_interrupted();
 }
 
 void interrupt()
@@ -152,13 +175,43 @@ void interrupt()
     pthread_mutex_lock(&running_mutex);
     running = 0;
     pthread_mutex_unlock(&running_mutex);
+    wake_interrupted();
 }
 
-void interrupt_relays()
+// Blocks until wpa_supplicant has an event for us, returns 1 if one is
+// pending, 0 on timeout and -1 if interrupted
+static int wait_for_wpa_event(struct wpa_ctrl *ctrl, int timeout_ms)
 {
-    pthread_mutex_lock(&relay_mutex);
-    relay_running = 0;
-    pthread_mutex_unlock(&relay_mutex);
+    struct pollfd fds[2];
+    fds[0].fd = wpa_ctrl_get_fd(ctrl);
+    fds[0].events = POLLIN;
+    fds[1].fd = interrupt_fd;
+    fds[1].events = POLLIN;
+
+    while (1) {
+        if (is_interrupted()) {
+            return -1;
+        }
+
+        if (wpa_ctrl_pending(ctrl) > 0) {
+            return 1;
+        }
+
+        int r = poll(fds, 2, timeout_ms);
+        if (r == 0) {
+            return 0;
+        }
+        if ((r == -1 && errno != EINTR) || (r > 0 && (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)))) {
+            return -1;
+        }
+
+        // A wakeup left over from an earlier interrupt (or one that raced
+        // with running being set) would otherwise keep poll() returning
+        // straight away
+        if (r > 0 && (fds[1].revents & POLLIN)) {
+            drain_interrupted();
+        }
+    }
 }
 
 void sigint_handler(int signum)
@@ -383,9 +436,80 @@ const char *get_dhcp_value(char **env, const char *key)
     return 0;
 }
 
+struct dhcp_context {
+    struct nl_sock *nl;
+    const char *lease_file;
+};
+
+// Adds an address to the interface without waiting for the kernel to reply
+static void add_interface_address(struct nl_sock *nl, const char *network_interface, const char *ip, const char *mask)
+{
+    // Create IP address object from DHCP data
+    struct nl_addr *ip_addr;
+    if (nl_addr_parse(ip, AF_INET, &ip_addr) < 0) {
+        return;
+    }
+    nl_addr_set_prefixlen(ip_addr, atoi(mask));
+
+    // Create route object
+    struct rtnl_addr *ra = rtnl_addr_alloc();
+    rtnl_addr_set_ifindex(ra, if_nametoindex(network_interface));
+    rtnl_addr_set_local(ra, ip_addr);
+
+    // Create build request
+    struct nl_msg *msg;
+    rtnl_addr_build_add_request(ra, 0, &msg);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,00)
+    // Make this route the lowest possible priority so the system doesn't favor it over other connections
+    nla_put_u32(msg, IFA_RT_PRIORITY, UINT32_MAX);
+#endif
+
+    // Send request
+    nl_send_auto_complete(nl, msg);
+
+    // Cleanup
+    nlmsg_free(msg);
+    rtnl_addr_put(ra);
+    nl_addr_put(ip_addr);
+}
+
+// The last lease is kept per console so a reconnect can reuse it straight away
+static void get_dhcp_lease_filename(const unsigned char *bssid, char *buf, size_t buf_size)
+{
+    char bssid_str[13];
+    char filename[64];
+    bytes_to_str((unsigned char *) bssid, 6, NULL, bssid_str);
+    snprintf(filename, sizeof(filename), "vanilla_dhcp_lease_%s", bssid_str);
+    get_home_directory_file(filename, buf, buf_size);
+}
+
+static int read_dhcp_lease(const char *lease_file, char *ip, char *mask)
+{
+    FILE *file = fopen(lease_file, "r");
+    if (!file) {
+        return 0;
+    }
+
+    int valid = (fscanf(file, "%15s %2s", ip, mask) == 2 && inet_addr(ip) != INADDR_NONE);
+    fclose(file);
+    return valid;
+}
+
+static void write_dhcp_lease(const char *lease_file, const char *ip, const char *mask)
+{
+    FILE *file = fopen(lease_file, "w");
+    if (!file) {
+        return;
+    }
+
+    fprintf(file, "%s %s\n", ip, mask);
+    fclose(file);
+}
+
 void dhcp_callback(const char *type, char **env, void *data)
 {
-    struct nl_sock *nl = (struct nl_sock *) data;
+    struct dhcp_context *ctx = (struct dhcp_context *) data;
 
     if (!strcmp(type, "bound")) {
         // Add address to interface
@@ -395,39 +519,21 @@ void dhcp_callback(const char *type, char **env, void *data)
         // const char *serverid = get_dhcp_value(env, "serverid");
         const char *mask = get_dhcp_value(env, "mask");
 
-        // Create IP address object from DHCP data
-        struct nl_addr *ip_addr;
-        nl_addr_parse(ip, AF_INET, &ip_addr);
-        nl_addr_set_prefixlen(ip_addr, atoi(mask));
-
-        // Create route object
-        struct rtnl_addr *ra = rtnl_addr_alloc();
-        rtnl_addr_set_ifindex(ra, if_nametoindex(get_dhcp_value(env, "interface")));
-        rtnl_addr_set_local(ra, ip_addr);
-
-        // Create build request
-        struct nl_msg *msg;
-        rtnl_addr_build_add_request(ra, 0, &msg);
+        add_interface_address(ctx->nl, get_dhcp_value(env, "interface"), ip, mask);
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,00)
-        // Make this route the lowest possible priority so the system doesn't favor it over other connections
-        nla_put_u32(msg, IFA_RT_PRIORITY, UINT32_MAX);
-#endif
-
-        // Send request
-        nl_send_auto_complete(nl, msg);
-
-        // Cleanup
-        nlmsg_free(msg);
-        rtnl_addr_put(ra);
-        nl_addr_put(ip_addr);
+        if (ip && mask) {
+            write_dhcp_lease(ctx->lease_file, ip, mask);
+        }
     } else if (!strcmp(type, "deconfig")) {
         // Remove address from interface
         struct rtnl_addr *ra = rtnl_addr_alloc();
         rtnl_addr_set_ifindex(ra, if_nametoindex(get_dhcp_value(env, "interface")));
         rtnl_addr_set_family(ra, AF_INET);
-        rtnl_addr_delete(nl, ra, 0);
+        rtnl_addr_delete(ctx->nl, ra, 0);
         rtnl_addr_put(ra);
+    } else if (!strcmp(type, "nak")) {
+        // The console no longer wants us using the cached address
+        unlink(ctx->lease_file);
     }
     // nlprint("GOT DHCP EVENT: %s", type);
     // while (*env) {
@@ -437,7 +543,7 @@ void dhcp_callback(const char *type, char **env, void *data)
     // }
 }
 
-int call_dhcp(const char *network_interface)
+int call_dhcp(const char *network_interface, const unsigned char *bssid)
 {
     int ret = VANILLA_ERR_GENERIC;
 
@@ -453,12 +559,32 @@ int call_dhcp(const char *network_interface)
         goto free_socket_and_exit;
     }
 
+    char lease_file[1024];
+    get_dhcp_lease_filename(bssid, lease_file, sizeof(lease_file));
+
+    struct dhcp_context ctx;
+    ctx.nl = nl;
+    ctx.lease_file = lease_file;
+
     client_config.foreground = 1;
     client_config.quit_after_lease = 1;
     client_config.interface = (char *) network_interface;
     client_config.callback = dhcp_callback;
-    client_config.callback_data = nl;
+    client_config.callback_data = &ctx;
     client_config.abort_if_no_lease = 1;
+    client_config.rapid_commit = 1;
+    client_config.timing = &udhcpc_timing_console;
+    client_config.requested_ip = 0;
+
+    // If we've had a lease from this console before, start using it now and
+    // only ask the console to confirm it (INIT-REBOOT). A NAK or no reply
+    // falls back to the full exchange.
+    char ip[16], mask[3];
+    if (read_dhcp_lease(lease_file, ip, mask)) {
+        nlprint("REUSING DHCP LEASE %s/%s", ip, mask);
+        add_interface_address(nl, network_interface, ip, mask);
+        client_config.requested_ip = inet_addr(ip);
+    }
 
     if (udhcpc_main() == 0) {
         ret = VANILLA_SUCCESS;
@@ -535,158 +661,23 @@ int nl80211_get_power_save(struct nl_sock *nl, int nl80211_id, int ifindex, int
     return (*ps_state == -1) ? -1 : 0;
 }
 
-void *do_relay(void *data)
-{
-    relay_ports *ports = (relay_ports *) data;
-    char buf[4096];
-    ssize_t read_size;
-    while (are_relays_running()) {
-        read_size = recv(ports->from_socket, buf, sizeof(buf), 0);
-        if (read_size <= 0) {
-            continue;
-        }
-
-        if (sendto(ports->to_socket, buf, read_size, 0, (const struct sockaddr *) &ports->to_address, ports->to_address_size) == -1) {
-            if (ports->to_address_size == sizeof(struct sockaddr_un)) {
-                nlprint("FAILED TO SENDTO \"%s\" (%i)", ports->to_address.un.sun_path, errno);
-            } else if (ports->to_address_size == sizeof(struct sockaddr_in)) {
-                char ip[20];
-                inet_ntop(AF_INET, &ports->to_address.in.sin_addr, ip, sizeof(ip));
-                nlprint("FAILED TO SENDTO %s:%u (%i)", ip, ports->to_address.in.sin_port, errno);
-            } else {
-                nlprint("FAILED TO SENDTO - INVALID SIZE: %zu", ports->to_address_size);
-            }
-        }
-    }
-    return NULL;
-}
-
-relay_ports create_ports(int from_socket, int to_socket, const sockaddr_u *to_addr, size_t to_addr_size)
-{
-    relay_ports ports;
-    ports.from_socket = from_socket;
-    ports.to_socket = to_socket;
-    ports.to_address = *to_addr;
-    ports.to_address_size = to_addr_size;
-    return ports;
-}
-
-int open_socket(int local, in_port_t port)
-{
-    sockaddr_u sa;
-    size_t sa_size;
-
-    int skt;
-    if (local) {
-        skt = socket(AF_UNIX, SOCK_DGRAM, 0);
-        sa.un.sun_family = AF_UNIX;
-        snprintf(sa.un.sun_path, sizeof(sa.un.sun_path) - 1, VANILLA_PIPE_LOCAL_SOCKET, port);
-        unlink(sa.un.sun_path);
-        sa_size = sizeof(struct sockaddr_un);
-    } else {
-        skt = socket(AF_INET, SOCK_DGRAM, 0);
-        sa.in.sin_family = AF_INET;
-        sa.in.sin_addr.s_addr = INADDR_ANY;
-        sa.in.sin_port = htons(port);
-        sa_size = sizeof(struct sockaddr_in);
-    }
-    if (skt == -1) {
-        return -1;
-    }
-
-    struct timeval tv = {0};
-    tv.tv_usec = 250000;
-    setsockopt(skt, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-
-    if (bind(skt, (const struct sockaddr *) &sa, sa_size) == -1) {
-        nlprint("FAILED TO BIND PORT %u: %i", port, errno);
-        close(skt);
-        return -1;
-    } else {
-        // nlprint("BOUND PORT %u", port);
-    }
-
-    return skt;
-}
-
-void *open_relay(void *data)
-{
-    struct relay_info *info = (struct relay_info *) data;
-    in_port_t port = info->port;
-    int ret = -1;
-
-    // Open an incoming port from the console
-    int from_console = open_socket(0, port);
-    if (from_console == -1) {
-        goto close;
-    }
-
-    setsockopt(from_console, SOL_SOCKET, SO_BINDTODEVICE, info->wireless_interface, strlen(info->wireless_interface));
-
-    // Open an incoming port from the frontend
-    int from_frontend = open_socket(info->local, port - 100);
-    if (from_frontend == -1) {
-        goto close_console_connection;
-    }
-
-    struct sockaddr_in console_addr = {0};
-    console_addr.sin_family = AF_INET;
-    console_addr.sin_addr.s_addr = inet_addr("192.168.1.10");
-    console_addr.sin_port = htons(port - 100);
-
-    sockaddr_u frontend_addr;
-    size_t frontend_addr_size;
-    if (info->local) {
-        memset(&frontend_addr.un, 0, sizeof(frontend_addr.un));
-        frontend_addr.un.sun_family = AF_UNIX;
-        snprintf(frontend_addr.un.sun_path, sizeof(frontend_addr.un.sun_path), VANILLA_PIPE_LOCAL_SOCKET, port);
-        frontend_addr_size = sizeof(frontend_addr.un);
-    } else {
-        memset(&frontend_addr.in, 0, sizeof(frontend_addr.in));
-        frontend_addr.in.sin_family = AF_INET;
-        frontend_addr.in.sin_addr = info->client.in.sin_addr;
-        frontend_addr.in.sin_port = htons(port);
-        frontend_addr_size = sizeof(frontend_addr.in);
-    }
-
-    // nlprint("ENTERING MAIN LOOP");
-    while (are_relays_running()) {
-        nlprint("STARTED RELAYS");
-        relay_ports console_to_frontend = create_ports(from_console, from_frontend, &frontend_addr, frontend_addr_size);
-        relay_ports frontend_to_console = create_ports(from_frontend, from_console, (sockaddr_u *) &console_addr, sizeof(struct sockaddr_in));
-
-        pthread_t a_thread, b_thread;
-        pthread_create(&a_thread, NULL, do_relay, &console_to_frontend);
-        pthread_create(&b_thread, NULL, do_relay, &frontend_to_console);
-
-        pthread_join(a_thread, NULL);
-        pthread_join(b_thread, NULL);
-
-        nlprint("STOPPED RELAYS");
-
-        // nlprint("RELAY EXITED");
-    }
-
-    ret = 0;
-
-close_frontend_connection:
-    close(from_frontend);
-
-close_console_connection:
-    close(from_console);
-
-close:
-    return THREADRESULT(ret);
-}
-
 int check_for_disconnection(struct sync_args *args)
 {
     vanilla_pipe_command_t cmd;
     char buf[1024];
-    size_t buf_len = sizeof(buf);
-    if (wpa_ctrl_recv(args->ctrl, buf, &buf_len) == 0) {
-        if (!memcmp(buf, "<3>CTRL-EVENT-DISCONNECTED", 26)) {
+
+    // Go through everything that's queued up so a disconnect isn't stuck
+    // behind BSS updates, but leave anything after it for do_connect()
+    while (wpa_ctrl_pending(args->ctrl) > 0) {
+        size_t buf_len = sizeof(buf);
+        if (wpa_ctrl_recv(args->ctrl, buf, &buf_len) != 0) {
+            break;
+        }
+
+        if (buf_len >= 26 && !memcmp(buf, "<3>CTRL-EVENT-DISCONNECTED", 26)) {
             nlprint("Wii U disconnected, attempting to re-connect...");
+            metrics_set(metric_associated, 0);
+            metrics_add(metric_reconnects, 1);
 
             // Let client know we lost connection
             cmd.control_code = VANILLA_PIPE_CC_DISCONNECTED;
@@ -701,55 +692,39 @@ int check_for_disconnection(struct sync_args *args)
 
 void create_all_relays(struct sync_args *args)
 {
-    pthread_t vid_thread, aud_thread, msg_thread, cmd_thread, hid_thread;
-    struct relay_info vid_info, aud_info, msg_info, cmd_info, hid_info;
+    int relays_started = 0;
 
     if (!args->local) {
-        // Set common info for all
-        vid_info.wireless_interface = aud_info.wireless_interface = msg_info.wireless_interface = cmd_info.wireless_interface = hid_info.wireless_interface = args->wireless_interface;
-        vid_info.local = aud_info.local = msg_info.local = cmd_info.local = hid_info.local = args->local;
-        vid_info.client = aud_info.client = msg_info.client = cmd_info.client = hid_info.client = args->client;
-        vid_info.client_size = aud_info.client_size = msg_info.client_size = cmd_info.client_size = hid_info.client_size = args->client_size;
-
-        vid_info.port = PORT_VID;
-        aud_info.port = PORT_AUD;
-        msg_info.port = PORT_MSG;
-        cmd_info.port = PORT_CMD;
-        hid_info.port = PORT_HID;
-
-        // Enable relays
-        relay_running = 1;
-
-        pthread_create(&vid_thread, NULL, open_relay, &vid_info);
-        pthread_create(&aud_thread, NULL, open_relay, &aud_info);
-        pthread_create(&msg_thread, NULL, open_relay, &msg_info);
-        pthread_create(&cmd_thread, NULL, open_relay, &cmd_info);
-        pthread_create(&hid_thread, NULL, open_relay, &hid_info);
+        struct relay_info info;
+        info.wireless_interface = args->wireless_interface;
+        info.address = INADDR_ANY;
+        info.console_address = inet_addr("192.168.1.10");
+        info.client = args->client;
+        info.client_size = args->client_size;
+
+        relays_started = (relay_start(&info) == 0);
     }
 
-    // Notify client that we are connected
+    // Notify client that we are connected, relay_start() has already opened
+    // everything it needs
     vanilla_pipe_command_t cmd;
     cmd.control_code = VANILLA_PIPE_CC_CONNECTED;
-    sendto(args->skt, &cmd, sizeof(cmd.control_code), 0, (const struct sockaddr *) &args->client, args->client_size);
+    cmd.connected.flags = 0;
+    if (relays_started && relay_serving_video_stream()) {
+        cmd.connected.flags |= VANILLA_PIPE_CONNECTED_VIDEO_STREAM;
+    }
+    sendto(args->skt, &cmd, sizeof(cmd.control_code) + sizeof(cmd.connected), 0, (const struct sockaddr *) &args->client, args->client_size);
 
-    while (!is_interrupted()) {
+    // The relays run on their own thread, so this one only has to wake up
+    // for wpa_supplicant events or an interrupt
+    while (wait_for_wpa_event(args->ctrl, -1) == 1) {
         if (check_for_disconnection(args)) {
             break;
         }
-
-        // wpa_ctrl_recv is non-blocking, so reduce thrashing by sleeping here
-        sleep(1);
     }
 
-    if (!args->local) {
-        // Stop all relays
-        interrupt_relays();
-
-        pthread_join(vid_thread, NULL);
-        pthread_join(aud_thread, NULL);
-        pthread_join(msg_thread, NULL);
-        pthread_join(cmd_thread, NULL);
-        pthread_join(hid_thread, NULL);
+    if (relays_started) {
+        relay_stop();
     }
 }
 
@@ -761,6 +736,9 @@ void *thread_handler(void *data)
     running = 1;
     pthread_mutex_unlock(&running_mutex);
 
+    // Clear any wakeup left over from the last interrupt
+    drain_interrupted();
+
     void *ret = args->start_routine(data);
 
     free(args);
@@ -887,11 +865,132 @@ int create_connect_config(const char *filename, unsigned char *bssid, unsigned c
     return VANILLA_SUCCESS;
 }
 
-ssize_t send_ping_to_client(struct sync_args *args)
+ssize_t send_ping_to_client(struct sync_args *args, const vanilla_pipe_sync_progress_t *progress)
 {
     vanilla_pipe_command_t cmd;
     cmd.control_code = VANILLA_PIPE_CC_PING;
-    return sendto(args->skt, &cmd, sizeof(cmd.control_code), 0, (const struct sockaddr *) &args->client, args->client_size);
+    cmd.sync_progress = *progress;
+    return sendto(args->skt, &cmd, sizeof(cmd.control_code) + sizeof(cmd.sync_progress), 0, (const struct sockaddr *) &args->client, args->client_size);
+}
+
+// Often enough that libvanilla's receive loop never gives up on us
+#define SYNC_PING_INTERVAL_MS 500
+
+// How long the console gets to answer a WPS PIN before moving on
+#define SYNC_PIN_TIMEOUT_MS 20000
+
+#define SYNC_MAX_CANDIDATES 16
+
+// Every so often, scan every channel again rather than just the ones consoles
+// were last seen on, in case those were stale or the console moved
+#define SYNC_FULL_SCAN_INTERVAL 4
+
+// WPS config_error for an M4/M6 that failed to authenticate, i.e. wrong PIN
+#define WPS_CONFIG_ERROR_WRONG_PIN "config_error=18"
+
+struct sync_candidate {
+    char bssid[18];
+    int freq;
+    int signal;
+};
+
+// Waits up to timeout_ms for the next wpa_supplicant event, pinging the client
+// in the meantime. Returns 1 with the event in buf, 0 on timeout and -1 if
+// interrupted or the client went away.
+static int next_sync_event(struct sync_args *args, const vanilla_pipe_sync_progress_t *progress, char *buf, size_t buf_size, int timeout_ms)
+{
+    double deadline = monotonic_seconds() + timeout_ms / 1000.0;
+    static double next_ping = 0;
+
+    while (1) {
+        double now = monotonic_seconds();
+        if (now >= next_ping) {
+            if (send_ping_to_client(args, progress) == -1) {
+                // Client has probably disconnected
+                interrupt();
+                return -1;
+            }
+            next_ping = now + SYNC_PING_INTERVAL_MS / 1000.0;
+        }
+
+        if (now >= deadline) {
+            return 0;
+        }
+
+        double wait = ((deadline < next_ping) ? deadline : next_ping) - now;
+        int r = wait_for_wpa_event(args->ctrl, (int) (wait * 1000) + 1);
+        if (r == -1) {
+            return -1;
+        }
+
+        if (r == 1) {
+            size_t len = buf_size - 1;
+            if (wpa_ctrl_recv(args->ctrl, buf, &len) == 0) {
+                buf[len] = '\0';
+                return 1;
+            }
+        }
+    }
+}
+
+static int compare_candidate_signal(const void *a, const void *b)
+{
+    return ((const struct sync_candidate *) b)->signal - ((const struct sync_candidate *) a)->signal;
+}
+
+// Picks every Wii U out of SCAN_RESULTS, strongest signal first
+static int find_sync_candidates(char *results, struct sync_candidate *candidates)
+{
+    int count = 0;
+    char *save;
+
+    // The first line is the column header
+    strtok_r(results, "\n", &save);
+
+    char *line;
+    while ((line = strtok_r(NULL, "\n", &save)) && count < SYNC_MAX_CANDIDATES) {
+        // bssid / frequency / signal level / flags / ssid
+        const char *ssid = strrchr(line, '\t');
+        if (!ssid || !strstr(ssid, "WiiU") || !strstr(ssid, "_STA1")) {
+            continue;
+        }
+
+        struct sync_candidate *c = &candidates[count];
+        if (sscanf(line, "%17s %d %d", c->bssid, &c->freq, &c->signal) == 3) {
+            count++;
+        }
+    }
+
+    qsort(candidates, count, sizeof(*candidates), compare_candidate_signal);
+    return count;
+}
+
+// Only scan the channels consoles were seen on, or everything if none were or
+// `full` is set
+static void request_sync_scan(struct sync_args *args, const struct sync_candidate *candidates, int count, int full, char *buf, size_t buf_size)
+{
+    char cmd[256] = "SCAN";
+    size_t len = strlen(cmd);
+    for (int i = 0; !full && i < count && len < sizeof(cmd); i++) {
+        int seen = 0;
+        for (int j = 0; j < i; j++) {
+            seen |= (candidates[j].freq == candidates[i].freq);
+        }
+        if (!seen) {
+            len += snprintf(cmd + len, sizeof(cmd) - len, (len == 4) ? " freq=%d" : ",%d", candidates[i].freq);
+        }
+    }
+    if (len >= sizeof(cmd)) {
+        cmd[4] = '\0';
+    }
+
+    size_t actual_buf_len = buf_size;
+    wpa_ctrl_command(args->ctrl, cmd, buf, &actual_buf_len);
+
+    // FAIL-BUSY means a scan is already running, its results will do just as well
+    if (memcmp(buf, "OK", 2) && memcmp(buf, "FAIL-BUSY", 9)) {
+        nlprint("UNKNOWN SCAN RESPONSE: %.*s", (int) actual_buf_len, buf);
+    }
 }
 
 void *sync_with_console_internal(void *data)
@@ -903,137 +1002,135 @@ void *sync_with_console_internal(void *data)
 
     int ret = VANILLA_ERR_GENERIC;
     char bssid[18];
+    double sync_start = monotonic_seconds();
+
+    struct sync_candidate candidates[SYNC_MAX_CANDIDATES];
+    int candidate_count = 0;
+
+    vanilla_pipe_sync_progress_t progress = {0};
+    int scan_count = 0;
+
     while (1) {
         size_t actual_buf_len;
+        int r;
 
         if (is_interrupted()) goto exit_loop;
 
-        // Request scan from hardware
-        while (1) {
-            if (is_interrupted()) goto exit_loop;
+        // Scan and wait for wpa_supplicant to say it's done rather than
+        // guessing how long that takes
+        progress.state = VANILLA_PIPE_SYNC_SCANNING;
+        progress.attempt = 0;
+        progress.signal = 0;
+        request_sync_scan(args, candidates, candidate_count, (scan_count % SYNC_FULL_SCAN_INTERVAL) == 0, buf, buf_len);
+        scan_count++;
 
-            if (send_ping_to_client(args) == -1) {
-                // Client has probably disconnected
-                interrupt();
-                goto exit_loop;
-            }
-
-            // nlprint("SCANNING");
-            actual_buf_len = buf_len;
-            wpa_ctrl_command(args->ctrl, "SCAN", buf, &actual_buf_len);
-
-            if (!memcmp(buf, "FAIL-BUSY", 9)) {
-                //nlprint("DEVICE BUSY, RETRYING");
-                sleep(5);
-            } else if (!memcmp(buf, "OK", 2)) {
+        while ((r = next_sync_event(args, &progress, buf, buf_len, 10000)) == 1) {
+            if (strstr(buf, "CTRL-EVENT-SCAN-RESULTS") || strstr(buf, "CTRL-EVENT-SCAN-FAILED")) {
                 break;
-            } else {
-                nlprint("UNKNOWN SCAN RESPONSE: %.*s (RETRYING)", actual_buf_len, buf);
-                sleep(5);
             }
         }
+        if (r == -1) goto exit_loop;
 
-        //nlprint("WAITING FOR SCAN RESULTS");
-        actual_buf_len = buf_len;
+        actual_buf_len = buf_len - 1;
         wpa_ctrl_command(args->ctrl, "SCAN_RESULTS", buf, &actual_buf_len);
-        nlprint("RECEIVED SCAN RESULTS");
+        buf[actual_buf_len] = '\0';
 
-        const char *line = strtok(buf, "\n");
-        while (line) {
-            if (is_interrupted()) goto exit_loop;
+        candidate_count = find_sync_candidates(buf, candidates);
+        nlprint("RECEIVED SCAN RESULTS, FOUND %i WII U(S)", candidate_count);
+        progress.candidates = candidate_count;
 
-            if (strstr(line, "WiiU") && strstr(line, "_STA1")) {
-                nlprint("FOUND WII U, TESTING WPS PIN");
+        for (int i = 0; i < candidate_count; i++) {
+            if (is_interrupted()) goto exit_loop;
 
-                // Make copy of bssid for later
-                strncpy(bssid, line, sizeof(bssid));
-                bssid[17] = '\0';
+            nlprint("TESTING WPS PIN ON %s (%i DBM)", candidates[i].bssid, candidates[i].signal);
 
-                char wps_buf[100];
-                snprintf(wps_buf, sizeof(wps_buf), "WPS_PIN %.*s %04d5678", 17, bssid, args->code);
+            // Make copy of bssid for later
+            strncpy(bssid, candidates[i].bssid, sizeof(bssid));
+            bssid[17] = '\0';
 
-                size_t actual_buf_len = buf_len;
-                wpa_ctrl_command(args->ctrl, wps_buf, buf, &actual_buf_len);
+            progress.state = VANILLA_PIPE_SYNC_TRYING_PIN;
+            progress.attempt = i + 1;
+            progress.signal = candidates[i].signal;
 
-                static const int max_wait = 20;
-                int wait_count = 0;
-                int cred_received = 0;
+            char wps_buf[100];
+            snprintf(wps_buf, sizeof(wps_buf), "WPS_PIN %.*s %04d5678", 17, bssid, args->code);
 
-                while (!is_interrupted()) {
-                    // Send a ping to the client to say we're still here
-                    if (send_ping_to_client(args) == -1) {
-                        // Client has probably disconnected
-                        interrupt();
-                        goto exit_loop;
-                    }
+            actual_buf_len = buf_len;
+            wpa_ctrl_command(args->ctrl, wps_buf, buf, &actual_buf_len);
+
+            int cred_received = 0;
+            double pin_deadline = monotonic_seconds() + SYNC_PIN_TIMEOUT_MS / 1000.0;
+            while (1) {
+                int remaining = (pin_deadline - monotonic_seconds()) * 1000;
+                r = (remaining > 0) ? next_sync_event(args, &progress, buf, buf_len, remaining) : 0;
+                if (r == -1) goto exit_loop;
+                if (r == 0) {
+                    nlprint("GIVING UP ON %s", bssid);
+                    break;
+                }
 
-                    if (!wpa_ctrl_pending(args->ctrl)) {
-                        // If we haven't gotten any information yet, wait one second and try again
-                        wait_count++;
-                        if (wait_count == max_wait) {
-                            nlprint("GIVING UP, RETURNING TO SCANNING");
-                            break;
-                        } else {
-                            sleep(1);
-                            continue;
-                        }
-                    } else {
-                        wait_count = 0;
-                    }
+                if (!strstr(buf, "CTRL-EVENT-BSS-ADDED")
+                    && !strstr(buf, "CTRL-EVENT-BSS-REMOVED")) {
+                    nlprint("CRED RECV: %s", buf);
+                }
 
-                    actual_buf_len = buf_len;
-                    wpa_ctrl_recv(args->ctrl, buf, &actual_buf_len);
-                    if (!strstr(buf, "CTRL-EVENT-BSS-ADDED")
-                        && !strstr(buf, "CTRL-EVENT-BSS-REMOVED")) {
-                        nlprint("CRED RECV: %.*s", buf_len, buf);
-                    }
+                if (!memcmp("<3>WPS-CRED-RECEIVED", buf, 20)) {
+                    nlprint("RECEIVED AUTHENTICATION FROM CONSOLE");
+                    cred_received = 1;
+                    break;
+                }
 
-                    if (!memcmp("<3>WPS-CRED-RECEIVED", buf, 20)) {
-                        nlprint("RECEIVED AUTHENTICATION FROM CONSOLE");
-                        cred_received = 1;
-                        break;
-                    }
+                // Wrong PIN, so this console isn't the one that's syncing. Any
+                // other failure gets retried by wpa_supplicant itself, so just
+                // keep waiting.
+                if (strstr(buf, "WPS-FAIL") && strstr(buf, WPS_CONFIG_ERROR_WRONG_PIN)) {
+                    nlprint("WRONG PIN FOR %s", bssid);
+                    break;
                 }
+            }
 
-                if (cred_received) {
-                    vanilla_pipe_command_t cmd;
-                    cmd.control_code = VANILLA_PIPE_CC_SYNC_SUCCESS;
-
-                    // Tell wpa_supplicant to save config (this seems to be the only way to retrieve the PSK)
-                    actual_buf_len = buf_len;
-                    nlprint("SAVING CONFIG", actual_buf_len, buf);
-                    wpa_ctrl_command(args->ctrl, "SAVE_CONFIG", buf, &actual_buf_len);
-
-                    // Retrieve BSSID and PSK from saved config
-                    FILE *in_file = fopen(get_wireless_authenticate_config_filename(), "r");
-                    if (in_file) {
-                        // Convert PSK from string to bytes
-                        int len;
-                        char buf[150];
-                        while (len = read_line_from_file(in_file, buf, sizeof(buf))) {
-                            if (memcmp("\tpsk=", buf, 5) == 0) {
-                                str_to_bytes(buf + 5, 0, cmd.connection.psk.psk, sizeof(cmd.connection.psk.psk));
-                                break;
-                            }
+            if (cred_received) {
+                vanilla_pipe_command_t cmd;
+                cmd.control_code = VANILLA_PIPE_CC_SYNC_SUCCESS;
+
+                // Tell wpa_supplicant to save config (this seems to be the only way to retrieve the PSK)
+                actual_buf_len = buf_len;
+                nlprint("SAVING CONFIG");
+                wpa_ctrl_command(args->ctrl, "SAVE_CONFIG", buf, &actual_buf_len);
+
+                // Retrieve BSSID and PSK from saved config
+                FILE *in_file = fopen(get_wireless_authenticate_config_filename(), "r");
+                if (in_file) {
+                    // Convert PSK from string to bytes
+                    int len;
+                    char buf[150];
+                    while (len = read_line_from_file(in_file, buf, sizeof(buf))) {
+                        if (memcmp("\tpsk=", buf, 5) == 0) {
+                            str_to_bytes(buf + 5, 0, cmd.connection.psk.psk, sizeof(cmd.connection.psk.psk));
+                            break;
                         }
+                    }
 
-                        fclose(in_file);
+                    fclose(in_file);
 
-                        // Convert BSSID from string to bytes
-                        str_to_bytes(bssid, 1, cmd.connection.bssid.bssid, sizeof(cmd.connection.bssid.bssid));
+                    // Convert BSSID from string to bytes
+                    str_to_bytes(bssid, 1, cmd.connection.bssid.bssid, sizeof(cmd.connection.bssid.bssid));
 
-                        sendto(args->skt, &cmd, sizeof(cmd.control_code) + sizeof(cmd.connection), 0, (const struct sockaddr *) &args->client, args->client_size);
+                    sendto(args->skt, &cmd, sizeof(cmd.control_code) + sizeof(cmd.connection), 0, (const struct sockaddr *) &args->client, args->client_size);
 
-                        ret = VANILLA_SUCCESS;
-                    } else {
-                        // TODO: Return error to the frontend
-                        nlprint("FAILED TO OPEN INPUT CONFIG FILE TO RETRIEVE PSK");
-                    }
+                    nlprint("SYNCED IN %.1f S", monotonic_seconds() - sync_start);
 
-                    goto exit_loop;
+                    ret = VANILLA_SUCCESS;
+                } else {
+                    // TODO: Return error to the frontend
+                    nlprint("FAILED TO OPEN INPUT CONFIG FILE TO RETRIEVE PSK");
                 }
+
+                goto exit_loop;
             }
-            line = strtok(NULL, "\n");
+
+            actual_buf_len = buf_len;
+            wpa_ctrl_command(args->ctrl, "WPS_CANCEL", buf, &actual_buf_len);
         }
     }
 
@@ -1047,19 +1144,18 @@ void *do_connect(void *data)
 
     while (!is_interrupted()) {
         while (1) {
-            while (!wpa_ctrl_pending(args->ctrl)) {
-                sleep(2);
+            int wait;
+            while ((wait = wait_for_wpa_event(args->ctrl, 2000)) == 0) {
                 nlprint("WAITING FOR CONNECTION");
-
-                if (is_interrupted()) return THREADRESULT(VANILLA_ERR_GENERIC);
             }
+            if (wait == -1) return THREADRESULT(VANILLA_ERR_GENERIC);
 
             char buf[1024];
             size_t actual_buf_len = sizeof(buf);
             wpa_ctrl_recv(args->ctrl, buf, &actual_buf_len);
             if (!strstr(buf, "CTRL-EVENT-BSS-ADDED")
                 && !strstr(buf, "CTRL-EVENT-BSS-REMOVED")) {
-                nlprint("CONN RECV: %.*s", actual_buf_len, buf);
+                nlprint("CONN RECV: %.*s", (int) actual_buf_len, buf);
             }
 
             if (memcmp(buf, "<3>CTRL-EVENT-CONNECTED", 23) == 0) {
@@ -1070,10 +1166,14 @@ void *do_connect(void *data)
         }
 
         nlprint("CONNECTED TO CONSOLE");
+        metrics_set(metric_associated, 1);
 
         // Use DHCP on interface
-        int r = call_dhcp(args->wireless_interface);
+        double dhcp_start = monotonic_seconds();
+        int r = call_dhcp(args->wireless_interface, args->bssid);
         if (r != VANILLA_SUCCESS) {
+            metrics_add(metric_dhcp_failures, 1);
+
             // For some reason, DHCP did not succeed. Determine if it's because
             // the Wi-Fi disconnected mid-handshake.
             if (check_for_disconnection(args)) {
@@ -1086,7 +1186,9 @@ void *do_connect(void *data)
             nlprint("FAILED TO RUN DHCP ON %s", args->wireless_interface);
             return THREADRESULT(r);
         } else {
-            nlprint("DHCP ESTABLISHED");
+            double dhcp_seconds = monotonic_seconds() - dhcp_start;
+            nlprint("DHCP ESTABLISHED IN %.0f MS", dhcp_seconds * 1000);
+            metrics_observe(metric_dhcp_seconds, dhcp_seconds);
         }
 
         create_all_relays(args);
@@ -1203,15 +1305,22 @@ void pipe_listen(int local, const char *wireless_interface, const char *log_file
     // Store reference to log file
     ext_logfile = log_file;
 
+    register_pipe_metrics();
+
     // Ensure local domain sockets can be written to by everyone
     umask(0000);
 
-    int skt = open_socket(local, VANILLA_PIPE_CMD_SERVER_PORT);
+    int skt = open_socket(local, INADDR_ANY, VANILLA_PIPE_CMD_SERVER_PORT);
     if (skt == -1) {
         nlprint("Failed to open server socket");
         return;
     }
 
+    // Wake up regularly to check whether we should quit
+    struct timeval tv = {0};
+    tv.tv_usec = 250000;
+    setsockopt(skt, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
     vanilla_pipe_command_t cmd;
 
     sockaddr_u addr;
@@ -1220,6 +1329,8 @@ void pipe_listen(int local, const char *wireless_interface, const char *log_file
     pthread_mutex_init(&action_mutex, NULL);
     pthread_mutex_init(&main_loop_mutex, NULL);
 
+    interrupt_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
 	pthread_t stdin_thread;
 	pthread_create(&stdin_thread, NULL, read_stdin, NULL);
 
@@ -1352,6 +1463,15 @@ void pipe_listen(int local, const char *wireless_interface, const char *log_file
 			if (sendto(skt, &cmd, sizeof(cmd.control_code), 0, (const struct sockaddr *) &addr, addr_size) == -1) {
 				nlprint("FAILED TO SEND ACK: %i", errno);
 			}
+        } else if (cmd.control_code == VANILLA_PIPE_CC_STATS) {
+            // Doesn't need a bind, so the frontend can ask mid-connection
+            vanilla_pipe_stats_t stats;
+            relay_get_stats(&stats);
+            vanilla_pipe_stats_to_wire(&stats);
+            memcpy(&cmd.stats, &stats, sizeof(stats));
+            if (sendto(skt, &cmd, sizeof(cmd.control_code) + sizeof(cmd.stats), 0, (const struct sockaddr *) &addr, addr_size) == -1) {
+                nlprint("FAILED TO SEND STATS: %i", errno);
+            }
         } else if (cmd.control_code == VANILLA_PIPE_CC_UNBIND) {
             nlprint("RECEIVED UNBIND SIGNAL");
             interrupt();
@@ -1376,6 +1496,9 @@ repeat_loop:
     pthread_mutex_destroy(&action_mutex);
     pthread_mutex_destroy(&running_mutex);
 
+    close(interrupt_fd);
+    interrupt_fd = -1;
+
 die_and_reenable_managed:
 #ifdef USE_LIBNM
     if (is_managed) {
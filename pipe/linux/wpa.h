@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <sys/types.h>
 
+#include "log.h"
+
 struct wpa_ctrl;
 
 void wpa_ctrl_command(struct wpa_ctrl *ctrl, const char *cmd, char *buf, size_t *buf_len);
@@ -14,7 +16,10 @@ int is_networkmanager_managing_device(const char *wireless_interface, int *is_ma
 int disable_networkmanager_on_device(const char *wireless_interface);
 int enable_networkmanager_on_device(const char *wireless_interface);
 
-void nlprint(const char *fmt, ...);
+// Logs through the asynchronous logger, see lib/log.h
+#define nlprint(...) VLOG_INFO(VANILLA_LOG_PIPE, __VA_ARGS__)
+
+void pipe_log_sink(int category, int level, const char *text, int newline);
 
 void pipe_listen(int local, const char *wireless_interface, const char *log_file);
 